@@ -1,9 +1,13 @@
 /*
 Cliente que envia por una cola abierta para escritura una cadena de caracteres
 recogida por teclado, mientras que el valor de esa cadena sea distinto a la palabra exit
+
+Cada cadena se envía con su longitud exacta, sin rellenar hasta MAX_SIZE, y puede ser
+más larga que los mensajes de la cola: mensajeria.h la parte en fragmentos.
 */
 
 #include "common.h"
+#include "mensajeria.h"
 #include <errno.h>
 #include <mqueue.h>
 #include <stdio.h>
@@ -21,8 +25,9 @@ FILE *fLog = NULL;
 int main(int argc, char **argv) {
     // Cola del servidor
     mqd_t mq_server;
-    // Buffer para intercambiar mensajes
-    char buffer[MAX_SIZE];
+    // Buffer para intercambiar mensajes. getline() lo agranda si la línea no cabe
+    char *buffer = NULL;
+    size_t capacidad = 0;
     // Nombre para la cola
     char serverQueue[100];
 
@@ -45,20 +50,25 @@ int main(int argc, char **argv) {
     do {
         printf("> ");
 
-        /* Leer por teclado. Según la documentación, fgets lo hace de esta manera:
-        It stops when either (n-1) characters are read, the newline character is read,
-        or the end-of-file is reached, whichever comes first.
-        Automáticamente fgets inserta el fin de cadena '\0'
+        /* Leer por teclado. getline lee la línea entera, sea cual sea su longitud
+        (incluido el '\n'), y devuelve el número de caracteres leídos. Al llegar al
+        fin de la entrada se envía el código de salida para que el servidor termine.
         */
-        fgets(buffer, MAX_SIZE, stdin);
+        ssize_t longitud = getline(&buffer, &capacidad, stdin);
+        if (longitud == -1) {
+            free(buffer);
+            buffer = strdup(MSG_STOP);
+            longitud = strlen(buffer);
+        }
 
-        // Enviar y comprobar si el mensaje se manda
-        if (mq_send(mq_server, buffer, MAX_SIZE, 0) != 0) {
+        // Enviar sólo los bytes de la cadena (el receptor añade el fin de cadena)
+        if (mensaje_enviar(mq_server, buffer, longitud, 0) != 0) {
             perror("Error al enviar el mensaje");
             exit(-1);
         }
         // Iterar hasta escribir el código de salida
     } while (strncmp(buffer, MSG_STOP, strlen(MSG_STOP)));
+    free(buffer);
 
     // Cerrar la cola del servidor
     if (mq_close(mq_server) == (mqd_t)-1) {
@@ -3,6 +3,8 @@
 
 #define SERVER_QUEUE "/server_queue"
 #define CLIENT_QUEUE "/client_queue"
+// Tamaño máximo de un mensaje de la cola. Los mensajes más largos se envían en
+// varios fragmentos (ver mensajeria.h)
 #define MAX_SIZE 1024
 #define MSG_STOP "exit"
 
@@ -1,4 +1,5 @@
-#include <errno.h> //Control de errores
+#include "mensajeria.h" // Envío de mensajes de cualquier longitud, en fragmentos
+#include <errno.h>       //Control de errores
 #include <mqueue.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,14 +8,18 @@
 #include <time.h>
 #include <unistd.h>
 
-#define MAX_SIZE 5
+/* Tamaño máximo de un mensaje de la cola. Es deliberadamente pequeño: el mensaje no cabe en
+   uno solo y mensajeria.h lo envía en varios fragmentos, cada uno con una cabecera de 8 bytes */
+#define MAX_SIZE 16
 #define QUEUE_NAME "/una_cola"
 
 int main() {
     // Descriptor de la cola
     mqd_t mq;
-    // Buffer para la lectura/escritura
-    char buffer[MAX_SIZE];
+    // Buffer para la escritura
+    char buffer[100];
+    // Mensaje recibido (lo reserva mensaje_recibir)
+    char *mensaje;
     // Atributos de la cola
     struct mq_attr attr;
     // Almacena el nombre de la cola
@@ -28,7 +33,7 @@ int main() {
     int numeroAleatorio;
     // Inicializar los atributos de la cola.
     attr.mq_maxmsg = 10;        // Maximo número de mensajes
-    attr.mq_msgsize = MAX_SIZE; // Maximo tamaño de un mensaje. Tener en cuenta que debe incluir el '/0'
+    attr.mq_msgsize = MAX_SIZE; // Maximo tamaño de un mensaje (de un fragmento, con su cabecera)
     // Nombre para la cola. Al concatenar el login, sera unica en un sistema compartido.
     sprintf(queue_name, "%s-%s", QUEUE_NAME, getenv("USER"));
 
@@ -65,12 +70,12 @@ int main() {
         srand(time(NULL));
         // Número aleatorio entre 0 y 4999
         numeroAleatorio = rand() % 5000;
-        sprintf(buffer, "%d", numeroAleatorio); // La funcion sprintf escribe en una cadena el valor indicado y añade el '/0'.
+        sprintf(buffer, "El numero aleatorio es %d", numeroAleatorio); // La funcion sprintf escribe en una cadena el valor indicado y añade el '/0'.
         printf("[HIJO]: Generado el mensaje \"%s\"\n", buffer);
 
-        // Mandamos el mensaje
+        // Mandamos el mensaje: sólo los caracteres de la cadena, en tantos fragmentos como haga falta
         printf("[HIJO]: Enviando mensaje...\n");
-        resultado = mq_send(mq, buffer, MAX_SIZE, 0);
+        resultado = mensaje_enviar(mq, buffer, strlen(buffer), 0);
         if (resultado == -1) {
             perror("[HIJO]: Error al enviar mensaje");
             exit(-1);
@@ -100,15 +105,16 @@ int main() {
         printf("[PADRE]: Mi PID es %d y el PID de mi hijo es %d \n", getpid(), rf);
         printf("[PADRE]: Recibiendo mensaje (espera bloqueante)...\n");
 
-        // Recibimos un mensaje a través de la cola
-        resultado = mq_receive(mq, buffer, MAX_SIZE, NULL);
-        if (resultado <= 0) {
+        // Recibimos un mensaje a través de la cola, juntando sus fragmentos. La cadena ya viene cerrada con '\0'
+        resultado = mensaje_recibir(mq, &mensaje, NULL);
+        if (resultado < 0) {
             perror("[PADRE]: Error al recibir el mensaje");
             exit(-1);
         }
 
         // Imprimimos el mensaje recibido
-        printf("[PADRE]: El mensaje recibido es \"%s\"\n", buffer);
+        printf("[PADRE]: El mensaje recibido es \"%s\" (%d bytes)\n", mensaje, resultado);
+        free(mensaje);
 
         // Cerrar la cola
         if (mq_close(mq) == -1) {
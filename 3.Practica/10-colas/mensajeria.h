@@ -0,0 +1,244 @@
+/*
+Capa de mensajería para los ejemplos de colas.
+
+Cada mensaje se envía con su longitud exacta (no se rellena hasta el tamaño máximo
+de la cola) y, si no cabe en un mensaje de la cola (mq_msgsize), se parte en varios
+fragmentos que se vuelven a juntar al recibirlo. Así el tamaño de los mensajes ya no
+depende del de la cola, y por ella sólo pasan los bytes del mensaje más una pequeña
+cabecera por fragmento.
+
+Cada fragmento lleva delante una cabecera con la longitud total del mensaje y su
+número de secuencia (0, 1, 2...). El receptor comprueba que los fragmentos llegan
+en orden y que todos son del mismo mensaje: si no es así (por ejemplo, porque dos
+procesos escriben a la vez en la misma cola y sus fragmentos se mezclan), el mensaje
+se descarta y la recepción falla con errno = EPROTO. Los fragmentos que queden del
+mensaje roto se descartan también, hasta el comienzo del siguiente mensaje.
+*/
+
+#ifndef MENSAJERIA_H_
+#define MENSAJERIA_H_
+
+#include <errno.h>
+#include <mqueue.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// Cabecera de cada fragmento
+struct cabecera_fragmento {
+    uint32_t longitud;  // Longitud total del mensaje, en bytes
+    uint32_t secuencia; // Número del fragmento dentro del mensaje, empezando por 0
+};
+
+/*
+Reserva un buffer para un mensaje de la cola. Devuelve su tamaño (mq_msgsize) o -1
+si hay un error o si en un mensaje de la cola no cabe ni siquiera la cabecera.
+*/
+ssize_t reservar_fragmento(mqd_t cola, char **fragmento) {
+    struct mq_attr attr;
+
+    if (mq_getattr(cola, &attr) == -1)
+        return -1;
+    if (attr.mq_msgsize <= (long)sizeof(struct cabecera_fragmento)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    *fragmento = malloc(attr.mq_msgsize);
+    if (*fragmento == NULL)
+        return -1;
+    return attr.mq_msgsize;
+}
+
+/*
+Envía un mensaje de cualquier longitud, en tantos fragmentos como haga falta. Todos
+los fragmentos se envían con la misma prioridad.
+
+Devuelve 0 si se envió el mensaje entero y -1 si hubo un error (errno indica la causa).
+*/
+int mensaje_enviar(mqd_t cola, const void *mensaje, size_t longitud, unsigned int prioridad) {
+    char *fragmento;
+    struct cabecera_fragmento cabecera;
+    size_t enviados = 0;
+
+    if (longitud > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    ssize_t tam_fragmento = reservar_fragmento(cola, &fragmento);
+    if (tam_fragmento == -1)
+        return -1;
+    // Bytes del mensaje que caben en cada fragmento, después de la cabecera
+    size_t max_datos = tam_fragmento - sizeof(cabecera);
+
+    cabecera.longitud = (uint32_t)longitud;
+    cabecera.secuencia = 0;
+    // Un mensaje vacío también se envía: un único fragmento con sólo la cabecera
+    do {
+        size_t n = longitud - enviados < max_datos ? longitud - enviados : max_datos;
+        memcpy(fragmento, &cabecera, sizeof(cabecera));
+        memcpy(fragmento + sizeof(cabecera), (const char *)mensaje + enviados, n);
+        if (mq_send(cola, fragmento, sizeof(cabecera) + n, prioridad) == -1) {
+            free(fragmento);
+            return -1;
+        }
+        enviados += n;
+        cabecera.secuencia++;
+    } while (enviados < longitud);
+
+    free(fragmento);
+    return 0;
+}
+
+// Primer fragmento de un mensaje que llegó en medio de otro (ver mensaje_recibir): se
+// guarda para empezar por él la siguiente recepción de la misma cola
+mqd_t guardado_cola = (mqd_t)-1;
+char *guardado = NULL;
+ssize_t guardado_len = 0;
+unsigned int guardado_prioridad = 0;
+
+/*
+Recibe el siguiente fragmento de la cola: el guardado, si lo hay, o uno nuevo. Con
+espera = 0 no bloquea (mq_timedreceive con un plazo ya vencido).
+*/
+ssize_t recibir_fragmento(mqd_t cola, char *fragmento, size_t tam, unsigned int *prioridad,
+                          int espera) {
+    static const struct timespec ya = {0, 0};
+
+    if (guardado != NULL && guardado_cola == cola) {
+        ssize_t n = guardado_len;
+        memcpy(fragmento, guardado, n);
+        if (prioridad != NULL)
+            *prioridad = guardado_prioridad;
+        free(guardado);
+        guardado = NULL;
+        return n;
+    }
+    if (espera)
+        return mq_receive(cola, fragmento, tam, prioridad);
+    return mq_timedreceive(cola, fragmento, tam, prioridad, &ya);
+}
+
+/*
+Guarda el fragmento (el primero de un mensaje) para la siguiente recepción.
+*/
+void guardar_fragmento(mqd_t cola, const char *fragmento, ssize_t n, unsigned int prioridad) {
+    free(guardado);
+    guardado = malloc(n);
+    if (guardado == NULL)
+        return; // Se pierde también este mensaje
+    memcpy(guardado, fragmento, n);
+    guardado_len = n;
+    guardado_cola = cola;
+    guardado_prioridad = prioridad;
+}
+
+/*
+Tras un error de protocolo, descarta los fragmentos que ya estén en la cola hasta el
+primero de otro mensaje (secuencia 0), que se guarda. Los que lleguen más tarde del
+mensaje roto los descarta la siguiente recepción, que no empieza nunca por un
+fragmento con secuencia distinta de 0.
+*/
+void resincronizar(mqd_t cola, char *fragmento, size_t tam) {
+    struct cabecera_fragmento cabecera;
+    unsigned int prioridad;
+    ssize_t n;
+
+    while ((n = recibir_fragmento(cola, fragmento, tam, &prioridad, 0)) != -1) {
+        if (n < (ssize_t)sizeof(cabecera))
+            continue;
+        memcpy(&cabecera, fragmento, sizeof(cabecera));
+        if (cabecera.secuencia == 0) {
+            guardar_fragmento(cola, fragmento, n, prioridad);
+            return;
+        }
+    }
+}
+
+/*
+Recibe un mensaje completo, juntando sus fragmentos. El mensaje se devuelve en un
+buffer reservado con malloc (que debe liberar quien llama) con un '\0' añadido al
+final, para poder tratarlo como una cadena.
+
+Si los fragmentos no llegan en orden, el mensaje roto se descarta entero: se tiran
+sus fragmentos hasta el comienzo del siguiente mensaje, para que la siguiente
+llamada reciba ese mensaje en lugar de fallar también.
+
+Devuelve la longitud del mensaje (sin el '\0' añadido) o -1 si hubo un error
+(errno indica la causa; EPROTO si los fragmentos no llegaron en orden).
+*/
+ssize_t mensaje_recibir(mqd_t cola, char **mensaje, unsigned int *prioridad) {
+    char *fragmento;
+    char *datos = NULL;
+    struct cabecera_fragmento cabecera;
+    uint32_t longitud = 0;
+    size_t recibidos = 0;
+    uint32_t esperada = 0;
+    unsigned int prio;
+    int error = 0;
+
+    ssize_t tam_fragmento = reservar_fragmento(cola, &fragmento);
+    if (tam_fragmento == -1)
+        return -1;
+
+    // Hasta recibir el primer fragmento (esperada == 0) y después hasta completar el
+    // mensaje; un mensaje vacío tiene un único fragmento
+    while (esperada == 0 || recibidos < longitud) {
+        ssize_t n = recibir_fragmento(cola, fragmento, tam_fragmento, &prio, 1);
+        if (n == -1) {
+            error = errno;
+            break;
+        }
+        if (prioridad != NULL)
+            *prioridad = prio;
+        if (n < (ssize_t)sizeof(cabecera)) {
+            error = EPROTO;
+            break;
+        }
+        memcpy(&cabecera, fragmento, sizeof(cabecera));
+        n -= sizeof(cabecera);
+
+        // Un mensaje no empieza nunca a medias: es el resto de uno que ya se descartó
+        if (esperada == 0 && cabecera.secuencia != 0)
+            continue;
+
+        // El primer fragmento indica la longitud del mensaje
+        if (esperada == 0) {
+            longitud = cabecera.longitud;
+            datos = malloc((size_t)longitud + 1);
+            if (datos == NULL) {
+                error = ENOMEM;
+                break;
+            }
+        }
+        // Comprobamos que el fragmento es el siguiente del mismo mensaje. Si es el
+        // primero de otro, se guarda para la siguiente llamada
+        else if (cabecera.secuencia == 0) {
+            guardar_fragmento(cola, fragmento, n + sizeof(cabecera), prio);
+            error = EPROTO;
+            break;
+        }
+        if (cabecera.secuencia != esperada || cabecera.longitud != longitud ||
+            recibidos + n > longitud || (n == 0 && longitud > 0)) {
+            error = EPROTO;
+            break;
+        }
+        memcpy(datos + recibidos, fragmento + sizeof(cabecera), n);
+        recibidos += n;
+        esperada++;
+    }
+
+    if (error == EPROTO && guardado == NULL)
+        resincronizar(cola, fragmento, tam_fragmento);
+    free(fragmento);
+    if (error != 0) {
+        free(datos);
+        errno = error;
+        return -1;
+    }
+    datos[longitud] = '\0';
+    *mensaje = datos;
+    return longitud;
+}
+
+#endif /* #ifndef MENSAJERIA_H_ */
@@ -3,9 +3,13 @@ Servidor que lee de una cola abierta para lectura una cadena de caracteres y la
 imprime por pantalla.
 
 Lo hace mientras que el valor de esa cadena sea distinto a la palabra exit.
+
+Los mensajes se reciben con mensajeria.h, que junta los fragmentos de los mensajes
+más largos que MAX_SIZE y añade el fin de cadena.
 */
 
 #include "common.h"
+#include "mensajeria.h"
 #include <errno.h>
 #include <mqueue.h>
 #include <stdio.h>
@@ -25,8 +29,8 @@ int main(int argc, char **argv) {
     mqd_t mq_server;
     // Atributos de la cola
     struct mq_attr attr;
-    // Buffer para intercambiar mensajes
-    char buffer[MAX_SIZE];
+    // Buffer para intercambiar mensajes (lo reserva mensaje_recibir)
+    char *buffer;
     // flag que indica cuando hay que parar. Se escribe palabra exit
     int must_stop = 0;
     // Inicializar los atributos de la cola
@@ -53,21 +57,21 @@ int main(int argc, char **argv) {
         // Número de bytes leidos
         ssize_t bytes_read;
 
-        // Recibir el mensaje
-        bytes_read = mq_receive(mq_server, buffer, MAX_SIZE, NULL);
+        // Recibir el mensaje completo, aunque llegue en varios fragmentos. La cadena
+        // ya viene cerrada con '\0'
+        bytes_read = mensaje_recibir(mq_server, &buffer, NULL);
         // Comprar que la recepción es correcta (bytes leidos no son negativos)
         if (bytes_read < 0) {
             perror("Error al recibir el mensaje");
             exit(-1);
         }
-        // Cerrar la cadena
-        // buffer[bytes_read] = '\0';
 
         // Comprobar el fin del bucle
         if (strncmp(buffer, MSG_STOP, strlen(MSG_STOP)) == 0)
             must_stop = 1;
         else
-            printf("Recibido el mensaje: %s\n", buffer);
+            printf("Recibido el mensaje (%ld bytes): %s\n", (long)bytes_read, buffer);
+        free(buffer);
     } while (!must_stop); // Iterar hasta que llegue el código de salida, es decir, la palabra exit
 
     // Cerrar la cola del servidor
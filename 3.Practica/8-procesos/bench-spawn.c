@@ -0,0 +1,133 @@
+/*
+Latencia de lanzar un programa según la memoria del padre: fork() + exec frente a
+posix_spawn() (ver lanzador.h).
+
+Para cada tamaño (10 MB, 100 MB, 1 GB y 10 GB), el padre reserva y escribe esa
+memoria, de modo que forme parte de su RSS, y lanza /bin/true varias veces con cada
+método, esperando a que termine. Se muestra el tiempo medio y la mediana de lanzar y
+esperar al hijo. Los tamaños que no caben en la memoria disponible se saltan.
+
+Uso:
+./bench-spawn [-n repeticiones] [-m max_MB]
+
+Compilación:
+gcc -O2 -o bench-spawn bench-spawn.c
+*/
+
+#include "lanzador.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+double microsegundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int comparar(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// RSS del proceso en MB, según /proc/self/statm
+long rss_mb() {
+    long total, residente;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL || fscanf(f, "%ld %ld", &total, &residente) != 2)
+        residente = 0;
+    if (f != NULL)
+        fclose(f);
+    return residente * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/*
+Lanza /bin/true repeticiones veces con lanzar y deja en tiempos lo que tarda cada una
+(desde el lanzamiento hasta que se recoge al hijo), en microsegundos.
+*/
+void medir(pid_t (*lanzar)(const struct lanzamiento *), int repeticiones, double *tiempos) {
+    char *args[] = {"/bin/true", (char *)0};
+    struct lanzamiento l = {"/bin/true", args, NULL, NULL, NULL};
+    int status;
+
+    for (int i = 0; i < repeticiones; i++) {
+        double inicio = microsegundos();
+        pid_t pid = lanzar(&l);
+        if (pid == -1) {
+            perror("Error al lanzar /bin/true");
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, &status, 0);
+        tiempos[i] = microsegundos() - inicio;
+    }
+    qsort(tiempos, repeticiones, sizeof(double), comparar);
+}
+
+int main(int argc, char **argv) {
+    long tamanios[] = {10, 100, 1000, 10000}; // MB
+    int repeticiones = 100;
+    long max_mb = sysconf(_SC_AVPHYS_PAGES) / (1024 * 1024 / sysconf(_SC_PAGESIZE)) * 8 / 10;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:m:")) != -1) {
+        switch (c) {
+        case 'n':
+            repeticiones = atoi(optarg);
+            break;
+        case 'm':
+            max_mb = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-n repeticiones] [-m max_MB]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (repeticiones < 1) {
+        fprintf(stderr, "El número de repeticiones debe ser positivo\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *tiempos = malloc(repeticiones * sizeof(double));
+    if (tiempos == NULL) {
+        perror("Error al reservar memoria");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%8s %8s | %12s %12s | %12s %12s\n", "memoria", "RSS", "fork media", "fork p50",
+           "spawn media", "spawn p50");
+    for (size_t k = 0; k < sizeof(tamanios) / sizeof(tamanios[0]); k++) {
+        if (tamanios[k] > max_mb) {
+            printf("%6ld MB: no cabe en la memoria disponible (%ld MB), se salta\n", tamanios[k],
+                   max_mb);
+            continue;
+        }
+        // Escribimos en cada página para que sea residente (si sólo se reserva, el
+        // núcleo no asigna las páginas y fork() no tiene nada que copiar). El puntero
+        // es volatile para que el compilador no elimine las escrituras, que nadie lee
+        size_t bytes = tamanios[k] * 1024 * 1024;
+        volatile char *memoria = malloc(bytes);
+        if (memoria == NULL) {
+            printf("%6ld MB: no se pudo reservar, se salta\n", tamanios[k]);
+            continue;
+        }
+        for (size_t i = 0; i < bytes; i += sysconf(_SC_PAGESIZE))
+            memoria[i] = 1;
+
+        double media_fork = 0, media_spawn = 0, p50_fork, p50_spawn;
+        medir(lanzar_fork, repeticiones, tiempos);
+        for (int i = 0; i < repeticiones; i++)
+            media_fork += tiempos[i] / repeticiones;
+        p50_fork = tiempos[repeticiones / 2];
+        medir(lanzar_spawn, repeticiones, tiempos);
+        for (int i = 0; i < repeticiones; i++)
+            media_spawn += tiempos[i] / repeticiones;
+        p50_spawn = tiempos[repeticiones / 2];
+
+        printf("%5ld MB %5ld MB | %9.1f us %9.1f us | %9.1f us %9.1f us\n", tamanios[k],
+               rss_mb(), media_fork, p50_fork, media_spawn, p50_spawn);
+        free((char *)memoria);
+    }
+    free(tiempos);
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+Contabilidad de los recursos usados por cada proceso hijo.
+
+Se recogen los hijos con wait4(), que hace lo mismo que waitpid() pero además devuelve
+el struct rusage del hijo que ha terminado: tiempo de CPU en modo usuario y sistema,
+memoria residente máxima, cambios de contexto y fallos de página. Junto con el tiempo
+de vida del hijo (desde justo antes del fork() hasta que se recoge) permite ver
+en qué se le fue el tiempo a cada uno:
+
+- %CPU (CPU / tiempo de vida) cerca del 100%: limitado por la CPU.
+- Muchos cambios de contexto involuntarios: el planificador lo expulsa porque hay más
+  procesos listos que CPUs.
+- Muchos cambios de contexto voluntarios y poca CPU: pasa el tiempo esperando (E/S,
+  tuberías, sleep...).
+- RSS máxima alta o fallos de página mayores (con acceso a disco): limitado por la
+  memoria.
+
+Uso:
+    struct contabilidad c;
+    contabilidad_iniciar(&c);
+    double inicio = contabilidad_ahora();
+    pid = fork(); ... contabilidad_registrar(&c, pid, inicio);
+    while ((flag = contabilidad_esperar(&c, -1, &status, 0)) > 0) { ... }
+    contabilidad_informe(&c, stdout, CONTABILIDAD_TEXTO);
+    contabilidad_liberar(&c);
+*/
+
+#ifndef CONTABILIDAD_HIJOS_H_
+#define CONTABILIDAD_HIJOS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Formatos del informe
+#define CONTABILIDAD_TEXTO 0
+#define CONTABILIDAD_JSON 1
+
+struct contabilidad_hijo {
+    pid_t pid;
+    int terminado;     // 1 cuando ya se ha recogido con contabilidad_esperar()
+    int status;        // Estado de terminación (como en waitpid)
+    double inicio;     // Instante en que se creó (antes del fork()), en segundos
+    double vida;       // Tiempo de vida, en segundos
+    struct rusage uso; // Recursos usados (wait4)
+};
+
+struct contabilidad {
+    struct contabilidad_hijo *hijos;
+    int num;
+    int capacidad;
+    double inicio; // Para los hijos que no se registraron tras el fork()
+};
+
+double contabilidad_ahora() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double contabilidad_segundos(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void contabilidad_iniciar(struct contabilidad *c) {
+    c->hijos = NULL;
+    c->num = c->capacidad = 0;
+    c->inicio = contabilidad_ahora();
+}
+
+void contabilidad_liberar(struct contabilidad *c) {
+    free(c->hijos);
+    c->hijos = NULL;
+    c->num = c->capacidad = 0;
+}
+
+/*
+Busca el hijo con ese PID que aún no se ha recogido. Si no está y crear es distinto de
+0, lo añade. Devuelve NULL si no está (o no hay memoria para añadirlo).
+*/
+struct contabilidad_hijo *contabilidad_buscar(struct contabilidad *c, pid_t pid, int crear) {
+    for (int i = 0; i < c->num; i++)
+        if (c->hijos[i].pid == pid && !c->hijos[i].terminado)
+            return &c->hijos[i];
+    if (!crear)
+        return NULL;
+
+    if (c->num == c->capacidad) {
+        int capacidad = c->capacidad ? c->capacidad * 2 : 16;
+        struct contabilidad_hijo *hijos = realloc(c->hijos, capacidad * sizeof(*hijos));
+        if (hijos == NULL)
+            return NULL;
+        c->hijos = hijos;
+        c->capacidad = capacidad;
+    }
+    struct contabilidad_hijo *h = &c->hijos[c->num++];
+    h->pid = pid;
+    h->terminado = 0;
+    h->status = 0;
+    h->inicio = c->inicio;
+    h->vida = 0;
+    return h;
+}
+
+/*
+Registra un hijo recién creado para medir su tiempo de vida desde inicio, el instante
+(contabilidad_ahora()) tomado justo antes del fork(). Tomarlo después no sirve: el hijo
+puede ejecutarse antes de que el padre vuelva del fork() y su tiempo de vida saldría
+menor que su tiempo de CPU. Se llama en el padre nada más volver del fork(), antes de
+cualquier E/S. Devuelve -1 si no hay memoria.
+*/
+int contabilidad_registrar(struct contabilidad *c, pid_t pid, double inicio) {
+    struct contabilidad_hijo *h = contabilidad_buscar(c, pid, 1);
+    if (h == NULL)
+        return -1;
+    h->inicio = inicio;
+    return 0;
+}
+
+/*
+Igual que waitpid(pid, status, opciones), pero con wait4() para anotar los recursos
+usados por el hijo si ha terminado. Los hijos parados o reanudados (WUNTRACED,
+WCONTINUED) se devuelven igual, pero no se anotan: siguen vivos.
+*/
+pid_t contabilidad_esperar(struct contabilidad *c, pid_t pid, int *status, int opciones) {
+    struct rusage uso;
+    pid_t flag = wait4(pid, status, opciones, &uso);
+
+    if (flag > 0 && (WIFEXITED(*status) || WIFSIGNALED(*status))) {
+        // Los hijos no registrados se cuentan desde contabilidad_iniciar()
+        struct contabilidad_hijo *h = contabilidad_buscar(c, flag, 1);
+        if (h != NULL) {
+            h->terminado = 1;
+            h->status = *status;
+            h->vida = contabilidad_ahora() - h->inicio;
+            h->uso = uso;
+        }
+    }
+    return flag;
+}
+
+/*
+Muestra en f una línea (o un objeto JSON) por cada hijo recogido y el total de todos
+ellos. En el total, la RSS máxima es la mayor de todas y el resto son sumas.
+*/
+void contabilidad_informe(const struct contabilidad *c, FILE *f, int formato) {
+    struct rusage total = {0};
+    double vida_total = 0, cpu, cpu_total = 0;
+    int recogidos = 0;
+
+    if (formato == CONTABILIDAD_JSON)
+        fprintf(f, "{\"hijos\": [");
+    else
+        fprintf(f, "%8s %-10s %9s %9s %9s %5s %10s %8s %8s %8s %8s\n", "PID", "Estado",
+                "Vida(s)", "User(s)", "Sys(s)", "%CPU", "RSS(KB)", "CtxVol", "CtxInv",
+                "FallMen", "FallMay");
+
+    for (int i = 0; i < c->num; i++) {
+        const struct contabilidad_hijo *h = &c->hijos[i];
+        const struct rusage *u = &h->uso;
+        char estado[16];
+
+        if (!h->terminado)
+            continue;
+        if (WIFEXITED(h->status))
+            snprintf(estado, sizeof(estado), "exit %d", WEXITSTATUS(h->status));
+        else
+            snprintf(estado, sizeof(estado), "señal %d", WTERMSIG(h->status));
+        cpu = contabilidad_segundos(u->ru_utime) + contabilidad_segundos(u->ru_stime);
+
+        if (formato == CONTABILIDAD_JSON)
+            fprintf(f,
+                    "%s\n  {\"pid\": %ld, \"estado\": \"%s\", \"vida\": %.6f, \"user\": %.6f, "
+                    "\"sys\": %.6f, \"rss_max_kb\": %ld, \"ctx_voluntarios\": %ld, "
+                    "\"ctx_involuntarios\": %ld, \"fallos_menores\": %ld, \"fallos_mayores\": %ld}",
+                    recogidos ? "," : "", (long)h->pid, estado, h->vida,
+                    contabilidad_segundos(u->ru_utime), contabilidad_segundos(u->ru_stime),
+                    u->ru_maxrss, u->ru_nvcsw, u->ru_nivcsw, u->ru_minflt, u->ru_majflt);
+        else
+            fprintf(f, "%8ld %-10s %9.3f %9.3f %9.3f %5.0f %10ld %8ld %8ld %8ld %8ld\n",
+                    (long)h->pid, estado, h->vida, contabilidad_segundos(u->ru_utime),
+                    contabilidad_segundos(u->ru_stime), h->vida > 0 ? 100 * cpu / h->vida : 0,
+                    u->ru_maxrss, u->ru_nvcsw, u->ru_nivcsw, u->ru_minflt, u->ru_majflt);
+
+        timeradd(&total.ru_utime, &u->ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &u->ru_stime, &total.ru_stime);
+        if (u->ru_maxrss > total.ru_maxrss)
+            total.ru_maxrss = u->ru_maxrss;
+        total.ru_nvcsw += u->ru_nvcsw;
+        total.ru_nivcsw += u->ru_nivcsw;
+        total.ru_minflt += u->ru_minflt;
+        total.ru_majflt += u->ru_majflt;
+        vida_total += h->vida;
+        cpu_total += cpu;
+        recogidos++;
+    }
+
+    if (formato == CONTABILIDAD_JSON)
+        fprintf(f,
+                "%s],\n \"total\": {\"hijos\": %d, \"vida\": %.6f, \"user\": %.6f, "
+                "\"sys\": %.6f, \"rss_max_kb\": %ld, \"ctx_voluntarios\": %ld, "
+                "\"ctx_involuntarios\": %ld, \"fallos_menores\": %ld, \"fallos_mayores\": %ld}}\n",
+                recogidos ? "\n" : "", recogidos, vida_total,
+                contabilidad_segundos(total.ru_utime), contabilidad_segundos(total.ru_stime),
+                total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw, total.ru_minflt,
+                total.ru_majflt);
+    else
+        fprintf(f, "%8s %-10d %9.3f %9.3f %9.3f %5.0f %10ld %8ld %8ld %8ld %8ld\n", "Total",
+                recogidos, vida_total, contabilidad_segundos(total.ru_utime),
+                contabilidad_segundos(total.ru_stime),
+                vida_total > 0 ? 100 * cpu_total / vida_total : 0, total.ru_maxrss,
+                total.ru_nvcsw, total.ru_nivcsw, total.ru_minflt, total.ru_majflt);
+}
+
+#endif /* #ifndef CONTABILIDAD_HIJOS_H_ */
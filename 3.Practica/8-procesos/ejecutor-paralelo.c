@@ -0,0 +1,462 @@
+/*
+Ejecutor de órdenes en paralelo, al estilo de xargs -P.
+
+Lee órdenes de la entrada estándar, una por línea, y las ejecuta con /bin/sh -c
+manteniendo hasta N en marcha a la vez. La salida estándar y la de error de cada
+orden se recogen por tuberías, vigiladas todas con epoll, y se muestran agrupadas por
+orden y en el mismo orden en que se leyeron las órdenes, de modo que las líneas de
+distintas órdenes nunca se mezclan:
+
+- La orden más antigua que aún no se ha mostrado es la "activa": su salida se pasa a
+  la del ejecutor según llega, con splice(), que mueve los datos de la tubería a la
+  salida dentro del núcleo, sin copiarlos al espacio de usuario. Así, una orden con
+  mucha salida no hace del ejecutor un cuello de botella. Si quien lee la salida del
+  ejecutor va más lento, se espera a que admita más (EPOLLOUT) sin leer de la orden.
+- La salida de las demás se guarda en memoria y se muestra cuando les toca, hasta
+  MAX_GUARDADO bytes por salida: después se deja de leer su tubería, que se llena, y
+  la orden espera a ser la activa.
+
+Al terminar cada orden se muestra por la salida de error su estado y su duración. El
+ejecutor termina con el estado 0 si todas las órdenes terminaron con 0, y 1 si no.
+
+Uso:
+./ejecutor-paralelo [-P trabajos] < ordenes.txt
+
+Ejemplo:
+printf 'sleep 1; echo a\necho b\nls /no-existe\n' | ./ejecutor-paralelo -P 3
+
+Compilación:
+gcc -O2 -o ejecutor-paralelo ejecutor-paralelo.c
+*/
+
+#define _GNU_SOURCE // Para splice() y pipe2()
+
+#include <errno.h> //Control de errores
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Salidas de cada orden: 0 = estándar, 1 = error
+#define NUM_SALIDAS 2
+
+// Bytes que se guardan como mucho de cada salida de una orden que no es la activa
+#define MAX_GUARDADO (1 << 20)
+
+// Datos de los eventos de epoll que no son de una tubería: el signalfd y la salida s del
+// ejecutor cuando se espera a que admita más
+#define EVENTO_SENAL UINT64_MAX
+#define EVENTO_SALIDA(s) (UINT64_MAX - 1 - (s))
+
+struct salida {
+    int fd;       // Extremo de lectura de la tubería (-1 cuando llega el fin de fichero)
+    char *buffer; // Lo recibido mientras la orden no es la activa
+    size_t len;
+    size_t capacidad;
+    int parada;   // Buffer lleno: la tubería no se vigila hasta que la orden sea la activa
+};
+
+struct trabajo {
+    char *orden;
+    pid_t pid;                          // -1 cuando ya se ha recogido con waitpid
+    int status;                         // Estado de terminación (waitpid)
+    double inicio, fin;                 // Instantes de inicio y fin, en segundos
+    struct salida salidas[NUM_SALIDAS]; // Salida estándar y de error
+};
+
+struct trabajo *trabajos = NULL;
+int num_trabajos = 0;
+int capacidad_trabajos = 0;
+int activo = 0;          // Primer trabajo que aún no se ha mostrado entero
+int *en_curso = NULL;    // Trabajos con el proceso sin recoger (hasta -P)
+int en_marcha = 0;       // Procesos sin recoger (entradas de en_curso)
+int epoll_fd = -1;
+int usar_splice = 1;     // Se desactiva si la salida del ejecutor no admite splice()
+int esperando[NUM_SALIDAS]; // Se espera a que la salida del ejecutor admita más
+int fallidos = 0;
+sigset_t mascara_original; // Máscara de señales con que se arrancó, para los hijos
+
+double segundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Escribe todo el buffer, aunque write() escriba menos de lo pedido. Si la salida no
+// bloquea y está llena, espera a que admita más
+void escribir_todo(int fd, const char *datos, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, datos, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            perror("Error al escribir la salida");
+            exit(EXIT_FAILURE);
+        }
+        datos += n;
+        len -= n;
+    }
+}
+
+/*
+Lanza la orden del trabajo t con su salida estándar y de error conectadas a dos
+tuberías, y registra los extremos de lectura en epoll.
+*/
+void lanzar(int t) {
+    struct trabajo *j = &trabajos[t];
+    int tuberias[NUM_SALIDAS][2];
+
+    for (int s = 0; s < NUM_SALIDAS; s++) {
+        // Los extremos del ejecutor no se heredan en los hijos (O_CLOEXEC): si no, una
+        // orden mantendría abiertas las tuberías de otras y nunca llegaría su fin de fichero
+        if (pipe2(tuberias[s], O_CLOEXEC) == -1) {
+            perror("Error al crear la tubería");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    j->inicio = segundos();
+    switch (j->pid = fork()) {
+    case -1:
+        perror("No he podido crear el proceso hijo");
+        exit(EXIT_FAILURE);
+    case 0: // Hijo: las tuberías pasan a ser su salida estándar y de error
+        // La máscara y las señales ignoradas se heredan a través del exec: la orden debe
+        // arrancar con SIGCHLD sin bloquear y SIGPIPE como siempre
+        signal(SIGPIPE, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &mascara_original, NULL);
+        dup2(tuberias[0][1], STDOUT_FILENO);
+        dup2(tuberias[1][1], STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", j->orden, (char *)0);
+        _exit(127);
+    }
+
+    en_curso[en_marcha++] = t;
+    for (int s = 0; s < NUM_SALIDAS; s++) {
+        close(tuberias[s][1]);
+        j->salidas[s].fd = tuberias[s][0];
+        fcntl(j->salidas[s].fd, F_SETFL, O_NONBLOCK);
+        // En data.u64 va el trabajo y la salida de la que llega el evento
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = (uint64_t)t * NUM_SALIDAS + s};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, j->salidas[s].fd, &ev) == -1) {
+            perror("Error al registrar la tubería en epoll");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+Lee la siguiente orden de la entrada estándar y la lanza. Devuelve 0 si no quedan más.
+*/
+int siguiente_orden() {
+    char *linea = NULL;
+    size_t capacidad = 0;
+    ssize_t n;
+
+    // Saltamos las líneas vacías
+    do {
+        n = getline(&linea, &capacidad, stdin);
+        if (n > 0 && linea[n - 1] == '\n')
+            linea[--n] = '\0';
+    } while (n == 0);
+    if (n == -1) {
+        free(linea);
+        return 0;
+    }
+
+    if (num_trabajos == capacidad_trabajos) {
+        capacidad_trabajos = capacidad_trabajos ? capacidad_trabajos * 2 : 64;
+        trabajos = realloc(trabajos, capacidad_trabajos * sizeof(struct trabajo));
+        if (trabajos == NULL) {
+            perror("Error al reservar memoria");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(&trabajos[num_trabajos], 0, sizeof(struct trabajo));
+    trabajos[num_trabajos].orden = linea;
+    lanzar(num_trabajos++);
+    return 1;
+}
+
+/*
+La salida s del ejecutor no admite más (quien la lee va más lento que la orden activa).
+Mientras tanto se deja de vigilar la tubería de la orden, que sigue con datos y haría
+que epoll avisara sin parar, y se vigila la salida hasta que admita más.
+
+Devuelve -1 si la salida no se puede vigilar con epoll (EPERM: un fichero regular o
+/dev/null). Entonces no se espera: quien llama copia con write(), que bloquea.
+*/
+int esperar_salida(int s) {
+    int destino = s == 0 ? STDOUT_FILENO : STDERR_FILENO;
+    struct epoll_event ev = {.events = EPOLLOUT, .data.u64 = EVENTO_SALIDA(s)};
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, destino, &ev) == -1) {
+        if (errno == EPERM)
+            return -1;
+        perror("Error al esperar a la salida en epoll");
+        exit(EXIT_FAILURE);
+    }
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, trabajos[activo].salidas[s].fd, NULL) == -1) {
+        perror("Error al esperar a la salida en epoll");
+        exit(EXIT_FAILURE);
+    }
+    esperando[s] = 1;
+    return 0;
+}
+
+void atender_salida(int t, int s);
+
+/*
+La salida s del ejecutor vuelve a admitir datos: se vuelve a vigilar la tubería de la
+orden activa y se sigue pasando lo que tenga.
+*/
+void salida_lista(int s) {
+    int destino = s == 0 ? STDOUT_FILENO : STDERR_FILENO;
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = (uint64_t)activo * NUM_SALIDAS + s};
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, destino, NULL) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, trabajos[activo].salidas[s].fd, &ev) == -1) {
+        perror("Error al volver a vigilar la tubería en epoll");
+        exit(EXIT_FAILURE);
+    }
+    esperando[s] = 0;
+    atender_salida(activo, s);
+}
+
+/*
+Mueve lo que haya en la tubería de la salida s del trabajo t. Si el trabajo es el
+activo, va directamente a la salida del ejecutor (con splice() si se puede); si no, se
+guarda en su buffer.
+*/
+void atender_salida(int t, int s) {
+    struct salida *sal = &trabajos[t].salidas[s];
+    int destino = s == 0 ? STDOUT_FILENO : STDERR_FILENO;
+    char bloque[65536];
+    int disponible;
+    ssize_t n;
+
+    // Puede quedar un evento de la tubería de cuando aún se vigilaba
+    if (t == activo && esperando[s])
+        return;
+    while (sal->fd != -1) {
+        if (t == activo && usar_splice) {
+            n = splice(sal->fd, NULL, destino, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n == -1 && errno == EINVAL) {
+                // La salida del ejecutor no admite splice() (por ejemplo, algunos
+                // terminales): a partir de ahora se copia con read() y write()
+                usar_splice = 0;
+                continue;
+            }
+            // EAGAIN con datos en la tubería: lo que está lleno es la salida
+            if (n == -1 && errno == EAGAIN && ioctl(sal->fd, FIONREAD, &disponible) == 0 &&
+                disponible > 0) {
+                if (esperar_salida(s) == 0)
+                    return;
+                usar_splice = 0; // Sin epoll: se copia con escribir_todo(), que espera
+                continue;
+            }
+        }
+        else {
+            // Con el buffer lleno se deja de vigilar la tubería: la orden se detiene
+            // al llenarla, hasta que sea la activa (ver avanzar_activo())
+            size_t max = t == activo ? sizeof(bloque) : MAX_GUARDADO - sal->len;
+            if (max == 0) {
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sal->fd, NULL) == -1) {
+                    perror("Error al dejar de vigilar la tubería en epoll");
+                    exit(EXIT_FAILURE);
+                }
+                sal->parada = 1;
+                return;
+            }
+            n = read(sal->fd, bloque, max < sizeof(bloque) ? max : sizeof(bloque));
+            if (n > 0 && t == activo)
+                escribir_todo(destino, bloque, n);
+            else if (n > 0) {
+                if (sal->len + n > sal->capacidad) {
+                    sal->capacidad = (sal->len + n) * 2;
+                    sal->buffer = realloc(sal->buffer, sal->capacidad);
+                    if (sal->buffer == NULL) {
+                        perror("Error al reservar memoria");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                memcpy(sal->buffer + sal->len, bloque, n);
+                sal->len += n;
+            }
+        }
+
+        if (n == -1 && (errno == EAGAIN || errno == EINTR))
+            return; // No hay más por ahora
+        if (n == -1) {
+            perror("Error al leer la salida de una orden");
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0) {
+            // Fin de fichero: close() también la quita de epoll
+            close(sal->fd);
+            sal->fd = -1;
+        }
+    }
+}
+
+/*
+Recoge los hijos que han terminado (llega SIGCHLD por el signalfd). Cada uno se busca
+solo entre los que están en marcha (en_curso), no entre todos los trabajos.
+*/
+void recoger_hijos(int signal_fd) {
+    struct signalfd_siginfo info;
+    pid_t flag;
+    int status;
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+    }
+    while ((flag = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < en_marcha; i++) {
+            struct trabajo *j = &trabajos[en_curso[i]];
+            if (j->pid == flag) {
+                j->pid = -1;
+                j->status = status;
+                j->fin = segundos();
+                en_curso[i] = en_curso[--en_marcha];
+                break;
+            }
+        }
+    }
+}
+
+/*
+Si el trabajo activo ha terminado del todo (proceso recogido y tuberías cerradas),
+muestra su informe y pasa al siguiente, mostrando lo que ya tuviera guardado.
+*/
+void avanzar_activo() {
+    while (activo < num_trabajos) {
+        struct trabajo *j = &trabajos[activo];
+        if (j->pid != -1 || j->salidas[0].fd != -1 || j->salidas[1].fd != -1)
+            return;
+
+        if (WIFEXITED(j->status)) {
+            fprintf(stderr, "[ejecutor] %d: \"%s\" finalizado, status = %d, %.3f s\n", activo,
+                    j->orden, WEXITSTATUS(j->status), j->fin - j->inicio);
+            fallidos += WEXITSTATUS(j->status) != 0;
+        }
+        else {
+            fprintf(stderr, "[ejecutor] %d: \"%s\" finalizado al recibir la señal %d, %.3f s\n",
+                    activo, j->orden, WTERMSIG(j->status), j->fin - j->inicio);
+            fallidos++;
+        }
+        free(j->orden);
+        activo++;
+
+        // El nuevo activo muestra lo que guardó mientras esperaba su turno; lo que
+        // llegue a partir de ahora ya va directamente a la salida
+        if (activo < num_trabajos) {
+            for (int s = 0; s < NUM_SALIDAS; s++) {
+                struct salida *sal = &trabajos[activo].salidas[s];
+                escribir_todo(s == 0 ? STDOUT_FILENO : STDERR_FILENO, sal->buffer, sal->len);
+                free(sal->buffer);
+                sal->buffer = NULL;
+                sal->len = sal->capacidad = 0;
+                if (sal->parada) {
+                    struct epoll_event ev = {.events = EPOLLIN,
+                                             .data.u64 = (uint64_t)activo * NUM_SALIDAS + s};
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sal->fd, &ev) == -1) {
+                        perror("Error al volver a vigilar la tubería en epoll");
+                        exit(EXIT_FAILURE);
+                    }
+                    sal->parada = 0;
+                }
+                atender_salida(activo, s);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int max_trabajos = sysconf(_SC_NPROCESSORS_ONLN);
+    int hay_ordenes = 1;
+    int c;
+    sigset_t mascara;
+    struct epoll_event eventos[64];
+
+    while ((c = getopt(argc, argv, "P:")) != -1) {
+        switch (c) {
+        case 'P':
+            max_trabajos = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-P trabajos] < ordenes\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (max_trabajos < 1) {
+        fprintf(stderr, "El número de trabajos debe ser positivo\n");
+        exit(EXIT_FAILURE);
+    }
+    en_curso = malloc(max_trabajos * sizeof(int));
+    if (en_curso == NULL) {
+        perror("Error al reservar memoria");
+        exit(EXIT_FAILURE);
+    }
+
+    // SIGCHLD llega por un signalfd, como un evento más de epoll. Se bloquea antes de
+    // crear ningún hijo para no perder ninguna
+    sigemptyset(&mascara);
+    sigaddset(&mascara, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mascara, &mascara_original);
+    int signal_fd = signalfd(-1, &mascara, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = EVENTO_SENAL};
+    if (signal_fd == -1 || epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev)) {
+        perror("Error al preparar epoll");
+        exit(EXIT_FAILURE);
+    }
+    // Si quien lee nuestra salida la cierra, write() y splice() devuelven EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    while (hay_ordenes || activo < num_trabajos) {
+        // Ocupamos los huecos libres con nuevas órdenes
+        while (hay_ordenes && en_marcha < max_trabajos)
+            hay_ordenes = siguiente_orden();
+        avanzar_activo();
+        if (activo == num_trabajos && !hay_ordenes)
+            break;
+
+        int n = epoll_wait(epoll_fd, eventos, 64, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("Error en epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t dato = eventos[i].data.u64;
+            if (dato == EVENTO_SENAL)
+                recoger_hijos(signal_fd);
+            else if (dato >= EVENTO_SALIDA(NUM_SALIDAS - 1))
+                salida_lista(EVENTO_SALIDA(0) - dato);
+            else
+                atender_salida(dato / NUM_SALIDAS, dato % NUM_SALIDAS);
+        }
+    }
+
+    fprintf(stderr, "[ejecutor] %d órdenes, %d fallidas\n", num_trabajos, fallidos);
+    free(trabajos);
+    free(en_curso);
+    close(signal_fd);
+    close(epoll_fd);
+    return fallidos > 0;
+}
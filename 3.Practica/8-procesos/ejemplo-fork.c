@@ -5,10 +5,17 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-int main() {
+#include "contabilidad-hijos.h"
+
+// Con -j, el informe de recursos de los hijos se muestra en JSON
+int main(int argc, char **argv) {
     pid_t rf, flag;
     int status;
+    struct contabilidad c;
+    int formato = argc > 1 && strcmp(argv[1], "-j") == 0 ? CONTABILIDAD_JSON : CONTABILIDAD_TEXTO;
 
+    contabilidad_iniciar(&c);
+    double inicio = contabilidad_ahora(); // El tiempo de vida del hijo se mide desde aquí
     rf = fork();
     switch (rf) {
     case -1:
@@ -18,12 +25,14 @@ int main() {
         printf("Soy el Hijo, mi PID es %d y mi PPID es %d \n", getpid(), getppid());
         exit(EXIT_SUCCESS);
     default:
+        contabilidad_registrar(&c, rf, inicio);
         printf("Soy el Padre, mi PID es %d y el PID de mi hijo es %d \n", getpid(), rf);
     }
 
     /*Espera del padre a los hijos*/
-    // Pruebe a sustituir wait() por waitpid()
-    while ((flag = wait(&status)) > 0) {
+    // contabilidad_esperar() es waitpid() con wait4() por debajo: además del estado,
+    // anota los recursos que ha usado el hijo
+    while ((flag = contabilidad_esperar(&c, -1, &status, 0)) > 0) {
         if (WIFEXITED(status)) {
             printf("Proceso Padre, Hijo con PID %ld finalizado, status = %d\n", (long int)flag, WEXITSTATUS(status));
         } else if (WIFSIGNALED(status)) { // Para seniales como las de finalizar o matar
@@ -32,6 +41,8 @@ int main() {
     }
     if (flag == (pid_t)-1 && errno == ECHILD) {
         printf("Proceso Padre %d, no hay mas hijos que esperar. Valor de errno = %d, definido como: %s\n", getpid(), errno, strerror(errno));
+        contabilidad_informe(&c, stdout, formato);
+        contabilidad_liberar(&c);
     } else {
         printf("Error en la invocacion de wait o waitpid. Valor de errno = %d, definido como: %s\n", errno, strerror(errno));
         exit(EXIT_FAILURE);
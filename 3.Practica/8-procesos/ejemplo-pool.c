@@ -0,0 +1,165 @@
+/*
+Comparación entre crear un proceso por tarea y usar un pool de procesos (prefork).
+
+Se ejecuta el mismo lote de tareas de dos formas y se muestran las tareas por segundo
+de cada una:
+- fork por tarea: para cada tarea, fork(), el hijo la calcula, devuelve el resultado
+  por una tubería y termina, y el padre lo espera con waitpid() (como en
+  ejemplo-fork.c, pero una vez por tarea).
+- pool: N trabajadores creados al principio reciben las tareas por tuberías (ver
+  pool-procesos.h).
+
+Uso:
+./ejemplo-pool [-n tareas] [-w trabajadores] [-k tareas_por_trabajador] [-f cada]
+
+Con -f, una de cada <cada> tareas hace que su trabajador muera con SIGSEGV, para ver
+cómo el pool lo reemplaza y la da por fallida tras los reintentos.
+
+Compilación:
+gcc -O2 -o ejemplo-pool ejemplo-pool.c
+*/
+
+#include "pool-procesos.h"
+#include <time.h>
+
+/*
+Trabajo de cada tarea: número de pasos de la sucesión de Collatz desde n. Con un
+argumento negativo, el proceso muere con una violación de segmento.
+*/
+long pasos_collatz(long n) {
+    long pasos = 0;
+
+    if (n < 0)
+        raise(SIGSEGV);
+    while (n > 1) {
+        n = n % 2 == 0 ? n / 2 : 3 * n + 1;
+        pasos++;
+    }
+    return pasos;
+}
+
+double segundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+Ejecuta las tareas con un fork() por tarea. Devuelve el número de tareas fallidas.
+*/
+long fork_por_tarea(const long *argumentos, long *resultados, long num) {
+    long fallidas = 0;
+    int fd[2];
+    int status;
+
+    for (long i = 0; i < num; i++) {
+        if (pipe(fd) == -1) {
+            perror("Error al crear la tubería");
+            exit(EXIT_FAILURE);
+        }
+        pid_t rf = fork();
+        switch (rf) {
+        case -1:
+            perror("Error al crear el proceso hijo");
+            exit(EXIT_FAILURE);
+        case 0:
+            close(fd[0]);
+            resultados[i] = pasos_collatz(argumentos[i]);
+            if (write(fd[1], &resultados[i], sizeof(long)) != sizeof(long))
+                _exit(EXIT_FAILURE);
+            _exit(EXIT_SUCCESS);
+        }
+        close(fd[1]);
+        if (read(fd[0], &resultados[i], sizeof(long)) != sizeof(long)) {
+            resultados[i] = POOL_FALLIDA;
+            fallidas++;
+        }
+        close(fd[0]);
+        waitpid(rf, &status, 0);
+    }
+    return fallidas;
+}
+
+int main(int argc, char **argv) {
+    long num_tareas = 20000;
+    int num_trabajadores = sysconf(_SC_NPROCESSORS_ONLN);
+    long max_tareas = 1000;
+    long cada_fallo = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:w:k:f:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_tareas = atol(optarg);
+            break;
+        case 'w':
+            num_trabajadores = atoi(optarg);
+            break;
+        case 'k':
+            max_tareas = atol(optarg);
+            break;
+        case 'f':
+            cada_fallo = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-n tareas] [-w trabajadores] [-k tareas_por_trabajador] "
+                            "[-f cada]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_tareas < 1 || num_trabajadores < 1) {
+        fprintf(stderr, "El número de tareas y de trabajadores debe ser positivo\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long *argumentos = malloc(num_tareas * sizeof(long));
+    long *resultados = malloc(num_tareas * sizeof(long));
+    if (argumentos == NULL || resultados == NULL) {
+        perror("Error al reservar memoria");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < num_tareas; i++)
+        argumentos[i] = cada_fallo > 0 && i % cada_fallo == cada_fallo - 1 ? -1 : i + 1;
+
+    // Primero, un proceso por tarea
+    double inicio = segundos();
+    long fallidas = fork_por_tarea(argumentos, resultados, num_tareas);
+    double t_fork = segundos() - inicio;
+    printf("fork por tarea: %ld tareas (%ld fallidas) en %.3f s, %.0f tareas/s\n", num_tareas,
+           fallidas, t_fork, num_tareas / t_fork);
+
+    // Después, el pool (la creación de los trabajadores también cuenta)
+    struct pool p;
+    inicio = segundos();
+    if (pool_crear(&p, num_trabajadores, max_tareas, pasos_collatz) == -1) {
+        perror("Error al crear el pool");
+        exit(EXIT_FAILURE);
+    }
+    fallidas = pool_ejecutar(&p, argumentos, resultados, num_tareas);
+    double t_pool = segundos() - inicio;
+    pool_destruir(&p);
+    if (fallidas == -1) {
+        fprintf(stderr, "Error al ejecutar las tareas en el pool\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("pool (%d trabajadores, reciclados cada %ld tareas): %ld tareas (%ld fallidas) en "
+           "%.3f s, %.0f tareas/s\n",
+           num_trabajadores, max_tareas, num_tareas, fallidas, t_pool, num_tareas / t_pool);
+    printf("pool: %ld trabajadores reemplazados tras morir, %ld reciclados\n", p.reemplazados,
+           p.reciclados);
+    printf("El pool es %.1f veces más rápido\n", t_fork / t_pool);
+
+    // Comprobamos los resultados del pool
+    for (long i = 0; i < num_tareas; i++) {
+        long esperado = argumentos[i] < 0 ? POOL_FALLIDA : pasos_collatz(argumentos[i]);
+        if (resultados[i] != esperado) {
+            fprintf(stderr, "Resultado incorrecto en la tarea %ld\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(argumentos);
+    free(resultados);
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+Versión de ejemplo-fork-exec.c con posix_spawn() (ver lanzador.h).
+
+Lanza "ls -t -l" dos veces, con fork() + exec y con posix_spawn(), redirigiendo su
+salida a un fichero y con un entorno propio (LC_ALL=C, para que las fechas salgan
+siempre en el mismo formato). El resultado de las dos formas es el mismo; la
+diferencia está en lo que cuesta crear el hijo (ver bench-spawn.c).
+
+Compilación:
+gcc -o ejemplo-spawn ejemplo-spawn.c
+*/
+
+#include "lanzador.h"
+#include <stdio.h>
+#include <string.h> //Para la funcion strerror(), que permite describir el valor de errno como cadena.
+#include <sys/wait.h>
+
+int main() {
+    pid_t rf, flag;
+    int status;
+
+    char *args[] = {"/bin/ls", "-t", "-l", (char *)0};
+    char *entorno[] = {"LC_ALL=C", (char *)0};
+    struct lanzamiento ls = {"/bin/ls", args, entorno, NULL, "salida-fork.txt"};
+
+    // Con fork() + exec: las redirecciones las hace el hijo antes del exec
+    rf = lanzar_fork(&ls);
+    if (rf == -1) {
+        printf("Proceso Padre, no he podido crear el proceso hijo: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printf("Proceso Padre, hijo %d (fork + exec) ejecutando ls con la salida en %s\n", rf,
+           ls.salida);
+
+    // Con posix_spawn: si el exec falla, el error llega aquí, no al hijo
+    ls.salida = "salida-spawn.txt";
+    rf = lanzar_spawn(&ls);
+    if (rf == -1) {
+        printf("Proceso Padre, no he podido lanzar ls: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printf("Proceso Padre, hijo %d (posix_spawn) ejecutando ls con la salida en %s\n", rf,
+           ls.salida);
+
+    /*Espera del padre a los hijos*/
+    while ((flag = wait(&status)) > 0) {
+        if (WIFEXITED(status)) {
+            printf("Proceso Padre, Hijo con PID %ld finalizado, status = %d\n", (long int)flag, WEXITSTATUS(status));
+        } else if (WIFSIGNALED(status)) { // Para seniales como las de finalizar o matar
+            printf("Proceso Padre, Hijo con PID %ld finalizado al recibir la señal %d\n", (long int)flag, WTERMSIG(status));
+        }
+    }
+    if (flag == (pid_t)-1 && errno == ECHILD) {
+        printf("Proceso Padre %d, no hay mas hijos que esperar. Valor de errno = %d, definido como: %s\n", getpid(), errno, strerror(errno));
+    } else {
+        printf("Error en la invocacion de wait o waitpid. Valor de errno = %d, definido como: %s\n", errno, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
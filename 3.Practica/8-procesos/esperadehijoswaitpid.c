@@ -2,12 +2,16 @@
 
 Lógica para esperar a hijos con waitpid().
 
-Faltaría el resto del programa en cuestión.
+Faltaría el resto del programa en cuestión. Se usa contabilidad_esperar(), de
+contabilidad-hijos.h, que llama a wait4() (waitpid() más los recursos usados por el
+hijo). Se supone una struct contabilidad c iniciada con contabilidad_iniciar() y cada
+hijo registrado con contabilidad_registrar() tras el fork(), con el instante tomado
+justo antes.
 
 */
 
 /*Espera del padre a los hijos*/
-while ((flag = waitpid(-1, &status, WUNTRACED | WCONTINUED)) > 0) {
+while ((flag = contabilidad_esperar(&c, -1, &status, WUNTRACED | WCONTINUED)) > 0) {
     if (WIFEXITED(status)) {
         printf("Proceso Padre %d, hijo con PID %ld finalizado, status = %d\n", getpid(), (long int)flag, WEXITSTATUS(status));
     } else if (WIFSIGNALED(status)) {
@@ -23,6 +27,9 @@ while ((flag = waitpid(-1, &status, WUNTRACED | WCONTINUED)) > 0) {
 
 if (flag == (pid_t)-1 && errno == ECHILD) {
     printf("Proceso Padre %d, no hay mas hijos que esperar. Valor de errno = %d, definido como: %s\n", getpid(), errno, strerror(errno));
+    // Informe por hijo y total (CONTABILIDAD_JSON para obtenerlo en JSON)
+    contabilidad_informe(&c, stdout, CONTABILIDAD_TEXTO);
+    contabilidad_liberar(&c);
 } else {
     printf("Error en la invocacion de wait o waitpid. Valor de errno = %d, definido como: %s\n", errno, strerror(errno));
     exit(EXIT_FAILURE);
@@ -0,0 +1,106 @@
+/*
+Lanzar un programa en un proceso hijo de dos formas equivalentes.
+
+- lanzar_fork(): fork() + execve(), como en ejemplo-fork-exec.c. fork() tiene que
+  copiar la tabla de páginas del padre (aunque las páginas se compartan hasta que
+  se escriban), así que su coste crece con la memoria que use el padre: lanzar un
+  programa pequeño desde un proceso de varios GB es lento.
+- lanzar_spawn(): posix_spawn(). En glibc (2.24 o posterior) se implementa con
+  clone(CLONE_VM | CLONE_VFORK): el hijo usa la memoria del padre, que queda parado
+  hasta que el hijo hace el exec, así que no se copia nada y el coste no depende del
+  tamaño del padre.
+
+Las dos admiten lo mismo: redirigir la entrada y la salida estándar a ficheros y
+pasar un entorno propio al programa.
+*/
+
+#ifndef LANZADOR_H_
+#define LANZADOR_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Qué se lanza y cómo. La salida estándar se redirige a un fichero que se crea o se trunca
+struct lanzamiento {
+    const char *ruta;    // Ruta del programa (no se busca en el PATH)
+    char *const *argv;   // Argumentos, terminados en NULL
+    char *const *envp;   // Entorno del programa (NULL = el del padre)
+    const char *entrada; // Fichero para la entrada estándar (NULL = la del padre)
+    const char *salida;  // Fichero para la salida estándar (NULL = la del padre)
+};
+
+/*
+Lanza el programa con fork() + execve(). Las redirecciones las hace el hijo entre el
+fork y el exec.
+
+Devuelve el PID del hijo o -1 si falló fork() (errno indica la causa). Si falla algo
+en el hijo (abrir un fichero o el exec), el hijo termina con el estado 127.
+*/
+pid_t lanzar_fork(const struct lanzamiento *l) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    // Hijo
+    if (l->entrada != NULL) {
+        int fd = open(l->entrada, O_RDONLY);
+        if (fd == -1 || dup2(fd, STDIN_FILENO) == -1)
+            _exit(127);
+        close(fd);
+    }
+    if (l->salida != NULL) {
+        int fd = open(l->salida, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            _exit(127);
+        close(fd);
+    }
+    execve(l->ruta, l->argv, l->envp != NULL ? l->envp : environ);
+    _exit(127);
+}
+
+/*
+Lanza el programa con posix_spawn(). Las redirecciones se describen con
+posix_spawn_file_actions y las aplica el hijo antes del exec.
+
+Devuelve el PID del hijo o -1 en caso de error (errno indica la causa), también si no
+se pudo preparar alguna redirección. A diferencia de fork(), los errores del exec se
+devuelven al padre (glibc espera a que el hijo haga el exec para saber si falló).
+*/
+pid_t lanzar_spawn(const struct lanzamiento *l) {
+    posix_spawn_file_actions_t acciones;
+    pid_t pid;
+    int error;
+
+    // posix_spawn_file_actions_* tampoco usan errno: si no hay memoria para apuntar una
+    // redirección, se lanzaría el programa sin ella, así que no se lanza
+    error = posix_spawn_file_actions_init(&acciones);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    if (l->entrada != NULL)
+        error = posix_spawn_file_actions_addopen(&acciones, STDIN_FILENO, l->entrada,
+                                                 O_RDONLY, 0);
+    if (error == 0 && l->salida != NULL)
+        error = posix_spawn_file_actions_addopen(&acciones, STDOUT_FILENO, l->salida,
+                                                 O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (error == 0)
+        error = posix_spawn(&pid, l->ruta, &acciones, NULL, l->argv,
+                            l->envp != NULL ? l->envp : environ);
+    posix_spawn_file_actions_destroy(&acciones);
+    if (error != 0) {
+        // posix_spawn no usa errno: devuelve el código de error
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+#endif /* #ifndef LANZADOR_H_ */
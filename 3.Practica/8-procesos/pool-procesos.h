@@ -0,0 +1,427 @@
+/*
+Pool de procesos creados de antemano (prefork).
+
+En lugar de hacer un fork() por cada tarea, el pool crea N procesos trabajadores que
+viven mientras dure el pool y les reparte las tareas por tuberías: cada trabajador
+tiene una tubería por la que recibe tareas y otra por la que devuelve los resultados.
+Así el coste de crear un proceso (copiar la tabla de páginas, el fork, el exit y el
+wait) se paga una vez por trabajador y no una vez por tarea.
+
+- Si un trabajador muere (por ejemplo, por una violación de segmento), el padre lo
+  detecta con SIGCHLD y waitpid(WNOHANG), crea otro en su lugar y vuelve a encargar
+  la tarea que estaba haciendo (como mucho POOL_REINTENTOS veces; después la tarea se
+  da por fallida). Si no se puede crear el sustituto (fork() falla), se vuelve a
+  intentar en cada vuelta del bucle de pool_ejecutar; si no queda ningún trabajador,
+  las tareas pendientes del lote se dan por fallidas.
+- Tras max_tareas tareas, el trabajador se recicla: el padre cierra su tubería de
+  tareas (el trabajador lee fin de fichero y termina) y crea otro. Así la memoria
+  que vaya acumulando un trabajador (fugas, fragmentación) no crece sin límite.
+
+El pool instala su propio manejador de SIGCHLD y recoge a todos los hijos que
+terminan, así que supone que el proceso no crea otros hijos mientras existe.
+*/
+
+#ifndef POOL_PROCESOS_H_
+#define POOL_PROCESOS_H_
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // Para ppoll()
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Veces que se vuelve a encargar una tarea cuyo trabajador murió
+#define POOL_REINTENTOS 2
+
+// Resultado de una tarea fallida
+#define POOL_FALLIDA LONG_MIN
+
+// Tarea y resultado tal y como viajan por las tuberías. Son más pequeños que PIPE_BUF,
+// así que cada write() es atómico
+struct pool_mensaje {
+    long indice; // Posición de la tarea en el lote
+    long valor;  // Argumento de la tarea o su resultado
+};
+
+struct pool_trabajador {
+    pid_t pid;         // -1 si no hay proceso
+    int fd_tareas;     // Extremo de escritura de la tubería de tareas
+    int fd_resultados; // Extremo de lectura de la tubería de resultados (-1 si ya dio EOF)
+    long tarea;        // Índice de la tarea que está haciendo (-1 si está libre)
+    long hechas;       // Tareas que ha terminado este proceso
+};
+
+struct pool {
+    int num;                              // Número de trabajadores
+    long max_tareas;                      // Tareas antes de reciclar un trabajador (0 = nunca)
+    long (*funcion)(long);                // Trabajo que hace cada tarea
+    struct pool_trabajador *trabajadores; // Trabajadores
+    long sin_recoger;                     // Reciclados que aún no se han recogido con waitpid
+    long reemplazados;                    // Trabajadores que murieron y se reemplazaron
+    long reciclados;                      // Trabajadores reciclados tras max_tareas
+    sigset_t mascara_espera;              // Máscara durante ppoll (con SIGCHLD desbloqueada)
+    struct sigaction sigchld_anterior;    // Para restaurarla al destruir el pool
+
+    // Estado del lote en curso (ver pool_ejecutar)
+    long *resultados;
+    int *intentos;
+    long *reintentar;
+    long num_reintentar;
+    long completadas;
+    long fallidas;
+};
+
+// La pone a 1 el manejador de SIGCHLD; el padre recoge a los hijos fuera del manejador
+volatile sig_atomic_t pool_hijo_terminado = 0;
+
+void pool_manejador_sigchld(int senial) {
+    (void)senial;
+    pool_hijo_terminado = 1;
+}
+
+/*
+Bucle del proceso trabajador: lee tareas hasta que la tubería se cierra.
+*/
+void pool_bucle_trabajador(long (*funcion)(long), int fd_tareas, int fd_resultados) {
+    struct pool_mensaje m;
+
+    while (read(fd_tareas, &m, sizeof(m)) == sizeof(m)) {
+        m.valor = funcion(m.valor);
+        if (write(fd_resultados, &m, sizeof(m)) != sizeof(m))
+            _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/*
+Crea el proceso del trabajador w con sus dos tuberías.
+
+Devuelve 0 si todo fue bien y -1 si falló pipe() o fork().
+*/
+int pool_arrancar(struct pool *p, struct pool_trabajador *w) {
+    int tareas[2], resultados[2];
+
+    if (pipe(tareas) == -1)
+        return -1;
+    if (pipe(resultados) == -1) {
+        close(tareas[0]);
+        close(tareas[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    switch (pid) {
+    case -1:
+        close(tareas[0]);
+        close(tareas[1]);
+        close(resultados[0]);
+        close(resultados[1]);
+        return -1;
+    case 0:
+        // El hijo hereda los extremos del padre de las tuberías de todos los trabajadores.
+        // Hay que cerrarlos: si no, otro trabajador nunca vería el fin de fichero de su
+        // tubería de tareas cuando el padre la cierre
+        for (int i = 0; i < p->num; i++) {
+            if (p->trabajadores[i].fd_tareas != -1)
+                close(p->trabajadores[i].fd_tareas);
+            if (p->trabajadores[i].fd_resultados != -1)
+                close(p->trabajadores[i].fd_resultados);
+        }
+        close(tareas[1]);
+        close(resultados[0]);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &p->mascara_espera, NULL);
+        pool_bucle_trabajador(p->funcion, tareas[0], resultados[1]);
+    }
+
+    close(tareas[0]);
+    close(resultados[1]);
+    w->pid = pid;
+    w->fd_tareas = tareas[1];
+    w->fd_resultados = resultados[0];
+    w->tarea = -1;
+    w->hechas = 0;
+    return 0;
+}
+
+/*
+Deja al trabajador w sin proceso: cierra sus tuberías. Su proceso, si sigue vivo,
+lee fin de fichero y termina.
+*/
+void pool_soltar(struct pool_trabajador *w) {
+    if (w->fd_tareas != -1)
+        close(w->fd_tareas);
+    if (w->fd_resultados != -1)
+        close(w->fd_resultados);
+    w->fd_tareas = w->fd_resultados = -1;
+    w->pid = -1;
+}
+
+/*
+Termina todos los trabajadores, espera a que acaben y restaura SIGCHLD.
+*/
+void pool_destruir(struct pool *p) {
+    sigset_t sigchld;
+
+    for (int i = 0; i < p->num; i++) {
+        if (p->trabajadores[i].pid != -1) {
+            pool_soltar(&p->trabajadores[i]);
+            p->sin_recoger++;
+        }
+    }
+    while (p->sin_recoger > 0 && waitpid(-1, NULL, 0) > 0)
+        p->sin_recoger--;
+    free(p->trabajadores);
+
+    sigaction(SIGCHLD, &p->sigchld_anterior, NULL);
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &sigchld, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    pool_hijo_terminado = 0;
+}
+
+/*
+Crea un pool de num trabajadores que ejecutan funcion, y que se reciclan tras
+max_tareas tareas (0 = no se reciclan nunca).
+
+Devuelve 0 si todo fue bien y -1 en caso de error (errno indica la causa). Si falla a
+medias, termina los trabajadores ya creados y lo deja todo como estaba.
+*/
+int pool_crear(struct pool *p, int num, long max_tareas, long (*funcion)(long)) {
+    struct sigaction sa;
+    sigset_t sigchld;
+
+    memset(p, 0, sizeof(*p));
+    p->num = num;
+    p->max_tareas = max_tareas;
+    p->funcion = funcion;
+    p->trabajadores = calloc(num, sizeof(struct pool_trabajador));
+    if (p->trabajadores == NULL)
+        return -1;
+    for (int i = 0; i < num; i++) {
+        p->trabajadores[i].pid = -1;
+        p->trabajadores[i].fd_tareas = p->trabajadores[i].fd_resultados = -1;
+    }
+
+    // Escribir en la tubería de un trabajador muerto no debe matar al padre: write()
+    // devuelve EPIPE y el trabajador se reemplaza al recogerlo
+    signal(SIGPIPE, SIG_IGN);
+
+    // SIGCHLD queda bloqueada salvo mientras el padre espera en ppoll(): así no se
+    // pierde ningún aviso entre comprobar pool_hijo_terminado y empezar a esperar
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld, &p->mascara_espera);
+    sigdelset(&p->mascara_espera, SIGCHLD);
+    sa.sa_handler = pool_manejador_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, &p->sigchld_anterior);
+
+    for (int i = 0; i < num; i++) {
+        if (pool_arrancar(p, &p->trabajadores[i]) == -1) {
+            int error = errno;
+            pool_destruir(p);
+            errno = error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+Recoge con waitpid(WNOHANG) a los hijos que han terminado. Si alguno era un trabajador
+en activo, ha muerto: se crea otro en su lugar y su tarea se vuelve a encargar (o se
+da por fallida tras POOL_REINTENTOS intentos).
+*/
+void pool_recoger(struct pool *p) {
+    pid_t pid;
+    int status;
+
+    pool_hijo_terminado = 0;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        struct pool_trabajador *w = NULL;
+        for (int i = 0; i < p->num && w == NULL; i++) {
+            if (p->trabajadores[i].pid == pid)
+                w = &p->trabajadores[i];
+        }
+        if (w == NULL) {
+            p->sin_recoger--; // Un trabajador reciclado
+            continue;
+        }
+
+        if (WIFSIGNALED(status))
+            printf("[POOL]: Trabajador %ld finalizado al recibir la señal %d\n", (long)pid,
+                   WTERMSIG(status));
+        else
+            printf("[POOL]: Trabajador %ld finalizado, status = %d\n", (long)pid,
+                   WEXITSTATUS(status));
+        if (w->tarea != -1) {
+            long t = w->tarea;
+            if (++p->intentos[t] > POOL_REINTENTOS) {
+                p->resultados[t] = POOL_FALLIDA;
+                p->completadas++;
+                p->fallidas++;
+            }
+            else
+                p->reintentar[p->num_reintentar++] = t;
+        }
+        pool_soltar(w);
+        p->reemplazados++;
+        if (pool_arrancar(p, w) == -1)
+            perror("[POOL]: Error al reemplazar un trabajador (se reintentará)");
+    }
+}
+
+/*
+Recicla al trabajador w: lo suelta (su proceso termina solo) y crea otro.
+*/
+void pool_reciclar(struct pool *p, struct pool_trabajador *w) {
+    pool_soltar(w);
+    p->sin_recoger++;
+    p->reciclados++;
+    if (pool_arrancar(p, w) == -1)
+        perror("[POOL]: Error al reciclar un trabajador (se reintentará)");
+}
+
+/*
+Da por fallidas todas las tareas del lote que no ha hecho nadie: las que había que
+repetir y las que no se han encargado todavía. Se usa cuando no queda ningún
+trabajador y no se puede crear ninguno.
+*/
+void pool_abandonar(struct pool *p, long *siguiente, long num) {
+    while (p->num_reintentar > 0) {
+        p->resultados[p->reintentar[--p->num_reintentar]] = POOL_FALLIDA;
+        p->completadas++;
+        p->fallidas++;
+    }
+    for (; *siguiente < num; (*siguiente)++) {
+        p->resultados[*siguiente] = POOL_FALLIDA;
+        p->completadas++;
+        p->fallidas++;
+    }
+}
+
+/*
+Ejecuta un lote de num tareas: resultados[i] = funcion(argumentos[i]). Las tareas se
+reparten entre los trabajadores libres a medida que terminan las anteriores.
+
+Devuelve el número de tareas fallidas (su resultado es POOL_FALLIDA) o -1 en caso de
+error.
+*/
+long pool_ejecutar(struct pool *p, const long *argumentos, long *resultados, long num) {
+    struct pollfd *fds = malloc(p->num * sizeof(struct pollfd));
+    int *quien = malloc(p->num * sizeof(int)); // Trabajador de cada entrada de fds
+    long siguiente = 0;
+
+    p->resultados = resultados;
+    p->intentos = calloc(num, sizeof(int));
+    p->reintentar = malloc(num * sizeof(long));
+    p->num_reintentar = 0;
+    p->completadas = 0;
+    p->fallidas = 0;
+    if (fds == NULL || quien == NULL || p->intentos == NULL || p->reintentar == NULL) {
+        free(fds);
+        free(quien);
+        free(p->intentos);
+        free(p->reintentar);
+        return -1;
+    }
+
+    while (p->completadas < num) {
+        // Al recoger a un trabajador muerto su tarea puede darse por fallida, y puede que
+        // fuera la última: se vuelve a comprobar la condición del bucle
+        if (pool_hijo_terminado) {
+            pool_recoger(p);
+            continue;
+        }
+
+        // Encargamos una tarea a cada trabajador libre: primero las que hay que repetir.
+        // Los que no se pudieron reemplazar o reciclar se vuelven a crear ahora
+        int vivos = 0;
+        for (int i = 0; i < p->num; i++) {
+            struct pool_trabajador *w = &p->trabajadores[i];
+            if (w->pid == -1 && pool_arrancar(p, w) == -1)
+                continue;
+            vivos++;
+            if (w->tarea != -1 || w->fd_resultados == -1)
+                continue;
+            long t;
+            if (p->num_reintentar > 0)
+                t = p->reintentar[--p->num_reintentar];
+            else if (siguiente < num)
+                t = siguiente++;
+            else
+                continue;
+            struct pool_mensaje m = {t, argumentos[t]};
+            if (write(w->fd_tareas, &m, sizeof(m)) != sizeof(m)) {
+                // El trabajador ha muerto: la tarea se encargará a otro y a él se le
+                // reemplazará al recogerlo
+                p->reintentar[p->num_reintentar++] = t;
+                close(w->fd_resultados);
+                w->fd_resultados = -1;
+                continue;
+            }
+            w->tarea = t;
+        }
+        if (vivos == 0) {
+            fprintf(stderr, "[POOL]: No queda ningún trabajador: se abandona el lote\n");
+            pool_abandonar(p, &siguiente, num);
+            break;
+        }
+
+        // Esperamos a que algún trabajador ocupado devuelva su resultado (o a SIGCHLD)
+        int n = 0;
+        for (int i = 0; i < p->num; i++) {
+            if (p->trabajadores[i].tarea != -1 && p->trabajadores[i].fd_resultados != -1) {
+                fds[n].fd = p->trabajadores[i].fd_resultados;
+                fds[n].events = POLLIN;
+                quien[n++] = i;
+            }
+        }
+        if (ppoll(fds, n, NULL, &p->mascara_espera) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("[POOL]: Error en ppoll");
+            break;
+        }
+
+        for (int j = 0; j < n; j++) {
+            struct pool_trabajador *w = &p->trabajadores[quien[j]];
+            struct pool_mensaje m;
+            if (fds[j].revents == 0)
+                continue;
+            if (read(w->fd_resultados, &m, sizeof(m)) != sizeof(m)) {
+                // Fin de fichero: el trabajador ha muerto. Dejamos de vigilarlo y se
+                // reemplaza al llegar SIGCHLD
+                close(w->fd_resultados);
+                w->fd_resultados = -1;
+                continue;
+            }
+            resultados[m.indice] = m.valor;
+            p->completadas++;
+            w->tarea = -1;
+            if (p->max_tareas > 0 && ++w->hechas >= p->max_tareas)
+                pool_reciclar(p, w);
+        }
+    }
+
+    free(fds);
+    free(quien);
+    free(p->intentos);
+    free(p->reintentar);
+    return p->completadas < num ? -1 : p->fallidas;
+}
+
+#endif /* #ifndef POOL_PROCESOS_H_ */
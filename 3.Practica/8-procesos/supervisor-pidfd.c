@@ -0,0 +1,256 @@
+/*
+Supervisión de miles de procesos hijos con pidfd y epoll.
+
+El bucle de esperadehijoswaitpid.c, while ((flag = waitpid(-1, ...)) > 0), se queda
+bloqueado en waitpid() y no puede atender nada más mientras tanto. Un pidfd es un
+descriptor de fichero que representa a un proceso: se vuelve legible cuando el proceso
+termina, así que se puede vigilar con epoll junto a tuberías, temporizadores o
+sockets, y recoger cada hijo con waitid(P_PIDFD, ...) en cuanto termina.
+
+Aquí el supervisor vigila en un mismo epoll:
+- Un pidfd por hijo (pidfd_open() justo después del fork()). No hay carrera con la
+  reutilización del PID: hasta que el padre no lo recoge, el hijo sigue siendo un
+  zombi y su PID no se puede reutilizar. clone3() con CLONE_PIDFD daría el pidfd en
+  la misma llamada, pero glibc no la envuelve y fork() es más seguro en un ejemplo.
+- Una tubería común por la que cada hijo manda su resultado y el instante en que va a
+  terminar.
+- Un timerfd que cada segundo muestra el progreso.
+
+Se lanzan N hijos de vida corta, manteniendo como mucho C vivos a la vez, y se mide el
+retraso de recogida: desde que el hijo termina hasta que el padre lo recoge. Para que
+ese retraso esté acotado, en cada vuelta del bucle solo se lanza un lote limitado de
+hijos nuevos; si no, mientras se crean cientos de procesos nadie recoge los que van
+terminando. El retraso máximo es, más o menos, lo que se tarda en lanzar un lote: pruebe
+con -l 1000 para ver cómo crece.
+
+Uso:
+./supervisor-pidfd [-n hijos] [-c concurrentes] [-l lote] [-s max_us]
+
+Con -s, cada hijo duerme un tiempo aleatorio de hasta max_us microsegundos.
+
+Compilación:
+gcc -O2 -o supervisor-pidfd supervisor-pidfd.c
+*/
+
+#define _GNU_SOURCE // Para pipe2()
+
+#include <errno.h> //Control de errores
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3 // glibc anterior a la 2.36
+#endif
+
+// Etiquetas de los eventos de epoll que no son pidfd (los pidfd llevan el índice del hijo)
+#define EVENTO_TUBERIA -1
+#define EVENTO_TEMPORIZADOR -2
+
+// Mensaje de un hijo por la tubería común (menor que PIPE_BUF, así que se escribe entero)
+struct resultado {
+    long indice;
+    double fin; // Instante en que el hijo va a terminar
+};
+
+double segundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// pidfd_open() por syscall, porque glibc solo la envuelve desde la 2.36
+int pidfd_abrir(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+int comparar(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    long num_hijos = 10000;
+    long max_vivos = 1000;
+    long lote = 8;
+    long max_us = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:c:l:s:")) != -1) {
+        switch (c) {
+        case 'n':
+            num_hijos = atol(optarg);
+            break;
+        case 'c':
+            max_vivos = atol(optarg);
+            break;
+        case 'l':
+            lote = atol(optarg);
+            break;
+        case 's':
+            max_us = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-n hijos] [-c concurrentes] [-l lote] [-s max_us]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_hijos < 1 || max_vivos < 1 || lote < 1 || max_us < 0) {
+        fprintf(stderr, "Los argumentos deben ser positivos\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Cada hijo vivo ocupa un descriptor (su pidfd): subimos el límite al máximo permitido
+    struct rlimit limite;
+    getrlimit(RLIMIT_NOFILE, &limite);
+    limite.rlim_cur = limite.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limite);
+
+    double *fin = malloc(num_hijos * sizeof(double));      // Cuándo terminó cada hijo
+    double *recogida = malloc(num_hijos * sizeof(double)); // Cuándo se recogió
+    int *pidfds = malloc(num_hijos * sizeof(int));
+    if (fin == NULL || recogida == NULL || pidfds == NULL) {
+        perror("Error al reservar memoria");
+        exit(EXIT_FAILURE);
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int tuberia[2];
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || timer_fd == -1 || pipe2(tuberia, O_CLOEXEC) == -1) {
+        perror("Error al preparar epoll");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(tuberia[0], F_SETFL, O_NONBLOCK);
+
+    struct itimerspec cada_segundo = {.it_interval = {1, 0}, .it_value = {1, 0}};
+    timerfd_settime(timer_fd, 0, &cada_segundo, NULL);
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = (uint64_t)EVENTO_TUBERIA};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tuberia[0], &ev);
+    ev.data.u64 = (uint64_t)EVENTO_TEMPORIZADOR;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    long lanzados = 0, recogidos = 0, resultados = 0, vivos = 0, errores = 0;
+    struct epoll_event eventos[256];
+    double inicio = segundos();
+
+    while (recogidos < num_hijos) {
+        // Lanzamos, como mucho, un lote de hijos nuevos por vuelta
+        for (long l = 0; l < lote && vivos < max_vivos && lanzados < num_hijos; l++) {
+            long i = lanzados;
+            pid_t pid = fork();
+            switch (pid) {
+            case -1:
+                perror("No he podido crear el proceso hijo");
+                exit(EXIT_FAILURE);
+            case 0: // Hijo: manda su resultado y termina con i % 256 como estado
+                if (max_us > 0) {
+                    srand(getpid());
+                    usleep(rand() % (max_us + 1));
+                }
+                struct resultado r = {.indice = i, .fin = segundos()};
+                if (write(tuberia[1], &r, sizeof(r)) != sizeof(r))
+                    _exit(EXIT_FAILURE);
+                _exit(i % 256);
+            }
+
+            pidfds[i] = pidfd_abrir(pid);
+            ev.data.u64 = i;
+            if (pidfds[i] == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfds[i], &ev) == -1) {
+                perror("Error al vigilar el pidfd del hijo");
+                exit(EXIT_FAILURE);
+            }
+            lanzados++;
+            vivos++;
+        }
+
+        int n = epoll_wait(epoll_fd, eventos, 256, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("Error en epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        double ahora = segundos();
+
+        for (int e = 0; e < n; e++) {
+            long dato = (long)eventos[e].data.u64;
+
+            if (dato == EVENTO_TUBERIA) {
+                struct resultado r;
+                while (read(tuberia[0], &r, sizeof(r)) == sizeof(r)) {
+                    fin[r.indice] = r.fin;
+                    resultados++;
+                }
+            }
+            else if (dato == EVENTO_TEMPORIZADOR) {
+                uint64_t vencimientos;
+                if (read(timer_fd, &vencimientos, sizeof(vencimientos)) == sizeof(vencimientos))
+                    printf("[%.0f s] %ld lanzados, %ld vivos, %ld recogidos\n", ahora - inicio,
+                           lanzados, vivos, recogidos);
+            }
+            else {
+                // El pidfd es legible: el hijo ha terminado y se recoge sin bloquear
+                siginfo_t info;
+                if (waitid(P_PIDFD, pidfds[dato], &info, WEXITED) == -1) {
+                    perror("Error en waitid");
+                    exit(EXIT_FAILURE);
+                }
+                if (info.si_code != CLD_EXITED || info.si_status != dato % 256)
+                    errores++;
+                recogida[dato] = ahora;
+                // Hay que quitarlo de epoll a mano: los hijos lanzados después heredaron
+                // una copia del pidfd, así que close() no basta para que epoll lo olvide
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfds[dato], NULL);
+                close(pidfds[dato]);
+                recogidos++;
+                vivos--;
+            }
+        }
+    }
+    double total = segundos() - inicio;
+
+    // Los últimos resultados pueden seguir en la tubería: cerramos nuestro extremo de
+    // escritura (ya no quedan hijos que lo tengan) y la leemos hasta el final
+    close(tuberia[1]);
+    fcntl(tuberia[0], F_SETFL, 0);
+    struct resultado r;
+    while (read(tuberia[0], &r, sizeof(r)) == sizeof(r)) {
+        fin[r.indice] = r.fin;
+        resultados++;
+    }
+    if (resultados != num_hijos || errores > 0) {
+        fprintf(stderr, "%ld resultados de %ld hijos, %ld estados incorrectos\n", resultados,
+                num_hijos, errores);
+        exit(EXIT_FAILURE);
+    }
+
+    // Retraso de recogida de cada hijo, de menor a mayor
+    for (long i = 0; i < num_hijos; i++)
+        recogida[i] -= fin[i];
+    qsort(recogida, num_hijos, sizeof(double), comparar);
+    printf("%ld hijos (como mucho %ld vivos, lotes de %ld) en %.3f s, %.0f hijos/s\n",
+           num_hijos, max_vivos, lote, total, num_hijos / total);
+    printf("Retraso de recogida: mediana %.3f ms, p99 %.3f ms, máximo %.3f ms\n",
+           recogida[num_hijos / 2] * 1e3, recogida[num_hijos * 99 / 100] * 1e3,
+           recogida[num_hijos - 1] * 1e3);
+
+    close(tuberia[0]);
+    close(timer_fd);
+    close(epoll_fd);
+    free(fin);
+    free(recogida);
+    free(pidfds);
+    return 0;
+}
@@ -0,0 +1,260 @@
+/*
+Comparación de mecanismos para notificar a otro proceso: señales de tiempo real
+(notificacion-rt.h, recogidas con sigwaitinfo() o con un signalfd), una tubería, un
+eventfd y un futex en memoria compartida.
+
+Para cada mecanismo se crea un hijo y se mide:
+- Latencia: padre e hijo se notifican por turnos (ping-pong); la latencia de una
+  notificación es la mitad de lo que tarda una ida y vuelta.
+- Ritmo: el padre manda N notificaciones seguidas y el hijo las recibe todas; se
+  cuentan notificaciones por segundo.
+
+Las señales de tiempo real y la tubería llevan un dato (aquí, el número de
+notificación) y el receptor comprueba que llegan todas y en orden. El eventfd y el
+futex solo llevan un contador: varias notificaciones seguidas se funden en una
+lectura, así que el receptor se despierta menos veces, pero no recibe datos.
+
+Uso:
+./bench-notificacion [-n notificaciones] [-l idas_y_vueltas]
+
+Compilación:
+gcc -O2 -o bench-notificacion bench-notificacion.c
+*/
+
+#define _GNU_SOURCE // Para sigqueue(), sigwaitinfo() y signalfd() con -std=c99
+
+#include "notificacion-rt.h"
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+
+enum mecanismo { SENAL, SIGNALFD, TUBERIA, EVENTFD, FUTEX, NUM_MECANISMOS };
+
+const char *nombres[NUM_MECANISMOS] = {"sigqueue + sigwaitinfo", "sigqueue + signalfd",
+                                       "pipe", "eventfd", "futex"};
+
+// Sentido de la notificación: del padre al hijo (0) o del hijo al padre (1)
+pid_t destino[2];      // Proceso al que se manda la señal en cada sentido
+int tuberias[2][2];    // Una tubería por sentido
+int eventfds[2];       // Un eventfd por sentido
+atomic_uint *futexes;  // Un contador por sentido, en memoria compartida con el hijo
+int signal_fd = -1;    // signalfd de cada proceso (se crea tras el fork)
+
+double segundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+_Noreturn void error(const char *mensaje) {
+    perror(mensaje);
+    exit(EXIT_FAILURE);
+}
+
+// El futex es compartido entre procesos: no se puede usar FUTEX_PRIVATE_FLAG
+long futex(atomic_uint *direccion, int operacion, unsigned valor) {
+    return syscall(SYS_futex, direccion, operacion, valor, NULL, NULL, 0);
+}
+
+/*
+Manda la notificación número valor en el sentido s.
+*/
+void notificar(enum mecanismo m, int s, int valor) {
+    uint64_t uno = 1;
+
+    switch (m) {
+    case SENAL:
+    case SIGNALFD:
+        if (notif_enviar_entero(destino[s], SIGRTMIN, valor) == -1)
+            error("Error en sigqueue");
+        break;
+    case TUBERIA:
+        if (write(tuberias[s][1], &valor, sizeof(valor)) != sizeof(valor))
+            error("Error al escribir en la tubería");
+        break;
+    case EVENTFD:
+        if (write(eventfds[s], &uno, sizeof(uno)) != sizeof(uno))
+            error("Error al escribir en el eventfd");
+        break;
+    case FUTEX:
+        atomic_fetch_add(&futexes[s], 1);
+        futex(&futexes[s], FUTEX_WAKE, 1);
+        break;
+    default:
+        break;
+    }
+}
+
+// Comprueba que el dato recibido es el siguiente que se esperaba
+void comprobar(int recibido, unsigned *siguiente) {
+    if (recibido != (int)*siguiente) {
+        fprintf(stderr, "Notificación fuera de orden: llega %d y se esperaba %u\n", recibido,
+                *siguiente);
+        exit(EXIT_FAILURE);
+    }
+    (*siguiente)++;
+}
+
+/*
+Espera a que llegue al menos una notificación en el sentido s y recoge todas las que
+pueda en una llamada. siguiente es el número de la próxima notificación esperada y
+se avanza con las recibidas.
+*/
+void esperar(enum mecanismo m, int s, unsigned *siguiente) {
+    siginfo_t info;
+    struct signalfd_siginfo infos[64];
+    int valores[1024];
+    uint64_t cuenta;
+    unsigned visto;
+    ssize_t n;
+
+    switch (m) {
+    case SENAL:
+        if (notif_esperar(SIGRTMIN, &info) == -1)
+            error("Error en sigwaitinfo");
+        comprobar(info.si_value.sival_int, siguiente);
+        break;
+    case SIGNALFD:
+        if ((n = notif_leer_fd(signal_fd, infos, 64)) == -1)
+            error("Error al leer el signalfd");
+        for (int i = 0; i < n; i++)
+            comprobar(infos[i].ssi_int, siguiente);
+        break;
+    case TUBERIA:
+        // Cada int se escribe de una vez (write de menos de PIPE_BUF bytes es atómico) y
+        // se piden múltiplos de un int, así que la lectura nunca corta uno por la mitad
+        n = read(tuberias[s][0], valores, sizeof(valores));
+        if (n <= 0)
+            error("Error al leer de la tubería");
+        for (size_t i = 0; i < n / sizeof(int); i++)
+            comprobar(valores[i], siguiente);
+        break;
+    case EVENTFD:
+        if (read(eventfds[s], &cuenta, sizeof(cuenta)) != sizeof(cuenta))
+            error("Error al leer del eventfd");
+        *siguiente += cuenta;
+        break;
+    case FUTEX:
+        // Si el contador no ha cambiado, dormimos; FUTEX_WAIT vuelve enseguida si ya
+        // no vale lo que vimos (llegó una notificación entre la lectura y la llamada)
+        while ((visto = atomic_load(&futexes[s])) == *siguiente)
+            futex(&futexes[s], FUTEX_WAIT, visto);
+        *siguiente = visto;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+Mide el mecanismo m: latencia con idas_y_vueltas ping-pongs y ritmo con num
+notificaciones.
+*/
+void medir(enum mecanismo m, int idas_y_vueltas, int num) {
+    unsigned siguiente = 0;
+    pid_t hijo;
+    int status;
+
+    for (int s = 0; s < 2; s++) {
+        if (pipe(tuberias[s]) == -1 || (eventfds[s] = eventfd(0, 0)) == -1)
+            error("Error al crear la tubería o el eventfd");
+        atomic_store(&futexes[s], 0);
+    }
+    destino[1] = getpid();
+
+    switch (hijo = fork()) {
+    case -1:
+        error("No he podido crear el proceso hijo");
+    case 0: // Hijo: contesta a cada ping y luego recibe la ráfaga
+        if (m == SIGNALFD && (signal_fd = notif_abrir_fd(SIGRTMIN)) == -1)
+            error("Error al crear el signalfd");
+        for (int i = 0; i < idas_y_vueltas; i++) {
+            esperar(m, 0, &siguiente);
+            notificar(m, 1, i);
+        }
+        while (siguiente < (unsigned)(idas_y_vueltas + num))
+            esperar(m, 0, &siguiente);
+        notificar(m, 1, idas_y_vueltas); // Confirmación de que han llegado todas
+        _exit(EXIT_SUCCESS);
+    }
+    destino[0] = hijo;
+    if (m == SIGNALFD && (signal_fd = notif_abrir_fd(SIGRTMIN)) == -1)
+        error("Error al crear el signalfd");
+
+    double inicio = segundos();
+    for (int i = 0; i < idas_y_vueltas; i++) {
+        notificar(m, 0, i);
+        esperar(m, 1, &siguiente);
+    }
+    double latencia = (segundos() - inicio) / idas_y_vueltas / 2;
+
+    inicio = segundos();
+    for (int i = 0; i < num; i++)
+        notificar(m, 0, idas_y_vueltas + i);
+    esperar(m, 1, &siguiente);
+    double ritmo = num / (segundos() - inicio);
+
+    waitpid(hijo, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "El hijo de %s ha fallado\n", nombres[m]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%-24s %12.2f %16.0f\n", nombres[m], latencia * 1e6, ritmo);
+
+    for (int s = 0; s < 2; s++) {
+        close(tuberias[s][0]);
+        close(tuberias[s][1]);
+        close(eventfds[s]);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+}
+
+int main(int argc, char **argv) {
+    int num = 200000;
+    int idas_y_vueltas = 50000;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:l:")) != -1) {
+        switch (c) {
+        case 'n':
+            num = atoi(optarg);
+            break;
+        case 'l':
+            idas_y_vueltas = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-n notificaciones] [-l idas_y_vueltas]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num < 1 || idas_y_vueltas < 1) {
+        fprintf(stderr, "Los argumentos deben ser positivos\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // SIGRTMIN queda bloqueada en el padre y en los hijos: solo se recoge cuando se espera
+    if (notif_bloquear(SIGRTMIN) == -1)
+        error("Error al bloquear la señal");
+    futexes = mmap(NULL, 2 * sizeof(atomic_uint), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (futexes == MAP_FAILED)
+        error("Error en mmap");
+
+    printf("%-24s %12s %16s\n", "Mecanismo", "Latencia(us)", "Notificaciones/s");
+    for (int m = 0; m < NUM_MECANISMOS; m++)
+        medir(m, idas_y_vueltas, num);
+
+    munmap(futexes, 2 * sizeof(atomic_uint));
+    return 0;
+}
@@ -0,0 +1,368 @@
+/*
+Divisiones enteras por lotes, aisladas de los fallos.
+
+ejemplo-signal-division.c captura SIGFPE y termina: un solo divisor malo acaba con
+todo. Aquí se leen millones de parejas dividendo/divisor de un fichero y se calculan
+todas; las que no se pueden calcular se marcan, cada una con su índice, sin abortar:
+- División por cero.
+- Desbordamiento: INT_MIN / -1 no cabe en un int (en x86 también lanza SIGFPE).
+
+Se comparan tres formas de hacerlo, con elementos por segundo:
+- trap: se divide sin mirar nada y cada fallo lanza SIGFPE; el manejador vuelve con
+  siglongjmp() al bucle, que apunta el índice y sigue con el siguiente elemento.
+- escalar: se comprueba cada pareja antes de dividir.
+- AVX2: se dividen 8 parejas a la vez. Los casos malos se detectan antes, comparando
+  los 8 divisores (y dividendos) a la vez y obteniendo una máscara de lanes; en esas
+  lanes se divide entre 1 y el resultado se descarta. x86 no tiene división entera
+  vectorial, así que se divide en double: un int cabe exacto en un double y el
+  cociente truncado es el de la división entera. Esta versión no puede fallar, pero se
+  ejecuta por bloques protegidos con sigsetjmp(): si aun así llegase una señal
+  inesperada (SIGFPE, SIGSEGV, SIGBUS), el bloque se repite elemento a elemento con el
+  método trap, que marca el elemento culpable.
+
+Uso:
+./division-lotes [-g parejas] [-p por_mil] [-e fichero_errores] fichero
+
+Con -g se genera antes el fichero con parejas aleatorias, de las que por_mil de cada
+mil son malas (por defecto 1). Con -e se escriben en un fichero todos los elementos
+que no se han podido calcular; si no, solo se muestran los primeros.
+
+Compilación:
+gcc -O2 -o division-lotes division-lotes.c
+*/
+
+#include <immintrin.h> // Intrínsecos de AVX2
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h> /* Manejo de señales */
+#include <stdint.h>
+#include <stdio.h>  /* Entrada salida */
+#include <stdlib.h> /* Utilidades generales */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Estado de cada elemento
+#define OK 0
+#define DIV_CERO 1
+#define DESBORDAMIENTO 2
+#define FALLO 3 // Señal inesperada
+
+// Elementos por bloque protegido con sigsetjmp() en la versión AVX2
+#define BLOQUE 4096
+
+const char *motivos[] = {"ok", "división por cero", "desbordamiento", "fallo inesperado"};
+
+// Métodos que se comparan
+enum metodo { TRAP, ESCALAR, AVX2, NUM_METODOS };
+
+const char *metodos[NUM_METODOS] = {"trap", "escalar", "AVX2"};
+
+sigjmp_buf entorno;        // Adonde vuelve el manejador
+volatile long i_trap;      // Elemento que se está calculando en el método trap
+
+double segundos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void mi_manejador_fallo(int signal) {
+    (void)signal;
+    siglongjmp(entorno, 1);
+}
+
+// Motivo por el que una pareja no se puede calcular (u OK)
+int clasificar(int dividendo, int divisor) {
+    if (divisor == 0)
+        return DIV_CERO;
+    if (dividendo == INT_MIN && divisor == -1)
+        return DESBORDAMIENTO;
+    return OK;
+}
+
+/*
+Método trap: divide los elementos [desde, hasta) sin comprobar nada. Cada SIGFPE (o
+cualquier otra señal capturada) vuelve aquí con siglongjmp(); se marca el elemento y
+se sigue con el siguiente. sigsetjmp() guarda la máscara de señales (segundo
+argumento 1), para que al volver del manejador SIGFPE no quede bloqueada.
+*/
+void dividir_trap(const int *a, const int *b, int *c, uint8_t *estado, long desde, long hasta) {
+    i_trap = desde;
+    if (sigsetjmp(entorno, 1) != 0) {
+        int motivo = clasificar(a[i_trap], b[i_trap]);
+        estado[i_trap] = motivo != OK ? motivo : FALLO;
+        c[i_trap] = 0;
+        i_trap++;
+    }
+    for (; i_trap < hasta; i_trap++) {
+        c[i_trap] = a[i_trap] / b[i_trap];
+        estado[i_trap] = OK;
+    }
+}
+
+// Método escalar: se comprueba cada pareja antes de dividir
+void dividir_escalar(const int *a, const int *b, int *c, uint8_t *estado, long desde,
+                     long hasta) {
+    for (long i = desde; i < hasta; i++) {
+        estado[i] = clasificar(a[i], b[i]);
+        c[i] = estado[i] == OK ? a[i] / b[i] : 0;
+    }
+}
+
+/*
+Divide 8 parejas con AVX2. Las lanes malas se detectan con comparaciones antes de
+dividir y se marcan en estado.
+*/
+__attribute__((target("avx2"))) void dividir_8(const int *a, const int *b, int *c,
+                                                uint8_t *estado) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)a);
+    __m256i vb = _mm256_loadu_si256((const __m256i *)b);
+
+    // Máscaras de lanes malas (todo unos en la lane si se cumple)
+    __m256i cero = _mm256_cmpeq_epi32(vb, _mm256_setzero_si256());
+    __m256i desborda = _mm256_and_si256(_mm256_cmpeq_epi32(va, _mm256_set1_epi32(INT_MIN)),
+                                        _mm256_cmpeq_epi32(vb, _mm256_set1_epi32(-1)));
+    __m256i malas = _mm256_or_si256(cero, desborda);
+
+    // En las lanes malas se divide entre 1
+    vb = _mm256_blendv_epi8(vb, _mm256_set1_epi32(1), malas);
+
+    // Cuatro lanes por cada división en double
+    __m256d a_bajo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(va));
+    __m256d a_alto = _mm256_cvtepi32_pd(_mm256_extracti128_si256(va, 1));
+    __m256d b_bajo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(vb));
+    __m256d b_alto = _mm256_cvtepi32_pd(_mm256_extracti128_si256(vb, 1));
+    __m128i c_bajo = _mm256_cvttpd_epi32(_mm256_div_pd(a_bajo, b_bajo));
+    __m128i c_alto = _mm256_cvttpd_epi32(_mm256_div_pd(a_alto, b_alto));
+    __m256i vc = _mm256_andnot_si256(malas, _mm256_set_m128i(c_alto, c_bajo));
+    _mm256_storeu_si256((__m256i *)c, vc);
+
+    // Un bit por lane mala; casi siempre es 0 y no hay nada más que hacer
+    int bits_malas = _mm256_movemask_ps(_mm256_castsi256_ps(malas));
+    int bits_cero = _mm256_movemask_ps(_mm256_castsi256_ps(cero));
+    memset(estado, OK, 8);
+    while (bits_malas != 0) {
+        int lane = __builtin_ctz(bits_malas);
+        estado[lane] = bits_cero & (1 << lane) ? DIV_CERO : DESBORDAMIENTO;
+        bits_malas &= bits_malas - 1;
+    }
+}
+
+/*
+Método AVX2, por bloques de BLOQUE elementos protegidos con sigsetjmp(). Si un bloque
+recibe una señal, se repite con el método trap, que aísla el elemento que falla.
+Devuelve el número de bloques que se han tenido que repetir.
+*/
+long dividir_avx2(const int *a, const int *b, int *c, uint8_t *estado, long num) {
+    volatile long repetidos = 0;
+
+    for (volatile long desde = 0; desde < num; desde += BLOQUE) {
+        long hasta = desde + BLOQUE < num ? desde + BLOQUE : num;
+
+        if (sigsetjmp(entorno, 1) != 0) {
+            repetidos++;
+            dividir_trap(a, b, c, estado, desde, hasta);
+            continue;
+        }
+        long i = desde;
+        for (; i + 8 <= hasta; i += 8)
+            dividir_8(a + i, b + i, c + i, estado + i);
+        dividir_escalar(a, b, c, estado, i, hasta);
+    }
+    return repetidos;
+}
+
+// Genera un fichero con num parejas aleatorias, por_mil de cada mil malas
+void generar(const char *nombre, long num, int por_mil) {
+    FILE *f = fopen(nombre, "w");
+    if (f == NULL) {
+        perror("Error al crear el fichero");
+        exit(EXIT_FAILURE);
+    }
+    srand(time(NULL));
+    for (long i = 0; i < num; i++) {
+        if (rand() % 1000 < por_mil) {
+            if (rand() % 2)
+                fprintf(f, "%d 0\n", rand() - RAND_MAX / 2);
+            else
+                fprintf(f, "%d -1\n", INT_MIN);
+        }
+        else {
+            int divisor = rand() % 2001 - 1000;
+            fprintf(f, "%d %d\n", rand() - RAND_MAX / 2, divisor != 0 ? divisor : 7);
+        }
+    }
+    fclose(f);
+}
+
+/*
+Lee las parejas del fichero, una por línea (las líneas vacías se saltan). Devuelve el
+número de parejas. Si una línea no es una pareja de enteros, termina indicando cuál:
+seguir con las anteriores daría resultados de un fichero que no es el pedido.
+*/
+long leer(const char *nombre, int **a, int **b) {
+    long num = 0, capacidad = 1 << 20, linea = 0;
+    char *texto = NULL;
+    size_t tam_texto = 0;
+    int x, y, fin;
+    FILE *f = fopen(nombre, "r");
+
+    if (f == NULL) {
+        perror("Error al abrir el fichero");
+        exit(EXIT_FAILURE);
+    }
+    *a = malloc(capacidad * sizeof(int));
+    *b = malloc(capacidad * sizeof(int));
+    while (*a != NULL && *b != NULL && getline(&texto, &tam_texto, f) != -1) {
+        linea++;
+        if (texto[strspn(texto, " \t\r\n")] == '\0')
+            continue;
+        if (sscanf(texto, "%d %d %n", &x, &y, &fin) != 2 || texto[fin] != '\0') {
+            fprintf(stderr, "%s: línea %ld mal formada: %s", nombre, linea, texto);
+            exit(EXIT_FAILURE);
+        }
+        if (num == capacidad) {
+            capacidad *= 2;
+            *a = realloc(*a, capacidad * sizeof(int));
+            *b = realloc(*b, capacidad * sizeof(int));
+            if (*a == NULL || *b == NULL)
+                break;
+        }
+        (*a)[num] = x;
+        (*b)[num] = y;
+        num++;
+    }
+    if (*a == NULL || *b == NULL) {
+        perror("Error al reservar memoria");
+        exit(EXIT_FAILURE);
+    }
+    if (ferror(f)) {
+        perror("Error al leer el fichero");
+        exit(EXIT_FAILURE);
+    }
+    free(texto);
+    fclose(f);
+    return num;
+}
+
+int main(int argc, char **argv) {
+    long generadas = 0;
+    int por_mil = 1;
+    char *fichero_errores = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "g:p:e:")) != -1) {
+        switch (c) {
+        case 'g':
+            generadas = atol(optarg);
+            break;
+        case 'p':
+            por_mil = atoi(optarg);
+            break;
+        case 'e':
+            fichero_errores = optarg;
+            break;
+        default:
+            fprintf(stderr, "Uso: %s [-g parejas] [-p por_mil] [-e fichero_errores] fichero\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Uso: %s [-g parejas] [-p por_mil] [-e fichero_errores] fichero\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (generadas > 0)
+        generar(argv[optind], generadas, por_mil);
+    int *a, *b;
+    long num = leer(argv[optind], &a, &b);
+
+    // Cada método escribe en sus propios buffers, para poder comparar los tres
+    int *cocientes[NUM_METODOS];
+    uint8_t *estados[NUM_METODOS];
+    for (int m = 0; m < NUM_METODOS; m++) {
+        cocientes[m] = malloc(num * sizeof(int) + 1);
+        estados[m] = malloc(num + 1);
+        if (cocientes[m] == NULL || estados[m] == NULL) {
+            perror("Error al reservar memoria");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Las señales que indican un fallo al calcular vuelven al bucle con siglongjmp()
+    struct sigaction accion = {.sa_handler = mi_manejador_fallo};
+    sigemptyset(&accion.sa_mask);
+    if (sigaction(SIGFPE, &accion, NULL) == -1 || sigaction(SIGSEGV, &accion, NULL) == -1 ||
+        sigaction(SIGBUS, &accion, NULL) == -1) {
+        perror("No puedo asociar las señales al manejador");
+        exit(EXIT_FAILURE);
+    }
+
+    double inicio = segundos();
+    dividir_trap(a, b, cocientes[TRAP], estados[TRAP], 0, num);
+    double t_trap = segundos() - inicio;
+
+    inicio = segundos();
+    dividir_escalar(a, b, cocientes[ESCALAR], estados[ESCALAR], 0, num);
+    double t_escalar = segundos() - inicio;
+
+    long repetidos = 0;
+    double t_avx2 = 0;
+    int hay_avx2 = __builtin_cpu_supports("avx2");
+    if (hay_avx2) {
+        inicio = segundos();
+        repetidos = dividir_avx2(a, b, cocientes[AVX2], estados[AVX2], num);
+        t_avx2 = segundos() - inicio;
+    }
+
+    // Los tres métodos tienen que dar lo mismo que trap
+    for (int m = ESCALAR; m < (hay_avx2 ? NUM_METODOS : AVX2); m++) {
+        if (memcmp(cocientes[m], cocientes[TRAP], num * sizeof(int)) != 0 ||
+            memcmp(estados[m], estados[TRAP], num) != 0) {
+            fprintf(stderr, "El método %s no da el mismo resultado que trap\n", metodos[m]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint8_t *estado = estados[TRAP];
+
+    // Elementos que no se han podido calcular, con su índice
+    long malos[4] = {0};
+    FILE *errores = NULL;
+    if (fichero_errores != NULL && (errores = fopen(fichero_errores, "w")) == NULL) {
+        perror("Error al crear el fichero de errores");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < num; i++) {
+        if (estado[i] == OK)
+            continue;
+        if (errores != NULL)
+            fprintf(errores, "%ld %d %d %s\n", i, a[i], b[i], motivos[estado[i]]);
+        else if (malos[DIV_CERO] + malos[DESBORDAMIENTO] + malos[FALLO] < 10)
+            printf("Elemento %ld: %d / %d, %s\n", i, a[i], b[i], motivos[estado[i]]);
+        malos[estado[i]]++;
+    }
+    if (errores != NULL)
+        fclose(errores);
+
+    printf("%ld elementos: %ld divisiones por cero, %ld desbordamientos, %ld fallos "
+           "inesperados\n",
+           num, malos[DIV_CERO], malos[DESBORDAMIENTO], malos[FALLO]);
+    printf("trap:    %.3f s, %.0f elementos/s\n", t_trap, num / t_trap);
+    printf("escalar: %.3f s, %.0f elementos/s\n", t_escalar, num / t_escalar);
+    if (hay_avx2)
+        printf("AVX2:    %.3f s, %.0f elementos/s (%ld bloques repetidos)\n", t_avx2,
+               num / t_avx2, repetidos);
+    else
+        printf("AVX2:    no disponible en esta CPU\n");
+
+    free(a);
+    free(b);
+    for (int m = 0; m < NUM_METODOS; m++) {
+        free(cocientes[m]);
+        free(estados[m]);
+    }
+    exit(0);
+}
@@ -0,0 +1,113 @@
+/*
+Canal de notificaciones con señales de tiempo real.
+
+Las señales estándar que usa ejemplo-signal.c no llevan datos y no se encolan: si
+llegan cinco SIGUSR1 mientras la señal está bloqueada, se entrega una sola. Las de
+tiempo real (SIGRTMIN ... SIGRTMAX) enviadas con sigqueue():
+- Se encolan: llegan todas, una por envío (hasta el límite RLIMIT_SIGPENDING).
+- Llevan un dato, un union sigval con un entero (sival_int) o un puntero (sival_ptr).
+  Un puntero solo tiene sentido si apunta a memoria que el receptor ve en la misma
+  dirección: el mismo proceso (entre hilos), datos que ya existían antes del fork() o
+  una proyección compartida hecha antes del fork().
+- Se entregan en el orden en que se enviaron (y, entre distintas señales de tiempo
+  real, primero la de número menor).
+
+El receptor bloquea la señal para que no se entregue de forma asíncrona a un
+manejador y la recoge cuando quiere, con sigwaitinfo() o leyendo un signalfd (que
+además se puede vigilar con poll/epoll junto a otros descriptores).
+
+Uso:
+    notif_bloquear(SIGRTMIN);          // En el receptor, antes de crear hilos o hijos
+    notif_enviar_entero(pid, SIGRTMIN, 42);
+    notif_esperar(SIGRTMIN, &info);    // info.si_value.sival_int == 42
+
+sigqueue(), sigwaitinfo() y signalfd() no se declaran con -std=c99 si no se pide: el
+programa debe definir _GNU_SOURCE antes de su primer #include (definirlo aquí no
+sirve si antes se ha incluido otra cabecera del sistema).
+*/
+
+#ifndef NOTIFICACION_RT_H_
+#define NOTIFICACION_RT_H_
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+Bloquea la señal en el hilo que llama (y en los hilos e hijos que cree después) para
+que quede pendiente hasta que se recoja. Devuelve -1 si falla.
+*/
+int notif_bloquear(int senal) {
+    sigset_t mascara;
+    sigemptyset(&mascara);
+    sigaddset(&mascara, senal);
+    return sigprocmask(SIG_BLOCK, &mascara, NULL);
+}
+
+/*
+Envía la señal con su dato al proceso pid. Si la cola de señales pendientes del
+receptor está llena (EAGAIN), espera a que la vacíe y lo reintenta, para no perder
+ninguna notificación. Devuelve -1 si falla por otro motivo.
+*/
+int notif_enviar(pid_t pid, int senal, union sigval valor) {
+    while (sigqueue(pid, senal, valor) == -1) {
+        if (errno != EAGAIN)
+            return -1;
+        sched_yield();
+    }
+    return 0;
+}
+
+int notif_enviar_entero(pid_t pid, int senal, int entero) {
+    union sigval valor = {.sival_int = entero};
+    return notif_enviar(pid, senal, valor);
+}
+
+int notif_enviar_puntero(pid_t pid, int senal, void *puntero) {
+    union sigval valor = {.sival_ptr = puntero};
+    return notif_enviar(pid, senal, valor);
+}
+
+/*
+Espera a que llegue la señal (que debe estar bloqueada) y deja en info quién la mandó
+(si_pid) y su dato (si_value). Devuelve -1 si falla.
+*/
+int notif_esperar(int senal, siginfo_t *info) {
+    sigset_t mascara;
+    sigemptyset(&mascara);
+    sigaddset(&mascara, senal);
+    while (sigwaitinfo(&mascara, info) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+Crea un signalfd para la señal (que debe estar bloqueada). Cada lectura devuelve uno o
+varios struct signalfd_siginfo, con el dato en ssi_int o ssi_ptr.
+*/
+int notif_abrir_fd(int senal) {
+    sigset_t mascara;
+    sigemptyset(&mascara);
+    sigaddset(&mascara, senal);
+    return signalfd(-1, &mascara, SFD_CLOEXEC);
+}
+
+/*
+Lee del signalfd las notificaciones pendientes, hasta max (bloquea si no hay ninguna).
+Devuelve cuántas ha leído o -1 si falla.
+*/
+int notif_leer_fd(int fd, struct signalfd_siginfo *infos, int max) {
+    ssize_t n;
+    while ((n = read(fd, infos, max * sizeof(struct signalfd_siginfo))) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return n / sizeof(struct signalfd_siginfo);
+}
+
+#endif /* #ifndef NOTIFICACION_RT_H_ */
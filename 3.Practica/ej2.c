@@ -11,6 +11,9 @@
  * - Creación de procesos con fork()
  * - Generación de números aleatorios
  * - Sincronización entre procesos padre e hijo
+ * - Contabilidad de los recursos usados por el hijo con wait4() (8-procesos/contabilidad-hijos.h)
+ *
+ * Uso: ./ej2 [-j]   (con -j, el informe de recursos del hijo se muestra en JSON)
  */
 
 #include <errno.h>    // Para códigos de error (errno) y funciones relacionadas
@@ -21,14 +24,22 @@
 #include <time.h>     // Para time(), usado para inicializar la semilla aleatoria
 #include <unistd.h>   // Para funciones POSIX como pipe(), fork(), read(), write()
 
-int main() {
+#include "8-procesos/contabilidad-hijos.h" // Para recoger al hijo anotando sus recursos (wait4)
+
+int main(int argc, char **argv) {
     pid_t flag;            // Almacena el PID del proceso hijo retornado por wait()
+    pid_t hijo;            // PID del proceso hijo retornado por fork()
     int status;            // Almacena el estado de salida del proceso hijo
     int fildes[2];         // Array para los descriptores de la tubería [0]=lectura, [1]=escritura
     const int BSIZE = 100; // Tamaño del buffer para la comunicación
     char buf[BSIZE];       // Buffer para almacenar los datos a transmitir
     ssize_t nbytes;        // Número de bytes leídos de la tubería
     float num1, num2, sum; // Variables para los números aleatorios y su suma
+    struct contabilidad c; // Recursos usados por el hijo
+
+    // Formato del informe de recursos: texto o JSON (-j)
+    int formato = argc > 1 && strcmp(argv[1], "-j") == 0 ? CONTABILIDAD_JSON : CONTABILIDAD_TEXTO;
+    contabilidad_iniciar(&c);
 
     // Inicializamos la semilla para la generación de números aleatorios
     // Esto garantiza que obtengamos números diferentes en cada ejecución
@@ -50,7 +61,10 @@ int main() {
     // - -1 en caso de error
     // - 0 en el proceso hijo
     // - PID del hijo en el proceso padre
-    switch (fork()) {
+    // El tiempo de vida del hijo se mide desde justo antes del fork(): el hijo puede
+    // ejecutarse antes de que el padre vuelva de la llamada
+    double inicio = contabilidad_ahora();
+    switch (hijo = fork()) {
     case -1: // Error al crear el proceso hijo
         perror("No se ha podido crear el proceso hijo...");
         exit(EXIT_FAILURE);
@@ -98,6 +112,9 @@ int main() {
         exit(EXIT_SUCCESS);
 
     default: // Código ejecutado por el proceso padre
+        // Registramos al hijo antes de cualquier E/S
+        contabilidad_registrar(&c, hijo, inicio);
+
         // El padre solo necesita escribir en la tubería, así que cerramos el extremo de lectura
         if (close(fildes[0]) == -1) {
             perror("Error en close");
@@ -140,9 +157,10 @@ int main() {
         }
 
         // Esperamos a que el proceso hijo termine
-        // wait() bloquea al proceso padre hasta que un hijo termine
+        // contabilidad_esperar() bloquea al proceso padre hasta que un hijo termine, como
+        // waitpid(), y con wait4() anota además los recursos que ha usado
         // Recorremos todos los hijos (en este caso solo hay uno)
-        while ((flag = wait(&status)) > 0) {
+        while ((flag = contabilidad_esperar(&c, -1, &status, 0)) > 0) {
             if (WIFEXITED(status)) {
                 // WIFEXITED comprueba si el hijo terminó normalmente (con exit)
                 // WEXITSTATUS obtiene el código de salida del hijo
@@ -163,6 +181,9 @@ int main() {
             printf("Proceso Padre %d, no hay mas hijos que esperar. Valor de errno = %d, definido "
                    "como: %s\n",
                    getpid(), errno, strerror(errno));
+            // Informe de recursos por hijo y total
+            contabilidad_informe(&c, stdout, formato);
+            contabilidad_liberar(&c);
         }
         else {
             // Cualquier otro error en wait()
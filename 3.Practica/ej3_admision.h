@@ -0,0 +1,81 @@
+/**
+ * Ejercicio 3: Control de admisión del servidor de colas
+ *
+ * Si llegan más peticiones de las que el servidor puede atender, las colas y los
+ * carriles se llenan y cada petición nueva espera detrás de todas las anteriores:
+ * la latencia crece sin límite, aunque el cliente ya no quiera la respuesta. Con
+ * las opciones -Q y -L, cada partición estima cuánto esperaría una petición nueva
+ * (mensajes en los carriles por el tiempo medio de servicio) y, si pasa de los
+ * umbrales, la rechaza en el momento de sacarla de la cola con una respuesta de
+ * ocupado (ver proto_ocupado()), sin calcular nada. Así la espera de las peticiones
+ * admitidas queda acotada y el cliente sabe enseguida que debe reintentar más
+ * tarde.
+ *
+ * Las peticiones del carril masivo se rechazan con la mitad de los umbrales, de
+ * modo que con sobrecarga se descartan antes que las interactivas. Los mensajes de
+ * control y los que no se pueden rechazar sin consecuencias (ver
+ * proto_rechazable()) se admiten siempre.
+ */
+
+#ifndef EJ3_ADMISION_H
+#define EJ3_ADMISION_H
+
+#include "ej3_carriles.h"
+#include "ej3_common.h"
+
+/**
+ * Umbrales de rechazo (0 = sin límite)
+ *
+ * - admision_max_pendientes: Mensajes en los carriles (-Q)
+ * - admision_max_espera_ns: Espera estimada de una petición nueva (-L)
+ */
+int admision_max_pendientes = 0;
+uint64_t admision_max_espera_ns = 0;
+
+/**
+ * Estructura: admision
+ *
+ * Estado del control de admisión de una partición.
+ */
+struct admision {
+    uint64_t servicio_ns; // Media móvil del tiempo de servicio
+    uint64_t rechazadas;  // Peticiones rechazadas en la racha de saturación actual
+    int saturada;         // La última petición se rechazó
+};
+
+/**
+ * Función: admision_anotar
+ *
+ * Incorpora un tiempo de servicio a la media móvil (exponencial, con peso 1/8 para
+ * la muestra nueva, como la estimación del RTT de TCP).
+ */
+void admision_anotar(struct admision *a, uint64_t servicio_ns) {
+    if (a->servicio_ns == 0) {
+        a->servicio_ns = servicio_ns;
+    }
+    else {
+        a->servicio_ns = a->servicio_ns - a->servicio_ns / 8 + servicio_ns / 8;
+    }
+}
+
+/**
+ * Función: admision_rechazar
+ *
+ * Decide si hay que rechazar una petición del carril indicado cuando hay
+ * "pendientes" mensajes en los carriles.
+ *
+ * Retorno:
+ *   - 1 si hay que rechazarla, 0 si se admite
+ */
+int admision_rechazar(const struct admision *a, int carril, int pendientes) {
+    uint64_t n = (uint64_t)pendientes * (carril == CARRIL_MASIVO ? 2 : 1);
+    if (carril == CARRIL_CONTROL) {
+        return 0;
+    }
+    if (admision_max_pendientes > 0 && n >= (uint64_t)admision_max_pendientes) {
+        return 1;
+    }
+    return admision_max_espera_ns > 0 && n * a->servicio_ns > admision_max_espera_ns;
+}
+
+#endif /* EJ3_ADMISION_H */
@@ -0,0 +1,290 @@
+/**
+ * Ejercicio 3: Arena de memoria compartida para los datos de las peticiones
+ *
+ * Con una cola de mensajes, el texto de una petición se copia dos veces (del
+ * cliente al núcleo y del núcleo al servidor) y no puede pasar de mq_msgsize. Con
+ * la opción -G, el servidor crea además una arena en memoria compartida (shm_open
+ * + mmap) dividida en slots de tamaño fijo. El cliente toma un slot libre, escribe
+ * en él el texto y envía por la cola sólo un descriptor (slot, generación, offset
+ * y longitud, ver ej3_protocolo.h): la cola sigue siendo el canal de aviso, pero
+ * los datos no pasan por el núcleo. El servidor calcula las estadísticas sobre el
+ * propio slot y lo devuelve a la lista de libres.
+ *
+ * Los slots libres forman una pila de Treiber sin cerrojos compartida por todos los
+ * procesos: la cima es un entero de 64 bits con el slot (más uno; 0 = pila vacía)
+ * en la parte baja y una etiqueta en la alta que aumenta en cada cambio. Sin la
+ * etiqueta, un proceso que leyó la cima A y su siguiente B podría, tras sacar otro
+ * proceso A y B y devolver A, instalar B como cima aunque ya esté ocupado (ABA).
+ *
+ * Cada slot tiene además un número de generación que el servidor aumenta al
+ * liberarlo; un descriptor con una generación antigua (de un slot ya liberado y
+ * quizá reutilizado) se rechaza en lugar de leer datos de otra petición.
+ */
+
+#ifndef EJ3_ARENA_H
+#define EJ3_ARENA_H
+
+#include "ej3_common.h"
+
+#include <fcntl.h>     // Para O_CREAT, O_RDWR...
+#include <stdatomic.h> // Para la pila de slots libres
+#include <sys/mman.h>  // Para shm_open() y mmap()
+
+/**
+ * Nombre base de la arena (se le añade el usuario con get_queue_name())
+ */
+#define ARENA_SHM "/ej3_arena"
+
+/**
+ * Número mágico y versión del formato
+ */
+#define ARENA_MAGIC 0x41334a45 // "EJ3A" en little endian
+#define ARENA_VERSION 1
+
+/**
+ * Tamaño por defecto de cada slot (opción -Z del servidor)
+ */
+#define ARENA_TAM_SLOT (1024L * 1024)
+
+/**
+ * Estructura: arena_cabecera
+ *
+ * Principio del segmento. Le siguen los num_slots arena_slot y, a partir del
+ * offset datos (múltiplo del tamaño de página), los datos de los slots.
+ */
+struct arena_cabecera {
+    uint32_t magic;               // ARENA_MAGIC cuando la arena está inicializada
+    uint32_t version;             // ARENA_VERSION
+    uint32_t num_slots;           // Número de slots
+    uint32_t reservado;           // 0
+    uint64_t tam_slot;            // Bytes de cada slot
+    uint64_t datos;               // Offset de los datos del primer slot
+    atomic_uint_least64_t libres; // Cima de la pila: (etiqueta << 32) | (slot + 1)
+};
+
+/**
+ * Estructura: arena_slot
+ */
+struct arena_slot {
+    atomic_uint_least32_t siguiente;  // Slot de debajo en la pila (más uno; 0 = ninguno)
+    atomic_uint_least32_t generacion; // Aumenta cada vez que se libera el slot
+};
+
+/**
+ * Estructura: arena
+ *
+ * Arena mapeada en el proceso actual.
+ */
+struct arena {
+    struct arena_cabecera *cabecera; // NULL si no está mapeada
+    struct arena_slot *slots;
+    char *datos;
+    size_t tam;
+};
+
+/**
+ * Arena del proceso actual (la que crea el servidor o la que abre el cliente)
+ */
+struct arena arena_actual = {NULL, NULL, NULL, 0};
+
+/**
+ * Función: arena_mapear
+ *
+ * Mapea el segmento del descriptor fd y completa a.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int arena_mapear(struct arena *a, int fd, size_t tam) {
+    void *p = mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    a->cabecera = p;
+    a->slots = (struct arena_slot *)(a->cabecera + 1);
+    a->tam = tam;
+    return 0;
+}
+
+/**
+ * Función: arena_crear
+ *
+ * Crea la arena con num_slots slots de tam_slot bytes, todos libres. Lo llama el
+ * servidor al arrancar; si quedó una arena de una ejecución anterior, se sustituye.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int arena_crear(struct arena *a, uint32_t num_slots, size_t tam_slot) {
+    char nombre[100];
+    size_t pagina = (size_t)sysconf(_SC_PAGESIZE);
+    size_t meta = sizeof(struct arena_cabecera) + num_slots * sizeof(struct arena_slot);
+    size_t datos = (meta + pagina - 1) / pagina * pagina;
+    size_t tam = datos + (size_t)num_slots * tam_slot;
+
+    get_queue_name(nombre, ARENA_SHM);
+    shm_unlink(nombre);
+    int fd = shm_open(nombre, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, tam) == -1 || arena_mapear(a, fd, tam) == -1) {
+        int error = errno;
+        close(fd);
+        shm_unlink(nombre);
+        errno = error;
+        return -1;
+    }
+    close(fd);
+
+    struct arena_cabecera *c = a->cabecera;
+    c->version = ARENA_VERSION;
+    c->num_slots = num_slots;
+    c->tam_slot = tam_slot;
+    c->datos = datos;
+    a->datos = (char *)c + datos;
+    // Al principio la pila contiene todos los slots, con el 0 en la cima
+    for (uint32_t i = 0; i < num_slots; i++) {
+        atomic_init(&a->slots[i].siguiente, i + 1 < num_slots ? i + 2 : 0);
+        atomic_init(&a->slots[i].generacion, 0);
+    }
+    atomic_init(&c->libres, num_slots > 0 ? 1 : 0);
+    // El número mágico se escribe el último: el cliente no usa la arena hasta verlo
+    atomic_thread_fence(memory_order_release);
+    c->magic = ARENA_MAGIC;
+    return 0;
+}
+
+/**
+ * Función: arena_abrir
+ *
+ * Mapea la arena de un servidor en ejecución.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no existe o no es válida
+ */
+int arena_abrir(struct arena *a) {
+    char nombre[100];
+    struct stat st;
+
+    get_queue_name(nombre, ARENA_SHM);
+    int fd = shm_open(nombre, O_RDWR, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct arena_cabecera) ||
+        arena_mapear(a, fd, st.st_size) == -1) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    close(fd);
+
+    struct arena_cabecera *c = a->cabecera;
+    if (c->magic != ARENA_MAGIC || c->version != ARENA_VERSION ||
+        c->datos + (uint64_t)c->num_slots * c->tam_slot > a->tam) {
+        munmap(c, a->tam);
+        a->cabecera = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    a->datos = (char *)c + c->datos;
+    return 0;
+}
+
+/**
+ * Función: arena_cerrar
+ *
+ * Desmapea la arena y, si eliminar es distinto de cero (el servidor), la elimina.
+ */
+void arena_cerrar(struct arena *a, int eliminar) {
+    char nombre[100];
+    if (a->cabecera == NULL) {
+        return;
+    }
+    munmap(a->cabecera, a->tam);
+    a->cabecera = NULL;
+    if (eliminar) {
+        get_queue_name(nombre, ARENA_SHM);
+        shm_unlink(nombre);
+    }
+}
+
+/**
+ * Función: arena_tomar
+ *
+ * Saca un slot de la pila de libres.
+ *
+ * Retorno:
+ *   - Número de slot, o -1 si no queda ninguno libre
+ */
+int arena_tomar(struct arena *a) {
+    atomic_uint_least64_t *libres = &a->cabecera->libres;
+    uint64_t cima = atomic_load_explicit(libres, memory_order_acquire);
+
+    while ((uint32_t)cima != 0) {
+        uint32_t slot = (uint32_t)cima - 1;
+        uint32_t siguiente = atomic_load_explicit(&a->slots[slot].siguiente, memory_order_relaxed);
+        uint64_t nueva = (((cima >> 32) + 1) << 32) | siguiente;
+        if (atomic_compare_exchange_weak_explicit(libres, &cima, nueva, memory_order_acquire,
+                                                  memory_order_acquire)) {
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Función: arena_liberar
+ *
+ * Devuelve un slot a la pila de libres, invalidando antes sus descriptores.
+ */
+void arena_liberar(struct arena *a, uint32_t slot) {
+    atomic_uint_least64_t *libres = &a->cabecera->libres;
+    uint64_t cima = atomic_load_explicit(libres, memory_order_relaxed);
+    uint64_t nueva;
+
+    atomic_fetch_add_explicit(&a->slots[slot].generacion, 1, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&a->slots[slot].siguiente, (uint32_t)cima, memory_order_relaxed);
+        nueva = (((cima >> 32) + 1) << 32) | (slot + 1);
+        // release: quien saque el slot ve terminadas las lecturas de sus datos
+    } while (!atomic_compare_exchange_weak_explicit(libres, &cima, nueva, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/**
+ * Función: arena_generacion
+ */
+uint32_t arena_generacion(const struct arena *a, uint32_t slot) {
+    return atomic_load_explicit(&a->slots[slot].generacion, memory_order_relaxed);
+}
+
+/**
+ * Función: arena_slot_datos
+ */
+char *arena_slot_datos(const struct arena *a, uint32_t slot) {
+    return a->datos + (size_t)slot * a->cabecera->tam_slot;
+}
+
+/**
+ * Función: arena_resolver
+ *
+ * Comprueba un descriptor recibido y devuelve la dirección de sus datos.
+ *
+ * Retorno:
+ *   - Puntero a los datos, o NULL si el descriptor no es válido (slot fuera de
+ *     rango, generación antigua o datos fuera del slot)
+ */
+const char *arena_resolver(const struct arena *a, uint32_t slot, uint32_t generacion,
+                           uint64_t offset, uint64_t longitud) {
+    if (a->cabecera == NULL || slot >= a->cabecera->num_slots ||
+        arena_generacion(a, slot) != generacion || offset > a->cabecera->tam_slot ||
+        longitud > a->cabecera->tam_slot - offset) {
+        return NULL;
+    }
+    return arena_slot_datos(a, slot) + offset;
+}
+
+#endif /* EJ3_ARENA_H */
@@ -0,0 +1,483 @@
+/**
+ * Ejercicio 3: Banco de pruebas de rendimiento para el servidor
+ *
+ * Este programa mide el rendimiento (mensajes por segundo) y la latencia de ida
+ * y vuelta de las peticiones al servidor del ejercicio 3, de forma que se pueda
+ * comparar el transporte por colas de mensajes POSIX con el socket Unix
+ * SOCK_SEQPACKET. Ambos transportes usan la misma lógica de servicio
+ * (procesar_peticion), por lo que la diferencia medida se debe sólo al transporte.
+ *
+ * Ejemplo de uso (con el servidor ya en ejecución):
+ *   ./ej3_servidor > /dev/null &       ./ej3_bench -n 20000
+ *   ./ej3_servidor -s > /dev/null &    ./ej3_bench -s -n 20000 -c 8
+ *
+ * Con colas de mensajes se admite un cliente por partición del servidor (opción -S
+ * de ej3_servidor): el cliente c usa la partición c, ya que dentro de una partición
+ * la cola de respuestas es compartida y varios clientes se robarían las respuestas
+ * entre sí. Así se puede medir cómo escala el servidor con el número de particiones:
+ *   ./ej3_servidor -S 4 > /dev/null &  ./ej3_bench -n 20000 -c 4
+ *
+ * Con -m (carga masiva) el cliente mantiene la cola del servidor llena de
+ * peticiones del carril masivo y mide la latencia de las peticiones del carril
+ * elegido con -p, para comprobar que el tráfico interactivo no queda detrás:
+ *   ./ej3_bench -m -p interactivo      frente a      ./ej3_bench -m -p masivo
+ *
+ * Para medir el modo busy-poll, el servidor y el cliente se fijan a núcleos
+ * distintos y se compara la latencia (sobre todo el p99) y el consumo de CPU que
+ * se muestra al final:
+ *   ./ej3_servidor -C 2 > /dev/null &         ./ej3_bench -C 3
+ *   ./ej3_servidor -C 2 -P 200 > /dev/null &  ./ej3_bench -C 3 -P 200
+ */
+
+#include "ej3_carriles.h" // Prioridades de los carriles del servidor
+#include "ej3_common.h"       // Incluye definiciones y funciones comunes
+#include "ej3_estadisticas.h" // Para conocer el PID del servidor (consumo de CPU)
+#include "ej3_socket.h"       // Transporte alternativo mediante socket Unix SOCK_SEQPACKET
+
+#include <getopt.h>       // Para procesar opciones de línea de comandos (getopt_long)
+#include <poll.h>         // Para dormir hasta la respuesta al agotar el busy-poll
+#include <sys/mman.h>     // Para mmap() (memoria compartida entre los procesos cliente)
+#include <sys/resource.h> // Para getrusage() (CPU consumida por los clientes)
+#include <sys/wait.h>     // Para wait()
+
+/**
+ * Opciones del banco de pruebas
+ *
+ * - prioridad_medida: Prioridad de las peticiones cuya latencia se mide (-p)
+ * - carga_masiva: Mantener la cola llena de peticiones del carril masivo (-m)
+ * - busy_poll_ns: Umbral del busy-poll al esperar cada respuesta (-P; 0 = no)
+ * - cpus_clientes / num_cpus_clientes: Núcleos de los clientes (-C)
+ * - prioridad_fifo: Prioridad SCHED_FIFO de los clientes (-F; 0 = planificación normal)
+ */
+unsigned int prioridad_medida = PRIO_INTERACTIVO;
+int carga_masiva = 0;
+uint64_t busy_poll_ns = 0;
+int cpus_clientes[MAX_SHARDS];
+int num_cpus_clientes = 0;
+int prioridad_fifo = 0;
+
+/**
+ * Función: comparar_u64
+ *
+ * Función de comparación para qsort() sobre valores uint64_t.
+ */
+int comparar_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Función: percentil
+ *
+ * Devuelve el percentil p (0-100) de un vector ya ordenado.
+ */
+uint64_t percentil(const uint64_t *v, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return v[i];
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles del banco de pruebas.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_bench [opciones]\n");
+    printf("Opciones:\n");
+    printf("-h, --help               Imprimir esta ayuda\n");
+    printf("-s, --socket             Usar el socket Unix (por defecto, colas de mensajes)\n");
+    printf("-n, --mensajes <N>       Peticiones que envía cada cliente (por defecto 10000)\n");
+    printf("-c, --clientes <N>       Clientes concurrentes; con colas, como mucho uno por "
+           "partición del servidor (por defecto 1)\n");
+    printf("-t, --tamanio <bytes>    Tamaño del texto de cada petición (por defecto 64)\n");
+    printf("-x, --exit               Enviar \"exit\" al terminar (detiene el servidor de colas)\n");
+    printf("-p, --prioridad <carril> Carril de las peticiones medidas: interactivo o masivo\n");
+    printf("-m, --carga-masiva       Mantener la cola llena de peticiones masivas (sólo colas)\n");
+    printf("-P, --busy-poll <us>     Sondear sin bloquear hasta <us> microsegundos al esperar "
+           "cada respuesta\n");
+    printf("-C, --cpus <lista>       Núcleos de los clientes, p. ej. 3 o 3-6 (el cliente c usa el "
+           "c-ésimo)\n");
+    printf("-F, --fifo <prioridad>   Ejecutar los clientes con la política SCHED_FIFO (1-99)\n");
+}
+
+/**
+ * Función: recibir
+ *
+ * Recibe una respuesta de la cola o del socket. En modo busy-poll la cola está
+ * abierta con O_NONBLOCK (y al socket se le pasa MSG_DONTWAIT): se reintenta sin
+ * bloquear hasta agotar el umbral y después se duerme en poll() hasta que llegue.
+ */
+ssize_t recibir(int fd, int es_socket, char *buffer, size_t tam, unsigned int *prio) {
+    uint64_t fin_giro = 0;
+
+    while (1) {
+        ssize_t r = es_socket ? recv(fd, buffer, tam, busy_poll_ns ? MSG_DONTWAIT : 0)
+                              : mq_receive((mqd_t)fd, buffer, tam, prio);
+        if (r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return r;
+        }
+        uint64_t ahora = ahora_ns();
+        if (fin_giro == 0) {
+            fin_giro = ahora + busy_poll_ns;
+        }
+        if (ahora < fin_giro) {
+            pausa_cpu();
+            continue;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        poll(&pfd, 1, -1);
+    }
+}
+
+/**
+ * Función: cpu_proceso_ns
+ *
+ * Devuelve la CPU (usuario + sistema) consumida hasta ahora por un proceso, leída
+ * de /proc/<pid>/stat, o 0 si no se puede leer.
+ */
+uint64_t cpu_proceso_ns(pid_t pid) {
+    char ruta[64], linea[1024];
+    unsigned long utime, stime;
+
+    snprintf(ruta, sizeof(ruta), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(ruta, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char *p = fgets(linea, sizeof(linea), f);
+    fclose(f);
+
+    // Los campos 14 y 15 (utime y stime) van detrás del nombre, que puede tener espacios
+    if (p == NULL || (p = strrchr(linea, ')')) == NULL ||
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) !=
+            2) {
+        return 0;
+    }
+    return (uint64_t)(utime + stime) * 1000000000ULL / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Función: ejecutar_cliente
+ *
+ * Envía n peticiones al servidor, una tras otra, y anota la latencia de ida y
+ * vuelta de cada una en el vector latencias. Con colas usa la partición shard de
+ * las num_shards del servidor.
+ *
+ * Retorno:
+ *   - 0 si todas las peticiones se completaron, -1 en caso de error
+ */
+int ejecutar_cliente(int usar_socket, int shard, int num_shards, long n, size_t tamanio,
+                     uint64_t *latencias) {
+    char peticion[MAX_SIZE];
+    char *respuesta;
+    size_t tam_respuesta = MAX_SIZE;
+    char nombre[120];
+    mqd_t cola_servidor = -1, cola_cliente = -1;
+    int fd = -1;
+    long pendientes_masivas = 0; // Peticiones masivas enviadas cuya respuesta no ha llegado
+    long max_masivas = 0;        // Peticiones masivas que se mantienen en vuelo con -m
+
+    if (usar_socket) {
+        get_queue_name(nombre, SERVER_SOCKET);
+        fd = conectar_socket_cliente(nombre);
+        if (fd == -1) {
+            perror("Error al conectar con el socket del servidor");
+            return -1;
+        }
+    }
+    else {
+        get_shard_name(nombre, SERVER_QUEUE, shard, num_shards);
+        cola_servidor = mq_open(nombre, O_WRONLY);
+        get_shard_name(nombre, CLIENT_QUEUE, shard, num_shards);
+        cola_cliente = mq_open(nombre, O_RDONLY | (busy_poll_ns ? O_NONBLOCK : 0));
+        if (cola_servidor == -1 || cola_cliente == -1) {
+            perror("Error al abrir las colas del servidor");
+            return -1;
+        }
+
+        // mq_receive() exige un buffer del tamaño de mensaje de la cola
+        struct mq_attr attr;
+        if (mq_getattr(cola_cliente, &attr) == 0) {
+            tam_respuesta = attr.mq_msgsize;
+            // Se dejan en vuelo tantas masivas como caben en la cola menos una, de forma
+            // que la cola de respuestas nunca se llena y el servidor no se bloquea
+            max_masivas = attr.mq_maxmsg - 1;
+        }
+    }
+    respuesta = malloc(tam_respuesta);
+    if (respuesta == NULL) {
+        perror("Error en malloc");
+        return -1;
+    }
+
+    // Texto de la petición: tamanio caracteres seguidos del '\0'
+    memset(peticion, 'a', tamanio);
+    peticion[tamanio] = '\0';
+
+    for (long i = 0; i < n; i++) {
+        uint64_t t0 = ahora_ns();
+        ssize_t r;
+        if (usar_socket) {
+            if (send(fd, peticion, tamanio + 1, MSG_NOSIGNAL) == -1) {
+                perror("Error en send");
+                return -1;
+            }
+            r = recibir(fd, 1, respuesta, tam_respuesta, NULL);
+        }
+        else {
+            // Con -m rellenamos la cola con peticiones masivas antes de la petición medida
+            // (el reloj se vuelve a tomar después, para medir sólo la petición)
+            while (carga_masiva && pendientes_masivas < max_masivas) {
+                if (mq_send(cola_servidor, peticion, tamanio + 1, PRIO_MASIVO) == -1) {
+                    perror("Error en mq_send");
+                    return -1;
+                }
+                pendientes_masivas++;
+            }
+            t0 = ahora_ns();
+            if (mq_send(cola_servidor, peticion, tamanio + 1, prioridad_medida) == -1) {
+                perror("Error en mq_send");
+                return -1;
+            }
+            // Descartamos las respuestas masivas hasta recibir la de la petición medida.
+            // Si las medidas también son masivas, la suya es la última de la tanda.
+            unsigned int prio;
+            long descartar = prioridad_medida == PRIO_MASIVO ? pendientes_masivas : 0;
+            while ((r = recibir(cola_cliente, 0, respuesta, tam_respuesta, &prio)) > 0 &&
+                   carga_masiva && (prio != prioridad_medida || descartar > 0)) {
+                if (prio == PRIO_MASIVO) {
+                    pendientes_masivas--;
+                }
+                descartar--;
+            }
+        }
+        if (r <= 0) {
+            perror("Error al recibir la respuesta");
+            return -1;
+        }
+        latencias[i] = ahora_ns() - t0;
+    }
+
+    // Recogemos las respuestas masivas que queden en vuelo antes de cerrar
+    while (pendientes_masivas > 0 && recibir(cola_cliente, 0, respuesta, tam_respuesta, NULL) > 0) {
+        pendientes_masivas--;
+    }
+
+    if (usar_socket) {
+        close(fd);
+    }
+    else {
+        mq_close(cola_servidor);
+        mq_close(cola_cliente);
+    }
+    free(respuesta);
+    return 0;
+}
+
+/**
+ * Función: enviar_exit
+ *
+ * Envía el mensaje de salida al servidor de colas para detenerlo. Basta con
+ * enviarlo a la primera partición: el servidor cierra todas.
+ */
+void enviar_exit(int num_shards) {
+    char nombre[120];
+    get_shard_name(nombre, SERVER_QUEUE, 0, num_shards);
+    mqd_t cola = mq_open(nombre, O_WRONLY);
+    if (cola != -1) {
+        mq_send(cola, MSG_EXIT, strlen(MSG_EXIT) + 1, 0);
+        mq_close(cola);
+    }
+}
+
+/**
+ * Función: main
+ *
+ * Lanza los clientes (un proceso hijo por cliente), espera a que terminen y
+ * muestra el rendimiento total y la distribución de latencias.
+ */
+int main(int argc, char *argv[]) {
+    int opt;
+    int usar_socket = 0;
+    int enviar_salida = 0;
+    long mensajes = 10000;
+    int clientes = 1;
+    size_t tamanio = 64;
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"socket", no_argument, 0, 's'},
+                                           {"mensajes", required_argument, 0, 'n'},
+                                           {"clientes", required_argument, 0, 'c'},
+                                           {"tamanio", required_argument, 0, 't'},
+                                           {"exit", no_argument, 0, 'x'},
+                                           {"prioridad", required_argument, 0, 'p'},
+                                           {"carga-masiva", no_argument, 0, 'm'},
+                                           {"busy-poll", required_argument, 0, 'P'},
+                                           {"cpus", required_argument, 0, 'C'},
+                                           {"fifo", required_argument, 0, 'F'},
+                                           {0, 0, 0, 0}};
+    int carril;
+
+    while ((opt = getopt_long(argc, argv, "hsn:c:t:xp:mP:C:F:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 's':
+            usar_socket = 1;
+            break;
+        case 'n':
+            mensajes = atol(optarg);
+            break;
+        case 'c':
+            clientes = atoi(optarg);
+            break;
+        case 't':
+            tamanio = (size_t)atol(optarg);
+            break;
+        case 'x':
+            enviar_salida = 1;
+            break;
+        case 'p':
+            carril = carril_por_nombre(optarg);
+            if (carril == -1 || carril == CARRIL_CONTROL) {
+                printf("Prioridad no válida: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            prioridad_medida = prioridad_de_carril(carril);
+            break;
+        case 'm':
+            carga_masiva = 1;
+            break;
+        case 'P':
+            busy_poll_ns = (uint64_t)atol(optarg) * 1000;
+            break;
+        case 'C':
+            num_cpus_clientes = leer_lista_cpus(optarg, cpus_clientes, MAX_SHARDS);
+            if (num_cpus_clientes <= 0) {
+                printf("Lista de CPUs no válida: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            prioridad_fifo = atoi(optarg);
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (mensajes <= 0 || clientes <= 0 || tamanio == 0 || tamanio >= MAX_SIZE) {
+        printf("Parámetros no válidos (1 <= tamaño < %d)\n", MAX_SIZE);
+        return EXIT_FAILURE;
+    }
+    if (usar_socket && carga_masiva) {
+        printf("La carga masiva sólo se aplica a las colas de mensajes\n");
+        return EXIT_FAILURE;
+    }
+    int num_shards = usar_socket ? 1 : contar_shards();
+    if (!usar_socket && num_shards == 0) {
+        printf("No se encontró la cola del servidor\n");
+        return EXIT_FAILURE;
+    }
+    if (!usar_socket && clientes > num_shards) {
+        printf("Con colas de mensajes se admite un cliente por partición y el servidor tiene %d "
+               "(la cola de respuestas de cada partición es compartida)\n",
+               num_shards);
+        return EXIT_FAILURE;
+    }
+
+    // Vector de latencias compartido con los hijos: cada cliente escribe en su tramo
+    size_t total = (size_t)mensajes * clientes;
+    uint64_t *latencias = mmap(NULL, total * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (latencias == MAP_FAILED) {
+        perror("Error en mmap");
+        return EXIT_FAILURE;
+    }
+
+    // CPU consumida por el servidor durante la prueba (si está publicando estadísticas)
+    const struct ej3_estadisticas *est = estadisticas_abrir();
+    pid_t pid_servidor = est != NULL ? est->pid : 0;
+    uint64_t cpu_servidor = pid_servidor ? cpu_proceso_ns(pid_servidor) : 0;
+
+    uint64_t inicio = ahora_ns();
+    for (int c = 0; c < clientes; c++) {
+        switch (fork()) {
+        case -1:
+            perror("No se ha podido crear el proceso cliente");
+            return EXIT_FAILURE;
+        case 0:
+            if (num_cpus_clientes > 0 && fijar_cpu(cpus_clientes[c % num_cpus_clientes]) == -1) {
+                perror("No se pudo fijar el cliente a su CPU");
+            }
+            if (prioridad_fifo > 0 && fijar_fifo(prioridad_fifo) == -1) {
+                perror("No se pudo usar SCHED_FIFO");
+            }
+            exit(ejecutar_cliente(usar_socket, c, num_shards, mensajes, tamanio,
+                                  latencias + c * mensajes) == 0
+                     ? EXIT_SUCCESS
+                     : EXIT_FAILURE);
+        }
+    }
+
+    // Esperamos a todos los clientes y comprobamos que terminaron bien
+    int status, fallos = 0;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fallos++;
+        }
+    }
+    uint64_t duracion = ahora_ns() - inicio;
+    if (pid_servidor) {
+        cpu_servidor = cpu_proceso_ns(pid_servidor) - cpu_servidor;
+    }
+    struct rusage uso;
+    getrusage(RUSAGE_CHILDREN, &uso);
+    uint64_t cpu_clientes = (uint64_t)(uso.ru_utime.tv_sec + uso.ru_stime.tv_sec) * 1000000000ULL +
+                            (uint64_t)(uso.ru_utime.tv_usec + uso.ru_stime.tv_usec) * 1000ULL;
+
+    if (enviar_salida && !usar_socket) {
+        enviar_exit(num_shards);
+    }
+    if (fallos > 0) {
+        printf("%d clientes terminaron con error\n", fallos);
+        return EXIT_FAILURE;
+    }
+
+    qsort(latencias, total, sizeof(uint64_t), comparar_u64);
+    uint64_t suma = 0;
+    for (size_t i = 0; i < total; i++) {
+        suma += latencias[i];
+    }
+
+    printf("Transporte: %s, clientes: %d, particiones: %d, peticiones: %zu, tamaño: %zu bytes\n",
+           usar_socket ? "socket SOCK_SEQPACKET" : "colas de mensajes", clientes, num_shards, total,
+           tamanio);
+    if (carga_masiva) {
+        printf("Con la cola llena de peticiones masivas; peticiones medidas en el carril %s\n",
+               prioridad_medida == PRIO_MASIVO ? "masivo" : "interactivo");
+    }
+    printf("Tiempo total: %.3f s, rendimiento: %.0f peticiones/s\n", duracion / 1e9,
+           total / (duracion / 1e9));
+    printf("Latencia (us): media %.1f, p50 %.1f, p90 %.1f, p99 %.1f, máx %.1f\n",
+           suma / (double)total / 1e3, percentil(latencias, total, 50) / 1e3,
+           percentil(latencias, total, 90) / 1e3, percentil(latencias, total, 99) / 1e3,
+           latencias[total - 1] / 1e3);
+
+    // Coste en CPU: el busy-poll mejora la latencia a cambio de mantener núcleos ocupados
+    printf("CPU clientes: %.0f%% de un núcleo, %.1f us por petición\n",
+           100.0 * cpu_clientes / duracion, cpu_clientes / (double)total / 1e3);
+    if (pid_servidor) {
+        printf("CPU servidor: %.0f%% de un núcleo, %.1f us por petición\n",
+               100.0 * cpu_servidor / duracion, cpu_servidor / (double)total / 1e3);
+    }
+
+    munmap(latencias, total * sizeof(uint64_t));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,263 @@
+/**
+ * Ejercicio 3: Carriles de prioridad para las peticiones del servidor
+ *
+ * Las colas POSIX entregan siempre primero el mensaje de mayor prioridad. Si se
+ * usaran las prioridades directamente, un cliente que envía mucho tráfico de
+ * prioridad alta dejaría sin servicio (inanición) al resto. Por eso el servidor
+ * vacía la cola en tres carriles locales y los atiende con un reparto ponderado
+ * (weighted round robin):
+ *
+ * - Carril de control: mensajes de gestión, como "exit"
+ * - Carril interactivo: peticiones de usuarios que esperan la respuesta
+ * - Carril masivo: cargas por lotes, que toleran más latencia
+ *
+ * En cada ronda el carril i se atiende como mucho peso[i] veces, de modo que
+ * todos los carriles con trabajo pendiente avanzan en cada ronda.
+ */
+
+#ifndef EJ3_CARRILES_H
+#define EJ3_CARRILES_H
+
+#include "ej3_common.h"
+
+/**
+ * Identificadores de los carriles, en el orden en que se atienden dentro de una ronda
+ */
+#define CARRIL_CONTROL 0
+#define CARRIL_INTERACTIVO 1
+#define CARRIL_MASIVO 2
+#define NUM_CARRILES 3
+
+/**
+ * Prioridad de cola (mq_send) asociada a cada carril
+ *
+ * Las respuestas se envían con la misma prioridad que la petición, así que el
+ * cliente también recibe antes las respuestas de control e interactivas.
+ */
+#define PRIO_CONTROL 2
+#define PRIO_INTERACTIVO 1
+#define PRIO_MASIVO 0
+
+/**
+ * Pesos por defecto del reparto ponderado (control:interactivo:masivo)
+ */
+#define PESO_CONTROL 16
+#define PESO_INTERACTIVO 4
+#define PESO_MASIVO 1
+
+/**
+ * Estructura: carril
+ *
+ * Cola circular de mensajes de tamaño fijo. Los mensajes se copian en huecos de
+ * tam_mensaje bytes reservados al crear el carril.
+ */
+struct carril {
+    char *datos;         // capacidad * tam_mensaje bytes
+    size_t *longitudes;  // Longitud de cada mensaje almacenado
+    uint64_t *etiquetas; // Etiqueta de cada mensaje (la del diario, ver ej3_diario.h)
+    int capacidad;       // Número de huecos
+    int cabeza;          // Hueco del siguiente mensaje a sacar
+    int cuenta;          // Mensajes almacenados
+    size_t tam_mensaje;  // Tamaño de cada hueco
+};
+
+/**
+ * Estructura: planificador
+ *
+ * Los tres carriles y el estado del reparto ponderado.
+ */
+struct planificador {
+    struct carril carriles[NUM_CARRILES];
+    int pesos[NUM_CARRILES];    // Servicios por ronda de cada carril
+    int creditos[NUM_CARRILES]; // Servicios que le quedan a cada carril en la ronda actual
+};
+
+/**
+ * Función: carril_de_prioridad
+ *
+ * Devuelve el carril que corresponde a una prioridad de cola.
+ */
+int carril_de_prioridad(unsigned int prio) {
+    if (prio >= PRIO_CONTROL) {
+        return CARRIL_CONTROL;
+    }
+    return prio == PRIO_INTERACTIVO ? CARRIL_INTERACTIVO : CARRIL_MASIVO;
+}
+
+/**
+ * Función: prioridad_de_carril
+ *
+ * Devuelve la prioridad de cola con la que se envían los mensajes de un carril.
+ */
+unsigned int prioridad_de_carril(int carril) {
+    static const unsigned int prioridades[NUM_CARRILES] = {PRIO_CONTROL, PRIO_INTERACTIVO,
+                                                           PRIO_MASIVO};
+    return prioridades[carril];
+}
+
+/**
+ * Función: carril_por_nombre
+ *
+ * Traduce el nombre de un carril ("control", "interactivo" o "masivo").
+ *
+ * Retorno:
+ *   - Identificador del carril, o -1 si el nombre no es válido
+ */
+int carril_por_nombre(const char *nombre) {
+    if (strcmp(nombre, "control") == 0) {
+        return CARRIL_CONTROL;
+    }
+    if (strcmp(nombre, "interactivo") == 0) {
+        return CARRIL_INTERACTIVO;
+    }
+    if (strcmp(nombre, "masivo") == 0) {
+        return CARRIL_MASIVO;
+    }
+    return -1;
+}
+
+/**
+ * Función: planificador_fijar_pesos
+ *
+ * Cambia los pesos del reparto; la ronda en curso empieza de nuevo con ellos.
+ */
+void planificador_fijar_pesos(struct planificador *p, const int pesos[NUM_CARRILES]) {
+    for (int i = 0; i < NUM_CARRILES; i++) {
+        p->pesos[i] = pesos[i] > 0 ? pesos[i] : 1;
+        p->creditos[i] = p->pesos[i];
+    }
+}
+
+/**
+ * Función: planificador_init
+ *
+ * Reserva los carriles con capacidad para "capacidad" mensajes de hasta
+ * tam_mensaje bytes cada uno y fija los pesos del reparto.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no hay memoria suficiente
+ */
+int planificador_init(struct planificador *p, int capacidad, size_t tam_mensaje,
+                      const int pesos[NUM_CARRILES]) {
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < NUM_CARRILES; i++) {
+        struct carril *c = &p->carriles[i];
+        c->datos = malloc((size_t)capacidad * tam_mensaje);
+        c->longitudes = malloc((size_t)capacidad * sizeof(size_t));
+        c->etiquetas = malloc((size_t)capacidad * sizeof(uint64_t));
+        if (c->datos == NULL || c->longitudes == NULL || c->etiquetas == NULL) {
+            return -1;
+        }
+        c->capacidad = capacidad;
+        c->tam_mensaje = tam_mensaje;
+    }
+    planificador_fijar_pesos(p, pesos);
+    return 0;
+}
+
+/**
+ * Función: planificador_liberar
+ *
+ * Libera la memoria de los carriles.
+ */
+void planificador_liberar(struct planificador *p) {
+    for (int i = 0; i < NUM_CARRILES; i++) {
+        free(p->carriles[i].datos);
+        free(p->carriles[i].longitudes);
+        free(p->carriles[i].etiquetas);
+    }
+    memset(p, 0, sizeof(*p));
+}
+
+/**
+ * Función: planificador_admite
+ *
+ * Indica si hay hueco en todos los carriles. El servidor sólo saca un mensaje de
+ * la cola cuando es así, ya que no sabe de qué carril será hasta recibirlo. Si un
+ * carril se llena, el resto de mensajes espera en la cola del núcleo, que los
+ * mantiene ordenados por prioridad.
+ */
+int planificador_admite(const struct planificador *p) {
+    for (int i = 0; i < NUM_CARRILES; i++) {
+        if (p->carriles[i].cuenta == p->carriles[i].capacidad) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Función: planificador_pendientes
+ *
+ * Devuelve el número total de mensajes almacenados en los carriles.
+ */
+int planificador_pendientes(const struct planificador *p) {
+    int total = 0;
+    for (int i = 0; i < NUM_CARRILES; i++) {
+        total += p->carriles[i].cuenta;
+    }
+    return total;
+}
+
+/**
+ * Función: planificador_meter
+ *
+ * Copia un mensaje al final del carril indicado, junto con una etiqueta que se
+ * devuelve al sacarlo. Debe comprobarse antes con planificador_admite() que hay
+ * hueco.
+ */
+void planificador_meter(struct planificador *p, int carril, const char *mensaje, size_t len,
+                        uint64_t etiqueta) {
+    struct carril *c = &p->carriles[carril];
+    int hueco = (c->cabeza + c->cuenta) % c->capacidad;
+    if (len > c->tam_mensaje) {
+        len = c->tam_mensaje;
+    }
+    memcpy(c->datos + (size_t)hueco * c->tam_mensaje, mensaje, len);
+    c->longitudes[hueco] = len;
+    c->etiquetas[hueco] = etiqueta;
+    c->cuenta++;
+}
+
+/**
+ * Función: planificador_sacar
+ *
+ * Elige el siguiente mensaje según el reparto ponderado y lo copia en destino (y su
+ * etiqueta en *etiqueta). Sólo se consideran los carriles cuyo primer mensaje
+ * tiene una etiqueta menor o igual que limite: con diario, los que ya están
+ * sincronizados, de modo que los que aún no lo están esperan sin bloquear al resto.
+ * Dentro de una ronda se recorren los carriles en orden (control, interactivo,
+ * masivo) y se atiende el primero con mensajes y créditos. Cuando ningún carril
+ * con mensajes tiene créditos, empieza una ronda nueva.
+ *
+ * Retorno:
+ *   - Carril del mensaje extraído, o -1 si no hay mensajes que se puedan sacar
+ */
+int planificador_sacar(struct planificador *p, char *destino, size_t *len, uint64_t *etiqueta,
+                       uint64_t limite) {
+    if (planificador_pendientes(p) == 0) {
+        return -1;
+    }
+
+    for (int intento = 0; intento < 2; intento++) {
+        for (int i = 0; i < NUM_CARRILES; i++) {
+            struct carril *c = &p->carriles[i];
+            if (c->cuenta > 0 && p->creditos[i] > 0 && c->etiquetas[c->cabeza] <= limite) {
+                p->creditos[i]--;
+                *len = c->longitudes[c->cabeza];
+                memcpy(destino, c->datos + (size_t)c->cabeza * c->tam_mensaje, *len);
+                *etiqueta = c->etiquetas[c->cabeza];
+                c->cabeza = (c->cabeza + 1) % c->capacidad;
+                c->cuenta--;
+                return i;
+            }
+        }
+        // Ronda agotada: se reponen los créditos de todos los carriles
+        for (int i = 0; i < NUM_CARRILES; i++) {
+            p->creditos[i] = p->pesos[i];
+        }
+    }
+    return -1;
+}
+
+#endif /* EJ3_CARRILES_H */
@@ -8,9 +8,34 @@
  * - Otra cola para recibir respuestas del servidor
  *
  * El cliente asume que el servidor ya está en ejecución y ha creado las colas.
+ *
+ * Con la opción -f el cliente no lee líneas, sino que envía un fichero entero (o la
+ * entrada estándar) como un flujo de fragmentos del tamaño de la cola, sin límite
+ * de longitud, y muestra la única respuesta del servidor (ver ej3_flujos.h). Con la
+ * opción -r sólo envía la ruta del fichero, y el servidor lo lee directamente; con
+ * la opción -x escribe el fichero en la arena compartida del servidor y envía sólo
+ * un descriptor (ver ej3_arena.h).
+ *
+ * Con -e, cada línea se envía con un plazo (opción -D): el cliente no espera ni a
+ * que haya sitio en la cola ni la respuesta más allá de él (mq_timedsend/
+ * mq_timedreceive), y el plazo viaja en la petición para que el servidor no la
+ * atienda si ya ha vencido (ver ej3_protocolo.h). En texto plano no hay plazo: la
+ * petición no lo lleva, así que el servidor la atendería igualmente y su respuesta
+ * tardía se tomaría por la de la línea siguiente.
  */
 
-#include "ej3_common.h" // Incluye definiciones y funciones comunes
+#include "ej3_carriles.h"     // Prioridades de los carriles del servidor
+#include "ej3_common.h"       // Incluye definiciones y funciones comunes
+#include "ej3_etapas.h"       // Desglose de la latencia por etapas (opción -T)
+#include "ej3_estadisticas.h" // Particiones y tamaño de mensaje del servidor
+#include "ej3_protocolo.h"    // Formato de las peticiones con cabecera binaria
+#include "ej3_registro.h"     // Log binario opcional (ver ej3_log)
+#include "ej3_socket.h"       // Transporte alternativo mediante socket Unix SOCK_SEQPACKET
+#include "ej3_traza.h"        // Grabación de las peticiones y respuestas (ver ej3_replay)
+
+#include <getopt.h>       // Para procesar opciones de línea de comandos (getopt_long)
+#include <poll.h>         // Para esperar a la vez la entrada, la respuesta y las señales
+#include <sys/signalfd.h> // Para recibir las señales como eventos (signalfd)
 
 /**
  * Nombre del archivo de log para el cliente
@@ -24,17 +49,90 @@
  * Variables globales para los descriptores de las colas de mensajes y control de ejecución
  *
  * Se definen como globales para que puedan ser accedidas desde la función
- * de limpieza y el manejador de señales.
+ * de limpieza y el tratamiento de señales.
  *
  * - server_queue: Descriptor de la cola para enviar mensajes al servidor
  * - client_queue: Descriptor de la cola para recibir respuestas del servidor
  * - running: Flag para controlar el bucle principal (1=ejecutando, 0=terminar)
+ * - signal_fd: Descriptor de signalfd por el que llegan SIGINT y SIGTERM
+ * - senal_recibida: Indica que el cliente termina por una señal
  *
  * El valor inicial -1 indica que las colas no están abiertas.
  */
 mqd_t server_queue = -1;
 mqd_t client_queue = -1;
 int running = 1;
+int signal_fd = -1;
+int senal_recibida = 0;
+
+/**
+ * Tiempo máximo, tras una señal, para recibir la respuesta de la petición en curso
+ */
+#define PLAZO_RESPUESTA_MS 5000
+
+/**
+ * Umbral del modo busy-poll en nanosegundos (opción -P; 0 = desactivado)
+ *
+ * Al esperar una respuesta, el cliente sondea la cola (o el socket) sin bloquear
+ * durante este tiempo antes de dormir en poll(), de modo que la respuesta se recoge
+ * en cuanto llega, sin esperar a que el planificador despierte al proceso.
+ */
+uint64_t busy_poll_ns = 0;
+
+/**
+ * Descriptor de la conexión con el servidor en modo socket (opción -s/--socket)
+ *
+ * El valor -1 indica que se usan las colas de mensajes.
+ */
+int socket_fd = -1;
+
+/**
+ * Parámetros de los mensajes
+ *
+ * - prioridad_envio: Prioridad con la que se envían las peticiones (opción -p/--prioridad).
+ *   El mensaje "exit" se envía siempre con la prioridad del carril de control.
+ * - tam_mensaje: Tamaño máximo de mensaje; con colas se obtiene de mq_getattr(), ya
+ *   que el servidor lo calcula al arrancar y mq_receive() exige un buffer de ese tamaño.
+ *   Con el socket, del segmento de estadísticas (ver leer_tam_socket()).
+ * - estadisticas: Estadísticas pedidas al servidor (opción -e/--estadisticas). Con 0 se
+ *   envía el texto plano y el servidor responde sólo con el número de caracteres.
+ */
+unsigned int prioridad_envio = PRIO_INTERACTIVO;
+size_t tam_mensaje = MAX_SIZE;
+uint32_t estadisticas = 0;
+int con_tiempos = 0; // Opción -T: anotar los tiempos de cada etapa (ver ej3_etapas.h)
+
+/**
+ * Tiempo que se da a cada petición para obtener su respuesta (opción -D/--plazo;
+ * 0 = sin plazo). Sólo se aplica con la cabecera binaria (-e), que lo lleva al
+ * servidor; el texto plano y los modos -f, -r y -x no usan plazo.
+ */
+uint64_t plazo_peticion_ns = PLAZO_PETICION_MS * 1000000ULL;
+
+/**
+ * Control de la sobrecarga
+ *
+ * Las peticiones se envían sin bloquear. Si la cola del servidor está llena (o el
+ * servidor responde que está ocupado, ver ej3_admision.h), se vuelve a intentar
+ * tras una espera aleatoria entre 0 y espera_base_ns * 2^intento (con un máximo de
+ * ESPERA_MAX_MS), como mucho reintentos veces. El azar evita que los clientes que
+ * chocaron a la vez vuelvan a chocar en el mismo instante.
+ *
+ * - reintentos: Reintentos por petición (opción -R/--reintentos)
+ * - espera_base_ns: Espera antes del primer reintento (opción -B/--espera-base)
+ */
+#define REINTENTOS 8
+#define ESPERA_BASE_US 100
+#define ESPERA_MAX_MS 100
+int reintentos = REINTENTOS;
+uint64_t espera_base_ns = ESPERA_BASE_US * 1000ULL;
+
+/**
+ * Traza en la que se graban las peticiones y las respuestas (opción -g/--grabar)
+ *
+ * Si traza.f es NULL no se graba nada.
+ */
+struct traza traza = {NULL, 0};
 
 /**
  * Función: cleanup
@@ -48,6 +146,14 @@ int running = 1;
 void cleanup() {
     char msgbuf[100]; // Buffer para mensajes de log
 
+    // En modo socket basta con cerrar la conexión
+    if (socket_fd != -1) {
+        close(socket_fd);
+        socket_fd = -1;
+        funcionLog("Conexión con el servidor cerrada", LOG_FILE);
+        return;
+    }
+
     // Cerramos la cola del servidor si está abierta
     if (server_queue != -1) {
         // mq_close cierra el descriptor de la cola pero no la elimina
@@ -73,73 +179,689 @@ void cleanup() {
 }
 
 /**
- * Función: handle_signal
+ * Función: preparar_senales
  *
- * Manejador de señales para SIGINT (Ctrl+C) y SIGTERM.
- * Cuando se recibe una de estas señales, el cliente envía un mensaje de salida
- * al servidor, realiza una limpieza ordenada de recursos y termina.
+ * Bloquea SIGINT y SIGTERM y crea un signalfd por el que llegan como eventos.
  *
- * Parámetros:
- *   - sig: Número de la señal recibida
+ * Un manejador de señales no puede llamar a funcionLog() ni a mq_send(), que no son
+ * async-signal-safe. Con las señales bloqueadas, quedan pendientes y el bucle principal
+ * las lee de signal_fd mientras espera la entrada del usuario o la respuesta del
+ * servidor, y termina de forma ordenada desde el flujo normal del programa.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
  */
-void handle_signal(int sig) {
+int preparar_senales() {
+    sigset_t mascara;
+    sigemptyset(&mascara);
+    sigaddset(&mascara, SIGINT);
+    sigaddset(&mascara, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mascara, NULL) == -1) {
+        return -1;
+    }
+    signal_fd = signalfd(-1, &mascara, SFD_NONBLOCK | SFD_CLOEXEC);
+    return signal_fd == -1 ? -1 : 0;
+}
+
+/**
+ * Función: atender_senales
+ *
+ * Lee las señales pendientes del signalfd y marca el fin del bucle principal.
+ */
+void atender_senales() {
+    struct signalfd_siginfo info;
     char msgbuf[100];
-    // Registramos qué señal se recibió (SIGINT o SIGTERM)
-    sprintf(msgbuf, "Recibida señal %d (%s), terminando...", sig,
-            (sig == SIGINT) ? "SIGINT" : "SIGTERM");
-    funcionLog(msgbuf, LOG_FILE);
 
-    // Enviamos un mensaje de salida al servidor para que también termine
-    if (server_queue != -1) {
-        funcionLog("Enviando mensaje de salida al servidor", LOG_FILE);
-        if (mq_send(server_queue, MSG_EXIT, strlen(MSG_EXIT) + 1, 0) == -1) {
-            sprintf(msgbuf, "Error al enviar mensaje de salida: %s", strerror(errno));
-            funcionLog(msgbuf, LOG_FILE);
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        // Registramos qué señal se recibió (SIGINT o SIGTERM)
+        sprintf(msgbuf, "Recibida señal %d (%s), terminando...", (int)info.ssi_signo,
+                (info.ssi_signo == SIGINT) ? "SIGINT" : "SIGTERM");
+        funcionLog(msgbuf, LOG_FILE);
+        senal_recibida = 1;
+        running = 0;
+    }
+}
+
+/**
+ * Función: esperar_evento
+ *
+ * Espera a que el descriptor fd tenga datos, atendiendo mientras tanto las señales.
+ *
+ * Al esperar una respuesta (hasta_senal == 0) con el modo busy-poll activado, se
+ * sondea sin bloquear hasta agotar el umbral.
+ *
+ * Parámetros:
+ *   - fd: Descriptor a vigilar (stdin, la cola del cliente o el socket)
+ *   - hasta_senal: Si es distinto de cero, vuelve en cuanto llega una señal; si no,
+ *     la registra y sigue esperando (para no perder una respuesta ya pedida)
+ *   - plazo_ms: Tiempo máximo de espera una vez recibida una señal
+ *   - fin_ns: Instante (CLOCK_MONOTONIC) en que se deja de esperar (0 = sin límite)
+ *
+ * Retorno:
+ *   - 1 si fd tiene datos, 0 si se interrumpió por una señal o venció alguno de los
+ *     plazos
+ */
+int esperar_evento(int fd, int hasta_senal, int plazo_ms, uint64_t fin_ns) {
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+    uint64_t limite = 0;
+    uint64_t fin_giro = busy_poll_ns > 0 && !hasta_senal ? ahora_ns() + busy_poll_ns : 0;
+
+    while (1) {
+        int espera = -1;
+        if (senal_recibida) {
+            if (hasta_senal) {
+                return 0;
+            }
+            uint64_t ahora = ahora_ns();
+            if (limite == 0) {
+                limite = ahora + (uint64_t)plazo_ms * 1000000ULL;
+            }
+            if (ahora >= limite) {
+                funcionLog("Vencido el plazo para recibir la respuesta pendiente", LOG_FILE);
+                return 0;
+            }
+            espera = (int)((limite - ahora) / 1000000ULL) + 1;
+        }
+        else if (fin_giro != 0 && ahora_ns() < fin_giro) {
+            espera = 0; // Busy-poll: se vuelve a sondear sin dormir
+        }
+        if (fin_ns != 0) {
+            uint64_t ahora = ahora_ns();
+            if (ahora >= fin_ns) {
+                return 0;
+            }
+            int resto = (int)((fin_ns - ahora) / 1000000ULL) + 1;
+            espera = espera == -1 || resto < espera ? resto : espera;
+        }
+
+        if (poll(fds, 2, espera) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        if (fds[1].revents & POLLIN) {
+            atender_senales();
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            return 1;
         }
     }
+}
 
-    // Limpiamos los recursos
-    cleanup();
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles del cliente.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_cliente [opciones]\n");
+    printf("Opciones:\n");
+    printf("-h, --help      Imprimir esta ayuda\n");
+    printf("-s, --socket    Conectar por el socket Unix del servidor en lugar de usar colas\n");
+    printf("-p, --prioridad (interactivo|masivo)   Carril de las peticiones (por defecto "
+           "interactivo)\n");
+    printf("-e, --estadisticas <lista>  Estadísticas a pedir, separadas por comas: bytes, "
+           "caracteres, palabras, lineas, utf8 o todas\n");
+    printf("-g, --grabar <fichero>      Grabar las peticiones y respuestas en una traza para "
+           "repetirlas con ej3_replay\n");
+    printf("-C, --cpu <n>               Fijar el cliente a la CPU n\n");
+    printf("-F, --fifo <prioridad>      Usar la política SCHED_FIFO (1-99)\n");
+    printf("-P, --busy-poll <us>        Sondear sin bloquear hasta <us> microsegundos al "
+           "esperar la respuesta\n");
+    printf("-T, --tiempos               Medir el tiempo de cada etapa de las peticiones y "
+           "mostrar el desglose al terminar\n");
+    printf("-b, --log-binario <prefijo> Escribir el log en formato binario en "
+           "<prefijo>.NNNNNN.ej3l (ver ej3_log)\n");
+    printf("-f, --fichero <ruta>        Enviar el fichero entero (\"-\" = entrada estándar) "
+           "como un flujo de fragmentos y terminar\n");
+    printf("-r, --ruta <fichero>        Enviar sólo la ruta del fichero para que el servidor lo "
+           "lea directamente, y terminar\n");
+    printf("-x, --arena <fichero>       Escribir el fichero (\"-\" = entrada estándar) en la "
+           "arena del servidor (opción -G) y terminar\n");
+    printf("-R, --reintentos <n>        Reintentos de una petición con el servidor saturado (por "
+           "defecto %d)\n",
+           REINTENTOS);
+    printf("-B, --espera-base <us>      Espera máxima antes del primer reintento; se dobla en "
+           "cada uno (por defecto %d)\n",
+           ESPERA_BASE_US);
+    printf("-D, --plazo <ms>            Plazo de cada petición para obtener la respuesta, con -e; "
+           "0 = sin plazo (por defecto %d)\n",
+           PLAZO_PETICION_MS);
+}
+
+/**
+ * Función: hay_senal
+ *
+ * Atiende las señales pendientes sin esperar.
+ *
+ * Retorno:
+ *   - 1 si se ha recibido una señal, 0 si no
+ */
+int hay_senal() {
+    struct pollfd fds = {signal_fd, POLLIN, 0};
+    if (poll(&fds, 1, 0) > 0) {
+        atender_senales();
+    }
+    return senal_recibida;
+}
+
+/**
+ * Función: espera_reintento
+ *
+ * Devuelve la espera antes del reintento número "intento" (desde 0): un valor
+ * aleatorio entre 0 y espera_base_ns * 2^intento, con un máximo de ESPERA_MAX_MS.
+ */
+uint64_t espera_reintento(int intento) {
+    static unsigned int semilla = 0;
+    if (semilla == 0) {
+        semilla = (unsigned int)(getpid() ^ ahora_ns());
+    }
+    uint64_t tope = espera_base_ns << (intento < 20 ? intento : 20);
+    if (tope > ESPERA_MAX_MS * 1000000ULL) {
+        tope = ESPERA_MAX_MS * 1000000ULL;
+    }
+    return (uint64_t)(rand_r(&semilla) / ((double)RAND_MAX + 1) * tope);
+}
 
-    // Establecemos la variable running a 0 para salir del bucle principal
-    // Esto es más elegante que llamar a exit() directamente, ya que permite
-    // que el programa termine de forma ordenada
-    running = 0;
+/**
+ * Función: esperar_reintento
+ *
+ * Duerme la espera del reintento número "intento" (ver espera_reintento()), sin
+ * pasar del instante fin_ns (0 = sin límite).
+ */
+void esperar_reintento(int intento, uint64_t fin_ns) {
+    uint64_t espera = espera_reintento(intento);
+    uint64_t ahora = ahora_ns();
+    if (fin_ns != 0 && ahora + espera > fin_ns) {
+        espera = fin_ns > ahora ? fin_ns - ahora : 0;
+    }
+    struct timespec pausa = {(time_t)(espera / 1000000000ULL), (long)(espera % 1000000000ULL)};
+    nanosleep(&pausa, NULL);
 }
 
 /**
- * Función: main
+ * Función: enviar_mensaje
+ *
+ * Envía un mensaje al servidor por el transporte activo (cola o socket) sin
+ * bloquear. Si no hay sitio, lo reintenta como mucho reintentos veces, con esperas
+ * crecientes (ver esperar_reintento()); una señal interrumpe los reintentos.
  *
- * Función principal del cliente. Abre las colas de mensajes creadas por el servidor,
- * configura los manejadores de señales y entra en un bucle para enviar mensajes
- * al servidor y recibir respuestas.
+ * Con colas, la espera entre intentos se hace dentro de mq_timedsend(), de modo
+ * que el mensaje sale en cuanto se libera un hueco en lugar de al final de la
+ * espera. Ni esas esperas ni los reintentos pasan del plazo fin_ns.
+ *
+ * Parámetros:
+ *   - mensaje, len: Mensaje a enviar y su longitud
+ *   - prio: Prioridad del mensaje (sólo se usa con colas)
+ *   - fin_ns: Instante (CLOCK_MONOTONIC) en que se abandona el envío (0 = sin plazo)
  *
  * Retorno:
- *   - EXIT_SUCCESS si el programa termina correctamente
- *   - EXIT_FAILURE si ocurre algún error
+ *   - 0 si se envió correctamente, -1 en caso de error (errno indica la causa; EAGAIN
+ *     si el servidor sigue saturado tras agotar los reintentos, ETIMEDOUT si venció
+ *     el plazo)
  */
-int main() {
-    char buffer[MAX_SIZE]; // Buffer para almacenar mensajes enviados/recibidos
-    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
-    unsigned int prio = 1; // Prioridad para recepción de mensajes
+int enviar_mensaje(const char *mensaje, size_t len, unsigned int prio, uint64_t fin_ns) {
+    for (int intento = 0;; intento++) {
+        int r;
+        if (socket_fd != -1) {
+            r = send(socket_fd, mensaje, len, MSG_NOSIGNAL | MSG_DONTWAIT) == -1 ? -1 : 0;
+        }
+        else {
+            // El primer intento no espera; los siguientes, lo que tocaría dormir
+            uint64_t limite = intento == 0 ? 0 : ahora_ns() + espera_reintento(intento - 1);
+            struct timespec ts;
+            instante_absoluto(fin_ns != 0 && fin_ns < limite ? fin_ns : limite, &ts);
+            r = mq_timedsend(server_queue, mensaje, len, prio, &ts);
+            if (r == -1 && errno == ETIMEDOUT) {
+                errno = EAGAIN; // Sigue sin haber sitio: como un envío sin bloqueo
+            }
+        }
+        if (r == 0 || errno != EAGAIN) {
+            return r;
+        }
+        if (fin_ns != 0 && ahora_ns() >= fin_ns) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (intento >= reintentos) {
+            return -1;
+        }
+        if (hay_senal()) {
+            errno = EINTR;
+            return -1;
+        }
+        if (socket_fd != -1) {
+            esperar_reintento(intento, fin_ns);
+        }
+    }
+}
 
-    // Configuramos los manejadores de señales
-    // SIGINT (Ctrl+C) y SIGTERM son señales comunes para terminar procesos
-    if (signal(SIGINT, handle_signal) == SIG_ERR) {
-        funcionLog("Error al establecer el manejador de SIGINT", LOG_FILE);
-        return EXIT_FAILURE;
+/**
+ * Función: recibir_respuesta
+ *
+ * Recibe una respuesta del servidor por el transporte activo (cola o socket).
+ * Se llama cuando poll() indica que hay una, pero con colas otro proceso de la
+ * misma partición puede habérsela llevado antes: la espera no pasa del plazo
+ * fin_ns (0 = sin plazo).
+ *
+ * Retorno:
+ *   - Número de bytes recibidos, o -1 en caso de error (errno indica la causa;
+ *     ETIMEDOUT si venció el plazo). En modo socket, 0 indica que el servidor
+ *     cerró la conexión.
+ */
+ssize_t recibir_respuesta(char *buffer, size_t max, uint64_t fin_ns) {
+    unsigned int prio; // Prioridad del mensaje recibido (no se utiliza)
+    if (socket_fd != -1) {
+        return recv(socket_fd, buffer, max, 0);
     }
+    if (fin_ns != 0) {
+        struct timespec ts;
+        instante_absoluto(fin_ns, &ts);
+        return mq_timedreceive(client_queue, buffer, max, &prio, &ts);
+    }
+    return mq_receive(client_queue, buffer, max, &prio);
+}
 
-    if (signal(SIGTERM, handle_signal) == SIG_ERR) {
-        funcionLog("Error al establecer el manejador de SIGTERM", LOG_FILE);
-        return EXIT_FAILURE;
+/**
+ * Función: esperar_respuesta_unica
+ *
+ * Espera la respuesta a la única petición de los modos -f, -r y -x, la registra y
+ * calcula el tiempo transcurrido desde inicio.
+ *
+ * Retorno:
+ *   - 0 si se recibió la respuesta, -1 en caso de error
+ */
+int esperar_respuesta_unica(char *buffer, uint64_t inicio, double *segundos) {
+    char msgbuf[MAX_SIZE + 100];
+    int fd_respuesta = socket_fd != -1 ? socket_fd : (int)client_queue;
+
+    if (!esperar_evento(fd_respuesta, 0, PLAZO_RESPUESTA_MS, 0)) {
+        return -1;
+    }
+    ssize_t bytes_read = recibir_respuesta(buffer, tam_mensaje, 0);
+    if (bytes_read <= 0) {
+        sprintf(msgbuf, "Error al recibir respuesta: %s",
+                bytes_read == 0 ? "el servidor cerró la conexión" : strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return -1;
     }
+    *segundos = (ahora_ns() - inicio) / 1e9;
+    buffer[bytes_read] = '\0';
+
+    snprintf(msgbuf, sizeof(msgbuf), "Respuesta del servidor: %s",
+             proto_texto_respuesta(buffer, bytes_read));
+    funcionLogEvento(EVENTO_RESPUESTA, msgbuf, LOG_FILE);
+    return 0;
+}
+
+/**
+ * Función: enviar_flujo
+ *
+ * Envía el contenido de un fichero (o de la entrada estándar) como un flujo de
+ * fragmentos y espera la respuesta del servidor. Cada fragmento llena un mensaje
+ * entero, y los datos se leen directamente en su sitio dentro del mensaje, así que
+ * no hay más copias que las del propio read() y mq_send(). Como el servidor sólo
+ * responde al último, el envío no espera a nadie más que al espacio libre en la
+ * cola.
+ *
+ * Parámetros:
+ *   - ruta: Fichero a enviar, o "-" para la entrada estándar
+ *   - buffer: Buffer de tam_mensaje + 1 bytes para la respuesta
+ *   - mensaje: Buffer de tam_mensaje bytes para componer los fragmentos
+ *
+ * Retorno:
+ *   - 0 si se recibió la respuesta, -1 en caso de error
+ */
+int enviar_flujo(const char *ruta, char *buffer, char *mensaje) {
+    char msgbuf[MAX_SIZE];
+    size_t max = tam_mensaje;
+    size_t hueco = proto_hueco_fragmento();
+    uint64_t id = ((uint64_t)getpid() << 32) ^ (uint32_t)ahora_ns();
+    uint64_t offset = 0, fragmentos = 0;
+
+    int fd = strcmp(ruta, "-") == 0 ? STDIN_FILENO : open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        sprintf(msgbuf, "Error al abrir %.200s: %s", ruta, strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return -1;
+    }
+    snprintf(msgbuf, sizeof(msgbuf), "Enviando %.200s como el flujo %016lx", ruta,
+             (unsigned long)id);
+    funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+
+    uint64_t inicio = ahora_ns();
+    int final = 0, resultado = 0;
+    while (!final) {
+        // Llenamos el fragmento entero: read() puede devolver menos (una tubería)
+        size_t len = 0;
+        ssize_t n = 1;
+        while (len < max - hueco && (n = read(fd, mensaje + hueco + len, max - hueco - len)) > 0) {
+            len += n;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            sprintf(msgbuf, "Error al leer %.200s: %s", ruta, strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            resultado = -1;
+            break;
+        }
+        final = n == 0; // Fin del fichero (el último fragmento puede ir vacío)
+
+        size_t longitud = proto_preparar_fragmento(mensaje, max, estadisticas, id, offset, final,
+                                                   mensaje + hueco, len);
+        // Un flujo no se abandona a medias por estar el servidor ocupado: se sigue
+        // reintentando mientras no llegue una señal
+        int r;
+        while ((r = enviar_mensaje(mensaje, longitud, prioridad_envio, 0)) == -1 &&
+               errno == EAGAIN) {
+        }
+        if (r == -1) {
+            sprintf(msgbuf, "Error al enviar fragmento: %s", strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            resultado = -1;
+            break;
+        }
+        offset += len;
+        fragmentos++;
+
+        // No miramos el signalfd en cada fragmento: basta con no tardar en notar Ctrl+C
+        if (fragmentos % 64 == 0 && hay_senal()) {
+            funcionLog("Envío del flujo interrumpido", LOG_FILE);
+            resultado = -1;
+            break;
+        }
+    }
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (resultado == -1) {
+        return -1;
+    }
+
+    // Una sola respuesta para todo el flujo
+    double segundos;
+    if (esperar_respuesta_unica(buffer, inicio, &segundos) == -1) {
+        return -1;
+    }
+    printf("Flujo de %lu bytes en %lu fragmentos: %.3f s, %.1f MB/s\n", (unsigned long)offset,
+           (unsigned long)fragmentos, segundos, segundos > 0 ? offset / segundos / 1e6 : 0.0);
+    return 0;
+}
+
+/**
+ * Función: enviar_ruta
+ *
+ * Pide las estadísticas de un fichero enviando sólo su ruta absoluta: el servidor
+ * lo lee directamente (ver ej3_fichero.h), así que tiene que poder acceder a él.
+ *
+ * Retorno:
+ *   - 0 si se recibió la respuesta, -1 en caso de error
+ */
+int enviar_ruta(const char *ruta, char *buffer, char *mensaje) {
+    char msgbuf[MAX_SIZE];
+    char absoluta[PATH_MAX];
+    struct stat st;
+
+    if (realpath(ruta, absoluta) == NULL || stat(absoluta, &st) == -1) {
+        sprintf(msgbuf, "Error al buscar %.200s: %s", ruta, strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return -1;
+    }
+    size_t longitud = proto_preparar_ruta(mensaje, tam_mensaje, estadisticas, absoluta);
+    if (longitud == 0) {
+        funcionLog("La ruta no cabe en la cola junto con la cabecera", LOG_FILE);
+        return -1;
+    }
+    snprintf(msgbuf, sizeof(msgbuf), "Enviando la ruta %.200s", absoluta);
+    funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+
+    uint64_t inicio = ahora_ns();
+    if (enviar_mensaje(mensaje, longitud, prioridad_envio, 0) == -1) {
+        sprintf(msgbuf, "Error al enviar mensaje: %s", strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return -1;
+    }
+    double segundos;
+    if (esperar_respuesta_unica(buffer, inicio, &segundos) == -1) {
+        return -1;
+    }
+    printf("Fichero de %lu bytes: %.3f s, %.1f MB/s\n", (unsigned long)st.st_size, segundos,
+           segundos > 0 ? st.st_size / segundos / 1e6 : 0.0);
+    return 0;
+}
+
+/**
+ * Función: enviar_arena
+ *
+ * Escribe el contenido de un fichero (o de la entrada estándar) en un slot de la
+ * arena del servidor y le envía sólo el descriptor. El slot pasa a ser del
+ * servidor al enviar el descriptor: es él quien lo libera al terminar.
+ *
+ * Retorno:
+ *   - 0 si se recibió la respuesta, -1 en caso de error
+ */
+int enviar_arena(const char *ruta, char *buffer, char *mensaje) {
+    char msgbuf[MAX_SIZE];
+
+    if (arena_abrir(&arena_actual) == -1) {
+        sprintf(msgbuf, "No se pudo abrir la arena del servidor (opción -G): %s",
+                strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    // Si todos los slots están ocupados, esperamos a que el servidor libere alguno
+    int slot;
+    uint64_t limite = ahora_ns() + (uint64_t)PLAZO_RESPUESTA_MS * 1000000ULL;
+    while ((slot = arena_tomar(&arena_actual)) == -1 && ahora_ns() < limite) {
+        struct timespec pausa = {0, 100000};
+        nanosleep(&pausa, NULL);
+    }
+    if (slot == -1) {
+        funcionLogEvento(EVENTO_ERROR, "No hay ningún slot libre en la arena", LOG_FILE);
+        arena_cerrar(&arena_actual, 0);
+        return -1;
+    }
+
+    // Leemos el fichero directamente en el slot
+    struct ej3_descriptor d = {(uint32_t)slot, arena_generacion(&arena_actual, slot), 0, 0};
+    char *datos = arena_slot_datos(&arena_actual, slot);
+    size_t tam_slot = arena_actual.cabecera->tam_slot;
+    int fd = strcmp(ruta, "-") == 0 ? STDIN_FILENO : open(ruta, O_RDONLY | O_CLOEXEC);
+    ssize_t n = fd == -1 ? -1 : 1;
+    char sobra;
+    while (n > 0 && d.longitud < tam_slot) {
+        n = read(fd, datos + d.longitud, tam_slot - d.longitud);
+        d.longitud += n > 0 ? (uint64_t)n : 0;
+    }
+    if (n > 0) {
+        n = read(fd, &sobra, 1) == 0 ? 0 : -2; // Sólo cabe si ya no queda nada
+    }
+    if (fd > STDIN_FILENO) {
+        close(fd);
+    }
+    if (n < 0) {
+        if (n == -2) {
+            snprintf(msgbuf, sizeof(msgbuf), "%.200s no cabe en un slot de la arena (%lu KiB)",
+                     ruta, (unsigned long)(tam_slot >> 10));
+        }
+        else {
+            snprintf(msgbuf, sizeof(msgbuf), "Error al leer %.200s: %s", ruta, strerror(errno));
+        }
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        arena_liberar(&arena_actual, slot);
+        arena_cerrar(&arena_actual, 0);
+        return -1;
+    }
+
+    size_t longitud = proto_preparar_descriptor(mensaje, tam_mensaje, estadisticas, &d);
+    snprintf(msgbuf, sizeof(msgbuf), "Enviando %.200s por la arena (slot %d, %lu bytes)", ruta,
+             slot, (unsigned long)d.longitud);
+    funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+
+    uint64_t inicio = ahora_ns();
+    int resultado = -1;
+    double segundos;
+    if (enviar_mensaje(mensaje, longitud, prioridad_envio, 0) == -1) {
+        sprintf(msgbuf, "Error al enviar mensaje: %s", strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        arena_liberar(&arena_actual, slot);
+    }
+    else if (esperar_respuesta_unica(buffer, inicio, &segundos) == 0) {
+        printf("Texto de %lu bytes por la arena: %.3f s, %.1f MB/s\n", (unsigned long)d.longitud,
+               segundos, segundos > 0 ? d.longitud / segundos / 1e6 : 0.0);
+        resultado = 0;
+    }
+    arena_cerrar(&arena_actual, 0);
+    return resultado;
+}
+
+/**
+ * Función: pedir
+ *
+ * Envía una petición y deja su respuesta en buffer. Si el servidor responde que
+ * está ocupado, la vuelve a enviar tras una espera (ver esperar_reintento()), como
+ * mucho reintentos veces; agotados los reintentos, se devuelve la respuesta de
+ * ocupado. Ni el envío, ni la espera de la respuesta, ni los reintentos pasan del
+ * plazo de la petición.
+ *
+ * Parámetros:
+ *   - mensaje, longitud: Petición ya compuesta (con el plazo, si lleva cabecera)
+ *   - plazo: Instante (CLOCK_MONOTONIC) en que se abandona la petición (0 = sin plazo)
+ *   - buffer: Buffer de tam_mensaje + 1 bytes para la respuesta
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta, -2 si venció el plazo sin respuesta, o -1 si
+ *     hay que terminar (por un error, ya registrado, porque el servidor cerró la
+ *     conexión o por una señal)
+ */
+ssize_t pedir(char *mensaje, size_t longitud, uint64_t plazo, char *buffer) {
+    char msgbuf[MAX_SIZE];
+    int fd_respuesta = socket_fd != -1 ? socket_fd : (int)client_queue;
+
+    for (int intento = 0;; intento++) {
+        proto_marcar(mensaje, longitud, offsetof(struct ej3_tiempos, envio));
+        if (enviar_mensaje(mensaje, longitud, prioridad_envio, plazo) == -1) {
+            if (errno == ETIMEDOUT) {
+                funcionLogEvento(EVENTO_ERROR, "Vencido el plazo de la petición sin poder enviarla",
+                                 LOG_FILE);
+                return -2;
+            }
+            sprintf(msgbuf, "Error al enviar mensaje: %s",
+                    errno == EAGAIN ? "la cola del servidor sigue llena" : strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            return -1;
+        }
+
+        // Esperamos la respuesta del servidor. Si llega una señal mientras tanto, se sigue
+        // esperando (como mucho PLAZO_RESPUESTA_MS) para no abandonar la petición en curso.
+        // La respuesta tardía de una petición anterior que ya venció lleva otro plazo, y se
+        // descarta
+        ssize_t bytes_read;
+        while (1) {
+            if (!esperar_evento(fd_respuesta, 0, PLAZO_RESPUESTA_MS, plazo)) {
+                if (senal_recibida) {
+                    return -1;
+                }
+                errno = ETIMEDOUT;
+                bytes_read = -1;
+                break;
+            }
+            bytes_read = recibir_respuesta(buffer, tam_mensaje, plazo);
+            uint64_t plazo_respuesta = bytes_read > 0 ? proto_plazo(buffer, bytes_read) : 0;
+            if (plazo_respuesta == 0 || plazo_respuesta == plazo) {
+                break;
+            }
+            funcionLog("Descartada la respuesta tardía de una petición anterior", LOG_FILE);
+        }
+
+        // En modo socket, 0 bytes significa que el servidor cerró la conexión
+        if (bytes_read == 0 && socket_fd != -1) {
+            funcionLog("El servidor cerró la conexión", LOG_FILE);
+            return -1;
+        }
+
+        // Verificamos si hubo error en la recepción
+        if (bytes_read < 0 && errno == ETIMEDOUT) {
+            funcionLogEvento(EVENTO_ERROR, "Vencido el plazo de la petición sin recibir respuesta",
+                             LOG_FILE);
+            return -2;
+        }
+        if (bytes_read < 0) {
+            sprintf(msgbuf, "Error al recibir respuesta: %s", strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            return -1;
+        }
+
+        if (!proto_es_ocupado(buffer, bytes_read) || intento >= reintentos || senal_recibida) {
+            return bytes_read;
+        }
+        funcionLog("Servidor ocupado, se reintenta la petición", LOG_FILE);
+        esperar_reintento(intento, plazo);
+    }
+}
+
+/**
+ * Función: abrir_socket
+ *
+ * Conecta con el socket del servidor (modo -s/--socket).
+ *
+ * Retorno:
+ *   - 0 si la conexión se estableció, -1 en caso de error
+ */
+int abrir_socket() {
+    char msgbuf[MAX_SIZE];
+    char socket_path[100];
+    get_queue_name(socket_path, SERVER_SOCKET);
+
+    sprintf(msgbuf, "La ruta del socket del servidor es: %s", socket_path);
+    funcionLog(msgbuf, LOG_FILE);
+
+    socket_fd = conectar_socket_cliente(socket_path);
+    if (socket_fd == -1) {
+        sprintf(msgbuf, "Error al conectar con el servidor: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        funcionLog("Asegúrese de que el servidor está en ejecución con la opción -s", LOG_FILE);
+        return -1;
+    }
+
+    // El servidor recibe mensajes de hasta -z bytes (nunca menos de MAX_SIZE)
+    size_t tam = leer_tam_socket();
+    if (tam >= MAX_SIZE) {
+        tam_mensaje = tam;
+    }
+    return 0;
+}
+
+/**
+ * Función: abrir_colas
+ *
+ * Abre las colas de mensajes creadas por el servidor.
+ *
+ * Retorno:
+ *   - 0 si ambas colas se abrieron, -1 en caso de error
+ */
+int abrir_colas() {
+    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
+
+    // Si el servidor reparte las colas en particiones, elegimos la nuestra a partir
+    // del PID (ver contar_shards() y shard_de_pid())
+    int num_shards = contar_shards();
+    if (num_shards == 0) {
+        funcionLog("No se encontró la cola del servidor", LOG_FILE);
+        funcionLog("Asegúrese de que el servidor está en ejecución", LOG_FILE);
+        return -1;
+    }
+    int shard = shard_de_pid(getpid(), num_shards);
 
     // Obtenemos nombres únicos para las colas basados en el nombre de usuario
-    char server_queue_name[100];
-    char client_queue_name[100];
-    get_queue_name(server_queue_name, SERVER_QUEUE);
-    get_queue_name(client_queue_name, CLIENT_QUEUE);
+    char server_queue_name[120];
+    char client_queue_name[120];
+    get_shard_name(server_queue_name, SERVER_QUEUE, shard, num_shards);
+    get_shard_name(client_queue_name, CLIENT_QUEUE, shard, num_shards);
 
     // Registramos los nombres de las colas en el log
     sprintf(msgbuf, "El nombre de la cola del servidor es: %s", server_queue_name);
@@ -155,7 +877,7 @@ int main() {
         sprintf(msgbuf, "Error al abrir la cola del servidor: %s", strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
         funcionLog("Asegúrese de que el servidor está en ejecución", LOG_FILE);
-        return EXIT_FAILURE;
+        return -1;
     }
 
     sprintf(msgbuf, "El descriptor de la cola del servidor es: %d", server_queue);
@@ -169,14 +891,190 @@ int main() {
         funcionLog(msgbuf, LOG_FILE);
         // Si hay error, cerramos la cola del servidor que ya habíamos abierto
         mq_close(server_queue);
-        return EXIT_FAILURE;
+        return -1;
     }
 
     sprintf(msgbuf, "El descriptor de la cola del cliente es: %d", client_queue);
     funcionLog(msgbuf, LOG_FILE);
 
-    // Mostramos instrucciones al usuario
-    funcionLog("Mandando mensajes al servidor (escribir \"exit\" para parar):", LOG_FILE);
+    // El tamaño de mensaje lo decide el servidor al crear las colas
+    struct mq_attr attr;
+    if (mq_getattr(client_queue, &attr) == 0) {
+        tam_mensaje = attr.mq_msgsize;
+    }
+    return 0;
+}
+
+/**
+ * Función: main
+ *
+ * Función principal del cliente. Abre las colas de mensajes creadas por el servidor
+ * (o se conecta a su socket con la opción -s), prepara el signalfd para las señales
+ * y entra en un bucle para enviar mensajes al servidor y recibir respuestas.
+ *
+ * Retorno:
+ *   - EXIT_SUCCESS si el programa termina correctamente
+ *   - EXIT_FAILURE si ocurre algún error
+ */
+int main(int argc, char *argv[]) {
+    char *buffer;          // Buffer para almacenar mensajes enviados/recibidos
+    char *peticion;        // Buffer para componer las peticiones con cabecera (-e)
+    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
+    int opt;
+    int socket_flag = 0; // Indica si se especificó la opción -s/--socket
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"socket", no_argument, 0, 's'},
+                                           {"prioridad", required_argument, 0, 'p'},
+                                           {"estadisticas", required_argument, 0, 'e'},
+                                           {"grabar", required_argument, 0, 'g'},
+                                           {"log-binario", required_argument, 0, 'b'},
+                                           {"cpu", required_argument, 0, 'C'},
+                                           {"fifo", required_argument, 0, 'F'},
+                                           {"busy-poll", required_argument, 0, 'P'},
+                                           {"tiempos", no_argument, 0, 'T'},
+                                           {"fichero", required_argument, 0, 'f'},
+                                           {"ruta", required_argument, 0, 'r'},
+                                           {"arena", required_argument, 0, 'x'},
+                                           {"reintentos", required_argument, 0, 'R'},
+                                           {"espera-base", required_argument, 0, 'B'},
+                                           {"plazo", required_argument, 0, 'D'},
+                                           {0, 0, 0, 0}};
+    int carril;
+    const char *ruta_traza = NULL;
+    const char *ruta_flujo = NULL;
+    const char *ruta_fichero = NULL;
+    const char *ruta_arena = NULL;
+
+    while ((opt = getopt_long(argc, argv, "hsp:e:g:b:C:F:P:Tf:r:x:R:B:D:", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 's':
+            socket_flag = 1;
+            break;
+        case 'p':
+            carril = carril_por_nombre(optarg);
+            if (carril == -1 || carril == CARRIL_CONTROL) {
+                printf("Prioridad no válida: %s\n", optarg);
+                print_help();
+                return EXIT_FAILURE;
+            }
+            prioridad_envio = prioridad_de_carril(carril);
+            break;
+        case 'e':
+            estadisticas = proto_estadisticas_por_nombre(optarg);
+            if (estadisticas == 0) {
+                printf("Lista de estadísticas no válida: %s\n", optarg);
+                print_help();
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'g':
+            ruta_traza = optarg;
+            break;
+        case 'b':
+            if (registro_activar(optarg, 0) == -1) {
+                printf("No se pudo crear el log binario %s: %s\n", optarg, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            if (fijar_cpu(atoi(optarg)) == -1) {
+                printf("No se pudo fijar el cliente a la CPU %s: %s\n", optarg, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            if (fijar_fifo(atoi(optarg)) == -1) {
+                printf("No se pudo usar SCHED_FIFO: %s\n", strerror(errno));
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            busy_poll_ns = (uint64_t)atol(optarg) * 1000;
+            break;
+        case 'T':
+            con_tiempos = 1;
+            break;
+        case 'f':
+            ruta_flujo = optarg;
+            break;
+        case 'r':
+            ruta_fichero = optarg;
+            break;
+        case 'x':
+            ruta_arena = optarg;
+            break;
+        case 'R':
+            reintentos = atoi(optarg);
+            break;
+        case 'B':
+            espera_base_ns = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        case 'D':
+            plazo_peticion_ns = strtoull(optarg, NULL, 10) * 1000000;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Los tiempos, los flujos, las rutas y los descriptores de la arena viajan con la
+    // cabecera binaria: sin -e se piden sólo los caracteres
+    int una_peticion = ruta_flujo != NULL || ruta_fichero != NULL || ruta_arena != NULL;
+    if ((con_tiempos || una_peticion) && estadisticas == 0) {
+        estadisticas = EST_CARACTERES;
+    }
+
+    // Recibimos SIGINT (Ctrl+C) y SIGTERM por un signalfd en lugar de con un manejador
+    if (preparar_senales() == -1) {
+        funcionLog("Error al preparar el tratamiento de señales", LOG_FILE);
+        return EXIT_FAILURE;
+    }
+
+    // Sin buffer en stdin: poll() sólo ve lo que aún no se ha leído del descriptor, así
+    // que fgets() no debe adelantar líneas a un buffer interno
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    // Abrimos el transporte elegido: socket Unix o colas de mensajes
+    if (socket_flag ? abrir_socket() == -1 : abrir_colas() == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // Creamos la traza si se pidió grabar el tráfico
+    if (ruta_traza != NULL && traza_crear(&traza, ruta_traza) == -1) {
+        sprintf(msgbuf, "Error al crear la traza %s: %s", ruta_traza, strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // Reservamos el buffer con un byte más para poder cerrar siempre la cadena
+    buffer = malloc(tam_mensaje + 1);
+    peticion = malloc(tam_mensaje);
+    if (buffer == NULL || peticion == NULL) {
+        funcionLog("Error al reservar memoria para el buffer", LOG_FILE);
+        cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // Con -f, -r o -x se envía el fichero (o su ruta) y se termina, sin leer líneas
+    int resultado = EXIT_SUCCESS;
+    if (una_peticion) {
+        int r = ruta_flujo != NULL     ? enviar_flujo(ruta_flujo, buffer, peticion)
+                : ruta_fichero != NULL ? enviar_ruta(ruta_fichero, buffer, peticion)
+                                       : enviar_arena(ruta_arena, buffer, peticion);
+        resultado = r == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        running = 0;
+    }
+    else {
+        // Mostramos instrucciones al usuario
+        funcionLog("Mandando mensajes al servidor (escribir \"exit\" para parar):", LOG_FILE);
+    }
 
     // Bucle principal del cliente
     // El cliente se ejecuta hasta que el usuario escriba "exit" o se reciba una señal
@@ -185,8 +1083,13 @@ int main() {
         printf("> ");
         fflush(stdout); // Forzamos la salida del buffer para que se muestre el prompt
 
+        // Esperamos a que haya entrada o llegue una señal
+        if (!esperar_evento(STDIN_FILENO, 1, 0, 0)) {
+            break;
+        }
+
         // Leemos una línea de la entrada estándar (teclado)
-        if (fgets(buffer, MAX_SIZE, stdin) == NULL) {
+        if (fgets(buffer, tam_mensaje, stdin) == NULL) {
             // Verificamos si llegamos al final de la entrada (Ctrl+D)
             if (feof(stdin)) {
                 funcionLog("Fin de entrada estándar, terminando...", LOG_FILE);
@@ -216,7 +1119,7 @@ int main() {
         if (strcmp(buffer, MSG_EXIT) == 0) {
             funcionLog("Enviando mensaje de salida, terminando...", LOG_FILE);
             // Enviamos el mensaje de salida al servidor
-            if (mq_send(server_queue, buffer, strlen(buffer) + 1, 0) == -1) {
+            if (enviar_mensaje(buffer, strlen(buffer) + 1, PRIO_CONTROL, 0) == -1) {
                 sprintf(msgbuf, "Error al enviar mensaje: %s", strerror(errno));
                 funcionLog(msgbuf, LOG_FILE);
             }
@@ -224,44 +1127,80 @@ int main() {
         }
 
         // Registramos el mensaje que vamos a enviar
-        sprintf(msgbuf, "Enviando mensaje: %s", buffer);
-        funcionLog(msgbuf, LOG_FILE);
+        snprintf(msgbuf, sizeof(msgbuf), "Enviando mensaje: %s", buffer);
+        funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
 
-        // Enviamos el mensaje al servidor
-        // Parámetros:
-        // - server_queue: Descriptor de la cola
-        // - buffer: Mensaje a enviar
-        // - strlen(buffer) + 1: Longitud del mensaje (incluyendo el carácter nulo)
-        // - 0: Prioridad del mensaje (0 es la más baja)
-        if (mq_send(server_queue, buffer, strlen(buffer) + 1, 0) == -1) {
-            sprintf(msgbuf, "Error al enviar mensaje: %s", strerror(errno));
-            funcionLog(msgbuf, LOG_FILE);
+        // Enviamos el mensaje al servidor: el texto plano (incluyendo el carácter nulo) o,
+        // si se pidieron estadísticas con -e, la cabecera binaria seguida del texto. Se
+        // compone aparte porque la respuesta se recibe en buffer y, si el servidor está
+        // ocupado, hay que volver a enviarlo. El plazo empieza a contar ahora, y sólo lo
+        // hay con la cabecera: es la que permite reconocer (y descartar) una respuesta tardía
+        uint64_t plazo = plazo_peticion_ns != 0 && estadisticas != 0
+                             ? ahora_ns() + plazo_peticion_ns
+                             : 0;
+        size_t longitud = len + 1;
+        if (estadisticas != 0) {
+            longitud = proto_preparar_peticion(peticion, tam_mensaje, estadisticas, con_tiempos,
+                                               plazo, buffer, len);
+            if (longitud == 0) {
+                funcionLog("El mensaje no cabe en la cola junto con la cabecera", LOG_FILE);
+                continue;
+            }
+        }
+        else {
+            memcpy(peticion, buffer, longitud);
+        }
+        if (traza.f != NULL) {
+            traza_escribir(&traza, TRAZA_PETICION, prioridad_envio, peticion, longitud);
+        }
+        ssize_t bytes_read = pedir(peticion, longitud, plazo, buffer);
+        if (bytes_read == -2) {
+            continue; // Se abandona esta petición (ya registrado), pero no las siguientes
+        }
+        if (bytes_read == -1) {
             break; // Salimos del bucle en caso de error
         }
+        if (con_tiempos) {
+            struct ej3_tiempos t;
+            proto_marcar(buffer, bytes_read, offsetof(struct ej3_tiempos, recepcion));
+            if (proto_tiempos(buffer, bytes_read, &t) == 0) {
+                etapas_anotar(&t);
+            }
+        }
 
-        // Recibimos la respuesta del servidor
-        // mq_receive es una llamada bloqueante: el proceso se detendrá aquí hasta que
-        // llegue un mensaje o se produzca un error
-        ssize_t bytes_read = mq_receive(client_queue, buffer, MAX_SIZE, &prio);
-
-        // Verificamos si hubo error en la recepción
-        if (bytes_read < 0) {
-            sprintf(msgbuf, "Error al recibir respuesta: %s", strerror(errno));
-            funcionLog(msgbuf, LOG_FILE);
-            break; // Salimos del bucle en caso de error
+        if (traza.f != NULL) {
+            traza_escribir(&traza, TRAZA_RESPUESTA, 0, buffer, bytes_read);
         }
 
         // Aseguramos que el buffer termine con un carácter nulo
         buffer[bytes_read] = '\0';
 
         // Registramos la respuesta recibida
-        sprintf(msgbuf, "Respuesta del servidor: %s", buffer);
-        funcionLog(msgbuf, LOG_FILE);
+        snprintf(msgbuf, sizeof(msgbuf), "Respuesta del servidor: %s",
+                 proto_texto_respuesta(buffer, bytes_read));
+        funcionLogEvento(EVENTO_RESPUESTA, msgbuf, LOG_FILE);
+    }
+
+    // Si terminamos por una señal, pedimos también al servidor que termine, como al
+    // escribir "exit" (en modo socket basta con cerrar la conexión en cleanup())
+    if (senal_recibida && server_queue != -1) {
+        funcionLog("Enviando mensaje de salida al servidor", LOG_FILE);
+        if (enviar_mensaje(MSG_EXIT, strlen(MSG_EXIT) + 1, PRIO_CONTROL, 0) == -1) {
+            sprintf(msgbuf, "Error al enviar mensaje de salida: %s", strerror(errno));
+            funcionLog(msgbuf, LOG_FILE);
+        }
     }
 
     // Limpiamos los recursos antes de terminar
     cleanup();
+    close(signal_fd);
+    traza_cerrar(&traza);
+    free(buffer);
+    if (con_tiempos) {
+        etapas_imprimir();
+    }
+    free(peticion);
 
-    // Terminamos el programa con éxito
-    return EXIT_SUCCESS;
+    // Terminamos el programa (con éxito salvo que fallara el envío del flujo)
+    return resultado;
 }
@@ -13,16 +13,25 @@
 #ifndef EJ3_COMMON_H
 #define EJ3_COMMON_H
 
-#include <errno.h>     // Para códigos de error (errno)
-#include <mqueue.h>    // Para funciones de colas de mensajes POSIX (mq_*)
-#include <signal.h>    // Para manejo de señales
-#include <stdio.h>     // Para funciones de entrada/salida estándar
-#include <stdlib.h>    // Para funciones como exit(), getenv()
-#include <string.h>    // Para funciones de manejo de cadenas
-#include <sys/stat.h>  // Para constantes de modo de archivos (permisos)
-#include <sys/types.h> // Para tipos como pid_t
-#include <time.h>      // Para funciones de manejo de tiempo
-#include <unistd.h>    // Para funciones POSIX básicas
+// Necesario para extensiones de Linux/glibc (accept4, epoll, signalfd...)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>        // Para códigos de error (errno)
+#include <mqueue.h>       // Para funciones de colas de mensajes POSIX (mq_*)
+#include <sched.h>        // Para fijar la CPU y la política de planificación
+#include <signal.h>       // Para manejo de señales
+#include <stdatomic.h>    // Para el nivel del log, que se cambia con el programa en marcha
+#include <stdint.h>       // Para tipos enteros de tamaño fijo (uint64_t)
+#include <stdio.h>        // Para funciones de entrada/salida estándar
+#include <stdlib.h>       // Para funciones como exit(), getenv()
+#include <string.h>       // Para funciones de manejo de cadenas
+#include <sys/resource.h> // Para getrlimit() y RLIMIT_MSGQUEUE
+#include <sys/stat.h>     // Para constantes de modo de archivos (permisos)
+#include <sys/types.h>    // Para tipos como pid_t
+#include <time.h>         // Para funciones de manejo de tiempo
+#include <unistd.h>       // Para funciones POSIX básicas
 
 /**
  * Nombres base para las colas de mensajes
@@ -42,6 +51,22 @@
  */
 #define MAX_SIZE 1024
 
+/**
+ * Tamaño mínimo de mensaje de las colas
+ *
+ * Por debajo no cabría la respuesta binaria más larga sin su línea de texto
+ * (cabecera, tiempos, plazo y resultado): el cliente no recibiría nada.
+ */
+#define MIN_SIZE 256
+
+/**
+ * Directorio con los límites del sistema para las colas de mensajes
+ *
+ * - msg_max: Máximo de mensajes por cola que puede pedir un usuario sin privilegios
+ * - msgsize_max: Tamaño máximo de mensaje que puede pedir un usuario sin privilegios
+ */
+#define MQUEUE_PROC "/proc/sys/fs/mqueue"
+
 /**
  * Mensaje de salida
  *
@@ -51,6 +76,11 @@
  */
 #define MSG_EXIT "exit"
 
+/**
+ * Número máximo de particiones (shards) de las colas del servidor
+ */
+#define MAX_SHARDS 64
+
 /**
  * Función: get_queue_name
  *
@@ -79,25 +109,141 @@ void get_queue_name(char *queue_name, const char *base_name) {
 }
 
 /**
- * Función: funcionLog
+ * Función: get_shard_name
+ *
+ * Genera el nombre de la cola de una partición (shard) del servidor.
+ *
+ * Con una sola partición se usa el nombre de siempre (/server_queue-usuario), de
+ * modo que los programas que no conocen las particiones siguen funcionando. Con
+ * varias, cada partición k tiene su propio par de colas: /server_queue-usuario-k
+ * y /client_queue-usuario-k.
+ *
+ * Parámetros:
+ *   - queue_name: Buffer donde se almacenará el nombre generado
+ *   - base_name: Nombre base de la cola (SERVER_QUEUE o CLIENT_QUEUE)
+ *   - shard: Número de partición (0 a num_shards - 1)
+ *   - num_shards: Número total de particiones
+ */
+void get_shard_name(char *queue_name, const char *base_name, int shard, int num_shards) {
+    get_queue_name(queue_name, base_name);
+    if (num_shards > 1) {
+        sprintf(queue_name + strlen(queue_name), "-%d", shard);
+    }
+}
+
+/**
+ * Función: shard_de_pid
+ *
+ * Elige la partición de un cliente a partir de su PID. Se usa una dispersión
+ * multiplicativa para que PIDs consecutivos no caigan siempre en particiones
+ * consecutivas.
+ */
+int shard_de_pid(pid_t pid, int num_shards) {
+    return num_shards > 1 ? (int)(((uint32_t)pid * 2654435761u) % (uint32_t)num_shards) : 0;
+}
+
+/**
+ * Tipos de evento del log
+ *
+ * Sólo se guardan en el log binario (ver ej3_registro.h), donde permiten filtrar
+ * los eventos al leerlo; en el log de texto no se distinguen.
+ */
+#define EVENTO_INFO 0      // Mensajes generales
+#define EVENTO_PETICION 1  // Petición enviada o recibida
+#define EVENTO_RESPUESTA 2 // Respuesta enviada o recibida
+#define EVENTO_ERROR 3     // Errores
+#define NUM_EVENTOS 4
+
+/**
+ * Niveles del log
+ *
+ * Con cada nivel se registran los eventos de los anteriores y los suyos. En el
+ * servidor se puede cambiar sin reiniciarlo (ver ej3_configuracion.h y SIGUSR2).
+ */
+#define NIVEL_ERRORES 0 // Sólo EVENTO_ERROR
+#define NIVEL_INFO 1    // Además, EVENTO_INFO
+#define NIVEL_TODO 2    // Además, cada petición y respuesta (por defecto)
+#define NUM_NIVELES 3
+
+static const char *const nombres_niveles_log[NUM_NIVELES] = {"errores", "info", "todo"};
+
+/**
+ * Nivel actual del log. Lo lee cualquier hilo que registre algo, así que es atómico.
+ */
+atomic_int nivel_log = NIVEL_TODO;
+
+/**
+ * Función: nivel_log_por_nombre
+ *
+ * Retorno:
+ *   - Nivel del log con ese nombre, o -1 si no existe
+ */
+int nivel_log_por_nombre(const char *nombre) {
+    for (int i = 0; i < NUM_NIVELES; i++) {
+        if (strcmp(nombre, nombres_niveles_log[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Función: log_activo
+ *
+ * Indica si el nivel actual registra los eventos del tipo indicado. Sirve para no
+ * preparar el texto de un mensaje que no se va a registrar.
+ */
+int log_activo(int tipo) {
+    int nivel = atomic_load_explicit(&nivel_log, memory_order_relaxed);
+    switch (tipo) {
+    case EVENTO_ERROR:
+        return 1;
+    case EVENTO_INFO:
+        return nivel >= NIVEL_INFO;
+    default:
+        return nivel >= NIVEL_TODO;
+    }
+}
+
+/**
+ * Destino alternativo del log
+ *
+ * Si no es NULL, funcionLogEvento() le pasa cada mensaje en lugar de escribirlo en
+ * el fichero de texto (ver registro_activar() en ej3_registro.h).
+ */
+void (*log_binario)(int tipo, const char *mensaje) = NULL;
+
+/**
+ * Función: funcionLogSiempre
  *
  * Registra mensajes en un archivo de log con marca de tiempo y también
  * los muestra por consola. Esta función es útil para depuración y para
  * mantener un registro de la actividad del programa.
  *
  * Parámetros:
+ *   - tipo: Tipo de evento (EVENTO_*), para el log binario
  *   - mensaje: El mensaje a registrar
  *   - logFileName: Nombre del archivo de log
  *
  * El formato de cada entrada en el log es:
  * [YYYY-MM-DD HH:MM:SS] mensaje
+ *
+ * Registra el mensaje sea cual sea el nivel del log: es lo que piden
+ * expresamente, por ejemplo, las señales de control del servidor.
  */
-void funcionLog(const char *mensaje, const char *logFileName) {
+void funcionLogSiempre(int tipo, const char *mensaje, const char *logFileName) {
     FILE *file;
     time_t t;
     struct tm *tm_info;
     char timestamp[20]; // Buffer para la marca de tiempo
 
+    // Con el log binario activado, el mensaje va allí en lugar de al fichero de texto
+    if (log_binario != NULL) {
+        log_binario(tipo, mensaje);
+        printf("%s\n", mensaje);
+        return;
+    }
+
     // Obtenemos la hora actual del sistema
     time(&t);
     tm_info = localtime(&t); // Convertimos a hora local
@@ -123,4 +269,211 @@ void funcionLog(const char *mensaje, const char *logFileName) {
     printf("%s\n", mensaje);
 }
 
+/**
+ * Función: funcionLogEvento
+ *
+ * Registra un mensaje con funcionLogSiempre() si el nivel actual del log registra
+ * los eventos de su tipo (ver log_activo()).
+ */
+void funcionLogEvento(int tipo, const char *mensaje, const char *logFileName) {
+    if (log_activo(tipo)) {
+        funcionLogSiempre(tipo, mensaje, logFileName);
+    }
+}
+
+/**
+ * Función: funcionLog
+ *
+ * Registra un mensaje general (EVENTO_INFO). Ver funcionLogEvento().
+ */
+void funcionLog(const char *mensaje, const char *logFileName) {
+    funcionLogEvento(EVENTO_INFO, mensaje, logFileName);
+}
+
+/**
+ * Función: ahora_ns
+ *
+ * Devuelve el instante actual del reloj monótono en nanosegundos.
+ * CLOCK_MONOTONIC no se ve afectado por cambios de la hora del sistema,
+ * por lo que es el adecuado para medir intervalos de tiempo.
+ */
+uint64_t ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Función: instante_absoluto
+ *
+ * Traduce un instante de CLOCK_MONOTONIC (en nanosegundos, como los de ahora_ns())
+ * al timespec de CLOCK_REALTIME que esperan mq_timedsend() y mq_timedreceive().
+ * Un instante ya pasado da un plazo vencido, con el que esas llamadas no esperan.
+ */
+void instante_absoluto(uint64_t instante_ns, struct timespec *ts) {
+    uint64_t ahora = ahora_ns();
+    uint64_t falta = instante_ns > ahora ? instante_ns - ahora : 0;
+    clock_gettime(CLOCK_REALTIME, ts);
+    falta += ts->tv_nsec;
+    ts->tv_sec += (time_t)(falta / 1000000000ULL);
+    ts->tv_nsec = (long)(falta % 1000000000ULL);
+}
+
+/**
+ * Función: leer_lista_cpus
+ *
+ * Interpreta una lista de CPUs como "0,2,4" o "2-5" (se pueden combinar).
+ *
+ * Retorno:
+ *   - Número de CPUs de la lista (como mucho max), o -1 si el formato no es válido
+ */
+int leer_lista_cpus(const char *lista, int *cpus, int max) {
+    int n = 0;
+    const char *p = lista;
+
+    while (*p != '\0') {
+        char *fin;
+        long desde = strtol(p, &fin, 10), hasta;
+        if (fin == p || desde < 0 || desde >= CPU_SETSIZE) {
+            return -1;
+        }
+        hasta = desde;
+        if (*fin == '-') {
+            p = fin + 1;
+            hasta = strtol(p, &fin, 10);
+            if (fin == p || hasta < desde || hasta >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+        for (long cpu = desde; cpu <= hasta && n < max; cpu++) {
+            cpus[n++] = (int)cpu;
+        }
+        if (*fin != ',' && *fin != '\0') {
+            return -1;
+        }
+        p = *fin == ',' ? fin + 1 : fin;
+    }
+    return n;
+}
+
+/**
+ * Función: fijar_cpu
+ *
+ * Fija el hilo que la llama a una CPU con sched_setaffinity() (en Linux, el pid 0
+ * se refiere al hilo que llama, no a todo el proceso). Así el hilo no migra entre
+ * núcleos y conserva sus cachés entre mensaje y mensaje.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int fijar_cpu(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+/**
+ * Función: fijar_fifo
+ *
+ * Pasa el hilo que la llama a la política de tiempo real SCHED_FIFO con la
+ * prioridad indicada (1-99): ningún proceso normal le quita la CPU mientras tenga
+ * trabajo. Hace falta CAP_SYS_NICE o un límite RLIMIT_RTPRIO suficiente.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int fijar_fifo(int prioridad) {
+    struct sched_param param = {.sched_priority = prioridad};
+    return sched_setscheduler(0, SCHED_FIFO, &param);
+}
+
+/**
+ * Función: pausa_cpu
+ *
+ * Indica al procesador que se está en una espera activa (instrucción PAUSE en
+ * x86), lo que reduce el consumo y deja recursos al otro hilo del núcleo.
+ */
+void pausa_cpu() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Función: leer_limite_mqueue
+ *
+ * Lee uno de los límites de /proc/sys/fs/mqueue (msg_max, msgsize_max...).
+ *
+ * Parámetros:
+ *   - nombre: Nombre del fichero dentro de MQUEUE_PROC
+ *   - defecto: Valor a devolver si el fichero no existe o no se puede leer
+ */
+long leer_limite_mqueue(const char *nombre, long defecto) {
+    char ruta[100];
+    long valor;
+
+    sprintf(ruta, "%s/%s", MQUEUE_PROC, nombre);
+    FILE *file = fopen(ruta, "r");
+    if (file == NULL) {
+        return defecto;
+    }
+    if (fscanf(file, "%ld", &valor) != 1 || valor <= 0) {
+        valor = defecto;
+    }
+    fclose(file);
+    return valor;
+}
+
+/**
+ * Función: calcular_atributos_cola
+ *
+ * Calcula la profundidad (mq_maxmsg) y el tamaño de mensaje (mq_msgsize) de las
+ * colas a partir de lo pedido por línea de comandos y de los límites del sistema:
+ *
+ * - Sin opción, la profundidad es msg_max (la mayor permitida) y el tamaño MAX_SIZE.
+ * - Ningún valor puede superar msg_max ni msgsize_max, y el tamaño no baja de MIN_SIZE.
+ * - Entre todas las colas no se puede superar RLIMIT_MSGQUEUE (bytes por usuario),
+ *   así que si hace falta se reduce la profundidad.
+ *
+ * Parámetros:
+ *   - attr: Atributos a rellenar
+ *   - maxmsg: Profundidad pedida (0 = automática)
+ *   - msgsize: Tamaño de mensaje pedido (0 = MAX_SIZE)
+ *   - num_colas: Número de colas que se van a crear con estos atributos
+ */
+void calcular_atributos_cola(struct mq_attr *attr, long maxmsg, long msgsize, int num_colas) {
+    long msg_max = leer_limite_mqueue("msg_max", 10);
+    long msgsize_max = leer_limite_mqueue("msgsize_max", 8192);
+
+    if (maxmsg <= 0 || maxmsg > msg_max) {
+        maxmsg = msg_max;
+    }
+    if (msgsize <= 0) {
+        msgsize = MAX_SIZE;
+    }
+    if (msgsize < MIN_SIZE) {
+        msgsize = MIN_SIZE;
+    }
+    if (msgsize > msgsize_max) {
+        msgsize = msgsize_max;
+    }
+
+    // El núcleo contabiliza por cada mensaje su tamaño más un puntero y la cabecera
+    // interna; se reserva el doble de un puntero como margen
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_MSGQUEUE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        long por_mensaje = msgsize + 2 * (long)sizeof(void *);
+        long cabe = (long)rl.rlim_cur / (por_mensaje * (num_colas > 0 ? num_colas : 1));
+        if (cabe < maxmsg) {
+            maxmsg = cabe > 1 ? cabe : 1;
+        }
+    }
+
+    attr->mq_flags = 0;
+    attr->mq_maxmsg = maxmsg;
+    attr->mq_msgsize = msgsize;
+    attr->mq_curmsgs = 0;
+}
+
 #endif /* EJ3_COMMON_H */
@@ -0,0 +1,166 @@
+/**
+ * Ejercicio 3: Fichero de configuración del servidor
+ *
+ * Con la opción -f, el servidor lee la configuración de un fichero al arrancar y la
+ * vuelve a leer cada vez que recibe SIGHUP, sin reiniciarse ni perder los mensajes
+ * pendientes (ver recargar_configuracion() en ej3_servidor.c). Cada línea tiene la
+ * forma "clave = valor"; las líneas vacías y lo que sigue a '#' se ignoran. Las
+ * claves son los nombres largos de las opciones equivalentes:
+ *
+ *   nivel-log = errores | info | todo
+ *   shards = M
+ *   maxmsg = N
+ *   msgsize = bytes
+ *   pesos = c:i:m
+ *   plazo-cierre = ms
+ *   busy-poll = us
+ *   plazo-diario = us
+ *   max-pendientes = N
+ *   max-espera = us
+ *
+ * Las claves que no aparecen en el fichero conservan su valor actual. Si alguna
+ * línea no es válida, no se aplica nada del fichero.
+ */
+
+#ifndef EJ3_CONFIGURACION_H
+#define EJ3_CONFIGURACION_H
+
+#include "ej3_carriles.h"
+#include "ej3_common.h"
+
+/**
+ * Estructura: configuracion
+ *
+ * Parámetros del servidor que se pueden cambiar sin reiniciarlo.
+ */
+struct configuracion {
+    int nivel_log;            // NIVEL_*
+    int num_shards;           // Particiones de las colas
+    long maxmsg;              // Profundidad de las colas (0 = automática)
+    long msgsize;             // Tamaño máximo de mensaje (0 = automático)
+    int pesos[NUM_CARRILES];  // Pesos del reparto entre carriles
+    long plazo_cierre_ms;     // Tiempo máximo para atender lo pendiente al cerrar
+    long busy_poll_us;        // Umbral del modo busy-poll (0 = no)
+    uint64_t plazo_diario_ns; // Espera máxima de un alta del diario
+    int max_pendientes;       // Umbral de rechazo por mensajes en los carriles
+    uint64_t max_espera_ns;   // Umbral de rechazo por espera estimada
+};
+
+/**
+ * Función: configuracion_numero
+ *
+ * Lee un número entero no negativo de como mucho max.
+ *
+ * Retorno:
+ *   - 0 si el valor es válido, -1 si no
+ */
+int configuracion_numero(const char *valor, long max, long *numero) {
+    char *fin;
+    errno = 0;
+    long n = strtol(valor, &fin, 10);
+    if (errno != 0 || fin == valor || *fin != '\0' || n < 0 || n > max) {
+        return -1;
+    }
+    *numero = n;
+    return 0;
+}
+
+/**
+ * Función: configuracion_asignar
+ *
+ * Aplica a c el valor de una clave.
+ *
+ * Retorno:
+ *   - 0 si la clave y el valor son válidos, -1 si no
+ */
+int configuracion_asignar(struct configuracion *c, const char *clave, const char *valor) {
+    long n;
+
+    if (strcmp(clave, "nivel-log") == 0) {
+        c->nivel_log = nivel_log_por_nombre(valor);
+        return c->nivel_log == -1 ? -1 : 0;
+    }
+    if (strcmp(clave, "pesos") == 0) {
+        int p[NUM_CARRILES];
+        char sobra;
+        if (sscanf(valor, "%d:%d:%d%c", &p[0], &p[1], &p[2], &sobra) != 3 || p[0] < 1 ||
+            p[1] < 1 || p[2] < 1) {
+            return -1;
+        }
+        memcpy(c->pesos, p, sizeof(p));
+        return 0;
+    }
+    if (configuracion_numero(valor, 1000000000L, &n) == -1) {
+        return -1;
+    }
+    if (strcmp(clave, "shards") == 0 && n >= 1 && n <= MAX_SHARDS) {
+        c->num_shards = (int)n;
+    }
+    else if (strcmp(clave, "maxmsg") == 0) {
+        c->maxmsg = n;
+    }
+    else if (strcmp(clave, "msgsize") == 0) {
+        c->msgsize = n;
+    }
+    else if (strcmp(clave, "plazo-cierre") == 0) {
+        c->plazo_cierre_ms = n;
+    }
+    else if (strcmp(clave, "busy-poll") == 0) {
+        c->busy_poll_us = n;
+    }
+    else if (strcmp(clave, "plazo-diario") == 0) {
+        c->plazo_diario_ns = (uint64_t)n * 1000;
+    }
+    else if (strcmp(clave, "max-pendientes") == 0) {
+        c->max_pendientes = (int)n;
+    }
+    else if (strcmp(clave, "max-espera") == 0) {
+        c->max_espera_ns = (uint64_t)n * 1000;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: configuracion_leer
+ *
+ * Lee el fichero de configuración sobre los valores que ya tiene c. Si algo falla,
+ * c no cambia y en error queda la causa.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int configuracion_leer(const char *ruta, struct configuracion *c, char *error, size_t max) {
+    char linea[256], clave[64], valor[128];
+    struct configuracion nueva = *c;
+    int num_linea = 0;
+
+    FILE *f = fopen(ruta, "r");
+    if (f == NULL) {
+        snprintf(error, max, "no se pudo abrir %s: %s", ruta, strerror(errno));
+        return -1;
+    }
+    while (fgets(linea, sizeof(linea), f) != NULL) {
+        num_linea++;
+        char *comentario = strchr(linea, '#');
+        if (comentario != NULL) {
+            *comentario = '\0';
+        }
+        int n = sscanf(linea, " %63[^= \t\n] = %127s", clave, valor);
+        if (n == EOF) {
+            continue; // Línea vacía o sólo con un comentario
+        }
+        if (n != 2 || configuracion_asignar(&nueva, clave, valor) == -1) {
+            snprintf(error, max, "%s:%d: línea no válida", ruta, num_linea);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    *c = nueva;
+    return 0;
+}
+
+#endif /* EJ3_CONFIGURACION_H */
@@ -0,0 +1,485 @@
+/**
+ * Ejercicio 3: Diario de peticiones (write-ahead log) del servidor
+ *
+ * Sin diario, si el servidor termina de forma abrupta se pierden las peticiones
+ * que ya había sacado de la cola y aún no había atendido. Con la opción -j, cada
+ * partición anota en su diario cada petición que saca de la cola (un alta) antes
+ * de atenderla, y anota que la ha terminado (un fin) después de enviar la
+ * respuesta. Al arrancar, las altas sin fin se vuelven a atender: cada petición se
+ * atiende al menos una vez (puede repetirse una que se atendió justo antes de la
+ * caída, pero no perderse).
+ *
+ * Sincronizar el fichero (fdatasync) en cada petición costaría más que atenderla,
+ * así que las altas se sincronizan por grupos (group commit). Una petición
+ * recogida pasa a los carriles, pero no se atiende hasta que su alta está
+ * sincronizada (ver planificador_sacar()); mientras haya otras ya sincronizadas,
+ * se atienden ésas y las nuevas se acumulan. El grupo se sincroniza cuando no queda
+ * nada más que atender o cuando la más antigua lleva esperando el plazo de la
+ * opción -J. Con carga, mientras dura una sincronización llegan más peticiones, de
+ * modo que los grupos crecen solos. Los fines no necesitan sincronizarse: si se
+ * pierden, sólo se repite la petición.
+ *
+ * Formato de cada registro (los enteros son varint, ver ej3_registro.h):
+ *   - 1 byte: DIARIO_ALTA o DIARIO_FIN
+ *   - varint: identificador de la petición
+ *   - sólo en las altas: varint prioridad, varint longitud y el mensaje
+ *   - 4 bytes: suma FNV-1a de lo anterior, para descartar un registro a medias
+ *
+ * Cuando no queda ninguna petición sin terminar y el fichero pasa de DIARIO_LIMITE
+ * bytes, se vacía.
+ */
+
+#ifndef EJ3_DIARIO_H
+#define EJ3_DIARIO_H
+
+#include "ej3_common.h"
+#include "ej3_registro.h"
+
+#include <fcntl.h>  // Para open()
+#include <limits.h> // Para PATH_MAX
+
+/**
+ * Tipos de registro
+ */
+#define DIARIO_ALTA 'A'
+#define DIARIO_FIN 'F'
+
+/**
+ * Tamaño a partir del cual se vacía el fichero (si no hay peticiones en curso)
+ */
+#define DIARIO_LIMITE (64L * 1024 * 1024)
+
+/**
+ * Estructura: diario_pendiente
+ *
+ * Petición sin terminar encontrada al abrir el diario, que hay que volver a atender.
+ */
+struct diario_pendiente {
+    uint64_t id;
+    unsigned int prioridad;
+    const char *mensaje; // Dentro de diario.leido
+    size_t longitud;
+};
+
+/**
+ * Estructura: diario
+ */
+struct diario {
+    int fd;          // -1 si no hay diario
+    uint8_t *buffer; // Registros aún no escritos en el fichero
+    size_t usado, capacidad;
+    uint64_t siguiente_id;
+    uint64_t sincronizado;    // Última alta sincronizada
+    uint64_t sin_sincronizar; // Altas aún no sincronizadas
+    uint64_t primero_ns;      // Instante de la primera de ellas
+    uint64_t en_curso;        // Altas sin fin
+    uint64_t tam_fichero;
+    uint64_t sincronizaciones; // Para el resumen al cerrar
+    uint64_t altas;
+    struct diario_pendiente *pendientes;
+    size_t num_pendientes;      // Peticiones que hay que volver a atender
+    size_t siguiente_pendiente; // La siguiente de ellas que hay que pasar a los carriles
+    char *leido;                // Contenido del diario al abrirlo
+};
+
+/**
+ * Función: diario_suma
+ *
+ * Suma FNV-1a de 32 bits.
+ */
+uint32_t diario_suma(const uint8_t *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Función: diario_reservar
+ *
+ * Asegura que caben n bytes más en el buffer.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no hay memoria
+ */
+int diario_reservar(struct diario *d, size_t n) {
+    if (d->usado + n <= d->capacidad) {
+        return 0;
+    }
+    size_t capacidad = d->capacidad ? d->capacidad : 65536;
+    while (capacidad < d->usado + n) {
+        capacidad *= 2;
+    }
+    uint8_t *nuevo = realloc(d->buffer, capacidad);
+    if (nuevo == NULL) {
+        return -1;
+    }
+    d->buffer = nuevo;
+    d->capacidad = capacidad;
+    return 0;
+}
+
+/**
+ * Función: diario_anotar
+ *
+ * Añade un registro al buffer.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no hay memoria
+ */
+int diario_anotar(struct diario *d, int tipo, uint64_t id, unsigned int prioridad,
+                  const char *mensaje, size_t len) {
+    if (diario_reservar(d, 1 + 3 * 10 + len + 4) == -1) {
+        return -1;
+    }
+    uint8_t *inicio = d->buffer + d->usado, *p = inicio;
+    *p++ = (uint8_t)tipo;
+    p += registro_poner_varint(p, id);
+    if (tipo == DIARIO_ALTA) {
+        p += registro_poner_varint(p, prioridad);
+        p += registro_poner_varint(p, len);
+        memcpy(p, mensaje, len);
+        p += len;
+    }
+    uint32_t suma = diario_suma(inicio, p - inicio);
+    memcpy(p, &suma, sizeof(suma));
+    d->usado += p - inicio + sizeof(suma);
+    return 0;
+}
+
+/**
+ * Función: diario_escribir
+ *
+ * Escribe en el fichero los registros del buffer (sin sincronizar). Si falla a
+ * medias, lo ya escrito se quita del buffer, para no repetirlo al reintentar.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int diario_escribir(struct diario *d) {
+    size_t hecho = 0;
+    int resultado = 0;
+    while (hecho < d->usado) {
+        ssize_t n = write(d->fd, d->buffer + hecho, d->usado - hecho);
+        if (n == -1 && errno != EINTR) {
+            resultado = -1;
+            break;
+        }
+        hecho += n > 0 ? (size_t)n : 0;
+    }
+    int error = errno;
+    memmove(d->buffer, d->buffer + hecho, d->usado - hecho);
+    d->usado -= hecho;
+    d->tam_fichero += hecho;
+    errno = error;
+    return resultado;
+}
+
+/**
+ * Función: diario_leer
+ *
+ * Recorre el contenido de un diario y devuelve en d->pendientes las altas sin fin.
+ * Se detiene en el primer registro incompleto o dañado (el que se estaba
+ * escribiendo al caer el servidor).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no hay memoria para las altas pendientes (no se
+ *     puede seguir: se perderían peticiones)
+ */
+int diario_leer(struct diario *d, size_t tam) {
+    const uint8_t *p = (const uint8_t *)d->leido, *fin = p + tam;
+    size_t capacidad = 0;
+
+    while (p < fin) {
+        const uint8_t *inicio = p++;
+        uint64_t id, prioridad = 0, longitud = 0;
+        size_t n = registro_tomar_varint(p, fin, &id);
+        if (n == 0 || (*inicio != DIARIO_ALTA && *inicio != DIARIO_FIN)) {
+            break;
+        }
+        p += n;
+        if (*inicio == DIARIO_ALTA) {
+            size_t m = registro_tomar_varint(p, fin, &prioridad);
+            size_t l = m ? registro_tomar_varint(p + m, fin, &longitud) : 0;
+            if (l == 0 || longitud > (uint64_t)(fin - (p + m + l))) {
+                break;
+            }
+            p += m + l + longitud;
+        }
+        uint32_t suma;
+        if (fin - p < (long)sizeof(suma)) {
+            break;
+        }
+        memcpy(&suma, p, sizeof(suma));
+        if (suma != diario_suma(inicio, p - inicio)) {
+            break;
+        }
+        p += sizeof(suma);
+
+        if (*inicio == DIARIO_ALTA) {
+            if (d->num_pendientes == capacidad) {
+                capacidad = capacidad ? capacidad * 2 : 64;
+                struct diario_pendiente *nuevo =
+                    realloc(d->pendientes, capacidad * sizeof(*nuevo));
+                if (nuevo == NULL) {
+                    return -1;
+                }
+                d->pendientes = nuevo;
+            }
+            struct diario_pendiente *e = &d->pendientes[d->num_pendientes++];
+            e->id = id;
+            e->prioridad = (unsigned int)prioridad;
+            e->longitud = longitud;
+            e->mensaje = (const char *)p - sizeof(suma) - longitud;
+        }
+        else {
+            // Los identificadores de las altas son crecientes: búsqueda binaria
+            size_t lo = 0, hi = d->num_pendientes;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (d->pendientes[mid].id < id) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            if (lo < d->num_pendientes && d->pendientes[lo].id == id) {
+                memmove(&d->pendientes[lo], &d->pendientes[lo + 1],
+                        (d->num_pendientes - lo - 1) * sizeof(*d->pendientes));
+                d->num_pendientes--;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Función: diario_sincronizar_directorio
+ *
+ * Sincroniza el directorio que contiene la ruta indicada. Tras un rename() hace
+ * falta: el cambio de nombre es una modificación del directorio, y sin sincronizarlo
+ * una caída podría dejar el diario antiguo en su sitio (o ninguno).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int diario_sincronizar_directorio(const char *ruta) {
+    char directorio[PATH_MAX];
+
+    snprintf(directorio, sizeof(directorio), "%s", ruta);
+    char *barra = strrchr(directorio, '/');
+    if (barra == NULL) {
+        strcpy(directorio, ".");
+    }
+    else {
+        barra[barra == directorio] = '\0'; // "/diario" está en "/"
+    }
+    int fd = open(directorio, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int resultado = fsync(fd);
+    int error = errno;
+    close(fd);
+    errno = error;
+    return resultado;
+}
+
+/**
+ * Función: diario_abrir
+ *
+ * Abre (o crea) el diario de la ruta indicada y busca las peticiones sin terminar.
+ * El diario se reescribe sólo con ellas, en un fichero aparte que sustituye al
+ * original una vez sincronizado (y después se sincroniza el directorio, para que
+ * el cambio de nombre también sea duradero), de modo que una caída durante la
+ * reescritura no pierde nada. Las peticiones quedan en d->pendientes, con sus nuevos
+ * identificadores, para volver a atenderlas.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int diario_abrir(struct diario *d, const char *ruta) {
+    char temporal[PATH_MAX];
+    struct stat st;
+
+    memset(d, 0, sizeof(*d));
+    d->fd = -1;
+
+    // Leemos el diario anterior, si lo hay. Si no se puede leer entero, no se sigue:
+    // reescribirlo sólo con una parte perdería las peticiones del resto
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno != ENOENT) {
+        return -1;
+    }
+    if (fd != -1) {
+        int resultado = 0;
+        if (fstat(fd, &st) == -1) {
+            resultado = -1;
+        }
+        else if (st.st_size > 0) {
+            size_t hecho = 0;
+            d->leido = malloc(st.st_size);
+            resultado = d->leido != NULL ? 0 : -1;
+            while (resultado == 0 && hecho < (size_t)st.st_size) {
+                ssize_t n = read(fd, d->leido + hecho, st.st_size - hecho);
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    resultado = -1;
+                    errno = n == 0 ? EIO : errno;
+                    break;
+                }
+                hecho += n;
+            }
+            if (resultado == 0 && diario_leer(d, hecho) == -1) {
+                errno = ENOMEM;
+                resultado = -1;
+            }
+        }
+        int error = errno;
+        close(fd);
+        if (resultado == -1) {
+            errno = error;
+            return -1;
+        }
+    }
+
+    // Reescribimos las peticiones pendientes, numeradas desde 1
+    for (size_t i = 0; i < d->num_pendientes; i++) {
+        struct diario_pendiente *e = &d->pendientes[i];
+        e->id = i + 1;
+        if (diario_anotar(d, DIARIO_ALTA, e->id, e->prioridad, e->mensaje, e->longitud) == -1) {
+            return -1;
+        }
+    }
+    d->siguiente_id = d->num_pendientes + 1;
+    d->sincronizado = d->num_pendientes;
+    d->en_curso = d->num_pendientes;
+
+    snprintf(temporal, sizeof(temporal), "%s.tmp", ruta);
+    d->fd = open(temporal, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (d->fd == -1) {
+        return -1;
+    }
+    if (diario_escribir(d) == -1 || fdatasync(d->fd) == -1 || rename(temporal, ruta) == -1 ||
+        diario_sincronizar_directorio(ruta) == -1) {
+        int error = errno;
+        close(d->fd);
+        d->fd = -1;
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: diario_alta
+ *
+ * Anota una petición recogida de la cola.
+ *
+ * Retorno:
+ *   - Identificador de la petición (0 si no se pudo anotar)
+ */
+uint64_t diario_alta(struct diario *d, unsigned int prioridad, const char *mensaje, size_t len) {
+    uint64_t id = d->siguiente_id;
+    if (diario_anotar(d, DIARIO_ALTA, id, prioridad, mensaje, len) == -1) {
+        return 0;
+    }
+    if (d->sin_sincronizar++ == 0) {
+        d->primero_ns = ahora_ns();
+    }
+    d->siguiente_id++;
+    d->en_curso++;
+    d->altas++;
+    return id;
+}
+
+/**
+ * Función: diario_fin
+ *
+ * Anota que una petición está terminada. Si ya no queda ninguna en curso y el
+ * fichero es demasiado grande, se vacía. Si el buffer se llena sólo de fines (no
+ * hay altas que obliguen a sincronizar pronto), se escribe sin sincronizar.
+ */
+void diario_fin(struct diario *d, uint64_t id) {
+    if (diario_anotar(d, DIARIO_FIN, id, 0, NULL, 0) == 0) {
+        d->en_curso--;
+    }
+    if (d->en_curso == 0 && d->tam_fichero + d->usado > DIARIO_LIMITE &&
+        ftruncate(d->fd, 0) == 0) {
+        d->usado = 0;
+        d->tam_fichero = 0;
+    }
+    else if (d->sin_sincronizar == 0 && d->usado >= 65536) {
+        diario_escribir(d);
+    }
+}
+
+/**
+ * Función: diario_sincronizar
+ *
+ * Escribe los registros pendientes y sincroniza el fichero: a partir de aquí, las
+ * altas anotadas sobreviven a una caída.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int diario_sincronizar(struct diario *d) {
+    // Si algo falla, las altas siguen contando como sin sincronizar: así el plazo del
+    // grupo sigue corriendo y se vuelve a intentar
+    if (diario_escribir(d) == -1 || fdatasync(d->fd) == -1) {
+        return -1;
+    }
+    d->sin_sincronizar = 0;
+    d->sincronizaciones++;
+    d->sincronizado = d->siguiente_id - 1;
+    return 0;
+}
+
+/**
+ * Función: diario_espera_ns
+ *
+ * Devuelve cuántos nanosegundos quedan para que haya que sincronizar las altas
+ * pendientes (0 si no hay ninguna o ya ha vencido el plazo).
+ */
+uint64_t diario_espera_ns(const struct diario *d, uint64_t plazo_ns) {
+    if (d->fd == -1 || d->sin_sincronizar == 0) {
+        return 0;
+    }
+    uint64_t ahora = ahora_ns(), limite = d->primero_ns + plazo_ns;
+    return ahora >= limite ? 0 : limite - ahora;
+}
+
+/**
+ * Función: diario_cerrar
+ *
+ * Escribe y sincroniza lo que quede y cierra el diario.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no se pudo escribir o sincronizar lo que quedaba
+ *     (errno indica la causa)
+ */
+int diario_cerrar(struct diario *d) {
+    int resultado = 0;
+    if (d->fd != -1) {
+        if (diario_escribir(d) == -1 || fdatasync(d->fd) == -1) {
+            resultado = -1;
+        }
+        int error = errno;
+        close(d->fd);
+        d->fd = -1;
+        errno = error;
+    }
+    free(d->buffer);
+    free(d->pendientes);
+    free(d->leido);
+    d->buffer = NULL;
+    d->pendientes = NULL;
+    d->leido = NULL;
+    return resultado;
+}
+
+#endif /* EJ3_DIARIO_H */
@@ -0,0 +1,320 @@
+/**
+ * Ejercicio 3: Segmento de estadísticas en memoria compartida
+ *
+ * El servidor publica sus contadores en un segmento de memoria compartida POSIX
+ * (shm_open + mmap). Cualquier proceso puede mapearlo en modo sólo lectura y
+ * consultarlo (por ejemplo, con la herramienta ej3_stats) sin enviar mensajes al
+ * servidor ni leer su log, de modo que la observación no le afecta.
+ *
+ * Los contadores son variables atómicas de C11 que el servidor actualiza sin
+ * cerrojos (memory_order_relaxed): cada contador es coherente por sí mismo,
+ * aunque entre dos contadores distintos puede haber un desfase de un mensaje.
+ */
+
+#ifndef EJ3_ESTADISTICAS_H
+#define EJ3_ESTADISTICAS_H
+
+#include "ej3_common.h"
+
+#include <fcntl.h>     // Para O_CREAT, O_RDWR...
+#include <stdatomic.h> // Para los contadores atómicos
+#include <stdint.h>    // Para uint64_t
+#include <sys/mman.h>  // Para shm_open() y mmap()
+
+/**
+ * Nombre base del segmento (se le añade el usuario con get_queue_name())
+ */
+#define STATS_SHM "/ej3_stats"
+
+/**
+ * Número mágico y versión del formato del segmento, para que el lector
+ * compruebe que lo que mapea es realmente un segmento de estadísticas.
+ */
+#define STATS_MAGIC 0x454a3353 // "EJ3S"
+#define STATS_VERSION 5
+
+/**
+ * Número de intervalos del histograma de tiempos de servicio
+ *
+ * El intervalo k contiene los tiempos t (en nanosegundos) con 2^k <= t < 2^(k+1).
+ * El último intervalo acumula todo lo que supere 2^(STATS_HIST-1) ns (~1 s).
+ */
+#define STATS_HIST 31
+
+/**
+ * Estructura: ej3_estadisticas
+ *
+ * Contenido del segmento compartido.
+ */
+struct ej3_estadisticas {
+    uint32_t magic;         // STATS_MAGIC cuando el segmento está inicializado
+    uint32_t version;       // STATS_VERSION
+    pid_t pid;              // PID del servidor
+    struct timespec inicio; // Instante de arranque del servidor (CLOCK_REALTIME)
+    atomic_int num_shards;  // Particiones de las colas (0 en modo socket)
+    atomic_long tam_socket; // Tamaño máximo de mensaje del socket (0 con colas)
+
+    atomic_uint_fast64_t mensajes_recibidos;     // Peticiones recibidas
+    atomic_uint_fast64_t mensajes_enviados;      // Respuestas enviadas
+    atomic_uint_fast64_t bytes_recibidos;        // Bytes de las peticiones
+    atomic_uint_fast64_t bytes_enviados;         // Bytes de las respuestas
+    atomic_uint_fast64_t errores;                // Errores de recepción o envío
+    atomic_uint_fast64_t rechazadas;             // Peticiones rechazadas por sobrecarga
+    atomic_uint_fast64_t vencidas;               // Peticiones descartadas con el plazo vencido
+    atomic_uint_fast64_t profundidad_cola;       // Mensajes en la cola (mq_curmsgs)
+    atomic_uint_fast64_t pendientes_carriles;    // Mensajes sacados de la cola sin atender
+    atomic_uint_fast64_t conexiones;             // Conexiones abiertas (modo socket)
+    atomic_uint_fast64_t servicio_total_ns;      // Suma de los tiempos de servicio
+    atomic_uint_fast64_t histograma[STATS_HIST]; // Histograma de tiempos de servicio
+};
+
+/**
+ * Puntero al segmento en el proceso actual (NULL si no está mapeado)
+ */
+struct ej3_estadisticas *stats = NULL;
+
+/**
+ * Función: estadisticas_crear
+ *
+ * Crea (o reutiliza) el segmento de estadísticas, lo mapea y lo inicializa a cero.
+ * Lo llama el servidor al arrancar.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int estadisticas_crear() {
+    char nombre[100];
+    get_queue_name(nombre, STATS_SHM);
+
+    int fd = shm_open(nombre, O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct ej3_estadisticas)) == -1) {
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct ej3_estadisticas), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    // El mapeo sigue siendo válido después de cerrar el descriptor
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    stats = p;
+    memset(stats, 0, sizeof(*stats));
+    stats->version = STATS_VERSION;
+    stats->pid = getpid();
+    clock_gettime(CLOCK_REALTIME, &stats->inicio);
+    // El número mágico se escribe el último: el lector no usa el segmento hasta verlo
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+    return 0;
+}
+
+/**
+ * Función: estadisticas_abrir
+ *
+ * Mapea en modo sólo lectura el segmento de un servidor en ejecución.
+ *
+ * Retorno:
+ *   - Puntero al segmento, o NULL si no existe o no es válido
+ */
+const struct ej3_estadisticas *estadisticas_abrir() {
+    char nombre[100];
+    get_queue_name(nombre, STATS_SHM);
+
+    int fd = shm_open(nombre, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    void *p = mmap(NULL, sizeof(struct ej3_estadisticas), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    const struct ej3_estadisticas *s = p;
+    if (s->magic != STATS_MAGIC || s->version != STATS_VERSION) {
+        munmap(p, sizeof(struct ej3_estadisticas));
+        errno = EINVAL;
+        return NULL;
+    }
+    return s;
+}
+
+/**
+ * Función: estadisticas_shards
+ *
+ * Publica cuántas particiones tienen las colas del servidor, para que los clientes
+ * sepan a qué cola enviar (ver contar_shards()). Lo llama el servidor cada vez que
+ * crea las colas.
+ */
+void estadisticas_shards(int num_shards) {
+    if (stats != NULL) {
+        atomic_store(&stats->num_shards, num_shards);
+    }
+}
+
+/**
+ * Función: estadisticas_tam_socket
+ *
+ * Publica el tamaño máximo de mensaje que acepta el servidor en modo socket, para
+ * que los clientes no envíen fragmentos mayores (ver leer_tam_socket()). Con colas
+ * no hace falta: lo da mq_getattr().
+ */
+void estadisticas_tam_socket(size_t tam) {
+    if (stats != NULL) {
+        atomic_store(&stats->tam_socket, (long)tam);
+    }
+}
+
+/**
+ * Función: leer_tam_socket
+ *
+ * Obtiene el tamaño máximo de mensaje del servidor de socket en ejecución a partir
+ * del que publica en el segmento de estadísticas (como contar_shards()).
+ *
+ * Retorno:
+ *   - Tamaño en bytes, o 0 si no se conoce (no hay segmento o no es de un servidor
+ *     de socket en ejecución)
+ */
+size_t leer_tam_socket() {
+    const struct ej3_estadisticas *s = estadisticas_abrir();
+    long tam = 0;
+
+    if (s == NULL) {
+        return 0;
+    }
+    if (kill(s->pid, 0) == 0 || errno == EPERM) {
+        tam = atomic_load(&s->tam_socket);
+    }
+    munmap((void *)s, sizeof(struct ej3_estadisticas));
+    return tam > 0 ? (size_t)tam : 0;
+}
+
+/**
+ * Función: contar_shards
+ *
+ * Obtiene cuántas particiones tiene el servidor de colas en ejecución a partir del
+ * número que publica en el segmento de estadísticas. No se deduce de qué colas
+ * existen: una cola antigua que siga ahí (por ejemplo, la que se conserva entre
+ * reinicios con el diario) haría que los clientes enviasen a una cola que ya no
+ * atiende nadie. Si el servidor que creó el segmento ya no existe, se ignora.
+ *
+ * Retorno:
+ *   - Número de particiones, o 0 si no hay ningún servidor de colas en ejecución
+ */
+int contar_shards() {
+    const struct ej3_estadisticas *s = estadisticas_abrir();
+    int n = 0;
+
+    if (s == NULL) {
+        return 0;
+    }
+    if (kill(s->pid, 0) == 0 || errno == EPERM) {
+        n = atomic_load(&s->num_shards);
+    }
+    munmap((void *)s, sizeof(struct ej3_estadisticas));
+    return n;
+}
+
+/**
+ * Función: estadisticas_eliminar
+ *
+ * Desmapea y elimina el segmento. Lo llama el servidor al terminar.
+ */
+void estadisticas_eliminar() {
+    char nombre[100];
+    if (stats == NULL) {
+        return;
+    }
+    munmap(stats, sizeof(struct ej3_estadisticas));
+    stats = NULL;
+    get_queue_name(nombre, STATS_SHM);
+    shm_unlink(nombre);
+}
+
+/**
+ * Función: estadisticas_intervalo
+ *
+ * Devuelve el intervalo del histograma que corresponde a un tiempo en nanosegundos
+ * (la posición de su bit más significativo).
+ */
+int estadisticas_intervalo(uint64_t ns) {
+    int k = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    return k < STATS_HIST ? k : STATS_HIST - 1;
+}
+
+/**
+ * Funciones de actualización
+ *
+ * No hacen nada si el segmento no está mapeado, de modo que el servidor puede
+ * seguir funcionando aunque no se haya podido crear.
+ */
+void estadisticas_sumar(atomic_uint_fast64_t *contador, uint64_t valor) {
+    if (stats != NULL) {
+        atomic_fetch_add_explicit(contador, valor, memory_order_relaxed);
+    }
+}
+
+void estadisticas_fijar(atomic_uint_fast64_t *contador, uint64_t valor) {
+    if (stats != NULL) {
+        atomic_store_explicit(contador, valor, memory_order_relaxed);
+    }
+}
+
+void estadisticas_recibido(size_t bytes) {
+    if (stats != NULL) {
+        estadisticas_sumar(&stats->mensajes_recibidos, 1);
+        estadisticas_sumar(&stats->bytes_recibidos, bytes);
+    }
+}
+
+void estadisticas_enviado(size_t bytes, uint64_t servicio_ns) {
+    if (stats != NULL) {
+        estadisticas_sumar(&stats->mensajes_enviados, 1);
+        estadisticas_sumar(&stats->bytes_enviados, bytes);
+        estadisticas_sumar(&stats->servicio_total_ns, servicio_ns);
+        estadisticas_sumar(&stats->histograma[estadisticas_intervalo(servicio_ns)], 1);
+    }
+}
+
+void estadisticas_error() {
+    if (stats != NULL) {
+        estadisticas_sumar(&stats->errores, 1);
+    }
+}
+
+void estadisticas_rechazada() {
+    if (stats != NULL) {
+        estadisticas_sumar(&stats->rechazadas, 1);
+    }
+}
+
+void estadisticas_vencida() {
+    if (stats != NULL) {
+        estadisticas_sumar(&stats->vencidas, 1);
+    }
+}
+
+void estadisticas_profundidad(uint64_t en_cola, uint64_t en_carriles) {
+    if (stats != NULL) {
+        estadisticas_fijar(&stats->profundidad_cola, en_cola);
+        estadisticas_fijar(&stats->pendientes_carriles, en_carriles);
+    }
+}
+
+void estadisticas_conexion(int abierta) {
+    if (stats != NULL) {
+        if (abierta) {
+            atomic_fetch_add_explicit(&stats->conexiones, 1, memory_order_relaxed);
+        }
+        else {
+            atomic_fetch_sub_explicit(&stats->conexiones, 1, memory_order_relaxed);
+        }
+    }
+}
+
+#endif /* EJ3_ESTADISTICAS_H */
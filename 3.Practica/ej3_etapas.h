@@ -0,0 +1,149 @@
+/**
+ * Ejercicio 3: Desglose de la latencia por etapas
+ *
+ * Con la opción -T del cliente, cada petición lleva un bloque ej3_tiempos (ver
+ * ej3_protocolo.h) en el que el cliente y el servidor anotan el instante en que
+ * pasa por cada etapa. Aquí se acumulan las duraciones de las etapas en
+ * histogramas y, al terminar, se muestra en qué se fue el tiempo:
+ *
+ * - cola: desde que el cliente envía hasta que el servidor saca la petición de la
+ *   cola (o la lee del socket)
+ * - espera: en los carriles del servidor, incluido el log de la petición
+ * - proceso: cálculo de la respuesta (procesar_peticion)
+ * - log: registro de la respuesta en el log del servidor
+ * - respuesta: desde que el servidor envía la respuesta hasta que el cliente la recibe
+ */
+
+#ifndef EJ3_ETAPAS_H
+#define EJ3_ETAPAS_H
+
+#include "ej3_common.h"
+#include "ej3_protocolo.h"
+
+/**
+ * Histograma log-lineal: cada potencia de 2 se divide en HIST_SUB intervalos, de
+ * modo que el error de un percentil es como mucho del 25 %, con un tamaño fijo.
+ */
+#define HIST_SUB 4
+#define HIST_TAM (64 * HIST_SUB)
+
+/**
+ * Etapas del desglose (la última es la latencia total)
+ */
+#define NUM_ETAPAS 6
+static const char *const nombres_etapas[NUM_ETAPAS] = {"cola", "espera",    "proceso",
+                                                       "log",  "respuesta", "total"};
+
+/**
+ * Estructura: histograma
+ */
+struct histograma {
+    uint64_t cuenta[HIST_TAM];
+    uint64_t n, suma, maximo;
+};
+
+/**
+ * Histogramas de las etapas de las peticiones con tiempos
+ */
+struct histograma etapas[NUM_ETAPAS];
+
+/**
+ * Función: hist_intervalo
+ *
+ * Devuelve el intervalo del histograma que corresponde a un valor.
+ */
+int hist_intervalo(uint64_t v) {
+    if (v < HIST_SUB) {
+        return (int)v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    return e * HIST_SUB + (int)((v >> (e - 2)) & (HIST_SUB - 1));
+}
+
+/**
+ * Función: hist_limite
+ *
+ * Devuelve el límite superior de los valores de un intervalo.
+ */
+uint64_t hist_limite(int i) {
+    if (i < HIST_SUB) {
+        return (uint64_t)i;
+    }
+    int e = i / HIST_SUB;
+    return ((uint64_t)(HIST_SUB + i % HIST_SUB + 1) << (e - 2)) - 1;
+}
+
+/**
+ * Función: hist_anotar
+ */
+void hist_anotar(struct histograma *h, uint64_t v) {
+    h->cuenta[hist_intervalo(v)]++;
+    h->n++;
+    h->suma += v;
+    if (v > h->maximo) {
+        h->maximo = v;
+    }
+}
+
+/**
+ * Función: hist_percentil
+ *
+ * Devuelve una cota superior del percentil p (0-100), nunca mayor que el máximo.
+ */
+uint64_t hist_percentil(const struct histograma *h, double p) {
+    uint64_t objetivo = (uint64_t)(p / 100.0 * h->n + 0.5), acumulado = 0;
+    for (int i = 0; i < HIST_TAM; i++) {
+        acumulado += h->cuenta[i];
+        if (acumulado >= objetivo && acumulado > 0) {
+            uint64_t limite = hist_limite(i);
+            return limite < h->maximo ? limite : h->maximo;
+        }
+    }
+    return h->maximo;
+}
+
+/**
+ * Función: etapas_anotar
+ *
+ * Anota las duraciones de las etapas de una respuesta con tiempos. Se descartan
+ * las respuestas con algún instante sin anotar (por ejemplo, de un servidor que
+ * no conoce el bloque de tiempos).
+ */
+void etapas_anotar(const struct ej3_tiempos *t) {
+    const uint64_t instantes[] = {t->envio,     t->desencolado, t->inicio,
+                                  t->procesado, t->enviado,     t->recepcion};
+    for (int i = 0; i < NUM_ETAPAS; i++) {
+        if (instantes[i] == 0 || (i > 0 && instantes[i] < instantes[i - 1])) {
+            return;
+        }
+    }
+    for (int i = 0; i < NUM_ETAPAS - 1; i++) {
+        hist_anotar(&etapas[i], instantes[i + 1] - instantes[i]);
+    }
+    hist_anotar(&etapas[NUM_ETAPAS - 1], t->recepcion - t->envio);
+}
+
+/**
+ * Función: etapas_imprimir
+ *
+ * Muestra el desglose: media, percentiles y máximo de cada etapa, y qué parte de
+ * la latencia media se va en cada una.
+ */
+void etapas_imprimir() {
+    const struct histograma *total = &etapas[NUM_ETAPAS - 1];
+    if (total->n == 0) {
+        printf("No se recibió ninguna respuesta con tiempos\n");
+        return;
+    }
+    printf("Desglose de la latencia (%lu peticiones, microsegundos):\n", (unsigned long)total->n);
+    printf("%-10s %9s %9s %9s %9s %9s %7s\n", "etapa", "media", "p50", "p90", "p99", "máx",
+           "%");
+    for (int i = 0; i < NUM_ETAPAS; i++) {
+        const struct histograma *h = &etapas[i];
+        printf("%-10s %9.1f %9.1f %9.1f %9.1f %9.1f %6.1f%%\n", nombres_etapas[i],
+               h->suma / 1e3 / h->n, hist_percentil(h, 50) / 1e3, hist_percentil(h, 90) / 1e3,
+               hist_percentil(h, 99) / 1e3, h->maximo / 1e3, 100.0 * h->suma / total->suma);
+    }
+}
+
+#endif /* EJ3_ETAPAS_H */
@@ -0,0 +1,458 @@
+/**
+ * Ejercicio 3: Estadísticas de un fichero sin pasarlo por la cola
+ *
+ * Cuando el texto ya está en un fichero accesible para el servidor, enviarlo en
+ * mensajes de la cola sólo añade copias. Con una petición PROTO_RUTA el cliente
+ * envía sólo la ruta; el servidor proyecta el fichero en memoria (mmap) y calcula
+ * las estadísticas directamente sobre la proyección.
+ *
+ * Los ficheros grandes se reparten entre varios hilos. Cada hilo procesa un tramo
+ * que empieza en el comienzo de un carácter (nunca en un byte de continuación), de
+ * modo que los tramos son textos independientes; lo único que un tramo hereda del
+ * anterior es si estaba en mitad de una palabra, que se deduce del byte anterior.
+ * Al final basta con sumar los contadores.
+ *
+ * Recorrer un fichero de varios GB lleva segundos, así que el servidor no lo hace en
+ * el hilo que atiende las peticiones: lo lanza en un hilo aparte (fichero_lanzar())
+ * y recoge el resultado cuando le avisa por un eventfd (fichero_recoger()). Cada
+ * tramo se recorre por porciones de FICHERO_PORCION bytes, entre las que se mira si
+ * hay que dejarlo (al cerrar el servidor).
+ *
+ * El fichero lo indica el cliente y puede truncarse mientras se recorre: leer una
+ * página que ya no existe provoca SIGBUS, que por defecto termina el proceso. Los
+ * recorridos se protegen con sigsetjmp() (ver fichero_sigbus()) y la petición
+ * termina con EIO.
+ */
+
+#ifndef EJ3_FICHERO_H
+#define EJ3_FICHERO_H
+
+#include "ej3_common.h"
+#include "ej3_texto.h"
+
+#include <fcntl.h>       // Para open()
+#include <limits.h>      // Para PATH_MAX
+#include <pthread.h>     // Para repartir los ficheros grandes entre hilos
+#include <setjmp.h>      // Para sigsetjmp() (ver fichero_sigbus())
+#include <sys/eventfd.h> // Para avisar de los ficheros ya calculados
+#include <sys/mman.h>    // Para mmap() y madvise()
+
+/**
+ * Tamaño mínimo del tramo de cada hilo y número máximo de hilos por fichero
+ *
+ * Por debajo de FICHERO_TRAMO_MIN bytes por hilo, crear los hilos cuesta más que lo
+ * que se gana.
+ */
+#define FICHERO_TRAMO_MIN (64L * 1024 * 1024)
+#define FICHERO_MAX_HILOS 16
+
+/**
+ * Bytes que se recorren entre dos comprobaciones de si hay que dejar el fichero
+ */
+#define FICHERO_PORCION (16L * 1024 * 1024)
+
+/**
+ * Ficheros que se calculan a la vez por cada hilo que atiende peticiones (una
+ * partición, o el hilo principal con socket). Con más, se responde que el servidor
+ * está ocupado, como con el control de admisión.
+ */
+#define FICHERO_MAX_PENDIENTES 4
+
+/**
+ * Configuración del reparto (ver fichero_preparar())
+ *
+ * - fichero_hilos: Número máximo de hilos por fichero
+ * - fichero_cpus: Núcleos en los que pueden ejecutarse esos hilos
+ */
+int fichero_hilos = 1;
+cpu_set_t fichero_cpus;
+
+/**
+ * Adónde vuelve el manejador de SIGBUS en el hilo que llama (NULL si el hilo no
+ * está recorriendo una proyección)
+ */
+_Thread_local sigjmp_buf *fichero_salto = NULL;
+
+/**
+ * Estructura: fichero_tramo
+ */
+struct fichero_tramo {
+    const unsigned char *datos;
+    size_t longitud;
+    int en_palabra;            // El byte anterior al tramo no era un separador
+    const atomic_int *dejar;   // Si se activa, el tramo se deja a medias (puede ser NULL)
+    int error;                 // 0, EIO (SIGBUS) o ECANCELED (se dejó a medias)
+    struct texto_estado estado;
+    pthread_t hilo;
+};
+
+/**
+ * Estructura: fichero_trabajo
+ *
+ * Un fichero que se calcula en un hilo aparte. Quien lo lanza guarda lo que necesite
+ * para responder (la petición, el destino de la respuesta...); el hilo deja el
+ * resultado en estado y error.
+ */
+struct fichero_trabajo {
+    char ruta[PATH_MAX];
+    char *peticion;  // Copia de la petición PROTO_RUTA
+    size_t len;
+    int destino;     // Carril o conexión de la respuesta (-1 = ya no hay a quién responder)
+    uint64_t plazo;
+    uint64_t etiqueta;
+    uint64_t inicio; // Instante en que empezó a atenderse
+    struct texto_estado estado;
+    int error;       // 0 o el errno de fichero_calcular()
+    pthread_t hilo;
+    struct fichero_pendientes *pendientes;
+    struct fichero_trabajo *siguiente; // Lista de lanzados (sólo la usa quien lanza)
+    struct fichero_trabajo *terminado; // Lista de terminados (con el mutex)
+};
+
+/**
+ * Estructura: fichero_pendientes
+ *
+ * Ficheros lanzados por un mismo hilo (una partición, o el hilo principal con
+ * socket) y aún no recogidos.
+ *
+ * - lanzados: Todos los no recogidos; sólo la recorre el hilo que los lanza
+ * - terminados: Los que ya tienen resultado (protegida por mutex)
+ * - num: Número de lanzados
+ * - aviso_fd: eventfd en el que se escribe al terminar cada uno, para vigilarlo
+ *   con epoll
+ * - dejar: Al cerrar, los hilos dejan los ficheros a medias
+ */
+struct fichero_pendientes {
+    pthread_mutex_t mutex;
+    struct fichero_trabajo *lanzados;
+    struct fichero_trabajo *terminados;
+    int num;
+    int aviso_fd;
+    atomic_int dejar;
+};
+
+/**
+ * Función: fichero_sigbus
+ *
+ * Manejador de SIGBUS. Si el hilo estaba recorriendo una proyección, vuelve a su
+ * sigsetjmp(); si no, es un fallo de verdad: se restaura la acción por defecto y, al
+ * repetirse el acceso, el proceso termina como habría terminado sin manejador.
+ */
+void fichero_sigbus(int senal) {
+    if (fichero_salto != NULL) {
+        siglongjmp(*fichero_salto, 1);
+    }
+    signal(senal, SIG_DFL);
+}
+
+/**
+ * Función: fichero_preparar
+ *
+ * Fija el número de hilos por fichero (0 = uno por núcleo disponible, hasta
+ * FICHERO_MAX_HILOS) y guarda los núcleos del proceso. Hay que llamarla antes de
+ * fijar ningún hilo a un núcleo: los hilos de un fichero no heredan la afinidad
+ * del hilo que atiende la petición, sino que se reparten por todo el proceso.
+ */
+void fichero_preparar(int hilos) {
+    CPU_ZERO(&fichero_cpus);
+    if (sched_getaffinity(0, sizeof(fichero_cpus), &fichero_cpus) == -1) {
+        CPU_ZERO(&fichero_cpus);
+    }
+    if (hilos <= 0) {
+        hilos = CPU_COUNT(&fichero_cpus) > 0 ? CPU_COUNT(&fichero_cpus) : 1;
+    }
+    fichero_hilos = hilos < FICHERO_MAX_HILOS ? hilos : FICHERO_MAX_HILOS;
+
+    struct sigaction accion = {.sa_handler = fichero_sigbus};
+    sigemptyset(&accion.sa_mask);
+    sigaction(SIGBUS, &accion, NULL);
+}
+
+/**
+ * Función: fichero_hilo
+ *
+ * Calcula las estadísticas de un tramo, por porciones de FICHERO_PORCION bytes. Si
+ * el fichero se trunca mientras tanto (SIGBUS), el tramo termina con EIO.
+ */
+void *fichero_hilo(void *arg) {
+    struct fichero_tramo *t = arg;
+    sigjmp_buf salto;
+
+    texto_iniciar(&t->estado);
+    t->estado.en_palabra = t->en_palabra;
+    t->error = 0;
+    if (sigsetjmp(salto, 1) != 0) {
+        fichero_salto = NULL;
+        t->error = EIO;
+        return NULL;
+    }
+    fichero_salto = &salto;
+    for (size_t hecho = 0; hecho < t->longitud; hecho += FICHERO_PORCION) {
+        if (t->dejar != NULL && atomic_load_explicit(t->dejar, memory_order_relaxed)) {
+            t->error = ECANCELED;
+            break;
+        }
+        size_t n = t->longitud - hecho < (size_t)FICHERO_PORCION ? t->longitud - hecho
+                                                                  : (size_t)FICHERO_PORCION;
+        texto_actualizar(&t->estado, t->datos + hecho, n);
+    }
+    fichero_salto = NULL;
+    texto_finalizar(&t->estado);
+    return NULL;
+}
+
+/**
+ * Función: fichero_calcular
+ *
+ * Calcula las estadísticas del fichero de la ruta indicada. Si dejar no es NULL y
+ * se activa, el cálculo se deja a medias.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa; EINVAL si no
+ *     es un fichero regular, EIO si se truncó mientras se leía y ECANCELED si se
+ *     dejó a medias)
+ */
+int fichero_calcular(const char *ruta, struct texto_estado *e, const atomic_int *dejar) {
+    struct fichero_tramo tramos[FICHERO_MAX_HILOS];
+    struct stat st;
+
+    texto_iniciar(e);
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t tam = (size_t)st.st_size;
+    const unsigned char *mapa = mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) {
+        return -1;
+    }
+
+    // Se lee una sola vez, de principio a fin: el núcleo puede leer por adelantado
+    // con más agresividad y liberar las páginas ya leídas. Las páginas grandes sólo
+    // se usan si el sistema de ficheros las admite (tmpfs, por ejemplo)
+    madvise((void *)mapa, tam, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise((void *)mapa, tam, MADV_HUGEPAGE);
+#endif
+
+    // Cortamos en n tramos, cada uno empezando en el comienzo de un carácter
+    long n = (long)(tam / FICHERO_TRAMO_MIN);
+    n = n < 1 ? 1 : (n > fichero_hilos ? fichero_hilos : n);
+    size_t inicio = 0;
+    for (long i = 0; i < n; i++) {
+        size_t fin = i == n - 1 ? tam : tam / n * (i + 1);
+        while (fin < tam && (mapa[fin] & 0xC0) == 0x80 && fin - tam / n * (i + 1) < 3) {
+            fin++;
+        }
+        tramos[i].datos = mapa + inicio;
+        tramos[i].longitud = fin - inicio;
+        tramos[i].en_palabra = inicio > 0 && !texto_es_separador(mapa[inicio - 1]);
+        tramos[i].dejar = dejar;
+        inicio = fin;
+    }
+
+    // El primer tramo lo procesa el hilo que atiende la petición
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (CPU_COUNT(&fichero_cpus) > 0) {
+        pthread_attr_setaffinity_np(&attr, sizeof(fichero_cpus), &fichero_cpus);
+    }
+    long creados = 1;
+    while (creados < n &&
+           pthread_create(&tramos[creados].hilo, &attr, fichero_hilo, &tramos[creados]) == 0) {
+        creados++;
+    }
+    pthread_attr_destroy(&attr);
+    fichero_hilo(&tramos[0]);
+    for (long i = creados; i < n; i++) {
+        fichero_hilo(&tramos[i]); // No se pudo crear el hilo: se procesa aquí
+    }
+
+    int error = 0;
+    for (long i = 0; i < n; i++) {
+        if (i > 0 && i < creados) {
+            pthread_join(tramos[i].hilo, NULL);
+        }
+        error = error != 0 ? error : tramos[i].error;
+        e->bytes += tramos[i].estado.bytes;
+        e->caracteres += tramos[i].estado.caracteres;
+        e->palabras += tramos[i].estado.palabras;
+        e->lineas += tramos[i].estado.lineas;
+        e->utf8_valido &= tramos[i].estado.utf8_valido;
+    }
+    munmap((void *)mapa, tam);
+    if (error != 0) {
+        texto_iniciar(e);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: fichero_pendientes_iniciar
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no se pudo crear el eventfd
+ */
+int fichero_pendientes_iniciar(struct fichero_pendientes *p) {
+    pthread_mutex_init(&p->mutex, NULL);
+    p->lanzados = p->terminados = NULL;
+    p->num = 0;
+    atomic_init(&p->dejar, 0);
+    p->aviso_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return p->aviso_fd == -1 ? -1 : 0;
+}
+
+/**
+ * Función: fichero_trabajar
+ *
+ * Hilo de un fichero lanzado con fichero_lanzar(): lo calcula, lo pasa a la lista
+ * de terminados y avisa por el eventfd.
+ */
+void *fichero_trabajar(void *arg) {
+    struct fichero_trabajo *t = arg;
+    struct fichero_pendientes *p = t->pendientes;
+    uint64_t uno = 1;
+
+    t->error = fichero_calcular(t->ruta, &t->estado, &p->dejar) == -1 ? errno : 0;
+    pthread_mutex_lock(&p->mutex);
+    t->terminado = p->terminados;
+    p->terminados = t;
+    pthread_mutex_unlock(&p->mutex);
+    if (write(p->aviso_fd, &uno, sizeof(uno)) == -1) {
+        return NULL; // Sólo falla con el contador al máximo: ya hay un aviso pendiente
+    }
+    return NULL;
+}
+
+/**
+ * Función: fichero_lanzar
+ *
+ * Empieza a calcular en un hilo aparte el fichero de la ruta indicada. La petición
+ * se copia en el trabajo, donde quien lo lanza completa el resto de datos para
+ * responder cuando lo recoja con fichero_recoger().
+ *
+ * Retorno:
+ *   - El trabajo, o NULL en caso de error (errno: EBUSY si ya hay
+ *     FICHERO_MAX_PENDIENTES en marcha)
+ */
+struct fichero_trabajo *fichero_lanzar(struct fichero_pendientes *p, const char *ruta,
+                                       const char *peticion, size_t len) {
+    if (p->num >= FICHERO_MAX_PENDIENTES) {
+        errno = EBUSY;
+        return NULL;
+    }
+    struct fichero_trabajo *t = calloc(1, sizeof(*t));
+    char *copia = malloc(len + 1);
+    if (t == NULL || copia == NULL) {
+        free(t);
+        free(copia);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(copia, peticion, len);
+    copia[len] = '\0';
+    snprintf(t->ruta, sizeof(t->ruta), "%s", ruta);
+    t->peticion = copia;
+    t->len = len;
+    t->destino = -1;
+    t->pendientes = p;
+
+    // El hilo se reparte por todos los núcleos, como los tramos (quien lo lanza puede
+    // estar fijado a uno)
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (CPU_COUNT(&fichero_cpus) > 0) {
+        pthread_attr_setaffinity_np(&attr, sizeof(fichero_cpus), &fichero_cpus);
+    }
+    int error = pthread_create(&t->hilo, &attr, fichero_trabajar, t);
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        free(copia);
+        free(t);
+        errno = error;
+        return NULL;
+    }
+    t->siguiente = p->lanzados;
+    p->lanzados = t;
+    p->num++;
+    return t;
+}
+
+/**
+ * Función: fichero_recoger
+ *
+ * Saca un fichero ya calculado. Quien lo recoge lo libera con fichero_liberar().
+ *
+ * Retorno:
+ *   - El trabajo, o NULL si no hay ninguno terminado
+ */
+struct fichero_trabajo *fichero_recoger(struct fichero_pendientes *p) {
+    pthread_mutex_lock(&p->mutex);
+    struct fichero_trabajo *t = p->terminados;
+    if (t != NULL) {
+        p->terminados = t->terminado;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    if (t == NULL) {
+        return NULL;
+    }
+
+    pthread_join(t->hilo, NULL);
+    for (struct fichero_trabajo **q = &p->lanzados; *q != NULL; q = &(*q)->siguiente) {
+        if (*q == t) {
+            *q = t->siguiente;
+            break;
+        }
+    }
+    p->num--;
+    return t;
+}
+
+void fichero_liberar(struct fichero_trabajo *t) {
+    free(t->peticion);
+    free(t);
+}
+
+/**
+ * Función: fichero_pendientes_cerrar
+ *
+ * Hace que los hilos dejen los ficheros a medias, los espera y libera todo lo que
+ * no se haya recogido.
+ */
+void fichero_pendientes_cerrar(struct fichero_pendientes *p) {
+    if (p->aviso_fd == -1) {
+        return;
+    }
+    atomic_store(&p->dejar, 1);
+    while (p->lanzados != NULL) {
+        struct fichero_trabajo *t = p->lanzados;
+        p->lanzados = t->siguiente;
+        pthread_join(t->hilo, NULL);
+        fichero_liberar(t);
+    }
+    p->terminados = NULL;
+    p->num = 0;
+    close(p->aviso_fd);
+    p->aviso_fd = -1;
+    pthread_mutex_destroy(&p->mutex);
+}
+
+#endif /* EJ3_FICHERO_H */
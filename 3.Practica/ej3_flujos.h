@@ -0,0 +1,144 @@
+/**
+ * Ejercicio 3: Flujos de datos de tamaño arbitrario
+ *
+ * Un mensaje de la cola no puede pasar de mq_msgsize bytes, así que el cliente
+ * envía los textos grandes (un fichero entero, la entrada estándar) como un flujo
+ * de fragmentos PROTO_FRAGMENTO (ver ej3_protocolo.h). El servidor no los guarda:
+ * cada trozo se pasa a texto_actualizar en cuanto llega, de modo que sólo hay que
+ * recordar por cada flujo abierto su texto_estado y la posición esperada del
+ * siguiente fragmento. Al llegar el último se responde una sola vez.
+ *
+ * Los fragmentos de un flujo llegan en orden porque el cliente los envía todos a
+ * la misma cola (el mismo shard) y con la misma prioridad (el mismo carril). Si
+ * aun así falta alguno (por ejemplo, porque el flujo se expulsó de la tabla), la
+ * respuesta es un error en lugar de unas estadísticas incorrectas.
+ *
+ * Cada hilo de servicio tiene su propia tabla, sin cerrojos. Si se llena, se
+ * expulsa el flujo que lleva más tiempo sin recibir nada (el de un cliente que
+ * terminó sin enviar el último fragmento, normalmente).
+ */
+
+#ifndef EJ3_FLUJOS_H
+#define EJ3_FLUJOS_H
+
+#include "ej3_common.h"
+#include "ej3_protocolo.h"
+
+/**
+ * Número máximo de flujos abiertos a la vez en cada tabla
+ */
+#define MAX_FLUJOS 64
+
+/**
+ * Estructura: flujo
+ */
+struct flujo {
+    uint64_t id;         // Identificador elegido por el cliente
+    uint64_t esperado;   // Offset que debe traer el siguiente fragmento
+    uint64_t fragmentos; // Fragmentos recibidos
+    uint64_t ultimo_ns;  // Instante del último fragmento (para expulsar el más antiguo)
+    int abierto;
+    int error;           // Faltó algún fragmento: se responderá con un error
+    struct texto_estado estado;
+};
+
+/**
+ * Estructura: tabla_flujos
+ */
+struct tabla_flujos {
+    struct flujo flujos[MAX_FLUJOS];
+};
+
+/**
+ * Función: flujo_buscar
+ *
+ * Devuelve el flujo con ese identificador. Si no está abierto, ocupa una entrada
+ * libre o la del flujo más antiguo y la inicializa.
+ */
+struct flujo *flujo_buscar(struct tabla_flujos *t, uint64_t id) {
+    struct flujo *libre = NULL, *antiguo = &t->flujos[0];
+
+    for (int i = 0; i < MAX_FLUJOS; i++) {
+        struct flujo *f = &t->flujos[i];
+        if (f->abierto && f->id == id) {
+            return f;
+        }
+        if (!f->abierto && libre == NULL) {
+            libre = f;
+        }
+        if (f->ultimo_ns < antiguo->ultimo_ns) {
+            antiguo = f;
+        }
+    }
+    struct flujo *f = libre != NULL ? libre : antiguo;
+    memset(f, 0, sizeof(*f));
+    f->id = id;
+    f->abierto = 1;
+    texto_iniciar(&f->estado);
+    return f;
+}
+
+/**
+ * Función: flujo_procesar
+ *
+ * Procesa un fragmento recibido. Si es el último del flujo, escribe la respuesta
+ * en respuesta y un resumen para el log en resumen.
+ *
+ * Parámetros:
+ *   - t: Tabla de flujos del hilo que atiende el mensaje
+ *   - mensaje, len: Fragmento recibido (un mensaje PROTO_FRAGMENTO válido)
+ *   - respuesta, max: Buffer donde se escribe la respuesta
+ *   - resumen, max_resumen: Buffer donde se escribe el resumen
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta, o 0 si el flujo no ha terminado
+ */
+size_t flujo_procesar(struct tabla_flujos *t, const char *mensaje, size_t len, char *respuesta,
+                      size_t max, char *resumen, size_t max_resumen) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    struct ej3_fragmento cabecera;
+    size_t longitud;
+    const char *datos = proto_datos(mensaje, len, &longitud);
+
+    if (c->longitud < sizeof(cabecera)) {
+        struct texto_estado vacio;
+        texto_iniciar(&vacio);
+        snprintf(resumen, max_resumen, "Fragmento demasiado corto (%u bytes)", c->longitud);
+        return proto_responder(c, &vacio, "fragmento no válido", respuesta, max);
+    }
+    memcpy(&cabecera, mensaje + proto_inicio_datos(c), sizeof(cabecera));
+
+    struct flujo *f = flujo_buscar(t, cabecera.flujo);
+    if (cabecera.offset != f->esperado) {
+        f->error = 1;
+    }
+    else if (!f->error) {
+        texto_actualizar(&f->estado, datos, longitud);
+    }
+    f->esperado = cabecera.offset + longitud;
+    f->fragmentos++;
+    f->ultimo_ns = ahora_ns();
+
+    if (!(cabecera.indicadores & FRAGMENTO_FINAL)) {
+        return 0;
+    }
+
+    size_t n;
+    if (f->error) {
+        snprintf(resumen, max_resumen,
+                 "Flujo %016lx incompleto: faltan fragmentos (%lu recibidos)",
+                 (unsigned long)f->id, (unsigned long)f->fragmentos);
+        n = proto_responder(c, &f->estado, "faltan fragmentos del flujo", respuesta, max);
+    }
+    else {
+        texto_finalizar(&f->estado);
+        snprintf(resumen, max_resumen, "Flujo %016lx: %lu bytes en %lu fragmentos",
+                 (unsigned long)f->id, (unsigned long)f->estado.bytes,
+                 (unsigned long)f->fragmentos);
+        n = proto_responder(c, &f->estado, NULL, respuesta, max);
+    }
+    f->abierto = 0;
+    return n;
+}
+
+#endif /* EJ3_FLUJOS_H */
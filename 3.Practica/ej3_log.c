@@ -0,0 +1,297 @@
+/**
+ * Ejercicio 3: Lector del log binario
+ *
+ * Este programa lee el log binario que escriben ej3_servidor y ej3_cliente con la
+ * opción -b (ver ej3_registro.h) y muestra sus eventos como texto, en el mismo
+ * formato que el log de texto, filtrando por intervalo de tiempo y tipo de evento.
+ *
+ * No recorre el log entero: descarta los segmentos que quedan fuera del intervalo
+ * por su cabecera, busca en el índice de cada segmento el primer bloque del
+ * intervalo y pasa por alto los bloques que no tienen eventos del tipo pedido.
+ *
+ * Ejemplos de uso:
+ *   ./ej3_servidor -b log/servidor &
+ *   ./ej3_log log/servidor                               Todo el log
+ *   ./ej3_log -d "2026-10-19 10:00:00" -a 10:05:00 log/servidor
+ *   ./ej3_log -t error,respuesta log/servidor            Sólo esos tipos
+ */
+
+#include "ej3_common.h"   // Incluye definiciones y funciones comunes
+#include "ej3_registro.h" // Formato del log binario
+
+#include <getopt.h> // Para procesar opciones de línea de comandos (getopt_long)
+
+/**
+ * Recuento de lo leído, para la opción -e
+ */
+long bloques_totales = 0;
+long bloques_leidos = 0;
+long registros_mostrados = 0;
+
+/**
+ * Función: leer_instante
+ *
+ * Interpreta una fecha y hora local: "AAAA-MM-DD HH:MM:SS", "AAAA-MM-DD" o
+ * "HH:MM:SS" (de hoy).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si el formato no es válido
+ */
+int leer_instante(const char *texto, uint64_t *ns) {
+    struct tm tm;
+    time_t t = time(NULL);
+    const char *fin;
+
+    memset(&tm, 0, sizeof(tm));
+    if ((fin = strptime(texto, "%Y-%m-%d %H:%M:%S", &tm)) == NULL || *fin != '\0') {
+        memset(&tm, 0, sizeof(tm));
+        if ((fin = strptime(texto, "%Y-%m-%d", &tm)) == NULL || *fin != '\0') {
+            localtime_r(&t, &tm);
+            if ((fin = strptime(texto, "%H:%M:%S", &tm)) == NULL || *fin != '\0') {
+                return -1;
+            }
+        }
+    }
+    tm.tm_isdst = -1;
+    *ns = (uint64_t)mktime(&tm) * 1000000000ULL;
+    return 0;
+}
+
+/**
+ * Función: mostrar_registro
+ *
+ * Muestra un evento como una línea del log de texto, con milisegundos y el tipo.
+ */
+void mostrar_registro(uint64_t instante_ns, int tipo, const char *mensaje, size_t len) {
+    char marca[20];
+    time_t t = (time_t)(instante_ns / 1000000000ULL);
+    struct tm tm;
+
+    localtime_r(&t, &tm);
+    strftime(marca, sizeof(marca), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("[%s.%03u] %-9s %.*s\n", marca, (unsigned)(instante_ns / 1000000ULL % 1000),
+           tipo < NUM_EVENTOS ? registro_nombres_eventos[tipo] : "?", (int)len, mensaje);
+    registros_mostrados++;
+}
+
+/**
+ * Función: recorrer
+ *
+ * Muestra los registros de un tramo del segmento que caen en el intervalo y son de
+ * los tipos pedidos.
+ *
+ * Retorno:
+ *   - 1 si se ha pasado del final del intervalo (no hace falta seguir leyendo),
+ *     0 en otro caso
+ */
+int recorrer(const uint8_t *p, const uint8_t *fin, uint64_t base_ns, uint64_t desde,
+             uint64_t hasta, uint32_t tipos) {
+    uint64_t instante = base_ns;
+    int tipo;
+    const char *mensaje;
+    size_t len;
+
+    while (p < fin) {
+        size_t n = registro_decodificar(p, fin, &instante, &tipo, &mensaje, &len);
+        if (n == 0) {
+            fprintf(stderr, "Aviso: registro dañado, se ignora el resto del tramo\n");
+            return 0;
+        }
+        p += n;
+        if (instante > hasta) {
+            return 1;
+        }
+        if (instante >= desde && tipo < 32 && (tipos & (1u << tipo))) {
+            mostrar_registro(instante, tipo, mensaje, len);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Función: leer_segmento
+ *
+ * Muestra los eventos de un segmento que cumplen los filtros, usando su índice.
+ *
+ * Retorno:
+ *   - 1 si el segmento ya pasa del final del intervalo, 0 si hay que seguir con el
+ *     siguiente, -1 si no existe
+ */
+int leer_segmento(const char *prefijo, uint64_t secuencia, uint64_t desde, uint64_t hasta,
+                  uint32_t tipos) {
+    char nombre[256];
+    struct stat st;
+
+    registro_nombre(nombre, sizeof(nombre), prefijo, secuencia, "ej3l");
+    int fd = open(nombre, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct registro_cabecera)) {
+        close(fd);
+        return 0;
+    }
+    const uint8_t *mapa = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) {
+        perror("Error en mmap");
+        return 0;
+    }
+
+    const struct registro_cabecera *c = (const struct registro_cabecera *)mapa;
+    uint64_t ocupado = __atomic_load_n(&c->ocupado, __ATOMIC_ACQUIRE);
+    int resultado = 0;
+    if (c->magic != REGISTRO_MAGIC || c->version != REGISTRO_VERSION ||
+        ocupado > (uint64_t)st.st_size) {
+        fprintf(stderr, "Aviso: %s no es un segmento válido\n", nombre);
+    }
+    else if (c->inicio_ns > hasta) {
+        resultado = 1;
+    }
+    else if (c->fin_ns >= desde) {
+        // Cargamos el índice completo: ocupa unos 48 bytes por cada REGISTRO_BLOQUE
+        struct registro_indice *indice = NULL;
+        size_t n = 0;
+        registro_nombre(nombre, sizeof(nombre), prefijo, secuencia, "idx");
+        FILE *f = fopen(nombre, "rb");
+        if (f != NULL && fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+            indice = malloc(st.st_size);
+            n = indice ? fread(indice, sizeof(*indice), st.st_size / sizeof(*indice), f) : 0;
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        bloques_totales += n;
+
+        // Búsqueda binaria del primer bloque que termina dentro del intervalo
+        size_t lo = 0, hi = n;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (indice[mid].fin_ns < desde) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        for (size_t i = lo; i < n && !resultado; i++) {
+            if (indice[i].inicio_ns > hasta) {
+                resultado = 1;
+            }
+            else if ((indice[i].tipos & tipos) &&
+                     indice[i].offset + indice[i].longitud <= ocupado) {
+                bloques_leidos++;
+                resultado = recorrer(mapa + indice[i].offset,
+                                     mapa + indice[i].offset + indice[i].longitud,
+                                     indice[i].base_ns, desde, hasta, tipos);
+            }
+        }
+
+        // Los registros posteriores al último bloque indexado (el bloque en curso de un
+        // log en marcha, o el de un proceso que terminó sin cerrarlo) se recorren enteros
+        uint64_t resto = n ? indice[n - 1].offset + indice[n - 1].longitud : sizeof(*c);
+        uint64_t base = n ? indice[n - 1].fin_ns : c->inicio_ns;
+        if (!resultado && resto < ocupado) {
+            resultado = recorrer(mapa + resto, mapa + ocupado, base, desde, hasta, tipos);
+        }
+        free(indice);
+    }
+    munmap((void *)mapa, st.st_size);
+    return resultado;
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_log [opciones] <prefijo>\n");
+    printf("Opciones:\n");
+    printf("-h, --help               Imprimir esta ayuda\n");
+    printf("-d, --desde <instante>   Mostrar desde este instante (AAAA-MM-DD HH:MM:SS, "
+           "AAAA-MM-DD o HH:MM:SS)\n");
+    printf("-a, --hasta <instante>   Mostrar hasta este instante (incluido)\n");
+    printf("-t, --tipos <lista>      Tipos de evento separados por comas: info, peticion, "
+           "respuesta, error\n");
+    printf("-e, --estadisticas       Indicar cuántos bloques del índice se han leído\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    uint64_t desde = 0, hasta = UINT64_MAX;
+    uint32_t tipos = (1u << NUM_EVENTOS) - 1;
+    int estadisticas = 0;
+    char copia[100];
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"desde", required_argument, 0, 'd'},
+                                           {"hasta", required_argument, 0, 'a'},
+                                           {"tipos", required_argument, 0, 't'},
+                                           {"estadisticas", no_argument, 0, 'e'},
+                                           {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "hd:a:t:e", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 'd':
+        case 'a':
+            if (leer_instante(optarg, opt == 'd' ? &desde : &hasta) == -1) {
+                printf("Instante no válido: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            if (opt == 'a' && strchr(optarg, ':') != NULL) {
+                hasta += 999999999ULL; // Incluimos todo el último segundo
+            }
+            else if (opt == 'a') {
+                hasta += 86400ULL * 1000000000ULL - 1; // Incluimos todo el día
+            }
+            break;
+        case 't':
+            tipos = 0;
+            snprintf(copia, sizeof(copia), "%s", optarg);
+            for (char *nombre = strtok(copia, ","); nombre != NULL; nombre = strtok(NULL, ",")) {
+                int i = 0;
+                while (i < NUM_EVENTOS && strcmp(nombre, registro_nombres_eventos[i]) != 0) {
+                    i++;
+                }
+                if (i == NUM_EVENTOS) {
+                    printf("Tipo de evento no válido: %s\n", nombre);
+                    return EXIT_FAILURE;
+                }
+                tipos |= 1u << i;
+            }
+            break;
+        case 'e':
+            estadisticas = 1;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        print_help();
+        return EXIT_FAILURE;
+    }
+
+    // Los segmentos se numeran desde 0 sin huecos y están en orden de tiempo
+    uint64_t secuencia = 0;
+    int r;
+    while ((r = leer_segmento(argv[optind], secuencia, desde, hasta, tipos)) == 0) {
+        secuencia++;
+    }
+    if (r == -1 && secuencia == 0) {
+        printf("No se encontró ningún segmento con el prefijo %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (estadisticas) {
+        fprintf(stderr, "Segmentos: %lu, bloques leídos: %ld de %ld, registros mostrados: %ld\n",
+                (unsigned long)(r == -1 ? secuencia : secuencia + 1), bloques_leidos,
+                bloques_totales, registros_mostrados);
+    }
+    return EXIT_SUCCESS;
+}
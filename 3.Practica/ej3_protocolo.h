@@ -0,0 +1,708 @@
+/**
+ * Ejercicio 3: Formato de las peticiones y respuestas del servidor
+ *
+ * El servidor admite dos formatos de mensaje:
+ *
+ * - Texto plano (el formato original): la petición es una cadena terminada en '\0'
+ *   y la respuesta es "Número de caracteres recibidos: N", donde N cuenta caracteres
+ *   UTF-8, no bytes.
+ *
+ * - Con cabecera binaria: la petición empieza por una ej3_cabecera que indica qué
+ *   estadísticas se quieren (cualquier combinación de EST_*) seguida del texto. La
+ *   respuesta lleva la misma cabecera, los valores numéricos (ej3_resultado) y una
+ *   línea de texto legible con las estadísticas pedidas.
+ *
+ * Los dos formatos se distinguen por el número mágico del principio del mensaje,
+ * que no puede aparecer en una cadena de texto (contiene bytes nulos).
+ *
+ * Si la petición lleva el indicador PROTO_TIEMPOS, detrás de la cabecera va un
+ * bloque ej3_tiempos en el que el cliente y el servidor anotan el instante
+ * (CLOCK_MONOTONIC, común a todos los procesos de la máquina) en que el mensaje
+ * pasa por cada etapa. El servidor lo copia en la respuesta, de modo que el cliente
+ * puede saber en qué etapa se fue el tiempo de una petición lenta. Sin el
+ * indicador, anotar un instante se reduce a comprobar el número mágico.
+ *
+ * Un texto que no cabe en un mensaje se envía como un flujo: una serie de mensajes
+ * PROTO_FRAGMENTO cuyos datos empiezan por un ej3_fragmento (identificador del flujo,
+ * posición de los datos y si es el último) seguido de un trozo del texto. El
+ * servidor procesa cada trozo al recibirlo y sólo responde al último (ver
+ * ej3_flujos.h), con una respuesta igual que la de una petición con esas estadísticas.
+ *
+ * Si el texto está en un fichero que el servidor puede leer, basta con una petición
+ * PROTO_RUTA cuyos datos son la ruta (absoluta) del fichero: el servidor lo lee
+ * directamente, sin que pase por la cola (ver ej3_fichero.h).
+ *
+ * Con la arena de memoria compartida del servidor, una petición PROTO_ARENA lleva
+ * como datos sólo un ej3_descriptor que indica en qué slot de la arena está el
+ * texto (ver ej3_arena.h).
+ *
+ * Si el servidor está saturado, puede rechazar una petición sin atenderla (ver
+ * ej3_admision.h): responde con MSG_OCUPADO en texto plano o con una respuesta
+ * PROTO_OCUPADO, y el cliente decide si vuelve a intentarlo más tarde.
+ *
+ * Con el indicador PROTO_PLAZO, la petición lleva detrás de la cabecera (y de los
+ * tiempos, si los hay) el instante (CLOCK_MONOTONIC) a partir del cual el cliente
+ * ya no espera la respuesta. El servidor descarta sin atenderla una petición cuyo
+ * plazo ha vencido, y no espera más allá del plazo para enviar la respuesta. La
+ * respuesta lleva el mismo plazo, que sirve al cliente para reconocer y descartar
+ * la respuesta tardía de una petición que ya abandonó.
+ */
+
+#ifndef EJ3_PROTOCOLO_H
+#define EJ3_PROTOCOLO_H
+
+#include "ej3_arena.h"
+#include "ej3_common.h"
+#include "ej3_fichero.h"
+#include "ej3_texto.h"
+
+#include <stddef.h> // Para offsetof()
+
+/**
+ * Número mágico y versión de la cabecera
+ */
+#define PROTO_MAGIC 0x50334a45 // "EJ3P" en little endian
+#define PROTO_VERSION 1
+
+/**
+ * Tipos de mensaje
+ */
+#define PROTO_PETICION 1
+#define PROTO_RESPUESTA 2
+#define PROTO_FRAGMENTO 3   // Trozo de un flujo (los datos empiezan por un ej3_fragmento)
+#define PROTO_RUTA 4        // Petición sobre un fichero (los datos son su ruta)
+#define PROTO_ARENA 5       // Petición con el texto en la arena (los datos son un ej3_descriptor)
+#define PROTO_OCUPADO 6     // Respuesta: el servidor está saturado y no ha atendido la petición
+#define PROTO_TIPO 0xff     // Máscara del tipo dentro del campo tipo
+#define PROTO_TIEMPOS 0x100 // Indicador: el mensaje lleva un bloque ej3_tiempos
+#define PROTO_PLAZO 0x200   // Indicador: el mensaje lleva su plazo (uint64_t) tras los tiempos
+
+/**
+ * Plazo por defecto de las peticiones del cliente, en milisegundos
+ */
+#define PLAZO_PETICION_MS 5000
+
+/**
+ * Respuesta de ocupado a una petición en texto plano
+ */
+#define MSG_OCUPADO "Servidor ocupado, inténtelo más tarde"
+
+/**
+ * Indicadores de ej3_fragmento
+ */
+#define FRAGMENTO_FINAL 1 // Último fragmento del flujo: el servidor responde
+
+/**
+ * Estructura: ej3_cabecera
+ *
+ * Cabecera de los mensajes binarios. Va seguida de longitud bytes de datos.
+ */
+struct ej3_cabecera {
+    uint32_t magic;        // PROTO_MAGIC
+    uint16_t version;      // PROTO_VERSION
+    uint16_t tipo;         // PROTO_PETICION, PROTO_RESPUESTA... más PROTO_TIEMPOS
+    uint32_t estadisticas; // Máscara de estadísticas pedidas (EST_*)
+    uint32_t longitud;     // Bytes de datos que siguen a la cabecera (y a los tiempos y el plazo)
+};
+
+/**
+ * Estructura: ej3_tiempos
+ *
+ * Instantes (CLOCK_MONOTONIC, en nanosegundos) en que el mensaje pasa por cada
+ * etapa. Las etapas de la petición son las diferencias entre campos consecutivos.
+ */
+struct ej3_tiempos {
+    uint64_t envio;       // Cliente: justo antes de enviar la petición
+    uint64_t desencolado; // Servidor: al sacarla de la cola (o leerla del socket)
+    uint64_t inicio;      // Servidor: justo antes de calcular la respuesta
+    uint64_t procesado;   // Servidor: respuesta calculada
+    uint64_t enviado;     // Servidor: tras registrarla en el log, justo antes de enviarla
+    uint64_t recepcion;   // Cliente: al recibir la respuesta
+};
+
+/**
+ * Estructura: ej3_fragmento
+ *
+ * Comienzo de los datos de un mensaje PROTO_FRAGMENTO. El identificador lo elige el
+ * cliente y debe ser único entre los flujos abiertos a la vez en el servidor.
+ */
+struct ej3_fragmento {
+    uint64_t flujo;       // Identificador del flujo
+    uint64_t offset;      // Posición del primer byte de este trozo dentro del flujo
+    uint32_t indicadores; // FRAGMENTO_FINAL en el último
+    uint32_t reservado;   // 0
+};
+
+/**
+ * Estructura: ej3_descriptor
+ *
+ * Datos de una petición PROTO_ARENA: dónde está el texto dentro de la arena.
+ */
+struct ej3_descriptor {
+    uint32_t slot;       // Slot de la arena
+    uint32_t generacion; // Generación del slot al tomarlo (ver arena_resolver())
+    uint64_t offset;     // Posición del texto dentro del slot
+    uint64_t longitud;   // Bytes de texto
+};
+
+/**
+ * Estructura: ej3_resultado
+ *
+ * Valores numéricos de la respuesta. Sólo son significativos los campos cuya
+ * estadística se pidió.
+ */
+struct ej3_resultado {
+    uint64_t bytes;
+    uint64_t caracteres;
+    uint64_t palabras;
+    uint64_t lineas;
+    uint32_t utf8_valido;
+    uint32_t relleno;
+};
+
+/**
+ * Nombres de las estadísticas, en el orden de sus bits
+ */
+static const char *const proto_nombres_estadisticas[] = {"bytes", "caracteres", "palabras",
+                                                         "lineas", "utf8"};
+
+/**
+ * Función: proto_estadisticas_por_nombre
+ *
+ * Traduce una lista separada por comas ("caracteres,palabras") a una máscara EST_*.
+ * "todas" equivale a EST_TODAS.
+ *
+ * Retorno:
+ *   - Máscara de estadísticas, o 0 si algún nombre no es válido
+ */
+uint32_t proto_estadisticas_por_nombre(const char *lista) {
+    char copia[100];
+    uint32_t mascara = 0;
+
+    snprintf(copia, sizeof(copia), "%s", lista);
+    for (char *nombre = strtok(copia, ","); nombre != NULL; nombre = strtok(NULL, ",")) {
+        uint32_t bit = 0;
+        if (strcmp(nombre, "todas") == 0) {
+            bit = EST_TODAS;
+        }
+        for (int i = 0; i < 5; i++) {
+            if (strcmp(nombre, proto_nombres_estadisticas[i]) == 0) {
+                bit = 1u << i;
+            }
+        }
+        if (bit == 0) {
+            return 0;
+        }
+        mascara |= bit;
+    }
+    return mascara;
+}
+
+/**
+ * Función: proto_inicio_datos
+ *
+ * Devuelve el desplazamiento de los datos en un mensaje con cabecera.
+ */
+size_t proto_inicio_datos(const struct ej3_cabecera *c) {
+    return sizeof(*c) + ((c->tipo & PROTO_TIEMPOS) ? sizeof(struct ej3_tiempos) : 0) +
+           ((c->tipo & PROTO_PLAZO) ? sizeof(uint64_t) : 0);
+}
+
+/**
+ * Función: proto_cabecera
+ *
+ * Comprueba si un mensaje empieza por una cabecera binaria válida.
+ *
+ * Retorno:
+ *   - Puntero a la cabecera, o NULL si el mensaje es de texto plano
+ */
+const struct ej3_cabecera *proto_cabecera(const char *mensaje, size_t len) {
+    const struct ej3_cabecera *c = (const struct ej3_cabecera *)mensaje;
+    if (len < sizeof(*c) || c->magic != PROTO_MAGIC || c->version != PROTO_VERSION) {
+        return NULL;
+    }
+    size_t inicio = proto_inicio_datos(c);
+    if (len < inicio || c->longitud > len - inicio) {
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * Función: proto_es_fragmento
+ *
+ * Indica si un mensaje es un fragmento de un flujo.
+ */
+int proto_es_fragmento(const char *mensaje, size_t len) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    return c != NULL && (c->tipo & PROTO_TIPO) == PROTO_FRAGMENTO;
+}
+
+/**
+ * Función: proto_marcar
+ *
+ * Anota el instante actual en el campo indicado del bloque de tiempos (por ejemplo,
+ * offsetof(struct ej3_tiempos, desencolado)), si el mensaje lo lleva.
+ */
+void proto_marcar(char *mensaje, size_t len, size_t campo) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    if (c != NULL && (c->tipo & PROTO_TIEMPOS)) {
+        uint64_t ahora = ahora_ns();
+        memcpy(mensaje + sizeof(*c) + campo, &ahora, sizeof(ahora));
+    }
+}
+
+/**
+ * Función: proto_tiempos
+ *
+ * Copia en t el bloque de tiempos del mensaje.
+ *
+ * Retorno:
+ *   - 0 si el mensaje lleva tiempos, -1 si no
+ */
+int proto_tiempos(const char *mensaje, size_t len, struct ej3_tiempos *t) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    if (c == NULL || !(c->tipo & PROTO_TIEMPOS)) {
+        return -1;
+    }
+    memcpy(t, mensaje + sizeof(*c), sizeof(*t));
+    return 0;
+}
+
+/**
+ * Función: proto_plazo
+ *
+ * Devuelve el plazo (CLOCK_MONOTONIC, en nanosegundos) de un mensaje, o 0 si no
+ * lleva.
+ */
+uint64_t proto_plazo(const char *mensaje, size_t len) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    uint64_t plazo = 0;
+    if (c != NULL && (c->tipo & PROTO_PLAZO)) {
+        memcpy(&plazo, mensaje + proto_inicio_datos(c) - sizeof(plazo), sizeof(plazo));
+    }
+    return plazo;
+}
+
+/**
+ * Función: proto_fijar_plazo
+ *
+ * Cambia el plazo de un mensaje que ya lleva uno (por ejemplo, al repetir una
+ * petición grabada). No hace nada si el mensaje no lleva plazo.
+ */
+void proto_fijar_plazo(char *mensaje, size_t len, uint64_t plazo) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    if (c != NULL && (c->tipo & PROTO_PLAZO)) {
+        memcpy(mensaje + proto_inicio_datos(c) - sizeof(plazo), &plazo, sizeof(plazo));
+    }
+}
+
+/**
+ * Función: proto_vencida
+ *
+ * Indica si el plazo de una petición ya ha vencido en el instante ahora.
+ */
+int proto_vencida(const char *mensaje, size_t len, uint64_t ahora) {
+    uint64_t plazo = proto_plazo(mensaje, len);
+    return plazo != 0 && plazo <= ahora;
+}
+
+/**
+ * Función: proto_datos
+ *
+ * Devuelve los datos (el texto) de un mensaje en cualquiera de los dos formatos y
+ * guarda su longitud en longitud. En texto plano no se cuenta el '\0' final.
+ */
+const char *proto_datos(const char *mensaje, size_t len, size_t *longitud) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    if (c != NULL && (c->tipo & PROTO_TIPO) == PROTO_FRAGMENTO) {
+        size_t f = c->longitud < sizeof(struct ej3_fragmento) ? c->longitud
+                                                               : sizeof(struct ej3_fragmento);
+        *longitud = c->longitud - f;
+        return mensaje + proto_inicio_datos(c) + f;
+    }
+    if (c != NULL) {
+        *longitud = c->longitud;
+        return mensaje + proto_inicio_datos(c);
+    }
+    *longitud = strnlen(mensaje, len);
+    return mensaje;
+}
+
+/**
+ * Función: proto_preparar_peticion
+ *
+ * Compone en destino una petición binaria con la cabecera y el texto. Con
+ * con_tiempos, la petición lleva además el bloque de tiempos (a cero), y con un
+ * plazo_ns distinto de 0, el plazo.
+ *
+ * Retorno:
+ *   - Longitud total del mensaje, o 0 si no cabe en max bytes
+ */
+size_t proto_preparar_peticion(char *destino, size_t max, uint32_t estadisticas, int con_tiempos,
+                               uint64_t plazo_ns, const char *texto, size_t len) {
+    struct ej3_cabecera c = {PROTO_MAGIC, PROTO_VERSION,
+                             PROTO_PETICION | (con_tiempos ? PROTO_TIEMPOS : 0) |
+                                 (plazo_ns ? PROTO_PLAZO : 0),
+                             estadisticas, (uint32_t)len};
+    size_t inicio = proto_inicio_datos(&c);
+    if (inicio + len > max) {
+        return 0;
+    }
+    memcpy(destino, &c, sizeof(c));
+    memset(destino + sizeof(c), 0, inicio - sizeof(c));
+    memcpy(destino + inicio, texto, len);
+    proto_fijar_plazo(destino, inicio + len, plazo_ns);
+    return inicio + len;
+}
+
+/**
+ * Función: proto_preparar_ruta
+ *
+ * Compone en destino una petición PROTO_RUTA sobre el fichero de la ruta indicada.
+ *
+ * Retorno:
+ *   - Longitud total del mensaje, o 0 si no cabe en max bytes
+ */
+size_t proto_preparar_ruta(char *destino, size_t max, uint32_t estadisticas, const char *ruta) {
+    size_t n = proto_preparar_peticion(destino, max, estadisticas, 0, 0, ruta, strlen(ruta));
+    if (n > 0) {
+        uint16_t tipo = PROTO_RUTA;
+        memcpy(destino + offsetof(struct ej3_cabecera, tipo), &tipo, sizeof(tipo));
+    }
+    return n;
+}
+
+/**
+ * Función: proto_preparar_descriptor
+ *
+ * Compone en destino una petición PROTO_ARENA con el descriptor d.
+ *
+ * Retorno:
+ *   - Longitud total del mensaje, o 0 si no cabe en max bytes
+ */
+size_t proto_preparar_descriptor(char *destino, size_t max, uint32_t estadisticas,
+                                 const struct ej3_descriptor *d) {
+    size_t n =
+        proto_preparar_peticion(destino, max, estadisticas, 0, 0, (const char *)d, sizeof(*d));
+    if (n > 0) {
+        uint16_t tipo = PROTO_ARENA;
+        memcpy(destino + offsetof(struct ej3_cabecera, tipo), &tipo, sizeof(tipo));
+    }
+    return n;
+}
+
+/**
+ * Función: proto_describir
+ *
+ * Escribe en destino el texto de una petición para el log: el propio texto, o el
+ * descriptor si el texto está en la arena.
+ */
+void proto_describir(const char *mensaje, size_t len, char *destino, size_t max) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    size_t longitud;
+    const char *datos = proto_datos(mensaje, len, &longitud);
+    struct ej3_descriptor d;
+
+    if (c != NULL && (c->tipo & PROTO_TIPO) == PROTO_ARENA && longitud == sizeof(d)) {
+        memcpy(&d, datos, sizeof(d));
+        snprintf(destino, max, "[arena: slot %u, generación %u, %lu bytes]", d.slot,
+                 d.generacion, (unsigned long)d.longitud);
+        return;
+    }
+    snprintf(destino, max, "%.*s", (int)longitud, datos);
+}
+
+/**
+ * Función: proto_preparar_fragmento
+ *
+ * Compone en destino un fragmento de un flujo con len bytes de texto. Para no
+ * copiar los datos dos veces, texto puede apuntar ya a su sitio dentro de destino
+ * (proto_hueco_fragmento bytes después del principio).
+ *
+ * Retorno:
+ *   - Longitud total del mensaje, o 0 si no cabe en max bytes
+ */
+size_t proto_preparar_fragmento(char *destino, size_t max, uint32_t estadisticas, uint64_t flujo,
+                                uint64_t offset, int final, const char *texto, size_t len) {
+    struct ej3_cabecera c = {PROTO_MAGIC, PROTO_VERSION, PROTO_FRAGMENTO, estadisticas,
+                             (uint32_t)(sizeof(struct ej3_fragmento) + len)};
+    struct ej3_fragmento f = {flujo, offset, final ? FRAGMENTO_FINAL : 0, 0};
+    size_t inicio = sizeof(c) + sizeof(f);
+    if (inicio + len > max) {
+        return 0;
+    }
+    memcpy(destino, &c, sizeof(c));
+    memcpy(destino + sizeof(c), &f, sizeof(f));
+    memmove(destino + inicio, texto, len);
+    return inicio + len;
+}
+
+/**
+ * Función: proto_hueco_fragmento
+ *
+ * Devuelve cuántos bytes ocupan las cabeceras de un fragmento (el texto va detrás).
+ */
+size_t proto_hueco_fragmento() {
+    return sizeof(struct ej3_cabecera) + sizeof(struct ej3_fragmento);
+}
+
+/**
+ * Función: proto_texto_respuesta
+ *
+ * Devuelve la línea de texto legible de una respuesta en cualquiera de los dos
+ * formatos (para mostrarla en el cliente).
+ */
+const char *proto_texto_respuesta(const char *respuesta, size_t len) {
+    const struct ej3_cabecera *c = proto_cabecera(respuesta, len);
+    int tipo = c != NULL ? c->tipo & PROTO_TIPO : 0;
+    if ((tipo == PROTO_RESPUESTA || tipo == PROTO_OCUPADO) &&
+        c->longitud > sizeof(struct ej3_resultado)) {
+        return respuesta + proto_inicio_datos(c) + sizeof(struct ej3_resultado);
+    }
+    return respuesta;
+}
+
+/**
+ * Función: proto_responder
+ *
+ * Compone en respuesta la respuesta binaria a la petición con cabecera c (que
+ * apunta al principio del mensaje recibido) a partir de las estadísticas ya
+ * calculadas en e. Si error no es NULL, la línea de texto es el error en lugar de
+ * las estadísticas. Si la petición lleva tiempos, la respuesta los lleva también,
+ * con el instante de procesado ya anotado, y lo mismo el plazo.
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta, o 0 si no cabe en max bytes
+ */
+size_t proto_responder(const struct ej3_cabecera *c, const struct texto_estado *e,
+                       const char *error, char *respuesta, size_t max) {
+    struct ej3_resultado r = {e->bytes, e->caracteres, e->palabras, e->lineas,
+                              (uint32_t)e->utf8_valido, 0};
+    struct ej3_cabecera rc = {PROTO_MAGIC, PROTO_VERSION,
+                              PROTO_RESPUESTA | (c->tipo & (PROTO_TIEMPOS | PROTO_PLAZO)),
+                              c->estadisticas, 0};
+    uint64_t valores[4] = {r.bytes, r.caracteres, r.palabras, r.lineas};
+    size_t inicio = proto_inicio_datos(&rc);
+    size_t fijo = inicio + sizeof(r);
+    if (max <= fijo) {
+        return 0;
+    }
+
+    // Línea legible con las estadísticas pedidas, en el orden de los bits
+    char *texto = respuesta + fijo;
+    size_t libre = max - fijo, usado = 0;
+    texto[0] = '\0';
+    if (error != NULL) {
+        usado = snprintf(texto, libre, "Error: %s", error);
+    }
+    for (int i = 0; i < 5 && error == NULL && usado < libre; i++) {
+        if (!(c->estadisticas & (1u << i))) {
+            continue;
+        }
+        if (i < 4) {
+            usado += snprintf(texto + usado, libre - usado, "%s%s: %lu", usado ? ", " : "",
+                              proto_nombres_estadisticas[i], (unsigned long)valores[i]);
+        }
+        else {
+            usado += snprintf(texto + usado, libre - usado, "%sutf8: %s", usado ? ", " : "",
+                              e->utf8_valido ? "válido" : "no válido");
+        }
+    }
+    usado = usado < libre ? usado + 1 : libre; // Incluimos el carácter nulo
+
+    rc.longitud = (uint32_t)(sizeof(r) + usado);
+    memcpy(respuesta, &rc, sizeof(rc));
+    memcpy(respuesta + sizeof(rc), c + 1, inicio - sizeof(rc)); // Tiempos y plazo
+    memcpy(respuesta + inicio, &r, sizeof(r));
+    proto_marcar(respuesta, fijo + usado, offsetof(struct ej3_tiempos, procesado));
+    return fijo + usado;
+}
+
+/**
+ * Función: proto_rechazable
+ *
+ * Indica si una petición se puede rechazar por sobrecarga sin más consecuencias:
+ * el texto plano (salvo "exit") y las peticiones PROTO_PETICION y PROTO_RUTA. Los
+ * fragmentos no, porque el flujo quedaría incompleto, ni los descriptores de la
+ * arena, cuyo slot sólo se libera al atenderlos.
+ */
+int proto_rechazable(const char *mensaje, size_t len) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    if (c == NULL) {
+        return len != sizeof(MSG_EXIT) || memcmp(mensaje, MSG_EXIT, len) != 0;
+    }
+    return (c->tipo & PROTO_TIPO) == PROTO_PETICION || (c->tipo & PROTO_TIPO) == PROTO_RUTA;
+}
+
+/**
+ * Función: proto_texto_arena
+ *
+ * Si el mensaje es una petición PROTO_ARENA con un descriptor válido, copia el
+ * descriptor en d y devuelve el texto de su slot (ver arena_resolver()).
+ *
+ * Retorno:
+ *   - Puntero al texto en la arena, o NULL si no es PROTO_ARENA o no es válido
+ */
+const char *proto_texto_arena(const char *mensaje, size_t len, struct ej3_descriptor *d) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    size_t longitud;
+    const char *datos = proto_datos(mensaje, len, &longitud);
+
+    if (c == NULL || (c->tipo & PROTO_TIPO) != PROTO_ARENA || longitud != sizeof(*d)) {
+        return NULL;
+    }
+    memcpy(d, datos, sizeof(*d));
+    return arena_resolver(&arena_actual, d->slot, d->generacion, d->offset, d->longitud);
+}
+
+/**
+ * Función: proto_soltar_arena
+ *
+ * Libera el slot de una petición PROTO_ARENA que se descarta sin atenderla (plazo
+ * vencido, rechazo): sólo procesar_peticion() lo libera al atenderla, así que en
+ * cualquier otro camino el slot se perdería para siempre. Con otros mensajes no
+ * hace nada.
+ */
+void proto_soltar_arena(const char *mensaje, size_t len) {
+    struct ej3_descriptor d;
+    if (proto_texto_arena(mensaje, len, &d) != NULL) {
+        arena_liberar(&arena_actual, d.slot);
+    }
+}
+
+/**
+ * Función: proto_ocupado
+ *
+ * Compone en respuesta la respuesta de ocupado a una petición, en su mismo formato.
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta
+ */
+size_t proto_ocupado(const char *peticion, size_t len, char *respuesta, size_t max) {
+    const struct ej3_cabecera *c = proto_cabecera(peticion, len);
+    struct texto_estado vacio;
+
+    if (c == NULL) {
+        snprintf(respuesta, max, "%s", MSG_OCUPADO);
+        return strlen(respuesta) + 1;
+    }
+    texto_iniciar(&vacio);
+    size_t n = proto_responder(c, &vacio, "servidor ocupado", respuesta, max);
+    uint16_t tipo = PROTO_OCUPADO | (c->tipo & (PROTO_TIEMPOS | PROTO_PLAZO));
+    memcpy(respuesta + offsetof(struct ej3_cabecera, tipo), &tipo, sizeof(tipo));
+    return n;
+}
+
+/**
+ * Función: proto_es_ocupado
+ *
+ * Indica si una respuesta es la de ocupado (ver proto_ocupado()).
+ */
+int proto_es_ocupado(const char *respuesta, size_t len) {
+    const struct ej3_cabecera *c = proto_cabecera(respuesta, len);
+    if (c == NULL) {
+        return len == sizeof(MSG_OCUPADO) && memcmp(respuesta, MSG_OCUPADO, len) == 0;
+    }
+    return (c->tipo & PROTO_TIPO) == PROTO_OCUPADO;
+}
+
+/**
+ * Función: proto_ruta
+ *
+ * Si el mensaje es una petición PROTO_RUTA, copia en ruta (de max bytes) la ruta
+ * del fichero.
+ *
+ * Retorno:
+ *   - 1 si es una petición PROTO_RUTA, 0 si no
+ */
+int proto_ruta(const char *mensaje, size_t len, char *ruta, size_t max) {
+    const struct ej3_cabecera *c = proto_cabecera(mensaje, len);
+    size_t longitud;
+
+    if (c == NULL || (c->tipo & PROTO_TIPO) != PROTO_RUTA) {
+        return 0;
+    }
+    const char *datos = proto_datos(mensaje, len, &longitud);
+    snprintf(ruta, max, "%.*s", (int)longitud, datos);
+    return 1;
+}
+
+/**
+ * Función: proto_responder_fichero
+ *
+ * Compone la respuesta a una petición PROTO_RUTA a partir de las estadísticas del
+ * fichero ya calculadas (o del error, si error no es 0).
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta, o 0 si no cabe en max bytes
+ */
+size_t proto_responder_fichero(const char *peticion, size_t len, const char *ruta,
+                               const struct texto_estado *e, int error, char *respuesta,
+                               size_t max) {
+    const struct ej3_cabecera *c = proto_cabecera(peticion, len);
+    char texto[PATH_MAX + 100];
+
+    if (error != 0) {
+        snprintf(texto, sizeof(texto), "no se pudo leer %s: %s", ruta, strerror(error));
+        return proto_responder(c, e, texto, respuesta, max);
+    }
+    return proto_responder(c, e, NULL, respuesta, max);
+}
+
+/**
+ * Función: procesar_peticion
+ *
+ * Lógica de servicio del servidor, independiente del transporte utilizado
+ * (colas de mensajes o sockets). Calcula las estadísticas del texto recibido
+ * (o del fichero, en una petición PROTO_RUTA) y escribe en respuesta el mensaje
+ * que se devolverá al cliente, en el mismo formato que la petición.
+ *
+ * Parámetros:
+ *   - peticion, len: Mensaje recibido del cliente y su longitud
+ *   - respuesta: Buffer donde se escribe la respuesta
+ *   - max: Tamaño del buffer de respuesta
+ *
+ * Retorno:
+ *   - Número de bytes de la respuesta (en texto plano, incluyendo el carácter nulo final)
+ */
+size_t procesar_peticion(const char *peticion, size_t len, char *respuesta, size_t max) {
+    const struct ej3_cabecera *c = proto_cabecera(peticion, len);
+    size_t longitud;
+    const char *datos = proto_datos(peticion, len, &longitud);
+    struct texto_estado e;
+
+    // El servidor lanza los ficheros en un hilo aparte (ver fichero_lanzar()): aquí
+    // sólo llegan si no se pudo
+    char ruta[PATH_MAX];
+    if (proto_ruta(peticion, len, ruta, sizeof(ruta))) {
+        int error = fichero_calcular(ruta, &e, NULL) == -1 ? errno : 0;
+        return proto_responder_fichero(peticion, len, ruta, &e, error, respuesta, max);
+    }
+
+    // El texto está en un slot de la arena: se procesa allí mismo y se libera el slot
+    if (c != NULL && (c->tipo & PROTO_TIPO) == PROTO_ARENA) {
+        struct ej3_descriptor d;
+        const char *texto = proto_texto_arena(peticion, len, &d);
+        if (texto == NULL) {
+            texto_iniciar(&e);
+            return proto_responder(c, &e, "descriptor de arena no válido", respuesta, max);
+        }
+        texto_calcular(&e, texto, d.longitud);
+        arena_liberar(&arena_actual, d.slot);
+        return proto_responder(c, &e, NULL, respuesta, max);
+    }
+
+    // Una sola pasada calcula todas las estadísticas
+    texto_calcular(&e, datos, longitud);
+
+    // Formato original: número de caracteres (puntos de código, no bytes)
+    if (c == NULL) {
+        snprintf(respuesta, max, "Número de caracteres recibidos: %lu",
+                 (unsigned long)e.caracteres);
+        return strlen(respuesta) + 1;
+    }
+    return proto_responder(c, &e, NULL, respuesta, max);
+}
+
+#endif /* EJ3_PROTOCOLO_H */
@@ -0,0 +1,395 @@
+/**
+ * Ejercicio 3: Log binario con índice de tiempos
+ *
+ * Alternativa opcional al log de texto de funcionLog() (opción -b del servidor y
+ * del cliente). Cada evento se guarda como un registro binario compacto en un
+ * segmento proyectado en memoria (mmap), de modo que escribir un evento es copiar
+ * unos bytes, sin abrir ni cerrar el fichero. Al llegar al tamaño límite se pasa al
+ * segmento siguiente. La herramienta ej3_log lee los segmentos, filtra por
+ * intervalo de tiempo y tipo de evento y muestra los registros como texto.
+ *
+ * Ficheros de cada segmento:
+ * - <prefijo>.NNNNNN.ej3l: cabecera fija (struct registro_cabecera) y los registros:
+ *   - varint: nanosegundos desde el registro anterior (CLOCK_REALTIME)
+ *   - 1 byte: tipo de evento (EVENTO_*)
+ *   - varint: longitud del mensaje
+ *   - el mensaje, sin el carácter nulo
+ * - <prefijo>.NNNNNN.idx: índice disperso, con una entrada (struct registro_indice)
+ *   por cada bloque de unos REGISTRO_BLOQUE bytes de registros. Cada entrada indica
+ *   el intervalo de tiempo del bloque y qué tipos de evento contiene, así que el
+ *   lector puede saltar directamente al primer bloque del intervalo pedido y pasar
+ *   por alto los bloques sin eventos del tipo buscado, sin recorrer el segmento.
+ *
+ * Los varint son los mismos de la traza (ver ej3_traza.h): 7 bits por byte. Un
+ * intervalo de unos microsegundos ocupa dos o tres bytes en lugar de ocho.
+ */
+
+#ifndef EJ3_REGISTRO_H
+#define EJ3_REGISTRO_H
+
+#include "ej3_common.h"
+
+#include <fcntl.h>    // Para open()
+#include <pthread.h>  // Para el cerrojo (el servidor registra desde varios hilos)
+#include <sys/mman.h> // Para mmap()
+
+/**
+ * Número mágico y versión del formato
+ */
+#define REGISTRO_MAGIC 0x4c334a45 // "EJ3L" en little endian
+#define REGISTRO_VERSION 1
+
+/**
+ * Tamaño por defecto de cada segmento y tamaño de los bloques del índice
+ */
+#define REGISTRO_LIMITE (64UL << 20)
+#define REGISTRO_BLOQUE 16384
+
+/**
+ * Nombres de los tipos de evento, en el orden de EVENTO_*
+ */
+static const char *const registro_nombres_eventos[NUM_EVENTOS] = {"info", "peticion",
+                                                                  "respuesta", "error"};
+
+/**
+ * Estructura: registro_cabecera
+ *
+ * Cabecera de cada segmento. Se actualiza con cada registro, de forma que un
+ * segmento que aún se está escribiendo (o que quedó a medias) se puede leer.
+ */
+struct registro_cabecera {
+    uint32_t magic;     // REGISTRO_MAGIC
+    uint16_t version;   // REGISTRO_VERSION
+    uint16_t reservado; // 0
+    uint64_t secuencia; // Número de segmento
+    uint64_t inicio_ns; // Apertura del segmento: base del intervalo del primer registro
+    uint64_t fin_ns;    // Instante del último registro
+    uint64_t ocupado;   // Bytes válidos del segmento, incluida la cabecera
+};
+
+/**
+ * Estructura: registro_indice
+ *
+ * Entrada del índice disperso: describe un bloque de registros consecutivos.
+ */
+struct registro_indice {
+    uint64_t inicio_ns; // Instante del primer registro del bloque
+    uint64_t fin_ns;    // Instante del último registro del bloque
+    uint64_t base_ns;   // Instante del registro anterior al bloque (base del primer intervalo)
+    uint64_t offset;    // Posición del primer registro en el segmento
+    uint32_t longitud;  // Bytes del bloque
+    uint32_t tipos;     // Máscara de los tipos de evento presentes (1 << EVENTO_*)
+    uint32_t registros; // Número de registros del bloque
+    uint32_t reservado; // 0
+};
+
+/**
+ * Estructura: registro
+ *
+ * Log binario abierto para escribir.
+ */
+struct registro {
+    char prefijo[200];
+    size_t limite;                 // Tamaño máximo de cada segmento
+    uint64_t secuencia;            // Segmento actual
+    int fd;                        // Segmento actual (-1 si no hay ninguno abierto)
+    FILE *indice;                  // Índice del segmento actual
+    char *mapa;                    // Proyección del segmento actual
+    size_t ocupado;                // Bytes escritos en el segmento actual
+    uint64_t ultimo_ns;            // Instante del último registro
+    struct registro_indice bloque; // Bloque en curso (aún no está en el índice)
+    pthread_mutex_t cerrojo;
+};
+
+/**
+ * Log binario del proceso (ver registro_activar())
+ */
+struct registro registro_actual = {.fd = -1, .cerrojo = PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * Funciones: registro_poner_varint / registro_tomar_varint
+ *
+ * Escriben y leen un entero sin signo en formato varint directamente en memoria.
+ *
+ * Retorno:
+ *   - Número de bytes escritos o leídos (registro_tomar_varint devuelve 0 si el
+ *     varint está cortado o es demasiado largo)
+ */
+size_t registro_poner_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+size_t registro_tomar_varint(const uint8_t *p, const uint8_t *fin, uint64_t *v) {
+    *v = 0;
+    for (size_t n = 0; n < 10 && p + n < fin; n++) {
+        *v |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Función: registro_decodificar
+ *
+ * Lee el registro que empieza en p. prev_ns es el instante del registro anterior
+ * y se actualiza con el del leído.
+ *
+ * Retorno:
+ *   - Bytes que ocupa el registro, o 0 si está cortado o dañado
+ */
+size_t registro_decodificar(const uint8_t *p, const uint8_t *fin, uint64_t *prev_ns, int *tipo,
+                            const char **mensaje, size_t *len) {
+    uint64_t intervalo, longitud;
+    size_t n = registro_tomar_varint(p, fin, &intervalo);
+    if (n == 0 || p + n >= fin) {
+        return 0;
+    }
+    *tipo = p[n++];
+    size_t m = registro_tomar_varint(p + n, fin, &longitud);
+    if (m == 0 || longitud > (uint64_t)(fin - (p + n + m))) {
+        return 0;
+    }
+    n += m;
+    *prev_ns += intervalo;
+    *mensaje = (const char *)p + n;
+    *len = longitud;
+    return n + longitud;
+}
+
+/**
+ * Función: registro_nombre
+ *
+ * Genera el nombre del fichero de un segmento (extension "ej3l") o de su índice
+ * ("idx").
+ */
+void registro_nombre(char *nombre, size_t max, const char *prefijo, uint64_t secuencia,
+                     const char *extension) {
+    snprintf(nombre, max, "%s.%06lu.%s", prefijo, (unsigned long)secuencia, extension);
+}
+
+/**
+ * Función: registro_cerrar_bloque
+ *
+ * Añade al índice la entrada del bloque en curso, si tiene algún registro.
+ */
+void registro_cerrar_bloque(struct registro *r) {
+    if (r->bloque.registros == 0) {
+        return;
+    }
+    r->bloque.longitud = (uint32_t)(r->ocupado - r->bloque.offset);
+    fwrite(&r->bloque, sizeof(r->bloque), 1, r->indice);
+    fflush(r->indice); // Para que el índice esté al día si se lee el log en marcha
+    memset(&r->bloque, 0, sizeof(r->bloque));
+}
+
+/**
+ * Función: registro_abrir_segmento
+ *
+ * Crea el siguiente segmento libre (a partir de r->secuencia, sin sobrescribir
+ * los de ejecuciones anteriores), le da su tamaño máximo y lo proyecta en memoria.
+ * El fichero es disperso: sólo ocupa disco lo que se escribe.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int registro_abrir_segmento(struct registro *r) {
+    char nombre[256];
+
+    for (;; r->secuencia++) {
+        registro_nombre(nombre, sizeof(nombre), r->prefijo, r->secuencia, "ej3l");
+        r->fd = open(nombre, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (r->fd != -1 || errno != EEXIST) {
+            break;
+        }
+    }
+    if (r->fd == -1) {
+        return -1;
+    }
+    if (ftruncate(r->fd, (off_t)r->limite) == -1 ||
+        (r->mapa = mmap(NULL, r->limite, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0)) ==
+            MAP_FAILED) {
+        close(r->fd);
+        r->fd = -1;
+        r->mapa = NULL;
+        return -1;
+    }
+
+    registro_nombre(nombre, sizeof(nombre), r->prefijo, r->secuencia, "idx");
+    r->indice = fopen(nombre, "wb");
+    if (r->indice == NULL) {
+        munmap(r->mapa, r->limite);
+        close(r->fd);
+        r->fd = -1;
+        r->mapa = NULL;
+        return -1;
+    }
+
+    struct timespec ahora;
+    clock_gettime(CLOCK_REALTIME, &ahora);
+    uint64_t inicio = (uint64_t)ahora.tv_sec * 1000000000ULL + ahora.tv_nsec;
+    if (inicio < r->ultimo_ns) {
+        inicio = r->ultimo_ns;
+    }
+    struct registro_cabecera *c = (struct registro_cabecera *)r->mapa;
+    *c = (struct registro_cabecera){REGISTRO_MAGIC, REGISTRO_VERSION, 0, r->secuencia, inicio,
+                                    inicio, sizeof(*c)};
+    r->ocupado = sizeof(*c);
+    r->ultimo_ns = inicio;
+    memset(&r->bloque, 0, sizeof(r->bloque));
+    return 0;
+}
+
+/**
+ * Función: registro_cerrar_segmento
+ *
+ * Cierra el segmento actual: completa el índice y recorta el fichero a lo escrito.
+ */
+void registro_cerrar_segmento(struct registro *r) {
+    if (r->fd == -1) {
+        return;
+    }
+    registro_cerrar_bloque(r);
+    fclose(r->indice);
+    munmap(r->mapa, r->limite);
+    if (ftruncate(r->fd, (off_t)r->ocupado) == -1) {
+        perror("Error al recortar el segmento del log");
+    }
+    close(r->fd);
+    r->fd = -1;
+    r->mapa = NULL;
+    r->indice = NULL;
+}
+
+/**
+ * Función: registro_escribir
+ *
+ * Añade un evento al log. Si no cabe en el segmento actual, se pasa al siguiente;
+ * los mensajes que no caben ni en un segmento vacío se recortan.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no se pudo abrir un segmento nuevo
+ */
+int registro_escribir(struct registro *r, int tipo, const char *mensaje, size_t len) {
+    struct timespec ts;
+
+    pthread_mutex_lock(&r->cerrojo);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t ahora = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    // Los instantes no retroceden aunque se ajuste el reloj: el índice cuenta con ello
+    if (ahora < r->ultimo_ns) {
+        ahora = r->ultimo_ns;
+    }
+
+    size_t maximo = r->limite - sizeof(struct registro_cabecera) - 21; // 21: varints y tipo
+    if (len > maximo) {
+        len = maximo;
+    }
+    if (r->fd != -1 && r->ocupado + 21 + len > r->limite) {
+        registro_cerrar_segmento(r);
+        r->secuencia++;
+    }
+    if (r->fd == -1 && registro_abrir_segmento(r) == -1) {
+        pthread_mutex_unlock(&r->cerrojo);
+        return -1;
+    }
+
+    // Los bloques del índice se cortan por tamaño, siempre entre dos registros
+    if (r->bloque.registros > 0 && r->ocupado - r->bloque.offset >= REGISTRO_BLOQUE) {
+        registro_cerrar_bloque(r);
+    }
+    if (r->bloque.registros == 0) {
+        r->bloque.inicio_ns = ahora;
+        r->bloque.base_ns = r->ultimo_ns;
+        r->bloque.offset = r->ocupado;
+    }
+
+    uint8_t *p = (uint8_t *)r->mapa + r->ocupado;
+    size_t n = registro_poner_varint(p, ahora - r->ultimo_ns);
+    p[n++] = (uint8_t)tipo;
+    n += registro_poner_varint(p + n, len);
+    memcpy(p + n, mensaje, len);
+    r->ocupado += n + len;
+    r->ultimo_ns = ahora;
+
+    r->bloque.fin_ns = ahora;
+    r->bloque.tipos |= 1u << tipo;
+    r->bloque.registros++;
+
+    // La longitud ocupada se publica la última, para que un lector del segmento en
+    // marcha no vea nunca un registro a medias
+    struct registro_cabecera *c = (struct registro_cabecera *)r->mapa;
+    c->fin_ns = ahora;
+    __atomic_store_n(&c->ocupado, r->ocupado, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&r->cerrojo);
+    return 0;
+}
+
+/**
+ * Función: registro_evento
+ *
+ * Destino de funcionLogEvento() cuando el log binario está activado.
+ */
+void registro_evento(int tipo, const char *mensaje) {
+    if (registro_escribir(&registro_actual, tipo, mensaje, strlen(mensaje)) == -1) {
+        perror("Error al escribir en el log binario");
+    }
+}
+
+/**
+ * Función: registro_desactivar
+ *
+ * Cierra el log binario y vuelve al log de texto.
+ */
+void registro_desactivar() {
+    log_binario = NULL;
+    pthread_mutex_lock(&registro_actual.cerrojo);
+    registro_cerrar_segmento(&registro_actual);
+    pthread_mutex_unlock(&registro_actual.cerrojo);
+}
+
+/**
+ * Función: registro_activar
+ *
+ * Activa el log binario: a partir de ahora funcionLog() escribe en los segmentos
+ * <prefijo>.NNNNNN.ej3l en lugar de en el fichero de texto. Se desactiva solo al
+ * terminar el proceso.
+ *
+ * Parámetros:
+ *   - prefijo: Prefijo de los ficheros del log
+ *   - limite: Tamaño máximo de cada segmento en bytes (0 = REGISTRO_LIMITE)
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int registro_activar(const char *prefijo, size_t limite) {
+    struct registro *r = &registro_actual;
+
+    snprintf(r->prefijo, sizeof(r->prefijo), "%s", prefijo);
+    r->limite = limite ? limite : REGISTRO_LIMITE;
+    if (r->limite < 4096) {
+        r->limite = 4096;
+    }
+    r->secuencia = 0;
+    r->ultimo_ns = 0;
+    if (registro_abrir_segmento(r) == -1) {
+        return -1;
+    }
+    log_binario = registro_evento;
+
+    // Al terminar el proceso (por cualquier camino) se completa el índice y se recorta
+    // el último segmento
+    atexit(registro_desactivar);
+    return 0;
+}
+
+#endif /* EJ3_REGISTRO_H */
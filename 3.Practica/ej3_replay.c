@@ -0,0 +1,347 @@
+/**
+ * Ejercicio 3: Repetición de trazas de tráfico contra el servidor
+ *
+ * Este programa lee una traza grabada con "ej3_cliente -g" (ver ej3_traza.h) y
+ * vuelve a enviar sus peticiones al servidor, respetando los intervalos originales
+ * entre ellas, acelerándolos N veces o sin ninguna espera. Al terminar compara la
+ * duración, el rendimiento y la latencia de la repetición con los de la grabación,
+ * y cuenta las respuestas que no coinciden con las grabadas.
+ *
+ * Las peticiones grabadas con plazo (ver ej3_protocolo.h) se envían con un plazo
+ * nuevo, de PLAZO_PETICION_MS desde el momento de repetirlas: el grabado ya venció.
+ *
+ * Ejemplos de uso (con el servidor ya en ejecución):
+ *   ./ej3_cliente -g traza.bin < entrada.txt      Graba el tráfico
+ *   ./ej3_replay traza.bin                        Lo repite al ritmo original
+ *   ./ej3_replay -v 10 traza.bin                  Diez veces más rápido
+ *   ./ej3_replay -v 0 traza.bin                   Tan rápido como sea posible
+ */
+
+#include "ej3_common.h"       // Incluye definiciones y funciones comunes
+#include "ej3_estadisticas.h" // Número de particiones del servidor (contar_shards)
+#include "ej3_protocolo.h"    // Plazo de las peticiones con cabecera binaria
+#include "ej3_socket.h"       // Transporte alternativo mediante socket Unix SOCK_SEQPACKET
+#include "ej3_traza.h"        // Formato de la traza
+
+#include <getopt.h> // Para procesar opciones de línea de comandos (getopt_long)
+
+/**
+ * Descriptores del transporte (cola o socket, como en ej3_cliente)
+ */
+mqd_t server_queue = -1;
+mqd_t client_queue = -1;
+int socket_fd = -1;
+size_t tam_mensaje = MAX_SIZE;
+
+/**
+ * Estructura: vector_u64
+ *
+ * Vector de valores que crece según se añaden.
+ */
+struct vector_u64 {
+    uint64_t *v;
+    size_t n, capacidad;
+};
+
+/**
+ * Función: vector_anadir
+ *
+ * Añade un valor al final del vector.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no hay memoria
+ */
+int vector_anadir(struct vector_u64 *vec, uint64_t valor) {
+    if (vec->n == vec->capacidad) {
+        size_t nueva = vec->capacidad ? vec->capacidad * 2 : 1024;
+        uint64_t *p = realloc(vec->v, nueva * sizeof(uint64_t));
+        if (p == NULL) {
+            return -1;
+        }
+        vec->v = p;
+        vec->capacidad = nueva;
+    }
+    vec->v[vec->n++] = valor;
+    return 0;
+}
+
+/**
+ * Función: comparar_u64
+ *
+ * Función de comparación para qsort() sobre valores uint64_t.
+ */
+int comparar_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Función: percentil
+ *
+ * Devuelve el percentil p (0-100) de un vector ya ordenado.
+ */
+uint64_t percentil(const uint64_t *v, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return v[i];
+}
+
+/**
+ * Función: media
+ *
+ * Devuelve la media de los valores del vector.
+ */
+double media(const struct vector_u64 *vec) {
+    uint64_t suma = 0;
+    for (size_t i = 0; i < vec->n; i++) {
+        suma += vec->v[i];
+    }
+    return vec->n ? (double)suma / vec->n : 0;
+}
+
+/**
+ * Función: abrir_transporte
+ *
+ * Abre las colas del servidor o conecta con su socket.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int abrir_transporte(int usar_socket) {
+    char nombre[120];
+
+    if (usar_socket) {
+        get_queue_name(nombre, SERVER_SOCKET);
+        socket_fd = conectar_socket_cliente(nombre);
+        if (socket_fd == -1) {
+            perror("Error al conectar con el socket del servidor");
+            return -1;
+        }
+        return 0;
+    }
+
+    // Con varias particiones, la nuestra se elige a partir del PID, como en ej3_cliente
+    int num_shards = contar_shards();
+    int shard = shard_de_pid(getpid(), num_shards);
+    get_shard_name(nombre, SERVER_QUEUE, shard, num_shards);
+    server_queue = mq_open(nombre, O_WRONLY);
+    get_shard_name(nombre, CLIENT_QUEUE, shard, num_shards);
+    client_queue = mq_open(nombre, O_RDONLY);
+    if (server_queue == -1 || client_queue == -1) {
+        perror("Error al abrir las colas del servidor");
+        return -1;
+    }
+    // mq_receive() exige un buffer del tamaño de mensaje de la cola
+    struct mq_attr attr;
+    if (mq_getattr(client_queue, &attr) == 0) {
+        tam_mensaje = attr.mq_msgsize;
+    }
+    return 0;
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_replay [opciones] <traza>\n");
+    printf("Opciones:\n");
+    printf("-h, --help               Imprimir esta ayuda\n");
+    printf("-s, --socket             Usar el socket Unix (por defecto, colas de mensajes)\n");
+    printf("-v, --velocidad <N>      Factor de velocidad: 1 = ritmo original (por defecto), "
+           "2 = el doble de rápido, 0 = sin esperas\n");
+    printf("-x, --exit               Enviar \"exit\" al terminar (detiene el servidor de colas)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int usar_socket = 0;
+    int enviar_salida = 0;
+    double velocidad = 1.0;
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"socket", no_argument, 0, 's'},
+                                           {"velocidad", required_argument, 0, 'v'},
+                                           {"exit", no_argument, 0, 'x'},
+                                           {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "hsv:x", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 's':
+            usar_socket = 1;
+            break;
+        case 'v':
+            velocidad = atof(optarg);
+            break;
+        case 'x':
+            enviar_salida = 1;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || velocidad < 0) {
+        print_help();
+        return EXIT_FAILURE;
+    }
+
+    struct traza traza;
+    struct traza_cabecera cabecera;
+    if (traza_abrir(&traza, argv[optind], &cabecera) == -1) {
+        perror("No se pudo abrir la traza");
+        return EXIT_FAILURE;
+    }
+    if (abrir_transporte(usar_socket) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // Buffers: petición grabada, respuesta grabada y respuesta recibida ahora
+    size_t max = tam_mensaje > MAX_SIZE ? tam_mensaje : MAX_SIZE;
+    char *peticion = malloc(max);
+    char *grabada = malloc(max);
+    char *respuesta = malloc(max);
+    if (peticion == NULL || grabada == NULL || respuesta == NULL) {
+        perror("Error en malloc");
+        return EXIT_FAILURE;
+    }
+
+    struct vector_u64 lat_grabada = {NULL, 0, 0}, lat_repetida = {NULL, 0, 0};
+    struct traza_registro r, pet;
+    uint64_t primero_ns = 0, ultimo_ns = 0, retraso_total = 0;
+    long peticiones = 0, distintas = 0;
+    int leido = traza_leer(&traza, &r, peticion, max);
+    uint64_t inicio = ahora_ns();
+
+    while (leido == 1) {
+        // Las respuestas sin petición (por ejemplo, si la traza empezó a mitad) se ignoran
+        if (r.tipo != TRAZA_PETICION) {
+            leido = traza_leer(&traza, &r, peticion, max);
+            continue;
+        }
+        pet = r;
+        if (peticiones == 0) {
+            primero_ns = pet.instante_ns;
+        }
+
+        // La respuesta grabada es el registro siguiente (el cliente espera cada respuesta
+        // antes de enviar la siguiente petición)
+        struct traza_registro resp;
+        int con_respuesta = 0;
+        leido = traza_leer(&traza, &resp, grabada, max);
+        if (leido == 1 && resp.tipo == TRAZA_RESPUESTA) {
+            con_respuesta = 1;
+            ultimo_ns = resp.instante_ns;
+            vector_anadir(&lat_grabada, resp.instante_ns - pet.instante_ns);
+        }
+
+        // Esperamos hasta el instante que le corresponde según el factor de velocidad
+        if (velocidad > 0) {
+            uint64_t objetivo = inicio + (uint64_t)((pet.instante_ns - primero_ns) / velocidad);
+            uint64_t ahora = ahora_ns();
+            if (ahora < objetivo) {
+                struct timespec ts = {(time_t)(objetivo / 1000000000ULL),
+                                      (long)(objetivo % 1000000000ULL)};
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+            else {
+                retraso_total += ahora - objetivo;
+            }
+        }
+
+        uint64_t t0 = ahora_ns();
+        size_t len = pet.longitud < max ? pet.longitud : max;
+        proto_fijar_plazo(peticion, len, t0 + PLAZO_PETICION_MS * 1000000ULL);
+        ssize_t recibidos;
+        if (usar_socket) {
+            recibidos = send(socket_fd, peticion, len, MSG_NOSIGNAL) == -1
+                            ? -1
+                            : recv(socket_fd, respuesta, max, 0);
+        }
+        else {
+            recibidos = mq_send(server_queue, peticion, len, pet.prioridad) == -1
+                            ? -1
+                            : mq_receive(client_queue, respuesta, max, NULL);
+        }
+        if (recibidos <= 0) {
+            perror("Error al repetir la petición");
+            break;
+        }
+        vector_anadir(&lat_repetida, ahora_ns() - t0);
+        peticiones++;
+
+        // La respuesta lleva el plazo de la petición: se compara con el mismo plazo
+        if (con_respuesta) {
+            proto_fijar_plazo(grabada, resp.longitud, proto_plazo(peticion, len));
+        }
+        if (con_respuesta &&
+            ((size_t)recibidos != resp.longitud || memcmp(respuesta, grabada, recibidos) != 0)) {
+            distintas++;
+        }
+
+        // Siguiente registro: si el leído no era la respuesta, ya es la siguiente petición
+        if (con_respuesta) {
+            leido = traza_leer(&traza, &r, peticion, max);
+        }
+        else if (leido == 1) {
+            r = resp;
+            memcpy(peticion, grabada, resp.longitud < max ? resp.longitud : max);
+        }
+    }
+    uint64_t duracion = ahora_ns() - inicio;
+
+    if (leido == -1) {
+        printf("Aviso: la traza está dañada o incompleta; se repitió hasta el error\n");
+    }
+    if (enviar_salida && !usar_socket) {
+        mq_send(server_queue, MSG_EXIT, strlen(MSG_EXIT) + 1, 0);
+    }
+
+    // Resultados: grabación frente a repetición
+    double dur_grabada = (ultimo_ns - primero_ns) / 1e9;
+    qsort(lat_grabada.v, lat_grabada.n, sizeof(uint64_t), comparar_u64);
+    qsort(lat_repetida.v, lat_repetida.n, sizeof(uint64_t), comparar_u64);
+
+    printf("Peticiones repetidas: %ld (respuestas distintas de las grabadas: %ld)\n", peticiones,
+           distintas);
+    printf("%-26s %14s %14s\n", "", "grabado", "repetido");
+    printf("%-26s %14.3f %14.3f\n", "Duración (s)", dur_grabada, duracion / 1e9);
+    printf("%-26s %14.0f %14.0f\n", "Rendimiento (pet/s)",
+           dur_grabada > 0 ? lat_grabada.n / dur_grabada : 0, peticiones / (duracion / 1e9));
+    printf("%-26s %14.1f %14.1f\n", "Latencia media (us)", media(&lat_grabada) / 1e3,
+           media(&lat_repetida) / 1e3);
+    const double percentiles[] = {50, 90, 99, 100};
+    const char *nombres[] = {"Latencia p50 (us)", "Latencia p90 (us)", "Latencia p99 (us)",
+                             "Latencia máxima (us)"};
+    for (int i = 0; i < 4; i++) {
+        printf("%-26s %14.1f %14.1f\n", nombres[i],
+               percentil(lat_grabada.v, lat_grabada.n, percentiles[i]) / 1e3,
+               percentil(lat_repetida.v, lat_repetida.n, percentiles[i]) / 1e3);
+    }
+    if (velocidad > 0) {
+        printf("Retraso medio respecto al calendario: %.1f us\n",
+               peticiones ? retraso_total / 1e3 / peticiones : 0);
+    }
+
+    traza_cerrar(&traza);
+    free(peticion);
+    free(grabada);
+    free(respuesta);
+    free(lat_grabada.v);
+    free(lat_repetida.v);
+    if (socket_fd != -1) {
+        close(socket_fd);
+    }
+    else {
+        mq_close(server_queue);
+        mq_close(client_queue);
+    }
+    return EXIT_SUCCESS;
+}
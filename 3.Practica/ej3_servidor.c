@@ -8,9 +8,49 @@
  * - Otra cola para enviar respuestas al cliente
  *
  * El servidor es responsable de crear y eliminar ambas colas.
+ *
+ * Con la opción -S las colas se reparten en varias particiones (shards), cada una
+ * con su par de colas y un hilo propio fijado a un núcleo; los clientes eligen la
+ * partición a partir de su PID (ver get_shard_name() y contar_shards()).
+ *
+ * Todo el trabajo se hace en un único bucle de eventos con epoll, que vigila a la
+ * vez la cola (o el socket), un signalfd y un timerfd. Las señales SIGINT y SIGTERM
+ * no se atienden en un manejador asíncrono, sino como un evento más del bucle:
+ * a partir de ese momento el servidor deja de aceptar trabajo nuevo, atiende lo que
+ * ya estaba encolado (con un plazo máximo) y termina de forma ordenada.
+ *
+ * Por el mismo camino llegan las señales de control, que cambian el servidor sin
+ * reiniciarlo y sin perder los mensajes pendientes:
+ * - SIGHUP: vuelve a leer el fichero de configuración de la opción -f (ver
+ *   ej3_configuracion.h y recargar_configuracion())
+ * - SIGUSR1: vuelca en el log las estadísticas y la configuración actual
+ * - SIGUSR2: cambia el nivel del log (todo -> info -> errores -> todo)
+ *
+ * Las peticiones pueden llevar un plazo (ver ej3_protocolo.h): las que llegan a
+ * atenderse con el plazo ya vencido se descartan sin calcular nada, porque el
+ * cliente ya no espera la respuesta, y la respuesta no espera a que haya sitio en
+ * la cola más allá del plazo.
  */
 
-#include "ej3_common.h" // Incluye definiciones y funciones comunes
+#include "ej3_admision.h"     // Rechazo de peticiones cuando el servidor está saturado
+#include "ej3_carriles.h"     // Carriles de prioridad con reparto ponderado
+#include "ej3_common.h"       // Incluye definiciones y funciones comunes
+#include "ej3_configuracion.h" // Fichero de configuración que se recarga con SIGHUP
+#include "ej3_diario.h"       // Diario de peticiones para no perderlas si el servidor cae
+#include "ej3_estadisticas.h" // Contadores en memoria compartida (ver ej3_stats)
+#include "ej3_flujos.h"       // Flujos de fragmentos para los textos grandes
+#include "ej3_protocolo.h"    // Formato de las peticiones y cálculo de la respuesta
+#include "ej3_registro.h"     // Log binario opcional (ver ej3_log)
+#include "ej3_socket.h"       // Transporte alternativo mediante socket Unix SOCK_SEQPACKET
+
+#include <getopt.h>       // Para procesar opciones de línea de comandos (getopt_long)
+#include <poll.h>         // Para esperar a los ficheros en curso al cerrar con socket
+#include <pthread.h>      // Para los hilos que atienden cada partición
+#include <sched.h>        // Para fijar cada hilo a un núcleo (cpu_set_t)
+#include <sys/epoll.h>    // Para el bucle de eventos
+#include <sys/eventfd.h>  // Para los avisos entre el hilo principal y los de las particiones
+#include <sys/signalfd.h> // Para recibir las señales como eventos (signalfd)
+#include <sys/timerfd.h>  // Para el temporizador periódico del bucle (timerfd)
 
 /**
  * Nombre del archivo de log para el servidor
@@ -21,35 +61,232 @@
 #define LOG_FILE "log-servidor.txt"
 
 /**
- * Variables globales para los descriptores de las colas de mensajes
+ * Variables globales para el transporte por socket (opción -s/--socket)
+ *
+ * - socket_flag: Indica si el servidor usa el socket en lugar de las colas
+ * - listen_fd: Descriptor del socket de escucha (-1 si no se usa o ya se cerró)
+ * - conexiones: Descriptores de los clientes conectados, para poder atender lo
+ *   que tengan pendiente al cerrar el servidor
+ * - flujos_socket: Flujos abiertos por los clientes conectados
+ * - buffer_socket: Buffer de recepción de las conexiones (tam_mensaje_socket + 1 bytes)
+ * - tam_mensaje_socket: Tamaño máximo de mensaje (-z/--msgsize, o MAX_SIZE). Se
+ *   publica en el segmento de estadísticas para que los clientes fragmenten con él.
+ * - ficheros_socket: Peticiones PROTO_RUTA que se calculan en hilos aparte (el
+ *   destino de cada una es la conexión que la envió)
+ */
+int socket_flag = 0;
+int listen_fd = -1;
+int *conexiones = NULL;
+int num_conexiones = 0;
+int cap_conexiones = 0;
+struct tabla_flujos flujos_socket;
+char *buffer_socket = NULL;
+size_t tam_mensaje_socket = MAX_SIZE;
+struct fichero_pendientes ficheros_socket = {.aviso_fd = -1};
+
+/**
+ * Descriptores del bucle de eventos
+ *
+ * - epoll_fd: Instancia de epoll que multiplexa todas las fuentes de eventos
+ * - signal_fd: Descriptor de signalfd por el que llegan las señales de terminación y
+ *   de control
+ * - timer_fd: Temporizador periódico (comprobar el plazo de cierre, publicar estadísticas)
+ */
+int epoll_fd = -1;
+int signal_fd = -1;
+int timer_fd = -1;
+
+/**
+ * Número máximo de eventos que se recogen en cada llamada a epoll_wait
+ */
+#define MAX_EVENTS 256
+
+/**
+ * Periodo del temporizador del bucle de eventos, en milisegundos
+ */
+#define PERIODO_TIMER_MS 100
+
+/**
+ * Plazo por defecto para atender lo pendiente al cerrar, en milisegundos
+ */
+#define PLAZO_CIERRE_MS 5000
+
+/**
+ * Plazo por defecto para sincronizar un grupo de altas del diario, en microsegundos
+ */
+#define PLAZO_DIARIO_US 1000
+
+/**
+ * Tiempo máximo que se espera a que haya sitio en la cola del cliente para una
+ * respuesta sin plazo, en milisegundos. Pasado ese tiempo se da al cliente por
+ * perdido (por ejemplo, murió con su cola llena) y la respuesta se descarta.
+ */
+#define PLAZO_RESPUESTA_MS 1000
+
+/**
+ * Cada cuánto se comprueba, mientras se espera sitio en la cola del cliente, si ha
+ * vencido el plazo de cierre, en milisegundos
+ */
+#define PASO_RESPUESTA_MS 50
+
+/**
+ * Tiempo máximo que se espera a que los hilos de las particiones se paren para
+ * recargar la configuración, en milisegundos. Es mayor que PLAZO_RESPUESTA_MS para
+ * que un hilo que espera sitio en la cola de un cliente llegue a pararse.
+ */
+#define PLAZO_PAUSA_MS 3000
+
+/**
+ * Opciones de las colas indicadas por línea de comandos
+ *
+ * - opcion_maxmsg / opcion_msgsize: Atributos pedidos (0 = automáticos, ver
+ *   calcular_atributos_cola())
+ * - pesos: Pesos del reparto ponderado entre carriles (control, interactivo, masivo)
+ * - plazo_cierre_ms: Tiempo máximo para atender lo pendiente tras SIGTERM
+ * - ruta_diario: Diario de peticiones (-j; NULL = sin diario). Con varias
+ *   particiones, cada una usa <ruta>.<k>
+ * - plazo_diario_ns: Tiempo máximo que una petición recogida espera a que se
+ *   sincronice su alta mientras se atienden otras (-J)
+ * - ruta_config: Fichero de configuración (-f; NULL = sin fichero)
+ */
+long opcion_maxmsg = 0;
+long opcion_msgsize = 0;
+int pesos[NUM_CARRILES] = {PESO_CONTROL, PESO_INTERACTIVO, PESO_MASIVO};
+long plazo_cierre_ms = PLAZO_CIERRE_MS;
+const char *ruta_diario = NULL;
+uint64_t plazo_diario_ns = PLAZO_DIARIO_US * 1000ULL;
+const char *ruta_config = NULL;
+
+/**
+ * Nombres de los carriles para los mensajes de log
+ */
+const char *nombres_carriles[NUM_CARRILES] = {"control", "interactivo", "masivo"};
+
+/**
+ * Estructura: shard
  *
- * Se definen como globales para que puedan ser accedidas desde la función
- * de limpieza y el manejador de señales.
+ * Partición de las colas del servidor. Cada partición tiene su propio par de colas,
+ * sus carriles y un hilo que la atiende, de modo que no hay un único receptor ni un
+ * único cerrojo de cola del núcleo por el que pasen todas las peticiones.
  *
  * - server_queue: Descriptor de la cola para recibir mensajes del cliente
  * - client_queue: Descriptor de la cola para enviar respuestas al cliente
+ * - plan: Carriles con los mensajes ya sacados de la cola y aún sin atender
+ * - buffer: Buffer de recepción (attr.mq_msgsize + 1 bytes)
+ * - epoll_fd: Bucle de eventos del hilo (la cola del servidor y aviso_fd)
+ * - aviso_fd: eventfd por el que el hilo principal avisa del cierre o de una pausa
+ * - pausar: El hilo debe salir de su bucle sin cerrar la partición, para que el
+ *   hilo principal cambie su configuración: 1 si se ha pedido, 2 cuando el hilo la
+ *   acepta y sale (ver pausar_shards() y pausa_aceptada())
+ * - drenando: El hilo ha empezado el cierre ordenado
+ * - por_recoger: Mensajes que estaban en la cola al empezar el cierre y que todavía
+ *   hay que sacar de ella (lo que llegue después ya no se atiende)
+ * - en_carriles: Mensajes en los carriles, publicado para el hilo principal
+ * - flujos: Flujos abiertos en la partición (los fragmentos de un cliente siempre
+ *   llegan a la misma)
+ * - diario: Diario de peticiones de la partición (fd -1 si no hay)
+ * - ficheros: Peticiones PROTO_RUTA que se calculan en hilos aparte (el destino de
+ *   cada una es su carril); su aviso_fd se vigila en el bucle de la partición
+ * - admision: Tiempo medio de servicio y estado del control de admisión
  *
  * El valor inicial -1 indica que las colas no están abiertas.
  */
-mqd_t server_queue = -1;
-mqd_t client_queue = -1;
+struct shard {
+    int id;
+    mqd_t server_queue;
+    mqd_t client_queue;
+    struct planificador plan;
+    char *buffer;
+    int epoll_fd;
+    int aviso_fd;
+    atomic_int pausar;
+    int drenando;
+    long por_recoger;
+    atomic_int en_carriles;
+    struct tabla_flujos flujos;
+    struct diario diario;
+    struct fichero_pendientes ficheros;
+    struct admision admision;
+    pthread_t hilo;
+    int hilo_creado;
+};
 
 /**
- * Función: cleanup
+ * Estado del servidor de colas
  *
- * Realiza la limpieza de recursos antes de terminar el programa.
- * Cierra y elimina las colas de mensajes si están abiertas.
+ * - attr: Atributos con los que se crearon las colas (iguales en todas las particiones)
+ * - shards / num_shards: Particiones (opción -S/--shards, por defecto una)
+ * - usar_afinidad: Fijar el hilo de cada partición a un núcleo (se desactiva con -A)
+ * - cpus_elegidas / num_cpus_elegidas: Núcleos para los hilos de las particiones (-C)
+ * - prioridad_fifo: Prioridad SCHED_FIFO de esos hilos (-F; 0 = planificación normal)
+ * - busy_poll_us: Umbral de inactividad del modo busy-poll en microsegundos (-P; 0 = no)
+ * - aviso_principal_fd: eventfd por el que un hilo avisa al principal de que recibió
+ *   "exit" o de que falló
+ * - fallo_shards: Algún hilo terminó por un error
+ */
+struct mq_attr attr;
+struct shard *shards = NULL;
+int num_shards = 1;
+int usar_afinidad = 1;
+int cpus_elegidas[MAX_SHARDS];
+int num_cpus_elegidas = 0;
+int prioridad_fifo = 0;
+long busy_poll_us = 0;
+int aviso_principal_fd = -1;
+atomic_int fallo_shards = 0;
+
+/**
+ * Estado del cierre ordenado
  *
- * Esta función se llama tanto al finalizar normalmente como
- * cuando se recibe una señal de terminación.
+ * - cerrando: Se recibió SIGINT/SIGTERM o "exit"; no se acepta trabajo nuevo
+ * - fin_plazo_ns: Instante (CLOCK_MONOTONIC) en que se abandona lo que quede pendiente
+ *
+ * Ambas las escribe sólo el hilo principal; fin_plazo_ns se fija antes de avisar a
+ * los hilos de las particiones.
  */
-void cleanup() {
-    char msgbuf[100]; // Buffer para mensajes de log
+atomic_int cerrando = 0;
+uint64_t fin_plazo_ns = 0;
+
+/**
+ * Función: cerrar_shard
+ *
+ * Libera los recursos de una partición: cierra y elimina (unlink) sus colas. Con
+ * diario, las colas no se eliminan: los mensajes que aún tengan se atenderán al
+ * volver a arrancar el servidor.
+ */
+void cerrar_shard(struct shard *s) {
+    char msgbuf[200];  // Buffer para mensajes de log
+    char nombre[120];  // Nombre de la cola
+
+    if (s->epoll_fd != -1) {
+        close(s->epoll_fd);
+    }
+    if (s->aviso_fd != -1) {
+        close(s->aviso_fd);
+    }
+    if (s->ficheros.num > 0) {
+        sprintf(msgbuf, "Cola %d: se dejan %d ficheros sin terminar de calcular", s->id,
+                s->ficheros.num);
+        funcionLog(msgbuf, LOG_FILE);
+    }
+    fichero_pendientes_cerrar(&s->ficheros);
+    free(s->buffer);
+    planificador_liberar(&s->plan);
+    if (s->diario.fd != -1) {
+        sprintf(msgbuf, "Diario de la cola %d: %lu altas en %lu sincronizaciones", s->id,
+                (unsigned long)s->diario.altas, (unsigned long)s->diario.sincronizaciones);
+        funcionLog(msgbuf, LOG_FILE);
+    }
+    if (diario_cerrar(&s->diario) == -1) {
+        sprintf(msgbuf, "Error al sincronizar el diario de la cola %d al cerrarlo: %s", s->id,
+                strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+    }
 
     // Cerramos la cola del servidor si está abierta
-    if (server_queue != -1) {
+    if (s->server_queue != -1) {
         // mq_close cierra el descriptor de la cola pero no la elimina
-        if (mq_close(server_queue) == -1) {
+        if (mq_close(s->server_queue) == -1) {
             sprintf(msgbuf, "Error al cerrar la cola del servidor: %s", strerror(errno));
             funcionLog(msgbuf, LOG_FILE);
         }
@@ -59,8 +296,8 @@ void cleanup() {
     }
 
     // Cerramos la cola del cliente si está abierta
-    if (client_queue != -1) {
-        if (mq_close(client_queue) == -1) {
+    if (s->client_queue != -1) {
+        if (mq_close(s->client_queue) == -1) {
             sprintf(msgbuf, "Error al cerrar la cola del cliente: %s", strerror(errno));
             funcionLog(msgbuf, LOG_FILE);
         }
@@ -69,92 +306,638 @@ void cleanup() {
         }
     }
 
+    if (ruta_diario != NULL) {
+        funcionLog("Colas conservadas para el siguiente arranque (diario activo)", LOG_FILE);
+        return;
+    }
+
     // Eliminamos (unlink) la cola del servidor del sistema
     // mq_unlink elimina la cola del sistema, liberando todos los recursos asociados
-    char server_queue_name[100];
-    get_queue_name(server_queue_name, SERVER_QUEUE);
-    if (mq_unlink(server_queue_name) == -1) {
-        sprintf(msgbuf, "Error al eliminar la cola del servidor: %s", strerror(errno));
+    get_shard_name(nombre, SERVER_QUEUE, s->id, num_shards);
+    if (mq_unlink(nombre) == -1) {
+        sprintf(msgbuf, "Error al eliminar la cola del servidor %s: %s", nombre, strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
     }
     else {
-        funcionLog("Cola del servidor eliminada", LOG_FILE);
+        sprintf(msgbuf, "Cola del servidor eliminada: %s", nombre);
+        funcionLog(msgbuf, LOG_FILE);
     }
 
     // Eliminamos (unlink) la cola del cliente del sistema
-    char client_queue_name[100];
-    get_queue_name(client_queue_name, CLIENT_QUEUE);
-    if (mq_unlink(client_queue_name) == -1) {
-        sprintf(msgbuf, "Error al eliminar la cola del cliente: %s", strerror(errno));
+    get_shard_name(nombre, CLIENT_QUEUE, s->id, num_shards);
+    if (mq_unlink(nombre) == -1) {
+        sprintf(msgbuf, "Error al eliminar la cola del cliente %s: %s", nombre, strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
     }
     else {
-        funcionLog("Cola del cliente eliminada", LOG_FILE);
+        sprintf(msgbuf, "Cola del cliente eliminada: %s", nombre);
+        funcionLog(msgbuf, LOG_FILE);
     }
 }
 
 /**
- * Función: handle_signal
+ * Función: cleanup
  *
- * Manejador de señales para SIGINT (Ctrl+C) y SIGTERM.
- * Cuando se recibe una de estas señales, el servidor realiza una limpieza
- * ordenada de recursos y termina.
+ * Realiza la limpieza de recursos antes de terminar el programa.
+ * Cierra y elimina las colas de mensajes (o el socket) y los descriptores
+ * del bucle de eventos.
  *
- * Parámetros:
- *   - sig: Número de la señal recibida
+ * Se llama una única vez, al salir del bucle de eventos y después de que hayan
+ * terminado los hilos de las particiones, ya que las señales de terminación se
+ * atienden dentro del propio bucle.
+ */
+void cleanup() {
+    char msgbuf[100]; // Buffer para mensajes de log
+
+    // Eliminamos el segmento de estadísticas y la arena: sin servidor no tiene sentido
+    // usarlos
+    estadisticas_eliminar();
+    arena_cerrar(&arena_actual, 1);
+
+    // Cerramos los descriptores del bucle de eventos
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    if (aviso_principal_fd != -1) {
+        close(aviso_principal_fd);
+    }
+
+    // En modo socket no hay colas: cerramos las conexiones y el socket de escucha y
+    // borramos su ruta
+    if (socket_flag) {
+        char socket_path[100];
+        get_queue_name(socket_path, SERVER_SOCKET);
+        fichero_pendientes_cerrar(&ficheros_socket);
+        for (int i = 0; i < num_conexiones; i++) {
+            close(conexiones[i]);
+        }
+        free(conexiones);
+        free(buffer_socket);
+        if (listen_fd != -1) {
+            close(listen_fd);
+            if (unlink(socket_path) == -1) {
+                sprintf(msgbuf, "Error al eliminar el socket del servidor: %s", strerror(errno));
+                funcionLog(msgbuf, LOG_FILE);
+            }
+            else {
+                funcionLog("Socket del servidor eliminado", LOG_FILE);
+            }
+        }
+        return;
+    }
+
+    // Cerramos y eliminamos las colas de cada partición
+    for (int k = 0; shards != NULL && k < num_shards; k++) {
+        cerrar_shard(&shards[k]);
+    }
+    free(shards);
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles del servidor.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_servidor [opciones]\n");
+    printf("Opciones:\n");
+    printf("-h, --help      Imprimir esta ayuda\n");
+    printf("-s, --socket    Escuchar en un socket Unix SOCK_SEQPACKET en lugar de usar colas\n");
+    printf("-m, --maxmsg <N>        Profundidad de las colas (por defecto %s/msg_max)\n",
+           MQUEUE_PROC);
+    printf("-z, --msgsize <bytes>   Tamaño máximo de mensaje (por defecto %d, entre %d y "
+           "msgsize_max; con -s, al menos %d)\n",
+           MAX_SIZE, MIN_SIZE, MAX_SIZE);
+    printf("-w, --pesos <c:i:m>     Pesos del reparto entre los carriles control, interactivo "
+           "y masivo (por defecto %d:%d:%d)\n",
+           PESO_CONTROL, PESO_INTERACTIVO, PESO_MASIVO);
+    printf("-c, --plazo-cierre <ms> Tiempo máximo para atender lo pendiente al recibir SIGTERM "
+           "(por defecto %d)\n",
+           PLAZO_CIERRE_MS);
+    printf("-k, --kernel <nombre>   Kernel de estadísticas de texto: avx2, sse2 o escalar (por "
+           "defecto, el más rápido disponible)\n");
+    printf("-S, --shards <M>        Repartir las colas en M particiones, cada una con su hilo "
+           "(por defecto 1, máximo %d)\n",
+           MAX_SHARDS);
+    printf("-A, --sin-afinidad      No fijar el hilo de cada partición a un núcleo\n");
+    printf("-C, --cpus <lista>      Núcleos de los hilos de las particiones, p. ej. 2,3 o 2-5 "
+           "(por defecto, uno distinto por partición)\n");
+    printf("-F, --fifo <prioridad>  Atender las colas con la política SCHED_FIFO (1-99)\n");
+    printf("-P, --busy-poll <us>    Sondear la cola sin bloquear hasta <us> microsegundos sin "
+           "mensajes antes de dormir\n");
+    printf("-b, --log-binario <prefijo>  Escribir el log en formato binario en "
+           "<prefijo>.NNNNNN.ej3l (ver ej3_log)\n");
+    printf("-R, --rotar <MiB>       Tamaño de cada segmento del log binario (por defecto %lu)\n",
+           REGISTRO_LIMITE >> 20);
+    printf("-H, --hilos-fichero <n> Hilos para leer un fichero pedido por su ruta (por defecto, "
+           "uno por núcleo, máximo %d)\n",
+           FICHERO_MAX_HILOS);
+    printf("-G, --arena <slots>     Crear una arena compartida con ese número de slots para "
+           "recibir el texto sin copiarlo por la cola\n");
+    printf("-Z, --tam-slot <KiB>    Tamaño de cada slot de la arena (por defecto %ld)\n",
+           ARENA_TAM_SLOT >> 10);
+    printf("-j, --diario <ruta>     Anotar las peticiones en un diario para volver a atender "
+           "las que no terminaron si el servidor cae\n");
+    printf("-J, --plazo-diario <us> Tiempo máximo que una petición espera a que se sincronice "
+           "su alta en el diario (por defecto %d)\n",
+           PLAZO_DIARIO_US);
+    printf("-Q, --max-pendientes <N>  Rechazar peticiones con N mensajes en los carriles de una "
+           "partición (N/2 en el carril masivo)\n");
+    printf("-L, --max-espera <us>   Rechazar peticiones si su espera estimada pasa de <us> "
+           "microsegundos (la mitad en el carril masivo)\n");
+    printf("-l, --nivel-log <nivel> Registrar sólo los errores (errores), además los avisos "
+           "(info) o también cada petición (todo, por defecto)\n");
+    printf("-f, --config <fichero>  Leer la configuración de un fichero, que se vuelve a leer "
+           "con SIGHUP (ver ej3_configuracion.h)\n");
+    printf("Señales: SIGHUP recarga el fichero de -f, SIGUSR1 vuelca las estadísticas en el "
+           "log y SIGUSR2 cambia el nivel del log\n");
+}
+
+/**
+ * Función: registrar_fd
+ *
+ * Añade un descriptor a la instancia de epoll.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int registrar_fd(int fd, uint32_t eventos) {
+    struct epoll_event ev;
+    ev.events = eventos;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Función: preparar_eventos
+ *
+ * Crea la instancia de epoll, el signalfd y el timerfd.
+ *
+ * Las señales SIGINT y SIGTERM, y las de control (SIGHUP, SIGUSR1 y SIGUSR2), se
+ * bloquean con sigprocmask() para que no se entreguen de forma asíncrona; quedan
+ * pendientes y el núcleo las notifica por signal_fd, que se lee desde el bucle
+ * como cualquier otro descriptor. Así el tratamiento de la señal puede usar
+ * funciones que no son async-signal-safe (funcionLog, mq_send, malloc...).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
  */
-void handle_signal(int sig) {
+int preparar_eventos() {
     char msgbuf[100];
-    sprintf(msgbuf, "Recibida señal %d, terminando...", sig);
+    sigset_t mascara;
+
+    sigemptyset(&mascara);
+    sigaddset(&mascara, SIGINT);
+    sigaddset(&mascara, SIGTERM);
+    sigaddset(&mascara, SIGHUP);
+    sigaddset(&mascara, SIGUSR1);
+    sigaddset(&mascara, SIGUSR2);
+    if (sigprocmask(SIG_BLOCK, &mascara, NULL) == -1) {
+        sprintf(msgbuf, "Error al bloquear las señales: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &mascara, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd == -1 || signal_fd == -1 || timer_fd == -1) {
+        sprintf(msgbuf, "Error al crear el bucle de eventos: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    // Temporizador periódico: el primer vencimiento y los siguientes cada PERIODO_TIMER_MS
+    struct itimerspec periodo;
+    periodo.it_interval.tv_sec = 0;
+    periodo.it_interval.tv_nsec = PERIODO_TIMER_MS * 1000000L;
+    periodo.it_value = periodo.it_interval;
+    if (timerfd_settime(timer_fd, 0, &periodo, NULL) == -1 ||
+        registrar_fd(signal_fd, EPOLLIN) == -1 || registrar_fd(timer_fd, EPOLLIN) == -1) {
+        sprintf(msgbuf, "Error al configurar el bucle de eventos: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: conexion_anadir / conexion_quitar
+ *
+ * Mantienen la lista de conexiones abiertas en modo socket.
+ */
+void conexion_anadir(int fd) {
+    if (num_conexiones == cap_conexiones) {
+        int nueva = cap_conexiones ? cap_conexiones * 2 : 64;
+        int *p = realloc(conexiones, nueva * sizeof(int));
+        if (p == NULL) {
+            return; // Sin memoria: la conexión funciona, pero no se atenderá al cerrar
+        }
+        conexiones = p;
+        cap_conexiones = nueva;
+    }
+    conexiones[num_conexiones++] = fd;
+    estadisticas_conexion(1);
+}
+
+void conexion_quitar(int fd) {
+    for (int i = 0; i < num_conexiones; i++) {
+        if (conexiones[i] == fd) {
+            conexiones[i] = conexiones[--num_conexiones];
+            break;
+        }
+    }
+    // Los ficheros que el cliente tenga en curso ya no tienen a quién responder (el
+    // descriptor se puede reutilizar para otra conexión)
+    for (struct fichero_trabajo *t = ficheros_socket.lanzados; t != NULL; t = t->siguiente) {
+        if (t->destino == fd) {
+            t->destino = -1;
+        }
+    }
+    // close() también elimina el descriptor de la instancia de epoll
+    close(fd);
+    estadisticas_conexion(0);
+}
+
+/**
+ * Función: iniciar_cierre
+ *
+ * Empieza el cierre ordenado: a partir de aquí no se acepta trabajo nuevo y se
+ * atiende lo pendiente hasta que se acaba o vence el plazo.
+ *
+ * - Con colas, se avisa a los hilos de las particiones: cada uno atiende sólo los
+ *   mensajes que ya estaban en su cola en ese instante (mq_curmsgs) y los que ya
+ *   estaban en sus carriles.
+ * - Con socket, se deja de escuchar (los clientes nuevos reciben un error al
+ *   conectar) y se atiende lo que cada cliente conectado ya hubiera enviado.
+ *
+ * Parámetros:
+ *   - motivo: Texto para el log
+ */
+void iniciar_cierre(const char *motivo) {
+    char msgbuf[200];
+    if (cerrando) {
+        return;
+    }
+    fin_plazo_ns = ahora_ns() + (uint64_t)plazo_cierre_ms * 1000000ULL;
+    cerrando = 1;
+
+    if (socket_flag) {
+        char socket_path[100];
+        get_queue_name(socket_path, SERVER_SOCKET);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+        sprintf(msgbuf, "%s: no se aceptan más conexiones, atendiendo a %d clientes conectados",
+                motivo, num_conexiones);
+    }
+    else {
+        sprintf(msgbuf, "%s: atendiendo lo pendiente en %d colas (plazo %ld ms)", motivo,
+                num_shards, plazo_cierre_ms);
+    }
     funcionLog(msgbuf, LOG_FILE);
 
-    // Llamamos a la función de limpieza para liberar recursos
-    cleanup();
+    // Avisamos a los hilos de las particiones
+    uint64_t uno = 1;
+    for (int k = 0; !socket_flag && shards != NULL && k < num_shards; k++) {
+        if (write(shards[k].aviso_fd, &uno, sizeof(uno)) == -1) {
+            funcionLog("Error al avisar del cierre a una partición", LOG_FILE);
+        }
+    }
+}
+
+/**
+ * Función: atender_timer
+ *
+ * Consume los vencimientos del temporizador y publica la profundidad de las colas
+ * en el segmento de estadísticas (fuera del camino de cada mensaje).
+ */
+void atender_timer() {
+    uint64_t vencimientos;
+    while (read(timer_fd, &vencimientos, sizeof(vencimientos)) == sizeof(vencimientos)) {
+    }
 
-    // Terminamos el programa con éxito
-    exit(EXIT_SUCCESS);
+    // Sumamos la profundidad de todas las particiones
+    uint64_t en_cola = 0, en_carriles = 0;
+    for (int k = 0; !socket_flag && k < num_shards; k++) {
+        struct mq_attr actual;
+        if (mq_getattr(shards[k].server_queue, &actual) == 0) {
+            en_cola += actual.mq_curmsgs;
+        }
+        en_carriles += atomic_load_explicit(&shards[k].en_carriles, memory_order_relaxed);
+    }
+    if (!socket_flag) {
+        estadisticas_profundidad(en_cola, en_carriles);
+    }
 }
 
 /**
- * Función: main
+ * Función: atender_cliente
+ *
+ * Atiende todas las peticiones pendientes de una conexión. Como el descriptor
+ * está registrado en modo edge-triggered, epoll sólo avisa una vez cuando llegan
+ * datos nuevos, así que hay que leer hasta que recv() devuelva EAGAIN.
  *
- * Función principal del servidor. Crea las colas de mensajes, configura
- * los manejadores de señales y entra en un bucle para recibir mensajes
- * del cliente, contar caracteres y enviar respuestas.
+ * Parámetros:
+ *   - fd: Descriptor de la conexión con el cliente
  *
  * Retorno:
- *   - EXIT_SUCCESS si el programa termina correctamente
- *   - EXIT_FAILURE si ocurre algún error
+ *   - 0 si la conexión sigue abierta
+ *   - -1 si hay que cerrarla (el cliente se desconectó, envió "exit" o hubo un error)
  */
-int main() {
-    char buffer[MAX_SIZE]; // Buffer para almacenar mensajes recibidos/enviados
-    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
-    unsigned int prio = 1; // Prioridad para recepción de mensajes
+int atender_cliente(int fd) {
+    char *buffer = buffer_socket;
+    char respuesta[MAX_SIZE];
+    char msgbuf[MAX_SIZE + 100];
 
-    // Configuramos los manejadores de señales
-    // SIGINT (Ctrl+C) y SIGTERM son señales comunes para terminar procesos
-    if (signal(SIGINT, handle_signal) == SIG_ERR) {
-        funcionLog("Error al establecer el manejador de SIGINT", LOG_FILE);
-        return EXIT_FAILURE;
+    while (1) {
+        // Con SOCK_SEQPACKET cada recv() devuelve un mensaje; si no cabe en el buffer se
+        // trunca, pero con MSG_TRUNC recv() devuelve su longitud real
+        ssize_t bytes_read = recv(fd, buffer, tam_mensaje_socket, MSG_TRUNC);
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0; // No quedan más mensajes por ahora
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            sprintf(msgbuf, "Error al recibir del cliente %d: %s", fd, strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            estadisticas_error();
+            return -1;
+        }
+        if (bytes_read == 0) {
+            return -1; // El cliente cerró la conexión
+        }
+        if ((size_t)bytes_read > tam_mensaje_socket) {
+            // Un mensaje truncado no se puede procesar como si estuviera entero: se
+            // rechaza y se cierra la conexión
+            sprintf(msgbuf, "Mensaje de %zd bytes del cliente %d rechazado (máximo %zu)",
+                    bytes_read, fd, tam_mensaje_socket);
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            estadisticas_error();
+            return -1;
+        }
+        buffer[bytes_read] = '\0';
+        estadisticas_recibido(bytes_read);
+        uint64_t inicio_servicio = ahora_ns();
+        proto_marcar(buffer, bytes_read, offsetof(struct ej3_tiempos, desencolado));
+
+        // Los fragmentos de un flujo no se registran uno a uno: sólo el resumen del
+        // flujo, al llegar el último, que es el único que tiene respuesta
+        size_t len;
+        if (proto_es_fragmento(buffer, bytes_read)) {
+            len = flujo_procesar(&flujos_socket, buffer, bytes_read, respuesta, sizeof(respuesta),
+                                 msgbuf, sizeof(msgbuf));
+            if (len == 0) {
+                continue;
+            }
+            funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+        }
+        else {
+            if (log_activo(EVENTO_PETICION)) {
+                char texto[MAX_SIZE];
+                proto_describir(buffer, bytes_read, texto, sizeof(texto));
+                snprintf(msgbuf, sizeof(msgbuf), "Recibido el mensaje: %s", texto);
+                funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+            }
+
+            // En modo socket "exit" sólo cierra la conexión de ese cliente: el servidor
+            // sigue atendiendo al resto y termina con SIGINT/SIGTERM
+            if (strcmp(buffer, MSG_EXIT) == 0) {
+                return -1;
+            }
+
+            if (proto_vencida(buffer, bytes_read, inicio_servicio)) {
+                funcionLogEvento(EVENTO_ERROR, "Petición descartada con el plazo vencido",
+                                 LOG_FILE);
+                estadisticas_vencida();
+                proto_soltar_arena(buffer, bytes_read);
+                continue;
+            }
+            proto_marcar(buffer, bytes_read, offsetof(struct ej3_tiempos, inicio));
+
+            // Los ficheros se calculan en un hilo aparte, para no detener al resto de
+            // clientes (ver recoger_ficheros_socket()); si ya hay demasiados en marcha,
+            // se responde que el servidor está ocupado
+            char ruta[PATH_MAX];
+            if (proto_ruta(buffer, bytes_read, ruta, sizeof(ruta))) {
+                struct fichero_trabajo *t =
+                    fichero_lanzar(&ficheros_socket, ruta, buffer, bytes_read);
+                if (t != NULL) {
+                    t->destino = fd;
+                    t->inicio = inicio_servicio;
+                    continue;
+                }
+                snprintf(msgbuf, sizeof(msgbuf), "No se puede calcular %.200s ahora: %s", ruta,
+                         strerror(errno));
+                funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+                len = proto_ocupado(buffer, bytes_read, respuesta, sizeof(respuesta));
+            }
+            else {
+                len = procesar_peticion(buffer, bytes_read, respuesta, sizeof(respuesta));
+            }
+        }
+
+        if (log_activo(EVENTO_RESPUESTA)) {
+            snprintf(msgbuf, sizeof(msgbuf), "Enviando respuesta: %s",
+                     proto_texto_respuesta(respuesta, len));
+            funcionLogEvento(EVENTO_RESPUESTA, msgbuf, LOG_FILE);
+        }
+        proto_marcar(respuesta, len, offsetof(struct ej3_tiempos, enviado));
+
+        // La respuesta vuelve por la misma conexión: es un canal privado de cada cliente.
+        // Si el cliente no lee sus respuestas y su buffer se llena (EAGAIN) se le desconecta,
+        // para que un cliente lento no bloquee al resto.
+        if (send(fd, respuesta, len, MSG_NOSIGNAL) == -1) {
+            sprintf(msgbuf, "Error al enviar respuesta al cliente %d: %s", fd, strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            estadisticas_error();
+            return -1;
+        }
+        estadisticas_enviado(len, ahora_ns() - inicio_servicio);
     }
+}
 
-    if (signal(SIGTERM, handle_signal) == SIG_ERR) {
-        funcionLog("Error al establecer el manejador de SIGTERM", LOG_FILE);
-        return EXIT_FAILURE;
+/**
+ * Función: recoger_ficheros_socket
+ *
+ * Responde, cada una por su conexión, a las peticiones PROTO_RUTA cuyos ficheros ya
+ * se han calculado (ver fichero_lanzar()). Las de clientes que ya se desconectaron
+ * se descartan.
+ */
+void recoger_ficheros_socket() {
+    char respuesta[MAX_SIZE];
+    char msgbuf[MAX_SIZE + 100];
+    struct fichero_trabajo *t;
+    uint64_t avisos;
+
+    if (read(ficheros_socket.aviso_fd, &avisos, sizeof(avisos)) == -1 && errno != EAGAIN) {
+        funcionLog("Error al leer el aviso de los ficheros", LOG_FILE);
+    }
+    while ((t = fichero_recoger(&ficheros_socket)) != NULL) {
+        int fd = t->destino;
+        size_t len = proto_responder_fichero(t->peticion, t->len, t->ruta, &t->estado, t->error,
+                                             respuesta, sizeof(respuesta));
+        if (fd == -1) {
+            snprintf(msgbuf, sizeof(msgbuf), "Fichero %.200s calculado, pero el cliente ya no está",
+                     t->ruta);
+            funcionLog(msgbuf, LOG_FILE);
+        }
+        else {
+            if (log_activo(EVENTO_RESPUESTA)) {
+                snprintf(msgbuf, sizeof(msgbuf), "Enviando respuesta: %s",
+                         proto_texto_respuesta(respuesta, len));
+                funcionLogEvento(EVENTO_RESPUESTA, msgbuf, LOG_FILE);
+            }
+            proto_marcar(respuesta, len, offsetof(struct ej3_tiempos, enviado));
+            if (send(fd, respuesta, len, MSG_NOSIGNAL) == -1) {
+                sprintf(msgbuf, "Error al enviar respuesta al cliente %d: %s", fd,
+                        strerror(errno));
+                funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+                estadisticas_error();
+                conexion_quitar(fd);
+            }
+            else {
+                estadisticas_enviado(len, ahora_ns() - t->inicio);
+            }
+        }
+        fichero_liberar(t);
+    }
+}
+
+/**
+ * Función: esperar_ficheros_socket
+ *
+ * Durante el cierre con socket, espera (como mucho hasta que vence el plazo de
+ * cierre) a los ficheros que aún se estén calculando y responde a cada uno.
+ */
+void esperar_ficheros_socket() {
+    char msgbuf[100];
+
+    while (ficheros_socket.num > 0) {
+        uint64_t ahora = ahora_ns();
+        if (ahora >= fin_plazo_ns) {
+            sprintf(msgbuf, "Vencido el plazo de cierre con %d ficheros sin calcular",
+                    ficheros_socket.num);
+            funcionLog(msgbuf, LOG_FILE);
+            return;
+        }
+        struct pollfd pfd = {.fd = ficheros_socket.aviso_fd, .events = POLLIN};
+        if (poll(&pfd, 1, (int)((fin_plazo_ns - ahora) / 1000000ULL) + 1) > 0) {
+            recoger_ficheros_socket();
+        }
+    }
+}
+
+/**
+ * Función: aceptar_conexiones
+ *
+ * Acepta todas las conexiones pendientes hasta obtener EAGAIN (el socket de
+ * escucha está registrado en modo edge-triggered).
+ */
+void aceptar_conexiones() {
+    char msgbuf[100];
+    while (listen_fd != -1) {
+        int cfd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                sprintf(msgbuf, "Error al aceptar conexión: %s", strerror(errno));
+                funcionLog(msgbuf, LOG_FILE);
+            }
+            return;
+        }
+        if (registrar_fd(cfd, EPOLLIN | EPOLLRDHUP | EPOLLET) == -1) {
+            close(cfd);
+            continue;
+        }
+        conexion_anadir(cfd);
+    }
+}
+
+/**
+ * Función: preparar_socket
+ *
+ * Crea el socket de escucha y lo registra en el bucle de eventos.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int preparar_socket() {
+    char msgbuf[MAX_SIZE];
+    char socket_path[100];
+
+    get_queue_name(socket_path, SERVER_SOCKET);
+    sprintf(msgbuf, "La ruta del socket del servidor es: %s", socket_path);
+    funcionLog(msgbuf, LOG_FILE);
+
+    if (opcion_msgsize > 0) {
+        tam_mensaje_socket = opcion_msgsize;
+    }
+    buffer_socket = malloc(tam_mensaje_socket + 1);
+    if (buffer_socket == NULL) {
+        funcionLog("Error al reservar el buffer de recepción del socket", LOG_FILE);
+        return -1;
+    }
+    estadisticas_tam_socket(tam_mensaje_socket);
+    if (fichero_pendientes_iniciar(&ficheros_socket) == -1 ||
+        registrar_fd(ficheros_socket.aviso_fd, EPOLLIN) == -1) {
+        sprintf(msgbuf, "Error al preparar los avisos de los ficheros: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    listen_fd = crear_socket_servidor(socket_path);
+    if (listen_fd == -1) {
+        sprintf(msgbuf, "Error al crear el socket del servidor: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    if (registrar_fd(listen_fd, EPOLLIN | EPOLLET) == -1) {
+        sprintf(msgbuf, "Error al registrar el socket de escucha: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
     }
+    return 0;
+}
+
+/**
+ * Función: preparar_shard
+ *
+ * Crea las colas y los carriles de una partición y su propio bucle de eventos,
+ * en el que se vigilan la cola del servidor y el eventfd de avisos (en Linux un
+ * mqd_t es un descriptor de fichero y se puede vigilar con epoll).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int preparar_shard(struct shard *s) {
+    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
 
-    // Configuramos los atributos de las colas de mensajes
-    struct mq_attr attr;
-    attr.mq_flags = 0;          // 0 = cola bloqueante (por defecto)
-    attr.mq_maxmsg = 10;        // Número máximo de mensajes en la cola
-    attr.mq_msgsize = MAX_SIZE; // Tamaño máximo de cada mensaje
-    attr.mq_curmsgs = 0;        // Número actual de mensajes (inicialmente 0)
+    // El buffer de recepción tiene un byte más para poder cerrar siempre la cadena
+    s->buffer = malloc(attr.mq_msgsize + 1);
+    if (s->buffer == NULL ||
+        planificador_init(&s->plan, (int)attr.mq_maxmsg, attr.mq_msgsize, pesos) == -1) {
+        funcionLog("Error al reservar memoria para los carriles", LOG_FILE);
+        return -1;
+    }
 
-    // Obtenemos nombres únicos para las colas basados en el nombre de usuario
-    char server_queue_name[100];
-    char client_queue_name[100];
-    get_queue_name(server_queue_name, SERVER_QUEUE);
-    get_queue_name(client_queue_name, CLIENT_QUEUE);
+    // Obtenemos nombres únicos para las colas basados en el nombre de usuario (y en el
+    // número de partición, si hay más de una)
+    char server_queue_name[120];
+    char client_queue_name[120];
+    get_shard_name(server_queue_name, SERVER_QUEUE, s->id, num_shards);
+    get_shard_name(client_queue_name, CLIENT_QUEUE, s->id, num_shards);
 
     // Registramos los nombres de las colas en el log
     sprintf(msgbuf, "El nombre de la cola del servidor es: %s", server_queue_name);
@@ -165,95 +948,1615 @@ int main() {
     // Creamos la cola del servidor
     // O_CREAT: Crea la cola si no existe
     // O_RDONLY: Abre la cola solo para lectura (el servidor lee mensajes del cliente)
+    // O_NONBLOCK: mq_receive no bloquea; la espera se hace en epoll_wait
     // 0644: Permisos de la cola (rw-r--r--)
-    server_queue = mq_open(server_queue_name, O_CREAT | O_RDONLY, 0644, &attr);
-    if (server_queue == -1) {
+    s->server_queue = mq_open(server_queue_name, O_CREAT | O_RDONLY | O_NONBLOCK, 0644, &attr);
+    if (s->server_queue == -1) {
         sprintf(msgbuf, "Error al crear la cola del servidor: %s", strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    sprintf(msgbuf, "El descriptor de la cola del servidor es: %d", server_queue);
+    sprintf(msgbuf, "El descriptor de la cola del servidor es: %d", s->server_queue);
     funcionLog(msgbuf, LOG_FILE);
 
     // Creamos la cola del cliente
     // O_CREAT: Crea la cola si no existe
     // O_WRONLY: Abre la cola solo para escritura (el servidor escribe respuestas al cliente)
-    client_queue = mq_open(client_queue_name, O_CREAT | O_WRONLY, 0644, &attr);
-    if (client_queue == -1) {
+    s->client_queue = mq_open(client_queue_name, O_CREAT | O_WRONLY, 0644, &attr);
+    if (s->client_queue == -1) {
         sprintf(msgbuf, "Error al crear la cola del cliente: %s", strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
-        // Si hay error, cerramos y eliminamos la cola del servidor que ya habíamos creado
-        mq_close(server_queue);
-        mq_unlink(server_queue_name);
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    sprintf(msgbuf, "El descriptor de la cola del cliente es: %d", client_queue);
+    sprintf(msgbuf, "El descriptor de la cola del cliente es: %d", s->client_queue);
     funcionLog(msgbuf, LOG_FILE);
 
-    // Bucle principal del servidor
-    // El servidor se ejecuta indefinidamente hasta recibir un mensaje de salida o un error
-    while (1) {
-        // Recibimos un mensaje de la cola del servidor
-        // mq_receive es una llamada bloqueante: el proceso se detendrá aquí hasta que
-        // llegue un mensaje o se produzca un error
-        // Parámetros:
-        // - server_queue: Descriptor de la cola
-        // - buffer: Buffer donde se almacenará el mensaje
-        // - MAX_SIZE: Tamaño máximo del mensaje
-        // - &prio: Puntero a variable donde se almacenará la prioridad del mensaje
-        ssize_t bytes_read = mq_receive(server_queue, buffer, MAX_SIZE, &prio);
-
-        // Verificamos si hubo error en la recepción
-        if (bytes_read < 0) {
-            sprintf(msgbuf, "Error al recibir mensaje: %s", strerror(errno));
+    // Abrimos el diario: las peticiones que quedaron sin terminar en la ejecución
+    // anterior se atienden antes que las de la cola
+    if (ruta_diario != NULL) {
+        char ruta[256];
+        if (num_shards > 1) {
+            snprintf(ruta, sizeof(ruta), "%s.%d", ruta_diario, s->id);
+        }
+        else {
+            snprintf(ruta, sizeof(ruta), "%s", ruta_diario);
+        }
+        if (diario_abrir(&s->diario, ruta) == -1) {
+            sprintf(msgbuf, "Error al abrir el diario %s: %s", ruta, strerror(errno));
             funcionLog(msgbuf, LOG_FILE);
-            break; // Salimos del bucle en caso de error
+            return -1;
         }
+        sprintf(msgbuf, "Diario %s: %lu peticiones sin terminar de la ejecución anterior",
+                ruta, (unsigned long)s->diario.num_pendientes);
+        funcionLog(msgbuf, LOG_FILE);
+    }
 
-        // Aseguramos que el buffer termine con un carácter nulo
-        // Esto es importante para funciones como strcmp y strlen
-        buffer[bytes_read] = '\0';
-
-        // Registramos el mensaje recibido en el log
-        sprintf(msgbuf, "Recibido el mensaje: %s", buffer);
+    // Bucle de eventos de la partición. La cola se vigila en modo level-triggered:
+    // mientras tenga mensajes, epoll avisa
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    s->aviso_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event ev_cola = {.events = EPOLLIN, .data.fd = s->server_queue};
+    struct epoll_event ev_aviso = {.events = EPOLLIN, .data.fd = s->aviso_fd};
+    int ficheros = fichero_pendientes_iniciar(&s->ficheros);
+    struct epoll_event ev_ficheros = {.events = EPOLLIN, .data.fd = s->ficheros.aviso_fd};
+    if (s->epoll_fd == -1 || s->aviso_fd == -1 || ficheros == -1 ||
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->server_queue, &ev_cola) == -1 ||
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->aviso_fd, &ev_aviso) == -1 ||
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->ficheros.aviso_fd, &ev_ficheros) == -1) {
+        sprintf(msgbuf, "Error al preparar el bucle de eventos de la cola: %s", strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+    return 0;
+}
 
-        // Verificamos si es un mensaje de salida
-        if (strcmp(buffer, MSG_EXIT) == 0) {
-            funcionLog("Recibido mensaje de salida, terminando...", LOG_FILE);
-            break; // Salimos del bucle si recibimos el mensaje de salida
-        }
+/**
+ * Función: tam_respuesta
+ *
+ * Tamaño máximo de una respuesta por la cola: el del buffer, pero sin pasar del
+ * tamaño de mensaje de la cola (-z puede ser menor que MAX_SIZE), para que la
+ * respuesta se recorte en lugar de que mq_timedsend() la rechace con EMSGSIZE.
+ */
+size_t tam_respuesta(size_t tam_buffer) {
+    return (size_t)attr.mq_msgsize < tam_buffer ? (size_t)attr.mq_msgsize : tam_buffer;
+}
 
-        // Contamos el número de caracteres en el mensaje recibido
-        // strlen devuelve la longitud de la cadena sin contar el carácter nulo
-        int char_count = strlen(buffer);
+/**
+ * Función: rechazar_peticion
+ *
+ * Responde que el servidor está ocupado a la petición que hay en el buffer de la
+ * partición, sin atenderla. Si la cola de respuestas está llena, la respuesta se
+ * descarta en lugar de esperar: bloquear aquí empeoraría la saturación.
+ */
+void rechazar_peticion(struct shard *s, unsigned int prio, size_t len) {
+    char msgbuf[200];
+    char respuesta[MAX_SIZE];
+    struct timespec ya = {0, 0}; // Plazo ya vencido: mq_timedsend no espera
 
-        // Preparamos el mensaje de respuesta con el conteo de caracteres
-        sprintf(buffer, "Número de caracteres recibidos: %d", char_count);
+    if (!s->admision.saturada) {
+        sprintf(msgbuf, "Cola %d saturada (%d mensajes en los carriles, servicio medio %.1f us): "
+                        "se rechazan peticiones",
+                s->id, planificador_pendientes(&s->plan), s->admision.servicio_ns / 1e3);
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        s->admision.saturada = 1;
+    }
+    s->admision.rechazadas++;
+    estadisticas_rechazada();
+    proto_soltar_arena(s->buffer, len); // No se rechazan (proto_rechazable()), pero por si acaso
 
-        // Registramos el mensaje de respuesta en el log
-        sprintf(msgbuf, "Enviando respuesta: %s", buffer);
+    size_t n = proto_ocupado(s->buffer, len, respuesta, tam_respuesta(sizeof(respuesta)));
+    if (n > 0 && mq_timedsend(s->client_queue, respuesta, n, prio, &ya) == -1 &&
+        errno != ETIMEDOUT) {
+        sprintf(msgbuf, "Error al enviar la respuesta de ocupado: %s", strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+    }
+}
+
+/**
+ * Función: descartar_vencida
+ *
+ * Registra que se descarta sin atenderla una petición cuyo plazo ha vencido.
+ */
+void descartar_vencida(struct shard *s, const char *etapa) {
+    char msgbuf[100];
+    sprintf(msgbuf, "Cola %d: petición descartada %s con el plazo vencido", s->id, etapa);
+    funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+    estadisticas_vencida();
+}
+
+/**
+ * Función: enviar_respuesta
+ *
+ * Envía una respuesta por la cola del cliente de la partición sin esperar nunca
+ * indefinidamente a que haya sitio: la espera termina con el plazo de la petición o,
+ * si no tiene, a los PLAZO_RESPUESTA_MS. Se espera por tramos de PASO_RESPUESTA_MS
+ * para abandonar también cuando vence el plazo de cierre del servidor; si no, un
+ * cliente que muere con su cola llena dejaría el hilo bloqueado en mq_send() y el
+ * cierre (pthread_join) no terminaría nunca.
+ *
+ * Parámetros:
+ *   - plazo: Plazo de la petición (ahora_ns()), o 0 si no tiene
+ *
+ * Retorno:
+ *   - 0 si se envió
+ *   - -1 con errno ETIMEDOUT si se abandonó la espera, u otro errno si falló
+ */
+int enviar_respuesta(struct shard *s, const char *respuesta, size_t len, unsigned int prio,
+                     uint64_t plazo) {
+    uint64_t limite = plazo != 0 ? plazo : ahora_ns() + PLAZO_RESPUESTA_MS * 1000000ULL;
+    struct timespec ts;
+
+    while (1) {
+        uint64_t ahora = ahora_ns();
+        uint64_t tramo = ahora + PASO_RESPUESTA_MS * 1000000ULL;
+        if (cerrando && fin_plazo_ns < limite) {
+            limite = fin_plazo_ns;
+        }
+        instante_absoluto(tramo < limite ? tramo : limite, &ts);
+        if (mq_timedsend(s->client_queue, respuesta, len, prio, &ts) == 0) {
+            return 0;
+        }
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            return -1;
+        }
+        if (ahora_ns() >= limite) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+/**
+ * Función: recoger_cola
+ *
+ * Pasa a los carriles de la partición, sin bloquear, los mensajes que haya en su
+ * cola mientras quepan. Durante el cierre sólo se recogen los que ya estaban en
+ * la cola. Con el control de admisión, las peticiones que llegan con la partición
+ * saturada se rechazan aquí mismo (ver ej3_admision.h), y las que ya llegan con el
+ * plazo vencido se descartan.
+ *
+ * Con diario, antes se pasan las peticiones pendientes de la ejecución anterior, y
+ * cada mensaje recogido se anota en el diario (salvo "exit", que no debe repetirse
+ * al volver a arrancar). Los carriles no se atienden hasta sincronizar esas altas
+ * (ver hilo_shard).
+ */
+void recoger_cola(struct shard *s) {
+    unsigned int prio;
+    char msgbuf[100];
+    struct diario *d = &s->diario;
+
+    while (d->siguiente_pendiente < d->num_pendientes && planificador_admite(&s->plan)) {
+        struct diario_pendiente *e = &d->pendientes[d->siguiente_pendiente++];
+        planificador_meter(&s->plan, carril_de_prioridad(e->prioridad), e->mensaje, e->longitud,
+                           e->id);
+    }
+
+    while (planificador_admite(&s->plan) && (!s->drenando || s->por_recoger > 0)) {
+        ssize_t bytes_read = mq_receive(s->server_queue, s->buffer, attr.mq_msgsize, &prio);
+        if (bytes_read < 0) {
+            if (errno != EAGAIN) {
+                sprintf(msgbuf, "Error al recibir mensaje: %s", strerror(errno));
+                funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+                estadisticas_error();
+            }
+            break;
+        }
+        proto_marcar(s->buffer, bytes_read, offsetof(struct ej3_tiempos, desencolado));
+        estadisticas_recibido(bytes_read);
+        if (s->drenando) {
+            s->por_recoger--;
+        }
+        if (proto_vencida(s->buffer, bytes_read, ahora_ns())) {
+            descartar_vencida(s, "al recogerla");
+            proto_soltar_arena(s->buffer, bytes_read);
+            continue;
+        }
+        int carril = carril_de_prioridad(prio);
+        if (proto_rechazable(s->buffer, bytes_read) &&
+            admision_rechazar(&s->admision, carril, planificador_pendientes(&s->plan))) {
+            rechazar_peticion(s, prio, bytes_read);
+            continue;
+        }
+        if (s->admision.saturada) {
+            sprintf(msgbuf, "Cola %d: fin de la saturación (%lu peticiones rechazadas)", s->id,
+                    (unsigned long)s->admision.rechazadas);
+            funcionLog(msgbuf, LOG_FILE);
+            s->admision.saturada = 0;
+            s->admision.rechazadas = 0;
+        }
+
+        uint64_t etiqueta = 0;
+        s->buffer[bytes_read] = '\0';
+        if (d->fd != -1 && strcmp(s->buffer, MSG_EXIT) != 0) {
+            etiqueta = diario_alta(d, prio, s->buffer, bytes_read);
+        }
+        planificador_meter(&s->plan, carril, s->buffer, bytes_read, etiqueta);
+    }
+
+    // Durante el cierre, en cuanto se han recogido los mensajes que quedaban, dejamos de
+    // vigilar la cola para que epoll no siga avisando de los que lleguen después
+    if (s->drenando && s->por_recoger <= 0) {
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, s->server_queue, NULL);
+    }
+}
+
+/**
+ * Función: avisar_principal
+ *
+ * Despierta al hilo principal (eventfd), que decide si hay que empezar el cierre.
+ */
+void avisar_principal() {
+    uint64_t uno = 1;
+    if (write(aviso_principal_fd, &uno, sizeof(uno)) == -1) {
+        funcionLog("Error al avisar al hilo principal", LOG_FILE);
+    }
+}
+
+/**
+ * Función: responder
+ *
+ * Envía a la cola del cliente la respuesta a una petición de la partición y termina
+ * de atenderla: la quita del diario y anota su tiempo de servicio en las
+ * estadísticas (el control de admisión lo anota quien la atendió).
+ *
+ * Parámetros:
+ *   - respuesta, len: Respuesta ya compuesta
+ *   - carril: Carril de la petición (la respuesta va con su prioridad)
+ *   - plazo: Plazo de la petición (0 = sin plazo)
+ *   - etiqueta: Identificador del alta en el diario (0 si no se anotó)
+ *   - inicio_servicio: Instante en que se empezó a atender
+ *
+ * Retorno:
+ *   - 0 si todo fue bien (aunque la respuesta se descartase), -1 en caso de error
+ */
+int responder(struct shard *s, char *respuesta, size_t len, int carril, uint64_t plazo,
+              uint64_t etiqueta, uint64_t inicio_servicio) {
+    char msgbuf[MAX_SIZE + 100]; // Buffer para mensajes de log
+
+    // Si ni siquiera la parte fija de la respuesta cabe en la cola (no debería pasar:
+    // el tamaño de mensaje no baja de MIN_SIZE), se pierde esta respuesta, pero la
+    // partición sigue
+    if (len == 0) {
+        sprintf(msgbuf, "Cola %d: la respuesta no cabe en un mensaje de la cola (%ld bytes)",
+                s->id, attr.mq_msgsize);
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+        if (etiqueta != 0) {
+            diario_fin(&s->diario, etiqueta);
+        }
+        return 0;
+    }
+
+    // Registramos el mensaje de respuesta en el log
+    if (log_activo(EVENTO_RESPUESTA)) {
+        snprintf(msgbuf, sizeof(msgbuf), "Enviando respuesta: %s",
+                 proto_texto_respuesta(respuesta, len));
+        funcionLogEvento(EVENTO_RESPUESTA, msgbuf, LOG_FILE);
+    }
+    proto_marcar(respuesta, len, offsetof(struct ej3_tiempos, enviado));
+
+    // Enviamos la respuesta al cliente a través de la cola del cliente de la partición
+    // Parámetros:
+    // - client_queue: Descriptor de la cola
+    // - respuesta: Mensaje a enviar
+    // - len: Longitud del mensaje (incluyendo el carácter nulo)
+    // - Prioridad: la misma de la petición, para que el cliente reciba antes las
+    //   respuestas de control e interactivas
+    // Si la petición tiene plazo, la espera a que haya sitio en la cola termina con él:
+    // después el cliente ya no recogerá la respuesta. Sin plazo, la espera también está
+    // acotada (ver enviar_respuesta())
+    int r = enviar_respuesta(s, respuesta, len, prioridad_de_carril(carril), plazo);
+    if (r == -1 && errno == ETIMEDOUT && plazo != 0 && ahora_ns() >= plazo) {
+        descartar_vencida(s, "al responder");
+    }
+    else if (r == -1 && errno == ETIMEDOUT) {
+        sprintf(msgbuf, "Cola %d: respuesta descartada, la cola del cliente sigue llena", s->id);
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+    }
+    else if (r == -1 && errno == EMSGSIZE) {
+        // No debería pasar (las respuestas se componen con tam_respuesta()), pero es un
+        // fallo de esta petición, no de la cola
+        sprintf(msgbuf, "Cola %d: respuesta de %lu bytes descartada, no cabe en la cola", s->id,
+                (unsigned long)len);
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+    }
+    else if (r == -1) {
+        sprintf(msgbuf, "Error al enviar respuesta: %s", strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+        return -1;
+    }
+    if (etiqueta != 0) {
+        diario_fin(&s->diario, etiqueta);
+    }
+    if (r == 0) {
+        estadisticas_enviado(len, ahora_ns() - inicio_servicio);
+    }
+    return 0;
+}
+
+/**
+ * Función: atender_carriles
+ *
+ * Atiende un mensaje de los carriles de la partición, elegido según el reparto
+ * ponderado. Si su plazo venció mientras esperaba en los carriles, lo descarta.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si hubo un error grave al enviar la respuesta
+ */
+int atender_carriles(struct shard *s) {
+    char msgbuf[MAX_SIZE + 100]; // Buffer para mensajes de log
+    char respuesta[MAX_SIZE];    // Buffer para la respuesta al cliente
+    size_t max = tam_respuesta(sizeof(respuesta));
+    char *buffer = s->buffer;
+    size_t len;
+    uint64_t etiqueta; // Identificador del alta en el diario (0 si no se anotó)
+
+    // Elegimos el siguiente mensaje según el reparto ponderado entre carriles
+    // (con diario, sólo los ya sincronizados)
+    uint64_t limite = s->diario.fd != -1 ? s->diario.sincronizado : UINT64_MAX;
+    int carril = planificador_sacar(&s->plan, buffer, &len, &etiqueta, limite);
+    if (carril == -1) {
+        return 0;
+    }
+    uint64_t inicio_servicio = ahora_ns();
+
+    // Aseguramos que el buffer termine con un carácter nulo
+    // Esto es importante para funciones como strcmp y strlen
+    buffer[len] = '\0';
+
+    // El plazo de la petición se guarda antes de que buffer se reutilice
+    uint64_t plazo = proto_plazo(buffer, len);
+    if (plazo != 0 && plazo <= inicio_servicio) {
+        descartar_vencida(s, "en los carriles");
+        proto_soltar_arena(buffer, len);
+        if (etiqueta != 0) {
+            diario_fin(&s->diario, etiqueta);
+        }
+        return 0;
+    }
+
+    // Los fragmentos de un flujo se procesan al llegar, pero no se registran uno a uno:
+    // sólo el resumen del flujo, al llegar el último, que es el único que tiene respuesta
+    if (proto_es_fragmento(buffer, len)) {
+        len = flujo_procesar(&s->flujos, buffer, len, respuesta, max, msgbuf, sizeof(msgbuf));
+        if (len == 0) {
+            if (etiqueta != 0) {
+                diario_fin(&s->diario, etiqueta);
+            }
+            return 0;
+        }
+        funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+    }
+    else {
+        // Registramos el mensaje recibido en el log (sólo el texto, sin la cabecera binaria);
+        // si el nivel del log no lo registra, ni siquiera se prepara el texto
+        if (log_activo(EVENTO_PETICION)) {
+            char texto[MAX_SIZE];
+            proto_describir(buffer, len, texto, sizeof(texto));
+            snprintf(msgbuf, sizeof(msgbuf), "Recibido el mensaje (cola %d, carril %s): %s",
+                     s->id, nombres_carriles[carril], texto);
+            funcionLogEvento(EVENTO_PETICION, msgbuf, LOG_FILE);
+        }
+
+        // Verificamos si es un mensaje de salida: se trata igual que SIGTERM, atendiendo
+        // antes lo que ya estuviera encolado. El cierre lo inicia el hilo principal
+        if (strcmp(buffer, MSG_EXIT) == 0) {
+            avisar_principal();
+            return 0;
+        }
+
+        // Calculamos las estadísticas y preparamos la respuesta (lógica común a ambos
+        // transportes)
+        // (si la petición lleva tiempos, se anota cuándo empieza y termina el cálculo)
+        proto_marcar(buffer, len, offsetof(struct ej3_tiempos, inicio));
+
+        // Los ficheros se calculan en un hilo aparte, para no detener la partición (ver
+        // recoger_ficheros()); si ya hay demasiados en marcha, se responde que el
+        // servidor está ocupado
+        char ruta[PATH_MAX];
+        if (proto_ruta(buffer, len, ruta, sizeof(ruta))) {
+            struct fichero_trabajo *t = fichero_lanzar(&s->ficheros, ruta, buffer, len);
+            if (t != NULL) {
+                t->destino = carril;
+                t->plazo = plazo;
+                t->etiqueta = etiqueta;
+                t->inicio = inicio_servicio;
+                return 0;
+            }
+            snprintf(msgbuf, sizeof(msgbuf), "Cola %d: no se puede calcular %.200s ahora: %s",
+                     s->id, ruta, strerror(errno));
+            funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+            len = proto_ocupado(buffer, len, respuesta, max);
+        }
+        else {
+            len = procesar_peticion(buffer, len, respuesta, max);
+        }
+    }
+
+    int r = responder(s, respuesta, len, carril, plazo, etiqueta, inicio_servicio);
+    admision_anotar(&s->admision, ahora_ns() - inicio_servicio);
+    return r;
+}
+
+/**
+ * Función: recoger_ficheros
+ *
+ * Responde a las peticiones PROTO_RUTA de la partición cuyos ficheros ya se han
+ * calculado (ver fichero_lanzar()). Las que vencieron mientras tanto se descartan.
+ * El control de admisión no las anota: el hilo de la partición apenas se ocupó de
+ * ellas.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (como atender_carriles())
+ */
+int recoger_ficheros(struct shard *s) {
+    char respuesta[MAX_SIZE];
+    struct fichero_trabajo *t;
+    uint64_t avisos;
+
+    if (read(s->ficheros.aviso_fd, &avisos, sizeof(avisos)) == -1 && errno != EAGAIN) {
+        funcionLog("Error al leer el aviso de los ficheros", LOG_FILE);
+    }
+    while ((t = fichero_recoger(&s->ficheros)) != NULL) {
+        int r = 0;
+        if (t->plazo != 0 && t->plazo <= ahora_ns()) {
+            descartar_vencida(s, "al calcular el fichero");
+            if (t->etiqueta != 0) {
+                diario_fin(&s->diario, t->etiqueta);
+            }
+        }
+        else {
+            size_t len = proto_responder_fichero(t->peticion, t->len, t->ruta, &t->estado,
+                                                 t->error, respuesta,
+                                                 tam_respuesta(sizeof(respuesta)));
+            r = responder(s, respuesta, len, t->destino, t->plazo, t->etiqueta, t->inicio);
+        }
+        fichero_liberar(t);
+        if (r == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Función: empezar_drenado
+ *
+ * Atiende el aviso de cierre del hilo principal: a partir de ahora la partición
+ * sólo atiende los mensajes que ya estaban en su cola y en sus carriles. Los avisos
+ * de pausa sólo despiertan al hilo (ver hilo_shard).
+ */
+void empezar_drenado(struct shard *s) {
+    char msgbuf[200];
+    uint64_t avisos;
+    struct mq_attr actual;
+
+    if (read(s->aviso_fd, &avisos, sizeof(avisos)) == -1 || s->drenando || !cerrando) {
+        return;
+    }
+    s->drenando = 1;
+    s->por_recoger = mq_getattr(s->server_queue, &actual) == 0 ? actual.mq_curmsgs : 0;
+    sprintf(msgbuf, "Cola %d: atendiendo %ld mensajes en la cola y %d en los carriles", s->id,
+            s->por_recoger, planificador_pendientes(&s->plan));
+    funcionLog(msgbuf, LOG_FILE);
+    if (s->por_recoger <= 0) {
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, s->server_queue, NULL);
+    }
+}
+
+/**
+ * Función: sincronizar_diario
+ *
+ * Sincroniza el diario de la partición si ya toca: cuando en los carriles sólo
+ * quedan peticiones sin sincronizar (no hay nada más que atender mientras tanto),
+ * cuando la más antigua lleva esperando el plazo de -J, cuando los carriles están
+ * llenos (no caben más peticiones en el grupo) o durante el cierre. Si falla, se
+ * registra el error y se sigue atendiendo, aunque sin la garantía del diario.
+ */
+void sincronizar_diario(struct shard *s) {
+    char msgbuf[200];
+    struct diario *d = &s->diario;
+
+    if (d->fd == -1 || d->sin_sincronizar == 0) {
+        return;
+    }
+    if ((uint64_t)planificador_pendientes(&s->plan) > d->sin_sincronizar &&
+        diario_espera_ns(d, plazo_diario_ns) > 0 && planificador_admite(&s->plan) &&
+        !s->drenando) {
+        return;
+    }
+    if (diario_sincronizar(d) == -1) {
+        sprintf(msgbuf, "Error al sincronizar el diario de la cola %d: %s", s->id,
+                strerror(errno));
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        estadisticas_error();
+        d->sin_sincronizar = 0;
+        d->sincronizado = d->siguiente_id - 1;
+    }
+}
+
+/**
+ * Función: preparar_hilo
+ *
+ * Ajusta la planificación del hilo de la partición k desde el propio hilo: lo fija
+ * a la CPU elegida con -C (o, si no se eligieron, al k-ésimo núcleo de los que el
+ * proceso tiene permitidos, dando la vuelta si hay más particiones que núcleos) y,
+ * con -F, lo pasa a SCHED_FIFO. Los errores sólo se registran: el servidor funciona
+ * igual, aunque con más latencia.
+ */
+void preparar_hilo(int k) {
+    char msgbuf[200];
+    cpu_set_t permitidos;
+    int cpu = -1;
+
+    if (num_cpus_elegidas > 0) {
+        cpu = cpus_elegidas[k % num_cpus_elegidas];
+    }
+    else if (usar_afinidad && sched_getaffinity(0, sizeof(permitidos), &permitidos) == 0) {
+        int objetivo = k % CPU_COUNT(&permitidos);
+        for (int c = 0; c < CPU_SETSIZE && cpu == -1; c++) {
+            if (CPU_ISSET(c, &permitidos) && objetivo-- == 0) {
+                cpu = c;
+            }
+        }
+    }
+    if (cpu != -1) {
+        if (fijar_cpu(cpu) == -1) {
+            sprintf(msgbuf, "No se pudo fijar la cola %d al núcleo %d: %s", k, cpu,
+                    strerror(errno));
+        }
+        else {
+            sprintf(msgbuf, "Cola %d atendida en el núcleo %d", k, cpu);
+        }
+        funcionLog(msgbuf, LOG_FILE);
+    }
+    if (prioridad_fifo > 0 && fijar_fifo(prioridad_fifo) == -1) {
+        sprintf(msgbuf, "No se pudo pasar la cola %d a SCHED_FIFO: %s", k, strerror(errno));
         funcionLog(msgbuf, LOG_FILE);
+    }
+}
 
-        // Enviamos la respuesta al cliente a través de la cola del cliente
-        // Parámetros:
-        // - client_queue: Descriptor de la cola
-        // - buffer: Mensaje a enviar
-        // - strlen(buffer) + 1: Longitud del mensaje (incluyendo el carácter nulo)
-        // - 0: Prioridad del mensaje (0 es la más baja)
-        if (mq_send(client_queue, buffer, strlen(buffer) + 1, 0) == -1) {
-            sprintf(msgbuf, "Error al enviar respuesta: %s", strerror(errno));
+/**
+ * Función: pausa_aceptada
+ *
+ * Comprueba si se ha pedido la pausa del hilo de la partición y, si es así, la
+ * acepta (pausar pasa de 1 a 2). El cambio es atómico, así que el hilo principal
+ * puede retirar una pausa pedida sin riesgo de que el hilo salga a la vez. No se
+ * acepta mientras la partición tenga ficheros calculándose: sus respuestas las
+ * tiene que dar este hilo.
+ *
+ * Retorno:
+ *   - 1 si el hilo debe salir de su bucle, 0 si sigue
+ */
+int pausa_aceptada(struct shard *s) {
+    int pedida = 1;
+
+    if (atomic_load_explicit(&s->pausar, memory_order_relaxed) != pedida
+        || s->ficheros.num > 0) {
+        return 0;
+    }
+    return atomic_compare_exchange_strong(&s->pausar, &pedida, 2);
+}
+
+/**
+ * Función: hilo_shard
+ *
+ * Bucle de eventos de una partición, que se ejecuta en su propio hilo. Espera en
+ * epoll_wait a que lleguen mensajes a la cola o un aviso de cierre; si hay mensajes
+ * en los carriles, epoll_wait no bloquea, de forma que se sigue recogiendo la cola
+ * entre mensaje y mensaje. Durante el cierre, termina cuando ha atendido todo lo
+ * pendiente o cuando vence el plazo.
+ *
+ * En modo busy-poll (-P), tras atender un mensaje el hilo no se duerme en epoll_wait
+ * sino que sigue intentando recoger la cola sin bloquear durante el umbral indicado.
+ * Una petición que llega en ese intervalo se atiende sin esperar a que el
+ * planificador despierte al hilo, a cambio de mantener ocupado un núcleo. Pasado el
+ * umbral sin mensajes, el hilo vuelve a la espera bloqueante.
+ *
+ * Con diario, antes de atender cada mensaje se decide si hay que sincronizar el
+ * grupo de altas pendiente (ver sincronizar_diario()).
+ *
+ * Si el hilo principal pide una pausa, el hilo termina sin tocar la partición: lo
+ * que quede en la cola y en los carriles se atiende al volver a arrancarlo.
+ */
+void *hilo_shard(void *arg) {
+    struct shard *s = arg;
+    char msgbuf[200];
+    struct epoll_event events[3];
+    uint64_t giro_ns = (uint64_t)busy_poll_us * 1000;
+    uint64_t ultima_actividad = 0;
+
+    preparar_hilo(s->id);
+
+    while (!pausa_aceptada(s)) {
+        int por_reproducir = (int)(s->diario.num_pendientes - s->diario.siguiente_pendiente);
+        int pendientes = planificador_pendientes(&s->plan) + por_reproducir;
+        atomic_store_explicit(&s->en_carriles, pendientes, memory_order_relaxed);
+
+        int espera = pendientes > 0 ? 0 : -1;
+        if (s->drenando) {
+            uint64_t ahora = ahora_ns();
+            if (s->por_recoger <= 0 && pendientes == 0 && s->ficheros.num == 0) {
+                sprintf(msgbuf, "Cola %d: todo lo pendiente ha sido atendido", s->id);
+                funcionLog(msgbuf, LOG_FILE);
+                break;
+            }
+            if (ahora >= fin_plazo_ns) {
+                sprintf(msgbuf, "Cola %d: vencido el plazo de cierre con %ld mensajes sin atender",
+                        s->id, (s->por_recoger > 0 ? s->por_recoger : 0) + pendientes
+                        + s->ficheros.num);
+                funcionLog(msgbuf, LOG_FILE);
+                break;
+            }
+            if (espera == -1) {
+                espera = (int)((fin_plazo_ns - ahora) / 1000000ULL) + 1;
+            }
+        }
+
+        // Busy-poll: mientras no pase el umbral de inactividad, se recoge la cola sin
+        // bloquear en lugar de dormir (durante el cierre se usa siempre epoll_wait, que
+        // es por donde llega el aviso)
+        int girar = 0;
+        if (giro_ns > 0 && !cerrando) {
+            uint64_t ahora = ahora_ns();
+            if (pendientes > 0) {
+                ultima_actividad = ahora;
+            }
+            girar = espera == -1 && ahora - ultima_actividad < giro_ns;
+        }
+
+        int n = 0;
+        if (girar) {
+            recoger_cola(s);
+            if (planificador_pendientes(&s->plan) == 0) {
+                pausa_cpu();
+                continue;
+            }
+        }
+        else {
+            n = epoll_wait(s->epoll_fd, events, 3, espera);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                sprintf(msgbuf, "Error en epoll_wait (cola %d): %s", s->id, strerror(errno));
+                funcionLog(msgbuf, LOG_FILE);
+                break;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == s->aviso_fd) {
+                empezar_drenado(s);
+            }
+            else if (events[i].data.fd == s->ficheros.aviso_fd) {
+                if (recoger_ficheros(s) == -1) {
+                    atomic_store(&fallo_shards, 1);
+                    avisar_principal();
+                    n = -1;
+                    break;
+                }
+            }
+            else {
+                recoger_cola(s);
+            }
+        }
+        if (n == -1) {
+            break;
+        }
+        if (por_reproducir > 0) {
+            recoger_cola(s);
+        }
+
+        // Atendemos un mensaje de los carriles por vuelta del bucle
+        sincronizar_diario(s);
+        if (atender_carriles(s) == -1) {
+            atomic_store(&fallo_shards, 1);
+            avisar_principal();
+            break;
+        }
+    }
+    atomic_store_explicit(&s->en_carriles, 0, memory_order_relaxed);
+    return NULL;
+}
+
+/**
+ * Función: crear_shards
+ *
+ * Crea num_shards particiones (sus colas y carriles) con los atributos que piden
+ * opcion_maxmsg y opcion_msgsize, sin arrancar sus hilos.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (las particiones que se llegaron a
+ *     crear quedan en shards, para cerrarlas con cerrar_shard())
+ */
+int crear_shards() {
+    char msgbuf[MAX_SIZE]; // Buffer para mensajes de log
+
+    // Configuramos los atributos de las colas de mensajes a partir de las opciones y de los
+    // límites de /proc/sys/fs/mqueue (se crean dos colas por partición: la del servidor y
+    // la del cliente)
+    calcular_atributos_cola(&attr, opcion_maxmsg, opcion_msgsize, 2 * num_shards);
+
+    sprintf(msgbuf, "Atributos de las colas: %ld mensajes de hasta %ld bytes (%d particiones)",
+            attr.mq_maxmsg, attr.mq_msgsize, num_shards);
+    funcionLog(msgbuf, LOG_FILE);
+
+    shards = calloc(num_shards, sizeof(struct shard));
+    if (shards == NULL) {
+        funcionLog("Error al reservar memoria para las particiones", LOG_FILE);
+        return -1;
+    }
+    for (int k = 0; k < num_shards; k++) {
+        shards[k].id = k;
+        shards[k].server_queue = shards[k].client_queue = -1;
+        shards[k].epoll_fd = shards[k].aviso_fd = -1;
+        shards[k].diario.fd = -1;
+        shards[k].ficheros.aviso_fd = -1;
+    }
+
+    for (int k = 0; k < num_shards; k++) {
+        if (preparar_shard(&shards[k]) == -1) {
+            return -1;
+        }
+    }
+    estadisticas_shards(num_shards);
+    return 0;
+}
+
+/**
+ * Función: arrancar_hilos
+ *
+ * Arranca el hilo de cada partición que no lo tenga. Los hilos heredan la máscara
+ * de señales del hilo principal, así que las señales sólo llegan al signalfd.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int arrancar_hilos() {
+    char msgbuf[200];
+
+    for (int k = 0; k < num_shards; k++) {
+        if (shards[k].hilo_creado) {
+            continue;
+        }
+        int error = pthread_create(&shards[k].hilo, NULL, hilo_shard, &shards[k]);
+        if (error != 0) {
+            sprintf(msgbuf, "Error al crear el hilo de la cola %d: %s", k, strerror(error));
             funcionLog(msgbuf, LOG_FILE);
-            break; // Salimos del bucle en caso de error
+            return -1;
         }
+        shards[k].hilo_creado = 1;
     }
+    return 0;
+}
+
+/**
+ * Función: preparar_colas
+ *
+ * Crea las particiones (sus colas y carriles) y arranca el hilo de cada una. El
+ * hilo principal sólo se queda con las señales, el temporizador y los avisos de
+ * los hilos (aviso_principal_fd).
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int preparar_colas() {
+    char msgbuf[200]; // Buffer para mensajes de log
+
+    aviso_principal_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (aviso_principal_fd == -1 || registrar_fd(aviso_principal_fd, EPOLLIN) == -1) {
+        sprintf(msgbuf, "Error al preparar los avisos entre hilos: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return -1;
+    }
+
+    // Arrancamos los hilos una vez creadas todas las colas
+    if (crear_shards() == -1) {
+        return -1;
+    }
+    return arrancar_hilos();
+}
+
+/**
+ * Función: esperar_shards
+ *
+ * Espera a que terminen los hilos de las particiones. Si el cierre no había
+ * empezado (por ejemplo, por un error en el bucle principal), lo inicia.
+ */
+void esperar_shards() {
+    for (int k = 0; shards != NULL && k < num_shards; k++) {
+        if (!shards[k].hilo_creado) {
+            continue;
+        }
+        if (!cerrando) {
+            iniciar_cierre("Terminando las colas");
+        }
+        pthread_join(shards[k].hilo, NULL);
+        shards[k].hilo_creado = 0;
+    }
+}
+
+/**
+ * Función: configuracion_actual
+ *
+ * Recoge en c la configuración con la que funciona el servidor.
+ */
+void configuracion_actual(struct configuracion *c) {
+    c->nivel_log = atomic_load(&nivel_log);
+    c->num_shards = num_shards;
+    c->maxmsg = opcion_maxmsg;
+    c->msgsize = opcion_msgsize;
+    memcpy(c->pesos, pesos, sizeof(pesos));
+    c->plazo_cierre_ms = plazo_cierre_ms;
+    c->busy_poll_us = busy_poll_us;
+    c->plazo_diario_ns = plazo_diario_ns;
+    c->max_pendientes = admision_max_pendientes;
+    c->max_espera_ns = admision_max_espera_ns;
+}
+
+/**
+ * Función: aplicar_configuracion
+ *
+ * Pasa a las variables globales la configuración c. Las particiones y los
+ * atributos de las colas no cambian aquí: sólo tienen efecto al crear las colas
+ * (ver rehacer_colas()). Con las colas, los hilos de las particiones tienen que
+ * estar parados.
+ */
+void aplicar_configuracion(const struct configuracion *c) {
+    atomic_store(&nivel_log, c->nivel_log);
+    memcpy(pesos, c->pesos, sizeof(pesos));
+    plazo_cierre_ms = c->plazo_cierre_ms;
+    busy_poll_us = c->busy_poll_us;
+    plazo_diario_ns = c->plazo_diario_ns;
+    admision_max_pendientes = c->max_pendientes;
+    admision_max_espera_ns = c->max_espera_ns;
+}
+
+/**
+ * Función: describir_configuracion
+ *
+ * Escribe en destino un resumen de la configuración actual para el log.
+ */
+void describir_configuracion(char *destino, size_t max) {
+    int n = snprintf(destino, max, "nivel de log %s, pesos %d:%d:%d, plazo de cierre %ld ms",
+                     nombres_niveles_log[atomic_load(&nivel_log)], pesos[CARRIL_CONTROL],
+                     pesos[CARRIL_INTERACTIVO], pesos[CARRIL_MASIVO], plazo_cierre_ms);
+    if (!socket_flag && n > 0 && (size_t)n < max) {
+        snprintf(destino + n, max - n,
+                 ", %d particiones con colas de %ld mensajes de hasta %ld bytes, busy-poll "
+                 "%ld us, admisión hasta %d mensajes y %lu us (0 = sin límite)",
+                 num_shards, attr.mq_maxmsg, attr.mq_msgsize, busy_poll_us,
+                 admision_max_pendientes, (unsigned long)(admision_max_espera_ns / 1000));
+    }
+}
+
+/**
+ * Función: volcar_estadisticas
+ *
+ * Atiende SIGUSR1: registra los contadores del segmento de estadísticas, el estado
+ * de cada partición y la configuración actual. Se registra sea cual sea el nivel
+ * del log, porque lo pide expresamente quien envía la señal.
+ */
+void volcar_estadisticas() {
+    char msgbuf[400];
+
+    if (stats != NULL) {
+        uint64_t enviados = atomic_load_explicit(&stats->mensajes_enviados, memory_order_relaxed);
+        uint64_t servicio = atomic_load_explicit(&stats->servicio_total_ns, memory_order_relaxed);
+        sprintf(msgbuf, "Estadísticas: %lu peticiones recibidas, %lu respuestas enviadas, %lu "
+                        "errores, %lu rechazadas, %lu vencidas, servicio medio %.1f us",
+                (unsigned long)atomic_load(&stats->mensajes_recibidos), (unsigned long)enviados,
+                (unsigned long)atomic_load(&stats->errores),
+                (unsigned long)atomic_load(&stats->rechazadas),
+                (unsigned long)atomic_load(&stats->vencidas),
+                enviados > 0 ? servicio / 1e3 / enviados : 0.0);
+        funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+    }
+
+    if (socket_flag) {
+        sprintf(msgbuf, "Conexiones abiertas: %d", num_conexiones);
+        funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+    }
+    for (int k = 0; !socket_flag && k < num_shards; k++) {
+        struct mq_attr actual;
+        long en_cola = mq_getattr(shards[k].server_queue, &actual) == 0 ? actual.mq_curmsgs : -1;
+        sprintf(msgbuf, "Cola %d: %ld mensajes en la cola, %d en los carriles", k, en_cola,
+                atomic_load_explicit(&shards[k].en_carriles, memory_order_relaxed));
+        funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+    }
+
+    strcpy(msgbuf, "Configuración: ");
+    describir_configuracion(msgbuf + strlen(msgbuf), sizeof(msgbuf) - strlen(msgbuf));
+    funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+}
+
+/**
+ * Función: cambiar_nivel_log
+ *
+ * Atiende SIGUSR2: pasa al siguiente nivel del log, de más a menos detalle, y del
+ * último vuelve al primero (todo -> info -> errores -> todo).
+ */
+void cambiar_nivel_log() {
+    char msgbuf[100];
+    int nivel = atomic_load(&nivel_log);
+    nivel = nivel == NIVEL_ERRORES ? NIVEL_TODO : nivel - 1;
+    atomic_store(&nivel_log, nivel);
+    sprintf(msgbuf, "Nivel del log: %s", nombres_niveles_log[nivel]);
+    funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+}
+
+/**
+ * Función: pausar_shards
+ *
+ * Para los hilos de las particiones sin cerrarlas: cada hilo sale de su bucle en la
+ * siguiente vuelta y deja en la cola y en los carriles lo que no haya atendido.
+ * Mientras están parados, el hilo principal puede cambiar la configuración que
+ * usan sin carreras; arrancar_hilos() los vuelve a poner en marcha.
+ *
+ * Se espera a los hilos como mucho PLAZO_PAUSA_MS (el hilo principal no puede
+ * quedarse bloqueado, por ejemplo, tras un envío a la cola llena de un cliente). A
+ * los que no se paren a tiempo se les retira la pausa y siguen atendiendo; los que
+ * sí se pararon hay que volver a arrancarlos con arrancar_hilos().
+ *
+ * Retorno:
+ *   - 0 si se pararon todos, -1 si alguno no se paró a tiempo
+ */
+int pausar_shards() {
+    char msgbuf[200];
+    uint64_t uno = 1;
+    uint64_t limite = ahora_ns() + PLAZO_PAUSA_MS * 1000000ULL;
+    struct timespec ts;
+    int resultado = 0;
+
+    for (int k = 0; k < num_shards; k++) {
+        atomic_store(&shards[k].pausar, 1);
+        if (write(shards[k].aviso_fd, &uno, sizeof(uno)) == -1) {
+            funcionLog("Error al avisar de la pausa a una partición", LOG_FILE);
+        }
+    }
+    for (int k = 0; k < num_shards; k++) {
+        int pedida = 1;
+        if (shards[k].hilo_creado) {
+            instante_absoluto(limite, &ts);
+            int error = pthread_timedjoin_np(shards[k].hilo, NULL, &ts);
+            // Si el hilo ya había aceptado la pausa está saliendo: se le espera
+            if (error == ETIMEDOUT &&
+                atomic_compare_exchange_strong(&shards[k].pausar, &pedida, 0)) {
+                sprintf(msgbuf, "Cola %d: el hilo no se ha parado en %d ms", k,
+                        PLAZO_PAUSA_MS);
+                funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+                resultado = -1;
+                continue;
+            }
+            if (error != 0) {
+                pthread_join(shards[k].hilo, NULL);
+            }
+            shards[k].hilo_creado = 0;
+        }
+        atomic_store(&shards[k].pausar, 0);
+    }
+    return resultado;
+}
+
+/**
+ * Estructura: traslado
+ *
+ * Mensajes pendientes que pasan de las colas anteriores a las nuevas al volver a
+ * crearlas (ver rehacer_colas()).
+ *
+ * - origen: Partición de la que sale el mensaje
+ * - prio: Prioridad con la que llegó
+ * - recibido: Ya estaba en los carriles (contado en las estadísticas)
+ */
+struct mensaje_trasladado {
+    int origen;
+    unsigned int prio;
+    int recibido;
+    size_t len;
+    char *datos;
+};
+
+struct traslado {
+    struct mensaje_trasladado *mensajes;
+    size_t num;
+    size_t capacidad;
+    long perdidos; // Mensajes que no se pudieron guardar (sin memoria)
+};
+
+/**
+ * Función: traslado_guardar
+ *
+ * Guarda una copia de un mensaje pendiente de la partición origen.
+ */
+void traslado_guardar(struct traslado *t, int origen, unsigned int prio, int recibido,
+                      const char *datos, size_t len) {
+    if (t->num == t->capacidad) {
+        size_t nueva = t->capacidad ? t->capacidad * 2 : 64;
+        struct mensaje_trasladado *p = realloc(t->mensajes, nueva * sizeof(*p));
+        if (p == NULL) {
+            t->perdidos++;
+            return;
+        }
+        t->mensajes = p;
+        t->capacidad = nueva;
+    }
+    char *copia = malloc(len);
+    if (copia == NULL) {
+        t->perdidos++;
+        return;
+    }
+    memcpy(copia, datos, len);
+    t->mensajes[t->num++] = (struct mensaje_trasladado){origen, prio, recibido, len, copia};
+}
+
+/**
+ * Función: traslado_repartir
+ *
+ * Pasa los mensajes guardados a las particiones nuevas: los de la partición k van
+ * a la k % num_shards, en el mismo orden, de modo que los de un mismo cliente no
+ * se adelantan unos a otros. Cada mensaje va a los carriles si caben y, si no, a la
+ * cola del servidor; si tampoco cabe allí, o si es más largo de lo que admiten las
+ * colas nuevas, se pierde.
+ *
+ * Retorno:
+ *   - Número de mensajes guardados que se perdieron
+ */
+long traslado_repartir(struct traslado *t) {
+    char nombre[120];
+    mqd_t colas[MAX_SHARDS]; // Descriptores para escribir en las colas nuevas
+    long perdidos = 0;
+
+    for (int k = 0; k < num_shards; k++) {
+        colas[k] = -1;
+    }
+    for (size_t i = 0; i < t->num; i++) {
+        struct mensaje_trasladado *m = &t->mensajes[i];
+        int k = m->origen % num_shards;
+        struct shard *s = &shards[k];
+
+        if (m->len > (size_t)attr.mq_msgsize) {
+            perdidos++;
+        }
+        else if (planificador_admite(&s->plan)) {
+            planificador_meter(&s->plan, carril_de_prioridad(m->prio), m->datos, m->len, 0);
+            if (!m->recibido) {
+                estadisticas_recibido(m->len);
+            }
+        }
+        else {
+            if (colas[k] == -1) {
+                get_shard_name(nombre, SERVER_QUEUE, k, num_shards);
+                colas[k] = mq_open(nombre, O_WRONLY | O_NONBLOCK);
+            }
+            if (colas[k] == -1 || mq_send(colas[k], m->datos, m->len, m->prio) == -1) {
+                perdidos++;
+            }
+        }
+        free(m->datos);
+    }
+    for (int k = 0; k < num_shards; k++) {
+        if (colas[k] != -1) {
+            mq_close(colas[k]);
+        }
+    }
+    free(t->mensajes);
+    return perdidos;
+}
+
+/**
+ * Función: cerrar_shards
+ *
+ * Cierra y elimina las colas de todas las particiones y libera la tabla.
+ */
+void cerrar_shards() {
+    for (int k = 0; shards != NULL && k < num_shards; k++) {
+        cerrar_shard(&shards[k]);
+    }
+    free(shards);
+    shards = NULL;
+}
+
+/**
+ * Función: rehacer_colas
+ *
+ * Vuelve a crear las particiones con el número y los atributos de las colas de la
+ * configuración nueva, con los hilos parados. Los mensajes que quedaban en las
+ * colas y en los carriles anteriores se guardan antes de eliminarlas y se pasan a
+ * las nuevas (ver traslado_repartir()). Si no se pueden crear las colas nuevas, se
+ * vuelven a crear con la configuración anterior.
+ *
+ * Los flujos a medio recibir se pierden, y los clientes que ya tenían abiertas las
+ * colas anteriores siguen escribiendo en ellas: tienen que volver a abrir las
+ * nuevas.
+ *
+ * Retorno:
+ *   - 0 si hay colas (nuevas o, si falló, las anteriores), -1 si no se pudo crear
+ *     ninguna
+ */
+int rehacer_colas(const struct configuracion *nueva, const struct configuracion *anterior) {
+    char msgbuf[300];
+    struct traslado t = {NULL, 0, 0, 0};
+    size_t len;
+    uint64_t etiqueta;
+    unsigned int prio;
+    ssize_t n;
+
+    // Primero los carriles, que tienen los mensajes más antiguos, y después la cola
+    for (int k = 0; k < num_shards; k++) {
+        struct shard *s = &shards[k];
+        int carril;
+        while ((carril = planificador_sacar(&s->plan, s->buffer, &len, &etiqueta, UINT64_MAX)) !=
+               -1) {
+            traslado_guardar(&t, k, prioridad_de_carril(carril), 1, s->buffer, len);
+        }
+        while ((n = mq_receive(s->server_queue, s->buffer, attr.mq_msgsize, &prio)) >= 0) {
+            traslado_guardar(&t, k, prio, 0, s->buffer, n);
+        }
+        atomic_store_explicit(&s->en_carriles, 0, memory_order_relaxed);
+    }
+    cerrar_shards();
+
+    num_shards = nueva->num_shards;
+    opcion_maxmsg = nueva->maxmsg;
+    opcion_msgsize = nueva->msgsize;
+    if (crear_shards() == -1) {
+        funcionLogEvento(EVENTO_ERROR,
+                         "No se pudieron crear las colas nuevas: se vuelven a crear las anteriores",
+                         LOG_FILE);
+        cerrar_shards();
+        num_shards = anterior->num_shards;
+        opcion_maxmsg = anterior->maxmsg;
+        opcion_msgsize = anterior->msgsize;
+        if (crear_shards() == -1) {
+            cerrar_shards();
+            num_shards = 0;
+            for (size_t i = 0; i < t.num; i++) {
+                free(t.mensajes[i].datos);
+            }
+            free(t.mensajes);
+            return -1;
+        }
+    }
+
+    long perdidos = traslado_repartir(&t);
+    sprintf(msgbuf, "Colas rehechas: %d particiones, %lu mensajes pendientes trasladados (%ld "
+                    "perdidos)",
+            num_shards, (unsigned long)(t.num - perdidos), perdidos + t.perdidos);
+    perdidos += t.perdidos;
+    funcionLogEvento(perdidos > 0 ? EVENTO_ERROR : EVENTO_INFO, msgbuf, LOG_FILE);
+    return 0;
+}
+
+/**
+ * Función: recargar_configuracion
+ *
+ * Atiende SIGHUP: vuelve a leer el fichero de configuración (-f) y aplica los
+ * cambios sin reiniciar. El nivel del log y el plazo de cierre se aplican al
+ * momento; para el resto, se paran los hilos de las particiones, se cambia lo que
+ * usan y se vuelven a arrancar. Si cambian las particiones o los atributos de las
+ * colas, además se vuelven a crear las colas con los mensajes pendientes (ver
+ * rehacer_colas()). Si el fichero tiene algún error o los hilos no se paran a
+ * tiempo (ver pausar_shards()), no se aplica nada.
+ *
+ * En modo socket no hay colas ni particiones, y con diario las colas no se pueden
+ * volver a crear (el diario de cada partición va con su cola): en esos casos se
+ * ignoran las claves shards, maxmsg y msgsize.
+ */
+void recargar_configuracion() {
+    char msgbuf[600];
+    char error[300];
+    struct configuracion anterior, c;
+
+    if (ruta_config == NULL) {
+        funcionLogEvento(EVENTO_ERROR, "Recibida SIGHUP sin fichero de configuración (-f)",
+                         LOG_FILE);
+        return;
+    }
+    configuracion_actual(&anterior);
+    c = anterior;
+    if (configuracion_leer(ruta_config, &c, error, sizeof(error)) == -1) {
+        sprintf(msgbuf, "No se recarga la configuración: %s", error);
+        funcionLogEvento(EVENTO_ERROR, msgbuf, LOG_FILE);
+        return;
+    }
+
+    int rehacer = c.num_shards != anterior.num_shards || c.maxmsg != anterior.maxmsg ||
+                  c.msgsize != anterior.msgsize;
+    if (rehacer && (socket_flag || ruta_diario != NULL)) {
+        funcionLogEvento(EVENTO_ERROR,
+                         socket_flag ? "En modo socket se ignoran shards, maxmsg y msgsize"
+                                     : "Con diario las colas no se pueden volver a crear: se "
+                                       "ignoran shards, maxmsg y msgsize",
+                         LOG_FILE);
+        rehacer = 0;
+    }
+
+    int resultado = 0;
+    if (socket_flag) {
+        aplicar_configuracion(&c);
+    }
+    else {
+        if (pausar_shards() == -1) {
+            // Algún hilo sigue en marcha con la configuración anterior: se deja como
+            // estaba y se vuelven a arrancar los que se pararon
+            funcionLogEvento(EVENTO_ERROR,
+                             "No se recarga la configuración: las particiones no se han parado",
+                             LOG_FILE);
+            if (arrancar_hilos() == -1) {
+                atomic_store(&fallo_shards, 1);
+                iniciar_cierre("Error al reanudar las particiones");
+            }
+            return;
+        }
+        aplicar_configuracion(&c);
+        if (rehacer) {
+            resultado = rehacer_colas(&c, &anterior);
+        }
+        else {
+            for (int k = 0; k < num_shards; k++) {
+                planificador_fijar_pesos(&shards[k].plan, pesos);
+            }
+        }
+        if (resultado == 0) {
+            resultado = arrancar_hilos();
+        }
+    }
+    if (resultado == -1) {
+        atomic_store(&fallo_shards, 1);
+        iniciar_cierre("Error al aplicar la configuración");
+        return;
+    }
+
+    strcpy(msgbuf, "Configuración recargada: ");
+    describir_configuracion(msgbuf + strlen(msgbuf), sizeof(msgbuf) - strlen(msgbuf));
+    funcionLogSiempre(EVENTO_INFO, msgbuf, LOG_FILE);
+}
+
+/**
+ * Función: atender_senales
+ *
+ * Lee las señales pendientes del signalfd. SIGINT y SIGTERM inician el cierre
+ * ordenado; SIGHUP, SIGUSR1 y SIGUSR2 son las señales de control.
+ */
+void atender_senales() {
+    struct signalfd_siginfo info;
+    char msgbuf[100];
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        sprintf(msgbuf, "Recibida señal %d (%s)", (int)info.ssi_signo,
+                strsignal((int)info.ssi_signo));
+        funcionLog(msgbuf, LOG_FILE);
+        switch (info.ssi_signo) {
+        case SIGHUP:
+            recargar_configuracion();
+            break;
+        case SIGUSR1:
+            volcar_estadisticas();
+            break;
+        case SIGUSR2:
+            cambiar_nivel_log();
+            break;
+        default:
+            iniciar_cierre("Cierre ordenado");
+        }
+    }
+}
+
+/**
+ * Función: bucle_eventos
+ *
+ * Bucle principal del servidor. Espera en epoll_wait a que ocurra algo en el
+ * signalfd, en el timerfd, en los avisos de los hilos de las particiones o, con
+ * la opción -s, en el socket, y lo atiende. Con colas, los mensajes los atienden
+ * los hilos de las particiones (ver hilo_shard).
+ *
+ * Retorno:
+ *   - EXIT_SUCCESS si el servidor termina de forma ordenada
+ *   - EXIT_FAILURE si ocurre algún error
+ */
+int bucle_eventos() {
+    char msgbuf[100];
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!cerrando) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sprintf(msgbuf, "Error en epoll_wait: %s", strerror(errno));
+            funcionLog(msgbuf, LOG_FILE);
+            return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == signal_fd) {
+                atender_senales();
+            }
+            else if (fd == timer_fd) {
+                atender_timer();
+            }
+            else if (!socket_flag && fd == aviso_principal_fd) {
+                // Un hilo recibió "exit" o terminó por un error
+                uint64_t avisos;
+                if (read(aviso_principal_fd, &avisos, sizeof(avisos)) > 0 && !cerrando) {
+                    iniciar_cierre(atomic_load(&fallo_shards) ? "Error al atender una cola"
+                                                              : "Recibido mensaje de salida");
+                }
+            }
+            else if (socket_flag && fd == listen_fd) {
+                aceptar_conexiones();
+            }
+            else if (socket_flag && fd == ficheros_socket.aviso_fd) {
+                recoger_ficheros_socket();
+            }
+            else if (socket_flag) {
+                // Mensajes (o desconexión) de un cliente ya conectado
+                if (atender_cliente(fd) == -1 || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                    conexion_quitar(fd);
+                }
+            }
+        }
+
+        // Con socket, al empezar el cierre se atiende lo que cada cliente ya hubiera
+        // enviado, se espera a los ficheros en curso y se cierran todas las conexiones
+        if (socket_flag && cerrando) {
+            for (int i = 0; i < num_conexiones; i++) {
+                atender_cliente(conexiones[i]);
+            }
+            esperar_ficheros_socket();
+            while (num_conexiones > 0) {
+                conexion_quitar(conexiones[num_conexiones - 1]);
+            }
+            funcionLog("Todo lo pendiente ha sido atendido, terminando...", LOG_FILE);
+        }
+    }
+    return atomic_load(&fallo_shards) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Función: main
+ *
+ * Función principal del servidor. Procesa las opciones, prepara el bucle de
+ * eventos y atiende a los clientes mediante colas de mensajes o, con la opción
+ * -s, mediante un socket Unix.
+ *
+ * Retorno:
+ *   - EXIT_SUCCESS si el programa termina correctamente
+ *   - EXIT_FAILURE si ocurre algún error
+ */
+int main(int argc, char *argv[]) {
+    int opt;
+    char msgbuf[300];               // Buffer para mensajes de log
+    const char *log_prefijo = NULL; // Prefijo del log binario (-b)
+    size_t log_limite = 0;          // Tamaño de sus segmentos (-R)
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"socket", no_argument, 0, 's'},
+                                           {"maxmsg", required_argument, 0, 'm'},
+                                           {"msgsize", required_argument, 0, 'z'},
+                                           {"pesos", required_argument, 0, 'w'},
+                                           {"plazo-cierre", required_argument, 0, 'c'},
+                                           {"kernel", required_argument, 0, 'k'},
+                                           {"shards", required_argument, 0, 'S'},
+                                           {"sin-afinidad", no_argument, 0, 'A'},
+                                           {"cpus", required_argument, 0, 'C'},
+                                           {"fifo", required_argument, 0, 'F'},
+                                           {"busy-poll", required_argument, 0, 'P'},
+                                           {"log-binario", required_argument, 0, 'b'},
+                                           {"rotar", required_argument, 0, 'R'},
+                                           {"hilos-fichero", required_argument, 0, 'H'},
+                                           {"arena", required_argument, 0, 'G'},
+                                           {"tam-slot", required_argument, 0, 'Z'},
+                                           {"diario", required_argument, 0, 'j'},
+                                           {"plazo-diario", required_argument, 0, 'J'},
+                                           {"max-pendientes", required_argument, 0, 'Q'},
+                                           {"max-espera", required_argument, 0, 'L'},
+                                           {"nivel-log", required_argument, 0, 'l'},
+                                           {"config", required_argument, 0, 'f'},
+                                           {0, 0, 0, 0}};
+    int hilos_fichero = 0;                  // Hilos por fichero en las peticiones PROTO_RUTA (-H)
+    long arena_slots = 0;                   // Slots de la arena compartida (-G; 0 = sin arena)
+    size_t arena_tam_slot = ARENA_TAM_SLOT; // Bytes de cada slot (-Z)
+
+    while ((opt = getopt_long(argc, argv, "hsm:z:w:c:k:S:AC:F:P:b:R:H:G:Z:j:J:Q:L:l:f:",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 's':
+            socket_flag = 1;
+            break;
+        case 'm':
+            opcion_maxmsg = atol(optarg);
+            break;
+        case 'z':
+            opcion_msgsize = atol(optarg);
+            break;
+        case 'w':
+            if (sscanf(optarg, "%d:%d:%d", &pesos[CARRIL_CONTROL], &pesos[CARRIL_INTERACTIVO],
+                       &pesos[CARRIL_MASIVO]) != 3) {
+                printf("Formato de pesos no válido: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            plazo_cierre_ms = atol(optarg);
+            break;
+        case 'k':
+            if (texto_elegir_kernel(optarg) == NULL) {
+                printf("Kernel no disponible en este procesador: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            num_shards = atoi(optarg);
+            if (num_shards < 1 || num_shards > MAX_SHARDS) {
+                printf("Número de particiones no válido (1-%d): %s\n", MAX_SHARDS, optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A':
+            usar_afinidad = 0;
+            break;
+        case 'C':
+            num_cpus_elegidas = leer_lista_cpus(optarg, cpus_elegidas, MAX_SHARDS);
+            if (num_cpus_elegidas <= 0) {
+                printf("Lista de CPUs no válida: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            prioridad_fifo = atoi(optarg);
+            if (prioridad_fifo < 1 || prioridad_fifo > 99) {
+                printf("Prioridad SCHED_FIFO no válida (1-99): %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            busy_poll_us = atol(optarg);
+            break;
+        case 'b':
+            log_prefijo = optarg;
+            break;
+        case 'R':
+            log_limite = strtoul(optarg, NULL, 10) << 20;
+            break;
+        case 'H':
+            hilos_fichero = atoi(optarg);
+            break;
+        case 'G':
+            arena_slots = atol(optarg);
+            break;
+        case 'Z':
+            arena_tam_slot = strtoul(optarg, NULL, 10) << 10;
+            break;
+        case 'j':
+            ruta_diario = optarg;
+            break;
+        case 'J':
+            plazo_diario_ns = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        case 'Q':
+            admision_max_pendientes = atoi(optarg);
+            break;
+        case 'L':
+            admision_max_espera_ns = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        case 'l':
+            if (nivel_log_por_nombre(optarg) == -1) {
+                printf("Nivel de log no válido (errores, info o todo): %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            atomic_store(&nivel_log, nivel_log_por_nombre(optarg));
+            break;
+        case 'f':
+            ruta_config = optarg;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Los valores del fichero de configuración mandan sobre los de la línea de comandos
+    if (ruta_config != NULL) {
+        struct configuracion c;
+        char error[300];
+        configuracion_actual(&c);
+        if (configuracion_leer(ruta_config, &c, error, sizeof(error)) == -1) {
+            printf("Error en la configuración: %s\n", error);
+            return EXIT_FAILURE;
+        }
+        aplicar_configuracion(&c);
+        num_shards = c.num_shards;
+        opcion_maxmsg = c.maxmsg;
+        opcion_msgsize = c.msgsize;
+    }
+
+    // Con el socket el tamaño de mensaje no baja de MAX_SIZE: los clientes envían las
+    // líneas y los fragmentos de ese tamaño si no encuentran el que publica el servidor
+    if (socket_flag && opcion_msgsize > 0 && opcion_msgsize < MAX_SIZE) {
+        printf("Con -s el tamaño de mensaje no puede ser menor que %d\n", MAX_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    // Activamos el log binario si se pidió
+    if (log_prefijo != NULL && registro_activar(log_prefijo, log_limite) == -1) {
+        sprintf(msgbuf, "No se pudo crear el log binario %s: %s", log_prefijo, strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        return EXIT_FAILURE;
+    }
+
+    // Creamos el segmento de estadísticas. En modo socket, si falla, el servidor funciona
+    // igualmente; con colas no, porque los clientes leen en él cuántas particiones hay
+    if (estadisticas_crear() == -1) {
+        sprintf(msgbuf, "No se pudo crear el segmento de estadísticas: %s", strerror(errno));
+        funcionLog(msgbuf, LOG_FILE);
+        if (!socket_flag) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Creamos la arena compartida si se pidió; sin ella se rechazan las peticiones
+    // PROTO_ARENA
+    if (arena_slots > 0) {
+        if (arena_crear(&arena_actual, (uint32_t)arena_slots, arena_tam_slot) == -1) {
+            sprintf(msgbuf, "No se pudo crear la arena compartida: %s", strerror(errno));
+            funcionLog(msgbuf, LOG_FILE);
+            return EXIT_FAILURE;
+        }
+        sprintf(msgbuf, "Arena compartida: %ld slots de %lu KiB", arena_slots,
+                (unsigned long)(arena_tam_slot >> 10));
+        funcionLog(msgbuf, LOG_FILE);
+    }
+
+    // Elegimos el kernel de estadísticas de texto (si no se fijó con -k)
+    if (texto_kernel_actual == NULL) {
+        texto_elegir_kernel(NULL);
+    }
+    sprintf(msgbuf, "Kernel de estadísticas de texto: %s", texto_kernel_actual->nombre);
+    funcionLog(msgbuf, LOG_FILE);
+    if (busy_poll_us > 0 && !socket_flag) {
+        sprintf(msgbuf, "Modo busy-poll: se sondea la cola hasta %ld us sin mensajes",
+                busy_poll_us);
+        funcionLog(msgbuf, LOG_FILE);
+    }
+    if ((admision_max_pendientes > 0 || admision_max_espera_ns > 0) && !socket_flag) {
+        sprintf(msgbuf, "Control de admisión: hasta %d mensajes en los carriles, hasta %lu us de "
+                        "espera estimada (0 = sin límite)",
+                admision_max_pendientes, (unsigned long)(admision_max_espera_ns / 1000));
+        funcionLog(msgbuf, LOG_FILE);
+    }
+    if (ruta_diario != NULL && socket_flag) {
+        funcionLog("El diario sólo se usa con las colas: se ignora la opción -j", LOG_FILE);
+    }
+
+    // Los hilos de los ficheros grandes se reparten por los núcleos del proceso, que
+    // hay que anotar antes de fijar los hilos de las particiones
+    fichero_preparar(hilos_fichero);
+
+    // Preparamos el bucle de eventos y el transporte elegido
+    int resultado = EXIT_FAILURE;
+    if (preparar_eventos() == 0 && (socket_flag ? preparar_socket() : preparar_colas()) == 0) {
+        resultado = bucle_eventos();
+    }
+
+    // Esperamos a que los hilos de las particiones terminen de atender lo pendiente
+    esperar_shards();
 
     // Limpiamos los recursos antes de terminar
-    // Esto incluye cerrar y eliminar las colas de mensajes
+    // Esto incluye cerrar y eliminar las colas de mensajes (o el socket)
     cleanup();
 
-    // Terminamos el programa con éxito
-    return EXIT_SUCCESS;
+    return resultado;
 }
@@ -0,0 +1,124 @@
+/**
+ * Ejercicio 3: Transporte alternativo mediante sockets de dominio Unix
+ *
+ * Las colas de mensajes POSIX están sujetas a los límites RLIMIT_MSGQUEUE y
+ * /proc/sys/fs/mqueue, que se alcanzan enseguida al aumentar la profundidad de
+ * la cola o el número de clientes. Este archivo contiene las funciones comunes
+ * para usar como alternativa un socket de dominio Unix de tipo SOCK_SEQPACKET:
+ *
+ * - Conserva los límites de cada mensaje (igual que una cola de mensajes): cada
+ *   send() se corresponde exactamente con un recv() en el otro extremo.
+ * - Es orientado a conexión: cada cliente tiene su propio descriptor, por lo que
+ *   la respuesta vuelve por un canal privado sin necesidad de una segunda cola.
+ * - Se puede multiplexar con epoll para atender miles de conexiones.
+ */
+
+#ifndef EJ3_SOCKET_H
+#define EJ3_SOCKET_H
+
+#include "ej3_common.h"
+
+#include <fcntl.h>      // Para O_NONBLOCK
+#include <sys/socket.h> // Para socket(), bind(), listen(), accept4()...
+#include <sys/un.h>     // Para struct sockaddr_un
+
+/**
+ * Nombre base del socket del servidor
+ *
+ * Igual que con las colas, se le añade el nombre de usuario mediante
+ * get_queue_name() para que cada usuario tenga su propio socket.
+ */
+#define SERVER_SOCKET "/tmp/ej3_socket"
+
+/**
+ * Número máximo de conexiones pendientes de aceptar (parámetro de listen)
+ */
+#define SOCKET_BACKLOG 4096
+
+/**
+ * Función: preparar_direccion
+ *
+ * Rellena una estructura sockaddr_un con la ruta indicada.
+ *
+ * Retorno:
+ *   - 0 si la ruta cabe en la estructura
+ *   - -1 (con errno = ENAMETOOLONG) en caso contrario
+ */
+int preparar_direccion(struct sockaddr_un *addr, const char *ruta) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(ruta) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, ruta);
+    return 0;
+}
+
+/**
+ * Función: crear_socket_servidor
+ *
+ * Crea el socket de escucha del servidor. El socket se crea no bloqueante
+ * porque se va a utilizar con epoll en modo edge-triggered, donde hay que
+ * leer/aceptar hasta obtener EAGAIN.
+ *
+ * Parámetros:
+ *   - ruta: Ruta del socket en el sistema de ficheros
+ *
+ * Retorno:
+ *   - Descriptor del socket de escucha, o -1 en caso de error (errno indica la causa)
+ */
+int crear_socket_servidor(const char *ruta) {
+    struct sockaddr_un addr;
+    if (preparar_direccion(&addr, ruta) == -1) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Eliminamos un posible socket anterior que no se borrase (por ejemplo tras un kill -9)
+    unlink(ruta);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, SOCKET_BACKLOG) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Función: conectar_socket_cliente
+ *
+ * Conecta con el socket del servidor. El descriptor devuelto es bloqueante,
+ * ya que el cliente envía una petición y espera su respuesta.
+ *
+ * Retorno:
+ *   - Descriptor conectado, o -1 en caso de error (errno indica la causa)
+ */
+int conectar_socket_cliente(const char *ruta) {
+    struct sockaddr_un addr;
+    if (preparar_direccion(&addr, ruta) == -1) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+#endif /* EJ3_SOCKET_H */
@@ -0,0 +1,215 @@
+/**
+ * Ejercicio 3: Lector del segmento de estadísticas del servidor
+ *
+ * Este programa mapea en modo sólo lectura el segmento de memoria compartida que
+ * publica ej3_servidor (ver ej3_estadisticas.h) y muestra sus contadores: mensajes
+ * y bytes recibidos/enviados, errores, profundidad de la cola e histograma de
+ * tiempos de servicio. No envía nada al servidor ni toma cerrojos, así que se
+ * puede ejecutar en bucle sin afectar a su rendimiento.
+ *
+ * Ejemplos de uso:
+ *   ./ej3_stats            Muestra los contadores una vez
+ *   ./ej3_stats -i 1       Los muestra cada segundo, con las tasas por segundo
+ */
+
+#include "ej3_common.h"       // Incluye definiciones y funciones comunes
+#include "ej3_estadisticas.h" // Formato del segmento de estadísticas
+
+#include <getopt.h> // Para procesar opciones de línea de comandos (getopt_long)
+
+/**
+ * Estructura: instantanea
+ *
+ * Copia local de los contadores, tomada en un instante dado.
+ */
+struct instantanea {
+    uint64_t recibidos, enviados, bytes_recibidos, bytes_enviados, errores, rechazadas;
+    uint64_t vencidas;
+    uint64_t profundidad, pendientes, conexiones, servicio_total_ns;
+    uint64_t histograma[STATS_HIST];
+    uint64_t cuando_ns; // Instante de la copia (CLOCK_MONOTONIC)
+};
+
+/**
+ * Función: tomar_instantanea
+ *
+ * Copia los contadores del segmento compartido con lecturas atómicas.
+ */
+void tomar_instantanea(const struct ej3_estadisticas *s, struct instantanea *i) {
+    i->recibidos = atomic_load_explicit(&s->mensajes_recibidos, memory_order_relaxed);
+    i->enviados = atomic_load_explicit(&s->mensajes_enviados, memory_order_relaxed);
+    i->bytes_recibidos = atomic_load_explicit(&s->bytes_recibidos, memory_order_relaxed);
+    i->bytes_enviados = atomic_load_explicit(&s->bytes_enviados, memory_order_relaxed);
+    i->errores = atomic_load_explicit(&s->errores, memory_order_relaxed);
+    i->rechazadas = atomic_load_explicit(&s->rechazadas, memory_order_relaxed);
+    i->vencidas = atomic_load_explicit(&s->vencidas, memory_order_relaxed);
+    i->profundidad = atomic_load_explicit(&s->profundidad_cola, memory_order_relaxed);
+    i->pendientes = atomic_load_explicit(&s->pendientes_carriles, memory_order_relaxed);
+    i->conexiones = atomic_load_explicit(&s->conexiones, memory_order_relaxed);
+    i->servicio_total_ns = atomic_load_explicit(&s->servicio_total_ns, memory_order_relaxed);
+    for (int k = 0; k < STATS_HIST; k++) {
+        i->histograma[k] = atomic_load_explicit(&s->histograma[k], memory_order_relaxed);
+    }
+    i->cuando_ns = ahora_ns();
+}
+
+/**
+ * Función: percentil_histograma
+ *
+ * Estima el percentil p (0-100) a partir del histograma: devuelve el límite
+ * superior (en nanosegundos) del intervalo en el que se alcanza el percentil.
+ */
+uint64_t percentil_histograma(const uint64_t *hist, double p) {
+    uint64_t total = 0, acumulado = 0;
+    for (int k = 0; k < STATS_HIST; k++) {
+        total += hist[k];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    for (int k = 0; k < STATS_HIST; k++) {
+        acumulado += hist[k];
+        if (acumulado >= p / 100.0 * total) {
+            return 1ULL << (k + 1);
+        }
+    }
+    return 1ULL << STATS_HIST;
+}
+
+/**
+ * Función: mostrar
+ *
+ * Muestra una instantánea. Si se pasa la anterior, muestra también las tasas
+ * por segundo del intervalo entre ambas.
+ */
+void mostrar(const struct ej3_estadisticas *s, const struct instantanea *i,
+             const struct instantanea *anterior, int con_histograma) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_REALTIME, &ahora);
+    double activo = (ahora.tv_sec - s->inicio.tv_sec) + (ahora.tv_nsec - s->inicio.tv_nsec) / 1e9;
+
+    printf("Servidor PID %d, en marcha desde hace %.1f s\n", (int)s->pid, activo);
+    printf("Mensajes: recibidos %lu, enviados %lu, errores %lu, rechazados %lu, vencidos %lu\n",
+           (unsigned long)i->recibidos, (unsigned long)i->enviados, (unsigned long)i->errores,
+           (unsigned long)i->rechazadas, (unsigned long)i->vencidas);
+    printf("Bytes:    recibidos %lu, enviados %lu\n", (unsigned long)i->bytes_recibidos,
+           (unsigned long)i->bytes_enviados);
+    printf("En espera: %lu en la cola, %lu en los carriles; conexiones abiertas: %lu\n",
+           (unsigned long)i->profundidad, (unsigned long)i->pendientes,
+           (unsigned long)i->conexiones);
+
+    if (anterior != NULL) {
+        double dt = (i->cuando_ns - anterior->cuando_ns) / 1e9;
+        printf("Tasas:    %.0f mensajes/s recibidos, %.0f mensajes/s enviados, %.0f bytes/s\n",
+               (i->recibidos - anterior->recibidos) / dt, (i->enviados - anterior->enviados) / dt,
+               (i->bytes_recibidos - anterior->bytes_recibidos) / dt);
+    }
+
+    if (i->enviados > 0) {
+        printf("Tiempo de servicio (us): medio %.1f, p50 < %.1f, p99 < %.1f\n",
+               i->servicio_total_ns / (double)i->enviados / 1e3,
+               percentil_histograma(i->histograma, 50) / 1e3,
+               percentil_histograma(i->histograma, 99) / 1e3);
+    }
+
+    if (con_histograma) {
+        uint64_t max = 0;
+        for (int k = 0; k < STATS_HIST; k++) {
+            max = i->histograma[k] > max ? i->histograma[k] : max;
+        }
+        for (int k = 0; k < STATS_HIST; k++) {
+            if (i->histograma[k] == 0) {
+                continue;
+            }
+            // Barra de hasta 50 caracteres proporcional al intervalo más poblado
+            int barra = (int)(i->histograma[k] * 50 / max);
+            printf("  [%10.1f us, %10.1f us) %10lu ", (1ULL << k) / 1e3, (1ULL << (k + 1)) / 1e3,
+                   (unsigned long)i->histograma[k]);
+            for (int b = 0; b < barra; b++) {
+                putchar('#');
+            }
+            putchar('\n');
+        }
+    }
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_stats [opciones]\n");
+    printf("Opciones:\n");
+    printf("-h, --help               Imprimir esta ayuda\n");
+    printf("-i, --intervalo <seg>    Repetir cada <seg> segundos (admite decimales)\n");
+    printf("-n, --veces <N>          Número de repeticiones con -i (por defecto, sin límite)\n");
+    printf("-H, --histograma         Mostrar el histograma de tiempos de servicio\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    double intervalo = 0;
+    long veces = -1;
+    int con_histograma = 0;
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"intervalo", required_argument, 0, 'i'},
+                                           {"veces", required_argument, 0, 'n'},
+                                           {"histograma", no_argument, 0, 'H'},
+                                           {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "hi:n:H", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 'i':
+            intervalo = atof(optarg);
+            break;
+        case 'n':
+            veces = atol(optarg);
+            break;
+        case 'H':
+            con_histograma = 1;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    const struct ej3_estadisticas *s = estadisticas_abrir();
+    if (s == NULL) {
+        perror("No se pudo abrir el segmento de estadísticas (¿está el servidor en ejecución?)");
+        return EXIT_FAILURE;
+    }
+
+    struct instantanea actual, anterior;
+    tomar_instantanea(s, &actual);
+    mostrar(s, &actual, NULL, con_histograma);
+
+    // Modo bucle: esperamos el intervalo y mostramos también las tasas
+    while (intervalo > 0 && veces != 0) {
+        struct timespec espera = {(time_t)intervalo,
+                                  (long)((intervalo - (time_t)intervalo) * 1e9)};
+        nanosleep(&espera, NULL);
+
+        // Si el servidor terminó, eliminó el segmento y su PID ya no existe
+        if (kill(s->pid, 0) == -1 && errno == ESRCH) {
+            printf("El servidor ha terminado\n");
+            break;
+        }
+
+        anterior = actual;
+        tomar_instantanea(s, &actual);
+        printf("\n");
+        mostrar(s, &actual, &anterior, con_histograma);
+        if (veces > 0) {
+            veces--;
+        }
+    }
+
+    munmap((void *)s, sizeof(struct ej3_estadisticas));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,567 @@
+/**
+ * Ejercicio 3: Motor de estadísticas de texto del servidor
+ *
+ * Calcula en una sola pasada sobre el texto:
+ * - Número de bytes
+ * - Número de caracteres (puntos de código UTF-8, no bytes: "canción" tiene 7
+ *   caracteres y 8 bytes)
+ * - Número de palabras (secuencias separadas por espacios, tabuladores o saltos de línea)
+ * - Número de líneas (caracteres '\n')
+ * - Si el texto es UTF-8 válido
+ *
+ * Hay tres implementaciones (kernels) con el mismo resultado, y se elige en tiempo de
+ * ejecución la más rápida que admita el procesador:
+ * - avx2: procesa bloques de 32 bytes y valida UTF-8 también con instrucciones vectoriales
+ *   (algoritmo de tablas de consulta de Keiser y Lemire, el que usa simdjson)
+ * - sse2: cuenta en bloques de 16 bytes; la validación vectorial necesita pshufb (SSSE3),
+ *   así que los bloques que no son ASCII se validan byte a byte
+ * - escalar: byte a byte, para cualquier arquitectura
+ *
+ * El cálculo es incremental (estado texto_estado): se puede alimentar el texto por
+ * trozos arbitrarios, aunque corten un carácter multibyte por la mitad.
+ */
+
+#ifndef EJ3_TEXTO_H
+#define EJ3_TEXTO_H
+
+#include "ej3_common.h"
+
+#include <stdint.h> // Para uint64_t
+#include <string.h> // Para memcpy()
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXTO_X86 1
+#include <immintrin.h> // Intrínsecos SSE2/AVX2
+#endif
+
+/**
+ * Estadísticas que se pueden pedir (máscara de bits)
+ */
+#define EST_BYTES 0x01
+#define EST_CARACTERES 0x02
+#define EST_PALABRAS 0x04
+#define EST_LINEAS 0x08
+#define EST_UTF8 0x10
+#define EST_TODAS 0x1f
+
+/**
+ * Estructura: texto_estado
+ *
+ * Resultados acumulados y estado necesario para continuar con el siguiente trozo.
+ */
+struct texto_estado {
+    uint64_t bytes;             // Bytes procesados
+    uint64_t caracteres;        // Puntos de código (bytes que no son de continuación)
+    uint64_t palabras;          // Comienzos de palabra
+    uint64_t lineas;            // Caracteres '\n'
+    int utf8_valido;            // 0 en cuanto aparece una secuencia no válida
+    int en_palabra;             // El último byte procesado no era un separador
+    unsigned char pendiente[4]; // Carácter multibyte incompleto al final del último trozo
+    int num_pendiente;          // Bytes en pendiente (0-3)
+};
+
+/**
+ * Estructura: texto_validador
+ *
+ * Validador UTF-8 byte a byte (RFC 3629): número de bytes de continuación que
+ * faltan y rango admitido para el siguiente, que excluye las formas sobrelargas,
+ * los sustitutos (U+D800-U+DFFF) y los valores mayores que U+10FFFF.
+ */
+struct texto_validador {
+    int faltan;
+    unsigned char minimo, maximo;
+};
+
+/**
+ * Función: texto_validar_byte
+ *
+ * Avanza el validador con un byte.
+ *
+ * Retorno:
+ *   - 1 si el byte es válido en su posición, 0 si no lo es
+ */
+static inline int texto_validar_byte(struct texto_validador *v, unsigned char b) {
+    if (v->faltan > 0) {
+        if (b < v->minimo || b > v->maximo) {
+            v->faltan = 0;
+            return 0;
+        }
+        v->faltan--;
+        v->minimo = 0x80;
+        v->maximo = 0xBF;
+        return 1;
+    }
+    v->minimo = 0x80;
+    v->maximo = 0xBF;
+    if (b < 0x80) {
+        return 1;
+    }
+    if (b >= 0xC2 && b <= 0xDF) {
+        v->faltan = 1;
+    }
+    else if (b >= 0xE0 && b <= 0xEF) {
+        v->faltan = 2;
+        v->minimo = b == 0xE0 ? 0xA0 : 0x80; // Sobrelargas
+        v->maximo = b == 0xED ? 0x9F : 0xBF; // Sustitutos
+    }
+    else if (b >= 0xF0 && b <= 0xF4) {
+        v->faltan = 3;
+        v->minimo = b == 0xF0 ? 0x90 : 0x80; // Sobrelargas
+        v->maximo = b == 0xF4 ? 0x8F : 0xBF; // Mayores que U+10FFFF
+    }
+    else {
+        return 0; // Continuación suelta, C0, C1 o F5-FF
+    }
+    return 1;
+}
+
+/**
+ * Función: texto_es_separador
+ *
+ * Indica si un byte separa palabras: espacio, '\t', '\n', '\v', '\f' o '\r'.
+ */
+static inline int texto_es_separador(unsigned char b) {
+    return b == ' ' || (b >= '\t' && b <= '\r');
+}
+
+/**
+ * Función: texto_longitud_secuencia
+ *
+ * Número de bytes de la secuencia UTF-8 que empieza con el byte b (1 si no es un
+ * byte inicial de secuencia multibyte).
+ */
+static inline int texto_longitud_secuencia(unsigned char b) {
+    if (b >= 0xF0) {
+        return 4;
+    }
+    if (b >= 0xE0) {
+        return 3;
+    }
+    return b >= 0xC0 ? 2 : 1;
+}
+
+/**
+ * Función: texto_longitud_completa
+ *
+ * Devuelve la longitud del prefijo de p que no termina con un carácter multibyte
+ * incompleto. Los bytes restantes (0-3) se guardan para el siguiente trozo.
+ */
+static inline size_t texto_longitud_completa(const unsigned char *p, size_t n) {
+    for (size_t i = 1; i <= 3 && i <= n; i++) {
+        unsigned char b = p[n - i];
+        if ((b & 0xC0) == 0x80) {
+            continue; // Byte de continuación: seguimos buscando el inicial
+        }
+        if (b >= 0xC0 && (size_t)texto_longitud_secuencia(b) > i) {
+            return n - i;
+        }
+        break;
+    }
+    return n;
+}
+
+/**
+ * Kernel escalar
+ *
+ * Todos los kernels procesan un fragmento que empieza y termina en un límite de
+ * carácter (ver texto_actualizar), de modo que no necesitan estado de validación
+ * entre llamadas; sólo en_palabra, para no contar dos veces una palabra partida.
+ */
+static void texto_kernel_escalar(struct texto_estado *e, const unsigned char *p, size_t n) {
+    struct texto_validador v = {0, 0x80, 0xBF};
+    uint64_t caracteres = 0, palabras = 0, lineas = 0;
+    int valido = 1, en_palabra = e->en_palabra;
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned char b = p[i];
+        caracteres += (b & 0xC0) != 0x80;
+        lineas += b == '\n';
+        int separador = texto_es_separador(b);
+        palabras += !separador && !en_palabra;
+        en_palabra = !separador;
+        valido &= texto_validar_byte(&v, b);
+    }
+
+    e->caracteres += caracteres;
+    e->palabras += palabras;
+    e->lineas += lineas;
+    e->en_palabra = en_palabra;
+    e->utf8_valido &= valido && v.faltan == 0;
+}
+
+#ifdef TEXTO_X86
+
+/**
+ * Función: texto_contar_mascaras
+ *
+ * Acumula las estadísticas de un bloque a partir de sus máscaras de bits (un bit
+ * por byte): separadores, saltos de línea y bytes de continuación. validos marca los
+ * bytes del bloque que pertenecen al texto. Es común a los kernels sse2 y avx2.
+ *
+ * Las palabras se cuentan por sus comienzos: bytes que no son separadores cuyo
+ * byte anterior sí lo es. El bit del byte anterior al primero del bloque viene de
+ * en_palabra.
+ */
+static inline void texto_contar_mascaras(uint64_t separadores, uint64_t saltos,
+                                         uint64_t continuaciones, uint64_t validos,
+                                         uint64_t *caracteres, uint64_t *palabras,
+                                         uint64_t *lineas, int *en_palabra) {
+    uint64_t letras = ~separadores & validos;
+    uint64_t anteriores = (letras << 1) | (uint64_t)*en_palabra;
+    *palabras += __builtin_popcountll(letras & ~anteriores);
+    *lineas += __builtin_popcountll(saltos & validos);
+    *caracteres += __builtin_popcountll(~continuaciones & validos);
+    *en_palabra = (int)((letras >> (63 - __builtin_clzll(validos))) & 1);
+}
+
+/**
+ * Kernel sse2
+ *
+ * Cuenta con instrucciones SSE2 en bloques de 16 bytes. Los bloques formados sólo
+ * por bytes ASCII son válidos si no queda ninguna secuencia multibyte abierta; el
+ * resto se pasa por el validador escalar.
+ */
+static void texto_kernel_sse2(struct texto_estado *e, const unsigned char *p, size_t n) {
+    struct texto_validador v = {0, 0x80, 0xBF};
+    uint64_t caracteres = 0, palabras = 0, lineas = 0;
+    int valido = 1, en_palabra = e->en_palabra;
+    const __m128i espacio = _mm_set1_epi8(' ');
+    const __m128i salto = _mm_set1_epi8('\n');
+    const __m128i tab_menos_1 = _mm_set1_epi8('\t' - 1);
+    const __m128i retorno_mas_1 = _mm_set1_epi8('\r' + 1);
+    const __m128i limite_continuacion = _mm_set1_epi8((char)0xC0);
+    size_t i = 0;
+
+    for (; i < n; i += 16) {
+        unsigned char relleno[16];
+        const unsigned char *bloque = p + i;
+        uint64_t validos = 0xFFFF;
+        if (n - i < 16) {
+            // Último bloque incompleto: lo copiamos a un buffer de 16 bytes
+            memset(relleno, 0, sizeof(relleno));
+            memcpy(relleno, p + i, n - i);
+            bloque = relleno;
+            validos = (1ULL << (n - i)) - 1;
+        }
+
+        __m128i x = _mm_loadu_si128((const __m128i *)bloque);
+        // '\t' <= x <= '\r' (comparación con signo: los bytes >= 0x80 son negativos)
+        __m128i rango = _mm_and_si128(_mm_cmpgt_epi8(x, tab_menos_1),
+                                      _mm_cmplt_epi8(x, retorno_mas_1));
+        __m128i sep = _mm_or_si128(_mm_cmpeq_epi8(x, espacio), rango);
+        // Bytes de continuación: 0x80-0xBF, es decir, menores que 0xC0 con signo
+        __m128i cont = _mm_cmplt_epi8(x, limite_continuacion);
+
+        texto_contar_mascaras((uint64_t)_mm_movemask_epi8(sep),
+                              (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, salto)),
+                              (uint64_t)_mm_movemask_epi8(cont), validos, &caracteres,
+                              &palabras, &lineas, &en_palabra);
+
+        // Validación: atajo para bloques ASCII, validador escalar para el resto
+        if (_mm_movemask_epi8(x) != 0 || v.faltan > 0) {
+            size_t fin = n - i < 16 ? n - i : 16;
+            for (size_t k = 0; k < fin; k++) {
+                valido &= texto_validar_byte(&v, bloque[k]);
+            }
+        }
+    }
+
+    e->caracteres += caracteres;
+    e->palabras += palabras;
+    e->lineas += lineas;
+    e->en_palabra = en_palabra;
+    e->utf8_valido &= valido && v.faltan == 0;
+}
+
+/**
+ * Funciones auxiliares del kernel avx2
+ *
+ * texto_anteriores_avx2 devuelve el bloque desplazado n bytes (1-3) hacia atrás,
+ * rellenando el principio con los últimos bytes del bloque anterior.
+ *
+ * texto_errores_avx2 aplica el algoritmo de validación de Keiser y Lemire: cada par
+ * de bytes consecutivos se clasifica con tres tablas de 16 entradas (pshufb), indexadas
+ * por el nibble alto del primero, su nibble bajo y el nibble alto del segundo. La
+ * intersección (AND) de las tres clasificaciones sólo es distinta de cero si el par
+ * es un error. Las secuencias de 3 y 4 bytes se comprueban aparte con los bytes
+ * desplazados 2 y 3 posiciones.
+ */
+__attribute__((target("avx2"))) static inline __m256i texto_anteriores_avx2(__m256i x,
+                                                                             __m256i anterior,
+                                                                             int n) {
+    __m256i mezcla = _mm256_permute2x128_si256(anterior, x, 0x21);
+    switch (n) {
+    case 1:
+        return _mm256_alignr_epi8(x, mezcla, 15);
+    case 2:
+        return _mm256_alignr_epi8(x, mezcla, 14);
+    default:
+        return _mm256_alignr_epi8(x, mezcla, 13);
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m256i texto_errores_avx2(__m256i x,
+                                                                          __m256i anterior) {
+    // Clases de error (un bit cada una)
+    const uint8_t CORTA = 1 << 0;        // Falta un byte de continuación
+    const uint8_t LARGA = 1 << 1;        // Continuación sin byte inicial
+    const uint8_t SOBRELARGA_3 = 1 << 2; // E0 80-9F
+    const uint8_t GRANDE = 1 << 3;       // Mayor que U+10FFFF
+    const uint8_t SUSTITUTO = 1 << 4;    // ED A0-BF
+    const uint8_t SOBRELARGA_2 = 1 << 5; // C0-C1
+    const uint8_t GRANDE_1000 = 1 << 6;  // F4 90-BF
+    const uint8_t SOBRELARGA_4 = 1 << 6; // F0 80-8F
+    const uint8_t DOS_CONT = 1 << 7;     // Dos continuaciones seguidas (válido en 3 y 4 bytes)
+    const uint8_t ARRASTRE = CORTA | LARGA | DOS_CONT;
+
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i previo1 = texto_anteriores_avx2(x, anterior, 1);
+
+    const __m256i tabla_alto_1 = _mm256_setr_epi8(
+        LARGA, LARGA, LARGA, LARGA, LARGA, LARGA, LARGA, LARGA, DOS_CONT, DOS_CONT, DOS_CONT,
+        DOS_CONT, CORTA | SOBRELARGA_2, CORTA, CORTA | SOBRELARGA_3 | SUSTITUTO,
+        CORTA | GRANDE | GRANDE_1000 | SOBRELARGA_4, LARGA, LARGA, LARGA, LARGA, LARGA, LARGA,
+        LARGA, LARGA, DOS_CONT, DOS_CONT, DOS_CONT, DOS_CONT, CORTA | SOBRELARGA_2, CORTA,
+        CORTA | SOBRELARGA_3 | SUSTITUTO, CORTA | GRANDE | GRANDE_1000 | SOBRELARGA_4);
+    const __m256i tabla_bajo_1 = _mm256_setr_epi8(
+        ARRASTRE | SOBRELARGA_3 | SOBRELARGA_2 | SOBRELARGA_4, ARRASTRE | SOBRELARGA_2,
+        ARRASTRE, ARRASTRE, ARRASTRE | GRANDE, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000 | SUSTITUTO,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | SOBRELARGA_3 | SOBRELARGA_2 | SOBRELARGA_4, ARRASTRE | SOBRELARGA_2,
+        ARRASTRE, ARRASTRE, ARRASTRE | GRANDE, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000 | SUSTITUTO,
+        ARRASTRE | GRANDE | GRANDE_1000, ARRASTRE | GRANDE | GRANDE_1000);
+    const __m256i tabla_alto_2 = _mm256_setr_epi8(
+        CORTA, CORTA, CORTA, CORTA, CORTA, CORTA, CORTA, CORTA,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SOBRELARGA_3 | GRANDE_1000 | SOBRELARGA_4,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SOBRELARGA_3 | GRANDE,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SUSTITUTO | GRANDE,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SUSTITUTO | GRANDE, CORTA, CORTA, CORTA, CORTA, CORTA,
+        CORTA, CORTA, CORTA, CORTA, CORTA, CORTA, CORTA,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SOBRELARGA_3 | GRANDE_1000 | SOBRELARGA_4,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SOBRELARGA_3 | GRANDE,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SUSTITUTO | GRANDE,
+        LARGA | SOBRELARGA_2 | DOS_CONT | SUSTITUTO | GRANDE, CORTA, CORTA, CORTA, CORTA);
+
+    __m256i alto_1 = _mm256_and_si256(_mm256_srli_epi16(previo1, 4), nibble);
+    __m256i bajo_1 = _mm256_and_si256(previo1, nibble);
+    __m256i alto_2 = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+    __m256i especiales = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(tabla_alto_1, alto_1),
+                         _mm256_shuffle_epi8(tabla_bajo_1, bajo_1)),
+        _mm256_shuffle_epi8(tabla_alto_2, alto_2));
+
+    // Dos continuaciones seguidas sólo son válidas si dos o tres bytes antes empieza una
+    // secuencia de 3 (E0-EF) o 4 bytes (F0-FF)
+    __m256i previo2 = texto_anteriores_avx2(x, anterior, 2);
+    __m256i previo3 = texto_anteriores_avx2(x, anterior, 3);
+    __m256i tercero = _mm256_subs_epu8(previo2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i cuarto = _mm256_subs_epu8(previo3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i debe_23 =
+        _mm256_and_si256(_mm256_or_si256(tercero, cuarto), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(debe_23, especiales);
+}
+
+/**
+ * Kernel avx2
+ *
+ * Procesa bloques de 32 bytes: cuenta con máscaras de bits y valida UTF-8 de forma
+ * vectorial. Los errores se acumulan con OR y se comprueban una sola vez al final.
+ */
+__attribute__((target("avx2,popcnt"))) static void
+texto_kernel_avx2(struct texto_estado *e, const unsigned char *p, size_t n) {
+    uint64_t caracteres = 0, palabras = 0, lineas = 0;
+    int en_palabra = e->en_palabra;
+    const __m256i espacio = _mm256_set1_epi8(' ');
+    const __m256i salto = _mm256_set1_epi8('\n');
+    const __m256i tab_menos_1 = _mm256_set1_epi8('\t' - 1);
+    const __m256i retorno = _mm256_set1_epi8('\r');
+    const __m256i limite_continuacion = _mm256_set1_epi8((char)0xC0);
+    __m256i anterior = _mm256_setzero_si256();
+    __m256i errores = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i < n; i += 32) {
+        unsigned char relleno[32];
+        const unsigned char *bloque = p + i;
+        uint64_t validos = 0xFFFFFFFFULL;
+        if (n - i < 32) {
+            // Último bloque incompleto: se rellena con ceros, que son ASCII válido
+            memset(relleno, 0, sizeof(relleno));
+            memcpy(relleno, p + i, n - i);
+            bloque = relleno;
+            validos = (1ULL << (n - i)) - 1;
+        }
+
+        __m256i x = _mm256_loadu_si256((const __m256i *)bloque);
+        // '\t' <= x <= '\r': AVX2 sólo tiene comparación "mayor que"
+        __m256i rango = _mm256_andnot_si256(_mm256_cmpgt_epi8(x, retorno),
+                                            _mm256_cmpgt_epi8(x, tab_menos_1));
+        __m256i sep = _mm256_or_si256(_mm256_cmpeq_epi8(x, espacio), rango);
+        __m256i cont = _mm256_cmpgt_epi8(limite_continuacion, x);
+
+        texto_contar_mascaras((uint32_t)_mm256_movemask_epi8(sep),
+                              (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, salto)),
+                              (uint32_t)_mm256_movemask_epi8(cont), validos, &caracteres,
+                              &palabras, &lineas, &en_palabra);
+
+        // Atajo: un bloque ASCII es válido si el anterior no dejó una secuencia abierta,
+        // lo que se comprueba igualmente al validar el siguiente bloque no ASCII
+        if (_mm256_movemask_epi8(x) != 0 || _mm256_movemask_epi8(anterior) != 0) {
+            errores = _mm256_or_si256(errores, texto_errores_avx2(x, anterior));
+        }
+        anterior = x;
+    }
+
+    e->caracteres += caracteres;
+    e->palabras += palabras;
+    e->lineas += lineas;
+    e->en_palabra = en_palabra;
+    e->utf8_valido &= _mm256_testz_si256(errores, errores);
+}
+
+#endif /* TEXTO_X86 */
+
+/**
+ * Tabla de kernels disponibles
+ */
+typedef void (*texto_kernel)(struct texto_estado *, const unsigned char *, size_t);
+
+struct texto_kernel_info {
+    const char *nombre;
+    texto_kernel funcion;
+};
+
+static const struct texto_kernel_info texto_kernels[] = {
+#ifdef TEXTO_X86
+    {"avx2", texto_kernel_avx2},
+    {"sse2", texto_kernel_sse2},
+#endif
+    {"escalar", texto_kernel_escalar},
+};
+
+#define TEXTO_NUM_KERNELS (int)(sizeof(texto_kernels) / sizeof(texto_kernels[0]))
+
+/**
+ * Kernel en uso (NULL hasta la primera llamada, que elige el mejor disponible)
+ */
+static const struct texto_kernel_info *texto_kernel_actual = NULL;
+
+/**
+ * Función: texto_kernel_soportado
+ *
+ * Indica si el procesador admite el kernel i de la tabla.
+ */
+int texto_kernel_soportado(int i) {
+#ifdef TEXTO_X86
+    if (strcmp(texto_kernels[i].nombre, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (strcmp(texto_kernels[i].nombre, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return 1;
+}
+
+/**
+ * Función: texto_elegir_kernel
+ *
+ * Fija el kernel por nombre o, con NULL, elige el primero de la tabla (el más
+ * rápido) que admita el procesador.
+ *
+ * Retorno:
+ *   - Nombre del kernel elegido, o NULL si el nombre no existe o no está soportado
+ */
+const char *texto_elegir_kernel(const char *nombre) {
+    for (int i = 0; i < TEXTO_NUM_KERNELS; i++) {
+        if ((nombre == NULL || strcmp(nombre, texto_kernels[i].nombre) == 0) &&
+            texto_kernel_soportado(i)) {
+            texto_kernel_actual = &texto_kernels[i];
+            return texto_kernel_actual->nombre;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Función: texto_iniciar
+ *
+ * Pone a cero el estado antes de procesar un texto nuevo.
+ */
+void texto_iniciar(struct texto_estado *e) {
+    memset(e, 0, sizeof(*e));
+    e->utf8_valido = 1;
+}
+
+/**
+ * Función: texto_actualizar
+ *
+ * Procesa el siguiente trozo del texto.
+ *
+ * Si el trozo anterior terminó con un carácter multibyte incompleto, primero se
+ * completa con los primeros bytes de éste y se procesa aparte. Del mismo modo, los
+ * bytes de un carácter incompleto al final de este trozo se guardan para el
+ * siguiente. Así los kernels siempre reciben fragmentos con caracteres completos.
+ */
+void texto_actualizar(struct texto_estado *e, const void *datos, size_t n) {
+    const unsigned char *p = datos;
+
+    if (texto_kernel_actual == NULL) {
+        texto_elegir_kernel(NULL);
+    }
+    e->bytes += n;
+
+    if (e->num_pendiente > 0) {
+        int longitud = texto_longitud_secuencia(e->pendiente[0]);
+        while (e->num_pendiente < longitud && n > 0 && (*p & 0xC0) == 0x80) {
+            e->pendiente[e->num_pendiente++] = *p++;
+            n--;
+        }
+        if (e->num_pendiente < longitud && n == 0) {
+            return; // El carácter sigue incompleto
+        }
+        // Carácter completo (o cortado por un byte que no es de continuación)
+        texto_kernel_escalar(e, e->pendiente, e->num_pendiente);
+        e->num_pendiente = 0;
+    }
+
+    size_t completa = texto_longitud_completa(p, n);
+    texto_kernel_actual->funcion(e, p, completa);
+    memcpy(e->pendiente, p + completa, n - completa);
+    e->num_pendiente = (int)(n - completa);
+}
+
+/**
+ * Función: texto_finalizar
+ *
+ * Cierra el cálculo: un carácter que siga incompleto al final del texto cuenta como
+ * un carácter, pero el texto no es UTF-8 válido.
+ */
+void texto_finalizar(struct texto_estado *e) {
+    if (e->num_pendiente > 0) {
+        texto_kernel_escalar(e, e->pendiente, e->num_pendiente);
+        e->utf8_valido = 0;
+        e->num_pendiente = 0;
+    }
+}
+
+/**
+ * Función: texto_calcular
+ *
+ * Calcula las estadísticas de un texto completo.
+ */
+void texto_calcular(struct texto_estado *e, const void *datos, size_t n) {
+    texto_iniciar(e);
+    texto_actualizar(e, datos, n);
+    texto_finalizar(e);
+}
+
+#endif /* EJ3_TEXTO_H */
@@ -0,0 +1,183 @@
+/**
+ * Ejercicio 3: Banco de pruebas de los kernels de estadísticas de texto
+ *
+ * Este programa mide el rendimiento (GB/s) de cada kernel de ej3_texto.h que admita
+ * el procesador, sobre un texto generado en memoria, y comprueba que todos obtienen
+ * los mismos resultados. Como referencia, mide también strlen(), que es lo que el
+ * servidor calculaba antes (bytes, no caracteres).
+ *
+ * Ejemplos de uso:
+ *   ./ej3_texto_bench                  Texto en español de 64 MiB
+ *   ./ej3_texto_bench -a               Texto sólo ASCII (atajo de validación)
+ *   ./ej3_texto_bench -b 1024          Trozos de 1 KiB, como los mensajes de la cola
+ */
+
+#include "ej3_common.h" // Incluye definiciones y funciones comunes
+#include "ej3_texto.h"  // Kernels de estadísticas de texto
+
+#include <getopt.h> // Para procesar opciones de línea de comandos (getopt_long)
+
+/**
+ * Palabras con las que se genera el texto de prueba
+ */
+static const char *palabras_es[] = {"canción", "niño",  "corazón", "está",  "año",   "pequeño",
+                                    "el",      "de",    "la",      "que",   "y",     "información",
+                                    "también", "más",   "después", "señal", "cola",  "mensaje",
+                                    "proceso", "¿qué?", "¡sí!",    "€",     "über",  "ça"};
+static const char *palabras_ascii[] = {"the",     "of",   "and",   "queue",  "message",
+                                       "process", "signal", "server", "client", "text"};
+
+/**
+ * Función: generar_texto
+ *
+ * Rellena el buffer con palabras al azar separadas por espacios y, de vez en
+ * cuando, por saltos de línea. No corta ninguna palabra por la mitad.
+ */
+void generar_texto(char *p, size_t n, int ascii) {
+    const char **lista = ascii ? palabras_ascii : palabras_es;
+    size_t num = ascii ? sizeof(palabras_ascii) / sizeof(*palabras_ascii)
+                       : sizeof(palabras_es) / sizeof(*palabras_es);
+    size_t pos = 0;
+    unsigned int semilla = 12345;
+
+    while (pos < n) {
+        const char *w = lista[rand_r(&semilla) % num];
+        size_t len = strlen(w);
+        if (pos + len + 1 > n) {
+            memset(p + pos, ' ', n - pos);
+            break;
+        }
+        memcpy(p + pos, w, len);
+        pos += len;
+        p[pos++] = rand_r(&semilla) % 12 == 0 ? '\n' : ' ';
+    }
+}
+
+/**
+ * Función: print_help
+ *
+ * Muestra las opciones disponibles.
+ */
+void print_help() {
+    printf("Uso del programa: ej3_texto_bench [opciones]\n");
+    printf("Opciones:\n");
+    printf("-h, --help               Imprimir esta ayuda\n");
+    printf("-t, --tamanio <MiB>      Tamaño del texto (por defecto 64)\n");
+    printf("-n, --repeticiones <N>   Pasadas por kernel; se toma la más rápida (por defecto 5)\n");
+    printf("-b, --bloque <bytes>     Procesar el texto en trozos de este tamaño (por defecto, "
+           "entero)\n");
+    printf("-a, --ascii              Generar sólo texto ASCII\n");
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    size_t tamanio = 64;
+    int repeticiones = 5;
+    size_t bloque = 0;
+    int ascii = 0;
+
+    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
+                                           {"tamanio", required_argument, 0, 't'},
+                                           {"repeticiones", required_argument, 0, 'n'},
+                                           {"bloque", required_argument, 0, 'b'},
+                                           {"ascii", no_argument, 0, 'a'},
+                                           {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "ht:n:b:a", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            print_help();
+            return EXIT_SUCCESS;
+        case 't':
+            tamanio = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            repeticiones = atoi(optarg);
+            break;
+        case 'b':
+            bloque = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            ascii = 1;
+            break;
+        default:
+            print_help();
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t n = tamanio << 20;
+    char *texto = malloc(n + 1);
+    if (texto == NULL || n == 0 || repeticiones < 1) {
+        perror("No se pudo preparar el texto");
+        return EXIT_FAILURE;
+    }
+    generar_texto(texto, n, ascii);
+    texto[n] = '\0';
+    if (bloque == 0 || bloque > n) {
+        bloque = n;
+    }
+
+    printf("Texto de %zu MiB (%s), trozos de %zu bytes, %d repeticiones\n", tamanio,
+           ascii ? "ASCII" : "español, UTF-8", bloque, repeticiones);
+    printf("%-10s %10s %14s %12s %10s %6s\n", "kernel", "GB/s", "caracteres", "palabras",
+           "lineas", "utf8");
+
+    // Referencia: strlen sólo cuenta bytes
+    uint64_t mejor = UINT64_MAX;
+    size_t total = 0;
+    for (int r = 0; r < repeticiones; r++) {
+        uint64_t t0 = ahora_ns();
+        total = 0;
+        for (size_t pos = 0; pos < n; pos += bloque) {
+            total += strnlen(texto + pos, bloque);
+        }
+        uint64_t t = ahora_ns() - t0;
+        mejor = t < mejor ? t : mejor;
+    }
+    printf("%-10s %10.2f %14zu %12s %10s %6s\n", "strlen", n / (double)mejor, total, "-", "-",
+           "-");
+
+    struct texto_estado referencia;
+    int primero = 1, diferencias = 0;
+    for (int k = 0; k < TEXTO_NUM_KERNELS; k++) {
+        if (!texto_kernel_soportado(k)) {
+            printf("%-10s (no soportado por el procesador)\n", texto_kernels[k].nombre);
+            continue;
+        }
+        texto_elegir_kernel(texto_kernels[k].nombre);
+
+        struct texto_estado e;
+        mejor = UINT64_MAX;
+        for (int r = 0; r < repeticiones; r++) {
+            uint64_t t0 = ahora_ns();
+            texto_iniciar(&e);
+            for (size_t pos = 0; pos < n; pos += bloque) {
+                texto_actualizar(&e, texto + pos, n - pos < bloque ? n - pos : bloque);
+            }
+            texto_finalizar(&e);
+            uint64_t t = ahora_ns() - t0;
+            mejor = t < mejor ? t : mejor;
+        }
+        printf("%-10s %10.2f %14lu %12lu %10lu %6s\n", texto_kernels[k].nombre,
+               n / (double)mejor, (unsigned long)e.caracteres, (unsigned long)e.palabras,
+               (unsigned long)e.lineas, e.utf8_valido ? "sí" : "no");
+
+        // Todos los kernels deben coincidir con el primero
+        if (primero) {
+            referencia = e;
+            primero = 0;
+        }
+        else if (e.caracteres != referencia.caracteres || e.palabras != referencia.palabras ||
+                 e.lineas != referencia.lineas || e.utf8_valido != referencia.utf8_valido) {
+            diferencias = 1;
+        }
+    }
+
+    free(texto);
+    if (diferencias) {
+        printf("ERROR: los kernels no coinciden\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+/**
+ * Ejercicio 3: Fichero de traza de peticiones y respuestas
+ *
+ * El cliente puede grabar (opción -g) cada petición que envía y cada respuesta
+ * que recibe, con su instante, en un fichero binario compacto. La herramienta
+ * ej3_replay lee la traza y repite las peticiones contra un servidor, al ritmo
+ * original, N veces más rápido o sin esperas, para disponer de pruebas de
+ * rendimiento repetibles a partir de tráfico real.
+ *
+ * Formato del fichero:
+ * - Cabecera fija (struct traza_cabecera)
+ * - Un registro por mensaje:
+ *   - 1 byte: bit 7 = respuesta (0 = petición), bits 0-6 = prioridad
+ *   - varint: nanosegundos transcurridos desde el registro anterior (CLOCK_MONOTONIC)
+ *   - varint: longitud de los datos
+ *   - los datos del mensaje, tal y como se enviaron o recibieron
+ *
+ * Los varint son enteros de 7 bits por byte (LEB128): el bit alto indica que sigue
+ * otro byte. Un intervalo de unos microsegundos o una longitud pequeña ocupan uno
+ * o dos bytes en lugar de ocho.
+ */
+
+#ifndef EJ3_TRAZA_H
+#define EJ3_TRAZA_H
+
+#include "ej3_common.h"
+
+/**
+ * Número mágico y versión del formato
+ */
+#define TRAZA_MAGIC 0x54334a45 // "EJ3T" en little endian
+#define TRAZA_VERSION 1
+
+/**
+ * Tipos de registro
+ */
+#define TRAZA_PETICION 0
+#define TRAZA_RESPUESTA 1
+
+/**
+ * Estructura: traza_cabecera
+ */
+struct traza_cabecera {
+    uint32_t magic;     // TRAZA_MAGIC
+    uint16_t version;   // TRAZA_VERSION
+    uint16_t reservado; // 0
+    uint64_t inicio;    // Instante de la grabación (CLOCK_REALTIME, nanosegundos)
+};
+
+/**
+ * Estructura: traza
+ *
+ * Fichero de traza abierto para escribir o para leer.
+ */
+struct traza {
+    FILE *f;
+    uint64_t ultimo_ns; // Instante del último registro (para calcular los intervalos)
+};
+
+/**
+ * Estructura: traza_registro
+ *
+ * Registro leído de la traza (los datos se copian en un buffer aparte).
+ */
+struct traza_registro {
+    int tipo;             // TRAZA_PETICION o TRAZA_RESPUESTA
+    unsigned int prioridad;
+    uint64_t instante_ns; // Instante relativo al primer registro
+    size_t longitud;      // Longitud original de los datos
+};
+
+/**
+ * Funciones: traza_escribir_varint / traza_leer_varint
+ *
+ * Escriben y leen un entero sin signo en formato varint.
+ */
+void traza_escribir_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        fputc((int)(v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    fputc((int)v, f);
+}
+
+int traza_leer_varint(FILE *f, uint64_t *v) {
+    *v = 0;
+    for (int desplazamiento = 0; desplazamiento < 64; desplazamiento += 7) {
+        int c = fgetc(f);
+        if (c == EOF) {
+            return -1;
+        }
+        *v |= (uint64_t)(c & 0x7f) << desplazamiento;
+        if (!(c & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Función: traza_crear
+ *
+ * Crea el fichero de traza y escribe la cabecera.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error (errno indica la causa)
+ */
+int traza_crear(struct traza *t, const char *ruta) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_REALTIME, &ahora);
+    struct traza_cabecera c = {TRAZA_MAGIC, TRAZA_VERSION, 0,
+                               (uint64_t)ahora.tv_sec * 1000000000ULL + ahora.tv_nsec};
+
+    t->f = fopen(ruta, "wb");
+    if (t->f == NULL) {
+        return -1;
+    }
+    t->ultimo_ns = 0;
+    if (fwrite(&c, sizeof(c), 1, t->f) != 1) {
+        fclose(t->f);
+        t->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: traza_abrir
+ *
+ * Abre una traza para leerla y comprueba su cabecera.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 si no se puede abrir o no es una traza válida
+ */
+int traza_abrir(struct traza *t, const char *ruta, struct traza_cabecera *c) {
+    t->f = fopen(ruta, "rb");
+    if (t->f == NULL) {
+        return -1;
+    }
+    t->ultimo_ns = 0;
+    if (fread(c, sizeof(*c), 1, t->f) != 1 || c->magic != TRAZA_MAGIC ||
+        c->version != TRAZA_VERSION) {
+        fclose(t->f);
+        t->f = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Función: traza_escribir
+ *
+ * Añade un registro con el instante actual. El primer registro tiene intervalo 0.
+ * La escritura pasa por el buffer de stdio, así que no añade una llamada al
+ * sistema por mensaje.
+ *
+ * Retorno:
+ *   - 0 si todo fue bien, -1 en caso de error
+ */
+int traza_escribir(struct traza *t, int tipo, unsigned int prioridad, const void *datos,
+                   size_t len) {
+    uint64_t ahora = ahora_ns();
+    uint64_t intervalo = t->ultimo_ns == 0 ? 0 : ahora - t->ultimo_ns;
+    t->ultimo_ns = ahora;
+
+    fputc((tipo == TRAZA_RESPUESTA ? 0x80 : 0) | (int)(prioridad & 0x7f), t->f);
+    traza_escribir_varint(t->f, intervalo);
+    traza_escribir_varint(t->f, len);
+    return fwrite(datos, 1, len, t->f) == len ? 0 : -1;
+}
+
+/**
+ * Función: traza_leer
+ *
+ * Lee el siguiente registro. Si los datos no caben en max bytes se truncan, pero
+ * r->longitud indica su longitud original.
+ *
+ * Retorno:
+ *   - 1 si se leyó un registro, 0 al final del fichero, -1 si la traza está dañada
+ */
+int traza_leer(struct traza *t, struct traza_registro *r, char *datos, size_t max) {
+    uint64_t intervalo, longitud;
+    int c = fgetc(t->f);
+    if (c == EOF) {
+        return 0;
+    }
+    if (traza_leer_varint(t->f, &intervalo) == -1 || traza_leer_varint(t->f, &longitud) == -1) {
+        return -1;
+    }
+
+    r->tipo = (c & 0x80) ? TRAZA_RESPUESTA : TRAZA_PETICION;
+    r->prioridad = c & 0x7f;
+    t->ultimo_ns += intervalo;
+    r->instante_ns = t->ultimo_ns;
+    r->longitud = longitud;
+
+    size_t copiar = longitud < max ? longitud : max;
+    if (fread(datos, 1, copiar, t->f) != copiar ||
+        fseek(t->f, (long)(longitud - copiar), SEEK_CUR) == -1) {
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * Función: traza_cerrar
+ *
+ * Cierra el fichero (vaciando antes el buffer de escritura).
+ */
+void traza_cerrar(struct traza *t) {
+    if (t->f != NULL) {
+        fclose(t->f);
+        t->f = NULL;
+    }
+}
+
+#endif /* EJ3_TRAZA_H */